@@ -0,0 +1,202 @@
+#include "asset_cache.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <vector>
+
+#include "buffer.hpp"
+
+namespace vk {
+
+namespace {
+
+// 64-bit FNV-1a.
+uint64_t HashContents(const std::vector<char>& contents) {
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : contents) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+std::optional<std::vector<char>> ReadFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return std::nullopt;
+  }
+  return std::vector<char>(std::istreambuf_iterator<char>(file),
+                           std::istreambuf_iterator<char>());
+}
+
+// Copies `size` bytes to a new GPU-only buffer and adds its memory to
+// `total`.
+AllocatedBuffer UploadBuffer(VmaAllocator allocator,
+                             QueueSubmitter& queue_submitter,
+                             const void* source, size_t size,
+                             VkBufferUsageFlags usage, VkDeviceSize& total) {
+  AllocatedBuffer staging_buffer =
+      CreateBuffer(allocator, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                   VMA_MEMORY_USAGE_CPU_ONLY);
+  void* data;
+  vmaMapMemory(allocator, staging_buffer.allocation, &data);
+  std::memcpy(data, source, size);
+  vmaUnmapMemory(allocator, staging_buffer.allocation);
+
+  AllocatedBuffer buffer =
+      CreateBuffer(allocator, size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                   VMA_MEMORY_USAGE_GPU_ONLY);
+  queue_submitter.SubmitImmediate([&](VkCommandBuffer cmd) {
+    VkBufferCopy copy = {};
+    copy.size = size;
+    vkCmdCopyBuffer(cmd, staging_buffer.buffer, buffer.buffer, 1, &copy);
+  });
+  vmaDestroyBuffer(allocator, staging_buffer.buffer,
+                   staging_buffer.allocation);
+
+  VmaAllocationInfo info;
+  vmaGetAllocationInfo(allocator, buffer.allocation, &info);
+  total += info.size;
+  return buffer;
+}
+
+}  // namespace
+
+AssetCache::~AssetCache() {
+  for (auto& [key, entry] : entries_) {
+    Destroy(entry);
+  }
+}
+
+AssetCache::Handle AssetCache::Load(const std::string& path,
+                                    QueueSubmitter& queue_submitter) {
+  std::optional<std::vector<char>> contents = ReadFile(path);
+  if (!contents.has_value()) {
+    std::cerr << "Unable to read the model " << path << ".\n";
+    return nullptr;
+  }
+  std::error_code error;
+  std::filesystem::path canonical = std::filesystem::canonical(path, error);
+  if (error) {
+    canonical = std::filesystem::absolute(path);
+  }
+  const std::string key = canonical.generic_string() + "#" +
+                          std::to_string(HashContents(contents.value()));
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    it->second.last_used = ++clock_;
+    Handle handle = it->second.handle.lock();
+    return handle ? handle : MakeHandle(it->second);
+  }
+
+  Entry entry;
+  entry.size = 0;
+  entry.model = Upload(path, queue_submitter, entry.size);
+  if (!entry.model) {
+    return nullptr;
+  }
+  entry.last_used = ++clock_;
+  size_ += entry.size;
+  Handle handle = MakeHandle(entry);
+  entries_.emplace(key, std::move(entry));
+
+  // The new entry is referenced, so it is never the one evicted.
+  Evict();
+  return handle;
+}
+
+VkDeviceSize AssetCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return size_;
+}
+
+std::shared_ptr<Model> AssetCache::Upload(const std::string& path,
+                                          QueueSubmitter& queue_submitter,
+                                          VkDeviceSize& size) {
+  auto model = std::make_shared<Model>(
+      LoadFromFile(path.c_str(), allocator_, device_, queue_submitter));
+  if (model->meshes.empty()) {
+    return nullptr;
+  }
+
+  for (const Texture& texture : model->textures) {
+    size += texture.size();
+  }
+  for (Mesh& mesh : model->meshes) {
+    ComputeBounds(mesh);
+    mesh.vertex_buffer = UploadBuffer(
+        allocator_, queue_submitter, mesh.vertices.data(),
+        mesh.vertices.size() * sizeof(Vertex),
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, size);
+
+    std::vector<glm::vec3> positions(mesh.vertices.size());
+    for (size_t i = 0; i < mesh.vertices.size(); i++) {
+      positions[i] = mesh.vertices[i].position;
+    }
+    mesh.position_buffer = UploadBuffer(
+        allocator_, queue_submitter, positions.data(),
+        positions.size() * sizeof(glm::vec3),
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, size);
+
+    if (!mesh.indices.empty()) {
+      mesh.index_buffer = UploadBuffer(
+          allocator_, queue_submitter, mesh.indices.data(),
+          mesh.indices.size() * sizeof(uint32_t),
+          VK_BUFFER_USAGE_INDEX_BUFFER_BIT, size);
+    }
+  }
+  return model;
+}
+
+AssetCache::Handle AssetCache::MakeHandle(Entry& entry) {
+  // The entry owns the model; the handles only count its users, and the
+  // last one to go gives the cache a chance to shrink back to its budget.
+  Handle handle(entry.model.get(), [this](const Model*) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Evict();
+  });
+  entry.handle = handle;
+  return handle;
+}
+
+void AssetCache::Evict() {
+  while (size_ > budget_) {
+    auto victim = entries_.end();
+    for (auto it = entries_.begin(); it != entries_.end(); it++) {
+      // No handle refers to it. New handles are only handed out under the
+      // lock, so this cannot change meanwhile.
+      if (it->second.handle.expired() &&
+          (victim == entries_.end() ||
+           it->second.last_used < victim->second.last_used)) {
+        victim = it;
+      }
+    }
+    if (victim == entries_.end()) {
+      return;
+    }
+    size_ -= victim->second.size;
+    Destroy(victim->second);
+    entries_.erase(victim);
+  }
+}
+
+void AssetCache::Destroy(Entry& entry) {
+  for (Mesh& mesh : entry.model->meshes) {
+    for (AllocatedBuffer* buffer :
+         {&mesh.vertex_buffer, &mesh.position_buffer, &mesh.index_buffer}) {
+      if (buffer->buffer != VK_NULL_HANDLE) {
+        vmaDestroyBuffer(allocator_, buffer->buffer, buffer->allocation);
+      }
+    }
+  }
+  // Textures release their own handles.
+  entry.model.reset();
+}
+
+}  // namespace vk
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "queue_submitter.hpp"
+#include "vk_mesh.hpp"
+
+namespace vk {
+
+// glTF models loaded and uploaded once per device, shared by every renderer
+// on it.
+//
+// Entries are keyed by the canonical path of the file together with a hash of
+// its contents, so loading a model again costs a read and a hash while an
+// edited file is loaded anew. Handles keep their entry alive. Entries no
+// handle refers to stay cached, and the least recently used of them are
+// destroyed whenever the cache holds more than its budget: after a load and
+// when the last handle to a model is dropped.
+//
+// Thread-safe. Loads are serialized, so two renderers asking for the same
+// model at once upload it once.
+//
+// Cached buffers are never moved by a Defragmenter: every renderer drawing a
+// model holds its own copy of the buffer handles, which a move could not
+// update, and the renderers record frames independently, so none of them
+// could tell when the others stopped using the old buffers. Models loaded
+// through the cache therefore stay where they were uploaded, and only
+// meshes a renderer uploads itself are compacted.
+class AssetCache {
+ public:
+  // An uploaded model. The buffers and textures belong to the cache, users
+  // may draw them but not destroy them. Every mesh has its bounds computed
+  // and keeps its vertices and indices, e.g. to copy into a geometry arena.
+  // Dropping the last handle may destroy the model right away, so only drop
+  // it once the GPU is done with the model.
+  using Handle = std::shared_ptr<const Model>;
+
+  AssetCache(VkDevice device, VmaAllocator allocator, VkDeviceSize budget)
+      : device_(device), allocator_(allocator), budget_(budget) {}
+  // Every handle must have been dropped, and the GPU be done with them.
+  ~AssetCache();
+
+  AssetCache(const AssetCache&) = delete;
+  AssetCache& operator=(const AssetCache&) = delete;
+
+  // Null if the model cannot be loaded. Uploads are submitted through
+  // `queue_submitter` and complete before returning.
+  Handle Load(const std::string& path, QueueSubmitter& queue_submitter);
+
+  // Device memory held by cached models, referenced or not.
+  VkDeviceSize size() const;
+
+ private:
+  struct Entry {
+    std::shared_ptr<Model> model;
+    // The handles handed out, which share one count.
+    std::weak_ptr<const Model> handle;
+    VkDeviceSize size;
+    uint64_t last_used;
+  };
+
+  std::shared_ptr<Model> Upload(const std::string& path,
+                                QueueSubmitter& queue_submitter,
+                                VkDeviceSize& size);
+  // A new handle to `entry`, whose previous handles are all gone.
+  Handle MakeHandle(Entry& entry);
+  // Destroys unreferenced entries, least recently used first, until the
+  // cache fits its budget.
+  void Evict();
+  void Destroy(Entry& entry);
+
+  VkDevice device_;
+  VmaAllocator allocator_;
+  VkDeviceSize budget_;
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Entry> entries_;
+  VkDeviceSize size_ = 0;
+  uint64_t clock_ = 0;
+};
+
+}  // namespace vk
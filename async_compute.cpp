@@ -0,0 +1,94 @@
+#include "async_compute.hpp"
+
+#include <iostream>
+
+#include "vk_init.hpp"
+
+namespace vk {
+
+std::optional<uint32_t> AsyncCompute::FindQueueFamily(VkPhysicalDevice gpu) {
+  uint32_t count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(gpu, &count, nullptr);
+  std::vector<VkQueueFamilyProperties> families(count);
+  vkGetPhysicalDeviceQueueFamilyProperties(gpu, &count, families.data());
+
+  for (uint32_t i = 0; i < count; i++) {
+    if ((families[i].queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+        !(families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+      return i;
+    }
+  }
+  return std::nullopt;
+}
+
+bool AsyncCompute::Init(uint32_t frames_in_flight) {
+  VkCommandPoolCreateInfo command_pool_info = init::CommandPoolCreateInfo(
+      queue_family_, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+  VkSemaphoreCreateInfo semaphore_info = init::SemaphoreCreateInfo();
+
+  frames_.resize(frames_in_flight);
+  for (FrameCompute& frame : frames_) {
+    frame = {};
+    if (vkCreateCommandPool(device_, &command_pool_info, nullptr,
+                            &frame.command_pool) != VK_SUCCESS) {
+      std::cerr << "Error creating the async compute command pool.\n";
+      return false;
+    }
+
+    VkCommandBufferAllocateInfo allocate_info =
+        init::CommandBufferAllocateInfo(frame.command_pool, 1);
+    if (vkAllocateCommandBuffers(device_, &allocate_info,
+                                 &frame.command_buffer) != VK_SUCCESS) {
+      std::cerr << "Error allocating the async compute command buffer.\n";
+      return false;
+    }
+
+    if (vkCreateSemaphore(device_, &semaphore_info, nullptr,
+                          &frame.semaphore) != VK_SUCCESS) {
+      std::cerr << "Error creating the async compute semaphore.\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+VkCommandBuffer AsyncCompute::Begin(uint32_t frame_index) {
+  FrameCompute& frame = frames_[frame_index];
+  vkResetCommandBuffer(frame.command_buffer, 0);
+
+  VkCommandBufferBeginInfo begin_info = {};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.pNext = nullptr;
+  begin_info.pInheritanceInfo = nullptr;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(frame.command_buffer, &begin_info);
+  return frame.command_buffer;
+}
+
+bool AsyncCompute::Submit(uint32_t frame_index) {
+  FrameCompute& frame = frames_[frame_index];
+  if (vkEndCommandBuffer(frame.command_buffer) != VK_SUCCESS) {
+    return false;
+  }
+
+  VkSubmitInfo submit = {};
+  submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit.pNext = nullptr;
+  submit.commandBufferCount = 1;
+  submit.pCommandBuffers = &frame.command_buffer;
+  submit.signalSemaphoreCount = 1;
+  submit.pSignalSemaphores = &frame.semaphore;
+
+  std::lock_guard<std::mutex> lock(queue_mutex_);
+  return vkQueueSubmit(queue_, 1, &submit, VK_NULL_HANDLE) == VK_SUCCESS;
+}
+
+void AsyncCompute::Release(DeletionQueue& queue) {
+  for (FrameCompute& frame : frames_) {
+    queue.Push(frame.semaphore);
+    queue.Push(frame.command_pool);
+  }
+  frames_.clear();
+}
+
+}  // namespace vk
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "deletion_queue.hpp"
+
+namespace vk {
+
+// Runs compute work on a dedicated compute queue, ahead of the graphics work
+// that consumes it.
+//
+// Each frame records its compute commands into its own command buffer and
+// submits them as soon as they are recorded, so they execute while the
+// graphics queue is still busy with the previous frame. The submission
+// signals a semaphore that the frame's graphics submission waits on at the
+// stages that read the results.
+//
+// No fence is needed: the graphics submission of a frame cannot complete
+// before the compute work it waits on, so once the caller has waited on the
+// frame's graphics fence, the frame's compute command buffer is free again.
+//
+// `queue_mutex` is held while submitting, as the queue may be shared with
+// other renderers.
+class AsyncCompute {
+ public:
+  AsyncCompute(VkDevice device, VkQueue queue, uint32_t queue_family,
+               std::mutex& queue_mutex)
+      : device_(device),
+        queue_(queue),
+        queue_family_(queue_family),
+        queue_mutex_(queue_mutex) {}
+
+  // A queue family with compute but no graphics support, if the GPU has one.
+  static std::optional<uint32_t> FindQueueFamily(VkPhysicalDevice gpu);
+
+  bool Init(uint32_t frames_in_flight);
+
+  // Starts recording `frame_index`'s commands. Only call once the previous
+  // graphics submission of the frame has completed.
+  VkCommandBuffer Begin(uint32_t frame_index);
+  // Ends recording and submits. The graphics submission of the frame must
+  // wait on semaphore(frame_index).
+  bool Submit(uint32_t frame_index);
+
+  VkSemaphore semaphore(uint32_t frame_index) const {
+    return frames_[frame_index].semaphore;
+  }
+  uint32_t queue_family() const { return queue_family_; }
+
+  // Hands every resource to `queue`. Used at shutdown.
+  void Release(DeletionQueue& queue);
+
+ private:
+  struct FrameCompute {
+    VkCommandPool command_pool;
+    VkCommandBuffer command_buffer;
+    VkSemaphore semaphore;
+  };
+
+  VkDevice device_;
+  VkQueue queue_;
+  uint32_t queue_family_;
+  std::mutex& queue_mutex_;
+
+  std::vector<FrameCompute> frames_;
+};
+
+}  // namespace vk
@@ -0,0 +1,59 @@
+#include "barrier_batch.hpp"
+
+namespace vk {
+
+void BarrierBatch::Image(VkImage image, const VkImageSubresourceRange& range,
+                         const ResourceState& from, const ResourceState& to) {
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.pNext = nullptr;
+  barrier.srcAccessMask = from.access;
+  barrier.dstAccessMask = to.access;
+  barrier.oldLayout = from.layout;
+  barrier.newLayout = to.layout;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange = range;
+  image_barriers_.push_back(barrier);
+
+  src_stages_ |= from.stages;
+  dst_stages_ |= to.stages;
+}
+
+void BarrierBatch::Memory(const ResourceState& from, const ResourceState& to) {
+  memory_src_access_ |= from.access;
+  memory_dst_access_ |= to.access;
+  src_stages_ |= from.stages;
+  dst_stages_ |= to.stages;
+}
+
+void BarrierBatch::Flush(VkCommandBuffer cmd) {
+  if (empty()) {
+    return;
+  }
+
+  VkMemoryBarrier memory_barrier = {};
+  memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  memory_barrier.pNext = nullptr;
+  memory_barrier.srcAccessMask = memory_src_access_;
+  memory_barrier.dstAccessMask = memory_dst_access_;
+  const bool has_memory_barrier =
+      memory_src_access_ != 0 || memory_dst_access_ != 0;
+
+  // Zero stage masks are invalid. A resource nothing has touched yet has no
+  // stages to wait on, and one that nothing will touch has none to block.
+  vkCmdPipelineBarrier(
+      cmd, src_stages_ ? src_stages_ : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+      dst_stages_ ? dst_stages_ : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+      has_memory_barrier ? 1 : 0, &memory_barrier, 0, nullptr,
+      static_cast<uint32_t>(image_barriers_.size()), image_barriers_.data());
+
+  src_stages_ = 0;
+  dst_stages_ = 0;
+  memory_src_access_ = 0;
+  memory_dst_access_ = 0;
+  image_barriers_.clear();
+}
+
+}  // namespace vk
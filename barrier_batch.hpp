@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+namespace vk {
+
+// Synchronization state of a resource: the layout it is in, and the stages
+// and accesses that a following barrier must wait on.
+struct ResourceState {
+  VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  VkPipelineStageFlags stages = 0;
+  VkAccessFlags access = 0;
+};
+
+// Collects barriers and records them with a single vkCmdPipelineBarrier.
+// Buffer hazards are folded into one global memory barrier, which drivers
+// handle at least as well as per-buffer barriers.
+class BarrierBatch {
+ public:
+  void Image(VkImage image, const VkImageSubresourceRange& range,
+             const ResourceState& from, const ResourceState& to);
+  void Memory(const ResourceState& from, const ResourceState& to);
+
+  // Records the batch, if any, and clears it.
+  void Flush(VkCommandBuffer cmd);
+
+  bool empty() const { return src_stages_ == 0 && dst_stages_ == 0; }
+
+ private:
+  VkPipelineStageFlags src_stages_ = 0;
+  VkPipelineStageFlags dst_stages_ = 0;
+  VkAccessFlags memory_src_access_ = 0;
+  VkAccessFlags memory_dst_access_ = 0;
+  std::vector<VkImageMemoryBarrier> image_barriers_;
+};
+
+}  // namespace vk
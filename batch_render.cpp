@@ -0,0 +1,353 @@
+#include "batch_render.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <glm/gtc/matrix_transform.hpp>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+#include "renderer.hpp"
+#include "worker_pool.hpp"
+
+namespace vk {
+
+namespace {
+
+bool ReadVec3(std::istringstream& line, glm::vec3& value) {
+  return static_cast<bool>(line >> value.x >> value.y >> value.z);
+}
+
+// Keeps the default field of view unless the line has one.
+void ReadFov(std::istringstream& line, Camera& camera) {
+  float fov_y_degrees;
+  if (line >> fov_y_degrees) {
+    camera.fov_y = glm::radians(fov_y_degrees);
+  }
+}
+
+std::string OutputPath(const BatchJob& job, uint32_t index) {
+  char suffix[16];
+  std::snprintf(suffix, sizeof(suffix), "_%04u", index);
+  return job.output + suffix + util::ImageExtension(job.format);
+}
+
+// Futures of frames that were not rendered are reset, and ready right away.
+bool IsReady(const std::future<ReadbackRing::Image>& future) {
+  return !future.valid() ||
+         future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+// Renders every view in one piece and returns the number of images that
+// could not be written.
+uint32_t RenderViews(Renderer& renderer, const BatchJob& job) {
+  std::atomic<uint32_t> failed{0};
+  const uint32_t cores = std::thread::hardware_concurrency();
+  util::WorkerPool workers(job.workers > 0 ? job.workers
+                                           : std::max(cores, 2u) - 1);
+
+  // Images are pinned in the readback ring until encoded, which is what
+  // lets the GPU keep rendering meanwhile.
+  auto encode = [&](uint32_t index, std::future<ReadbackRing::Image> future) {
+    auto image = std::make_shared<ReadbackRing::Image>(future.get());
+    workers.Submit([&job, &failed, index, image]() {
+      const std::string path = OutputPath(job, index);
+      if (!util::WriteImage(path, job.format, image->width(), image->height(),
+                            image->data())) {
+        std::cerr << "Unable to write " << path << ".\n";
+        failed++;
+      }
+    });
+  };
+
+  std::deque<std::pair<uint32_t, std::future<ReadbackRing::Image>>> in_flight;
+  for (uint32_t i = 0; i < job.cameras.size(); i++) {
+    renderer.SetCameras({job.cameras[i]});
+    in_flight.emplace_back(i, renderer.ReadNextFrame());
+    // Blocks only while every frame slot is busy on the GPU.
+    if (!renderer.Draw()) {
+      // The request is broken with the frame.
+      std::cerr << "Frame " << i << " was not rendered.\n";
+      failed++;
+      in_flight.pop_back();
+    }
+
+    while (!in_flight.empty() && IsReady(in_flight.front().second)) {
+      encode(in_flight.front().first, std::move(in_flight.front().second));
+      in_flight.pop_front();
+    }
+  }
+
+  renderer.FlushReadbacks();
+  for (auto& [index, future] : in_flight) {
+    if (IsReady(future)) {
+      encode(index, std::move(future));
+    } else {
+      std::cerr << "Frame " << index << " was not rendered.\n";
+      failed++;
+    }
+  }
+  in_flight.clear();
+
+  // The images have to be released before the renderer.
+  workers.Wait();
+  return failed;
+}
+
+// Renders every view in tiles of job.tile_size, each with its own
+// off-center frustum and culling, and returns the number of images that
+// could not be written. Tiles are copied into a band as they are read back;
+// a complete band is streamed to the file on a writer thread while the
+// following tiles render.
+uint32_t RenderTiles(Renderer& renderer, const BatchJob& job) {
+  struct Tile {
+    uint32_t view;
+    uint32_t x;
+    uint32_t y;
+  };
+
+  const uint32_t tile_size = job.tile_size;
+  const uint32_t tiles_x = (job.width + tile_size - 1) / tile_size;
+  const uint32_t tiles_y = (job.height + tile_size - 1) / tile_size;
+
+  std::atomic<uint32_t> failed{0};
+  // One thread, so the bands of an image are written in order.
+  util::WorkerPool writer_thread(1);
+  std::shared_ptr<util::ImageStreamWriter> writer;
+  std::shared_ptr<std::vector<uint8_t>> band;
+  // Set once a tile of the current view is lost; its file is left
+  // incomplete.
+  bool broken = false;
+
+  const auto stitch = [&](const Tile& tile,
+                          const ReadbackRing::Image* image) {
+    if (tile.x == 0 && tile.y == 0) {
+      const std::string path = OutputPath(job, tile.view);
+      writer = std::make_shared<util::ImageStreamWriter>();
+      broken = false;
+      writer_thread.Submit([&job, writer, path]() {
+        writer->Open(path, job.format, job.width, job.height);
+      });
+    }
+    const uint32_t band_rows =
+        std::min(tile_size, job.height - tile.y * tile_size);
+    if (tile.x == 0) {
+      band = std::make_shared<std::vector<uint8_t>>(size_t{job.width} *
+                                                    band_rows * 4);
+    }
+
+    broken = broken || image == nullptr;
+    if (!broken) {
+      // Tiles on the right and bottom edges extend past the image.
+      const size_t columns =
+          std::min(tile_size, job.width - tile.x * tile_size);
+      for (uint32_t row = 0; row < band_rows; row++) {
+        std::memcpy(band->data() +
+                        (size_t{row} * job.width + tile.x * tile_size) * 4,
+                    image->data() + size_t{row} * image->width() * 4,
+                    columns * 4);
+      }
+      if (tile.x == tiles_x - 1) {
+        writer_thread.Submit([writer = writer, band = band, band_rows]() {
+          writer->WriteRows(band->data(), band_rows);
+        });
+      }
+    }
+
+    if (tile.x == tiles_x - 1 && tile.y == tiles_y - 1) {
+      writer_thread.Submit([&failed, writer = writer,
+                            path = OutputPath(job, tile.view)]() {
+        if (!writer->Close()) {
+          std::cerr << "Unable to write " << path << ".\n";
+          failed++;
+        }
+      });
+    }
+  };
+
+  std::deque<std::pair<Tile, std::future<ReadbackRing::Image>>> in_flight;
+  const auto stitch_front = [&]() {
+    const Tile& tile = in_flight.front().first;
+    if (in_flight.front().second.valid()) {
+      ReadbackRing::Image image = in_flight.front().second.get();
+      stitch(tile, &image);
+    } else {
+      std::cerr << "Tile " << tile.x << ", " << tile.y << " of view "
+                << tile.view << " was not rendered.\n";
+      stitch(tile, nullptr);
+    }
+    in_flight.pop_front();
+  };
+
+  const glm::vec2 window_size(static_cast<float>(tile_size) / job.width,
+                              static_cast<float>(tile_size) / job.height);
+  for (uint32_t i = 0; i < job.cameras.size(); i++) {
+    Camera camera = job.cameras[i];
+    camera.window_size = window_size;
+    for (uint32_t y = 0; y < tiles_y; y++) {
+      for (uint32_t x = 0; x < tiles_x; x++) {
+        camera.window_offset =
+            glm::vec2(x * window_size.x, y * window_size.y);
+        renderer.SetCameras({camera});
+        in_flight.emplace_back(Tile{i, x, y}, renderer.ReadNextFrame());
+        if (!renderer.Draw()) {
+          // The request is broken with the frame; the tile is stitched as
+          // lost in its turn.
+          in_flight.back().second = {};
+        }
+
+        while (!in_flight.empty() && IsReady(in_flight.front().second)) {
+          stitch_front();
+        }
+      }
+    }
+  }
+
+  renderer.FlushReadbacks();
+  while (!in_flight.empty()) {
+    if (IsReady(in_flight.front().second)) {
+      stitch_front();
+      continue;
+    }
+    const Tile& tile = in_flight.front().first;
+    std::cerr << "Tile " << tile.x << ", " << tile.y << " of view "
+              << tile.view << " was not rendered.\n";
+    stitch(tile, nullptr);
+    in_flight.pop_front();
+  }
+
+  writer_thread.Wait();
+  return failed;
+}
+
+}  // namespace
+
+std::optional<BatchJob> LoadBatchJob(const std::string& path) {
+  std::ifstream file(path);
+  if (!file) {
+    std::cerr << "Unable to open the batch job " << path << ".\n";
+    return std::nullopt;
+  }
+
+  BatchJob job;
+  std::string text;
+  for (int line_number = 1; std::getline(file, text); line_number++) {
+    text = text.substr(0, text.find('#'));
+    std::istringstream line(text);
+    std::string key;
+    if (!(line >> key)) {
+      continue;
+    }
+
+    bool valid = true;
+    if (key == "size") {
+      valid = (line >> job.width >> job.height) && job.width > 0 &&
+              job.height > 0;
+    } else if (key == "format") {
+      std::string format;
+      line >> format;
+      if (format == "png") {
+        job.format = util::ImageFormat::kPng;
+      } else if (format == "exr") {
+        job.format = util::ImageFormat::kExr;
+      } else {
+        valid = false;
+      }
+    } else if (key == "output") {
+      valid = static_cast<bool>(line >> job.output);
+    } else if (key == "workers") {
+      valid = static_cast<bool>(line >> job.workers);
+    } else if (key == "tile") {
+      valid = (line >> job.tile_size) && job.tile_size > 0;
+    } else if (key == "camera") {
+      glm::vec3 eye;
+      glm::vec3 target;
+      valid = ReadVec3(line, eye) && ReadVec3(line, target);
+      if (valid) {
+        Camera camera;
+        camera.view = glm::lookAt(eye, target, glm::vec3(0.f, 1.f, 0.f));
+        ReadFov(line, camera);
+        job.cameras.push_back(camera);
+      }
+    } else if (key == "turntable") {
+      glm::vec3 center;
+      float radius;
+      float height;
+      uint32_t count;
+      valid = ReadVec3(line, center) && (line >> radius >> height >> count);
+      if (valid) {
+        Camera camera;
+        ReadFov(line, camera);
+        for (uint32_t i = 0; i < count; i++) {
+          const float angle = 6.28318531f * i / count;
+          const glm::vec3 eye =
+              center + glm::vec3(radius * std::sin(angle), height,
+                                 radius * std::cos(angle));
+          camera.view = glm::lookAt(eye, center, glm::vec3(0.f, 1.f, 0.f));
+          job.cameras.push_back(camera);
+        }
+      }
+    } else {
+      valid = false;
+    }
+
+    if (!valid) {
+      std::cerr << path << ":" << line_number << ": invalid line: " << text
+                << "\n";
+      return std::nullopt;
+    }
+  }
+
+  if (job.cameras.empty()) {
+    std::cerr << "The batch job " << path << " has no cameras.\n";
+    return std::nullopt;
+  }
+  return job;
+}
+
+std::optional<BatchStats> RunBatchJob(const BatchJob& job) {
+  const bool tiled = job.tile_size > 0;
+  Renderer renderer;
+  Renderer::InitParams params;
+  params.width = static_cast<int>(tiled ? job.tile_size : job.width);
+  params.height = static_cast<int>(tiled ? job.tile_size : job.height);
+  params.application_name = "vk-renderer batch";
+  params.window_handle = nullptr;
+  params.headless = true;
+  params.async_compute = true;
+  params.post_process = PostProcess::Settings{};
+  if (tiled) {
+    // It would darken the corners of every tile.
+    params.post_process->vignette = 0.f;
+  }
+  // Every image at the requested resolution and quality, so no dynamic
+  // resolution or quality governor.
+  if (!renderer.Init(params)) {
+    renderer.Shutdown();
+    std::cerr << "Unable to initialize the headless renderer.\n";
+    return std::nullopt;
+  }
+
+  BatchStats stats;
+  const auto start = std::chrono::steady_clock::now();
+  stats.failed =
+      tiled ? RenderTiles(renderer, job) : RenderViews(renderer, job);
+  stats.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  renderer.Shutdown();
+
+  stats.images = static_cast<uint32_t>(job.cameras.size()) - stats.failed;
+  return stats;
+}
+
+}  // namespace vk
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "camera.hpp"
+#include "image_writer.hpp"
+
+namespace vk {
+
+// A list of views of the scene to render offscreen and write to disk.
+//
+// Job files have one setting per line, `#` starts a comment:
+//   size <width> <height>
+//   format png|exr
+//   output <path prefix>        Image i goes to <prefix>_<iiii>.<format>.
+//   workers <count>             Encoding threads, 0 for all cores but one.
+//   tile <pixels>               Render each view in square tiles of this
+//                               size, see below.
+//   camera <eye xyz> <target xyz> [fov_y degrees]
+//   turntable <center xyz> <radius> <height> <count> [fov_y degrees]
+// Cameras and turntables add views in file order; a turntable adds `count`
+// views evenly spaced around `center`, `height` above it.
+//
+// Tiled views are rendered a tile at a time with off-center frusta and
+// streamed to disk a row of tiles at a time, so neither the GPU nor RAM
+// needs to hold the whole image: poster sizes beyond maxImageDimension2D
+// are limited by disk space only. About two rows of tiles are in memory.
+// The vignette is off for tiled views; shadows and FXAA are computed per
+// tile and may differ slightly across tile edges.
+struct BatchJob {
+  uint32_t width = 1920;
+  uint32_t height = 1080;
+  util::ImageFormat format = util::ImageFormat::kPng;
+  std::string output = "frame";
+  uint32_t workers = 0;
+  // 0 to render each view in one piece.
+  uint32_t tile_size = 0;
+  std::vector<Camera> cameras;
+};
+
+struct BatchStats {
+  uint32_t images = 0;
+  uint32_t failed = 0;
+  // From the first submission until the last image is written.
+  double seconds = 0.0;
+
+  double images_per_second() const {
+    return seconds > 0.0 ? images / seconds : 0.0;
+  }
+};
+
+std::optional<BatchJob> LoadBatchJob(const std::string& path);
+
+// Renders every view of `job` back to back with a headless renderer. Frames
+// stay in flight while earlier ones are read back, and images are encoded on
+// a worker pool while the GPU renders the following ones.
+std::optional<BatchStats> RunBatchJob(const BatchJob& job);
+
+}  // namespace vk
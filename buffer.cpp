@@ -6,7 +6,8 @@ namespace vk {
 
 AllocatedBuffer CreateBuffer(VmaAllocator allocator, size_t allocation_size,
                              VkBufferUsageFlags usage,
-                             VmaMemoryUsage memory_usage) {
+                             VmaMemoryUsage memory_usage,
+                             const std::vector<uint32_t>& queue_families) {
   // Allocate the vertex buffer.
   VkBufferCreateInfo info = {};
   info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -14,6 +15,11 @@ AllocatedBuffer CreateBuffer(VmaAllocator allocator, size_t allocation_size,
 
   info.size = allocation_size;
   info.usage = usage;
+  if (queue_families.size() > 1) {
+    info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    info.queueFamilyIndexCount = static_cast<uint32_t>(queue_families.size());
+    info.pQueueFamilyIndices = queue_families.data();
+  }
 
   VmaAllocationCreateInfo vma_allocation_info = {};
   vma_allocation_info.usage = memory_usage;
@@ -2,15 +2,22 @@
 
 #include <vk_mem_alloc.h>
 
+#include <cstdint>
+#include <vector>
+
 namespace vk {
 
 struct AllocatedBuffer {
-  VkBuffer buffer;
-  VmaAllocation allocation;
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VmaAllocation allocation = VK_NULL_HANDLE;
 };
 
+// With more than one of `queue_families` the buffer is shared concurrently
+// between them, so it can be used from several queues without ownership
+// transfers.
 AllocatedBuffer CreateBuffer(VmaAllocator allocator, size_t allocation_size,
                              VkBufferUsageFlags usage,
-                             VmaMemoryUsage memory_usage);
+                             VmaMemoryUsage memory_usage,
+                             const std::vector<uint32_t>& queue_families = {});
 
 }  // namespace vk
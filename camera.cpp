@@ -0,0 +1,52 @@
+#include "camera.hpp"
+
+#include <cmath>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace vk {
+
+glm::mat4 Projection(const Camera& camera, float aspect, float near_plane,
+                     float far_plane) {
+  // Edges of the full picture on the near plane.
+  const float top = near_plane * std::tan(camera.fov_y * 0.5f);
+  const float right =
+      top * aspect * camera.window_size.y / camera.window_size.x;
+
+  const float left = -right + 2.f * right * camera.window_offset.x;
+  const float window_top = top - 2.f * top * camera.window_offset.y;
+  glm::mat4 projection =
+      glm::frustum(left, left + 2.f * right * camera.window_size.x,
+                   window_top - 2.f * top * camera.window_size.y, window_top,
+                   near_plane, far_plane);
+  projection[1][1] *= -1;
+  // Flipping y also flips the off-center term of the window.
+  projection[2][1] *= -1;
+  return projection;
+}
+
+Frustum::Frustum(const glm::mat4& view_projection) {
+  // Each plane is the sum or difference of the last row of the matrix and
+  // one of the others; glm matrices are indexed by column.
+  const glm::mat4 m = glm::transpose(view_projection);
+  planes_[0] = m[3] + m[0];
+  planes_[1] = m[3] - m[0];
+  planes_[2] = m[3] + m[1];
+  planes_[3] = m[3] - m[1];
+  planes_[4] = m[3] + m[2];
+  planes_[5] = m[3] - m[2];
+  for (glm::vec4& plane : planes_) {
+    plane = plane / glm::length(glm::vec3(plane));
+  }
+}
+
+bool Frustum::Intersects(const glm::vec3& center, float radius) const {
+  for (const glm::vec4& plane : planes_) {
+    if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace vk
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+namespace vk {
+
+// Most views rendered together in one multiview pass, e.g. one per monitor or
+// eye. Must match MAX_VIEWS in the shaders.
+constexpr uint32_t kMaxViews = 4;
+
+struct Camera {
+  // World to view transform. The camera looks down -z.
+  glm::mat4 view = glm::mat4(1.f);
+  // Vertical field of view in radians.
+  float fov_y = 1.2217305f;  // 70 degrees.
+  // The part of the full picture this camera renders, in fractions of its
+  // width and height from the top left corner. A smaller window gives an
+  // off-center frustum, so tiles of one picture rendered separately join
+  // without seams. The window may extend past the picture.
+  glm::vec2 window_offset = {0.f, 0.f};
+  glm::vec2 window_size = {1.f, 1.f};
+};
+
+// Perspective projection of `camera`'s window, with `aspect` the width to
+// height ratio of the window, not of the full picture. Y points down in
+// clip space, as Vulkan expects.
+glm::mat4 Projection(const Camera& camera, float aspect, float near_plane,
+                     float far_plane);
+
+// A camera resolved for one frame.
+struct RenderView {
+  glm::mat4 view;
+  glm::mat4 projection;
+  glm::mat4 view_projection;
+};
+
+// The planes of a view projection matrix's clip volume, facing inwards.
+class Frustum {
+ public:
+  explicit Frustum(const glm::mat4& view_projection);
+
+  // Whether a world space sphere is at least partly inside.
+  bool Intersects(const glm::vec3& center, float radius) const;
+
+ private:
+  glm::vec4 planes_[6];
+};
+
+}  // namespace vk
@@ -0,0 +1,624 @@
+#include "cascaded_shadows.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <iostream>
+
+#include "defer.hpp"
+#include "shader.hpp"
+#include "vk_init.hpp"
+
+namespace vk {
+
+namespace {
+
+// How far towards the light casters are picked up beyond a cascade's bounds.
+constexpr float kCasterReach = 50.f;
+
+// Blend between uniform and logarithmic split distances.
+constexpr float kSplitLambda = 0.75f;
+
+// Constant and slope scaled bias against shadow acne.
+constexpr float kDepthBiasConstant = 1.25f;
+constexpr float kDepthBiasSlope = 1.75f;
+
+// Right handed orthographic projection to Vulkan's [0, 1] depth range.
+glm::mat4 OrthoZeroToOne(float left, float right, float bottom, float top,
+                         float near_plane, float far_plane) {
+  glm::mat4 result(1.f);
+  result[0][0] = 2.f / (right - left);
+  result[1][1] = 2.f / (top - bottom);
+  result[2][2] = -1.f / (far_plane - near_plane);
+  result[3][0] = -(right + left) / (right - left);
+  result[3][1] = -(top + bottom) / (top - bottom);
+  result[3][2] = -near_plane / (far_plane - near_plane);
+  return result;
+}
+
+glm::mat4 LightView(const glm::vec3& direction) {
+  const glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.f, 0.f, 1.f)
+                                                     : glm::vec3(0.f, 1.f, 0.f);
+  return glm::lookAt(glm::vec3(0.f), direction, up);
+}
+
+// Maps clip space x and y from [-1, 1] to [-1, 2 * scale - 1], i.e. onto the
+// top left `scale` of the render target.
+glm::mat4 ScaleToCorner(float scale) {
+  glm::mat4 result(1.f);
+  result[0][0] = scale;
+  result[1][1] = scale;
+  result[3][0] = scale - 1.f;
+  result[3][1] = scale - 1.f;
+  return result;
+}
+
+}  // namespace
+
+bool CascadedShadows::Init(VkDescriptorPool pool,
+                           VkDescriptorSetLayout object_set_layout,
+                           RenderGraph& graph, VkFormat depth_format,
+                           uint32_t frames_in_flight) {
+  depth_format_ = depth_format;
+
+  VkDescriptorSetLayoutBinding cascade_binding =
+      init::DescriptorSetLayoutBinding(
+          VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+          VK_SHADER_STAGE_GEOMETRY_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0);
+  VkDescriptorSetLayoutBinding shadow_map_binding =
+      init::DescriptorSetLayoutBinding(
+          VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          VK_SHADER_STAGE_FRAGMENT_BIT, 1);
+  VkDescriptorSetLayoutBinding bindings[] = {cascade_binding,
+                                             shadow_map_binding};
+
+  VkDescriptorSetLayoutCreateInfo set_layout_info = {};
+  set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  set_layout_info.pNext = nullptr;
+  set_layout_info.flags = 0;
+  set_layout_info.bindingCount = 2;
+  set_layout_info.pBindings = bindings;
+
+  if (vkCreateDescriptorSetLayout(device_, &set_layout_info, nullptr,
+                                  &set_layout_) != VK_SUCCESS) {
+    std::cerr << "Error creating the shadow descriptor set layout.\n";
+    return false;
+  }
+
+  // Hardware PCF. Anything outside of a cascade is lit.
+  VkSamplerCreateInfo sampler_info = {};
+  sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  sampler_info.pNext = nullptr;
+  sampler_info.magFilter = VK_FILTER_LINEAR;
+  sampler_info.minFilter = VK_FILTER_LINEAR;
+  sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+  sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+  sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+  sampler_info.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+  sampler_info.compareEnable = VK_TRUE;
+  sampler_info.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+  sampler_info.maxLod = 0.f;
+
+  if (vkCreateSampler(device_, &sampler_info, nullptr, &sampler_) !=
+      VK_SUCCESS) {
+    std::cerr << "Error creating the shadow sampler.\n";
+    return false;
+  }
+
+  frames_.resize(frames_in_flight);
+  for (FrameShadows& frame : frames_) {
+    frame.cascade_buffer =
+        CreateBuffer(allocator_, sizeof(GpuCascadeData),
+                     VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                     VMA_MEMORY_USAGE_CPU_TO_GPU);
+    frame.bound_view = VK_NULL_HANDLE;
+
+    VkDescriptorSetAllocateInfo allocate_info = {};
+    allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocate_info.pNext = nullptr;
+    allocate_info.descriptorPool = pool;
+    allocate_info.descriptorSetCount = 1;
+    allocate_info.pSetLayouts = &set_layout_;
+
+    if (vkAllocateDescriptorSets(device_, &allocate_info, &frame.descriptor) !=
+        VK_SUCCESS) {
+      std::cerr << "Error allocating a shadow descriptor set.\n";
+      return false;
+    }
+
+    VkDescriptorBufferInfo cascade_info = {};
+    cascade_info.buffer = frame.cascade_buffer.buffer;
+    cascade_info.offset = 0;
+    cascade_info.range = sizeof(GpuCascadeData);
+
+    VkWriteDescriptorSet write =
+        init::WriteDescriptorSet(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                                 frame.descriptor, &cascade_info, 0);
+    vkUpdateDescriptorSets(device_, 1, &write, 0, nullptr);
+  }
+
+  return InitPipeline(object_set_layout,
+                      graph.GetCompatibleRenderPass({}, depth_format_)) &&
+         InitCache(depth_format_);
+}
+
+bool CascadedShadows::InitPipeline(VkDescriptorSetLayout object_set_layout,
+                                   VkRenderPass render_pass) {
+  VkPushConstantRange push_constant;
+  push_constant.offset = 0;
+  push_constant.size = sizeof(ShadowPushConstants);
+  push_constant.stageFlags = VK_SHADER_STAGE_GEOMETRY_BIT;
+
+  VkDescriptorSetLayout set_layouts[] = {object_set_layout, set_layout_};
+
+  VkPipelineLayoutCreateInfo layout_info = init::PipelineLayoutCreateInfo();
+  layout_info.setLayoutCount = 2;
+  layout_info.pSetLayouts = set_layouts;
+  layout_info.pushConstantRangeCount = 1;
+  layout_info.pPushConstantRanges = &push_constant;
+
+  if (vkCreatePipelineLayout(device_, &layout_info, nullptr,
+                             &pipeline_layout_) != VK_SUCCESS) {
+    std::cerr << "Error creating the shadow pipeline layout.\n";
+    return false;
+  }
+
+  VkShaderModule vert;
+  if (!LoadShader(device_, "shaders/shadow.vert.spv", &vert)) {
+    std::cerr << "Unable to load file: shadow.vert.spv" << std::endl;
+    return false;
+  }
+  DEFER([&]() { vkDestroyShaderModule(device_, vert, nullptr); });
+
+  VkShaderModule geom;
+  if (!LoadShader(device_, "shaders/shadow.geom.spv", &geom)) {
+    std::cerr << "Unable to load file: shadow.geom.spv" << std::endl;
+    return false;
+  }
+  DEFER([&]() { vkDestroyShaderModule(device_, geom, nullptr); });
+
+  VkPipelineShaderStageCreateInfo stages[] = {
+      init::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, vert),
+      init::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_GEOMETRY_BIT, geom),
+  };
+
+  PositionInputDescription vertex_description =
+      Vertex::GetPositionDescription();
+  VkPipelineVertexInputStateCreateInfo vertex_input =
+      init::PipelineVertexInputStateCreateInfo();
+  vertex_input.vertexBindingDescriptionCount =
+      vertex_description.bindings.size();
+  vertex_input.pVertexBindingDescriptions = vertex_description.bindings.data();
+  vertex_input.vertexAttributeDescriptionCount =
+      vertex_description.attributes.size();
+  vertex_input.pVertexAttributeDescriptions =
+      vertex_description.attributes.data();
+
+  VkPipelineInputAssemblyStateCreateInfo input_assembly =
+      init::PipelineInputAssemblyStateCreateInfo(
+          VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+
+  VkViewport viewport = {0.f, 0.f, static_cast<float>(kShadowMapSize),
+                         static_cast<float>(kShadowMapSize), 0.f, 1.f};
+  VkRect2D scissor = {{0, 0}, {kShadowMapSize, kShadowMapSize}};
+
+  VkPipelineViewportStateCreateInfo viewport_state = {};
+  viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewport_state.pNext = nullptr;
+  viewport_state.viewportCount = 1;
+  viewport_state.pViewports = &viewport;
+  viewport_state.scissorCount = 1;
+  viewport_state.pScissors = &scissor;
+
+  VkPipelineRasterizationStateCreateInfo rasterizer =
+      init::PipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL);
+  rasterizer.depthBiasEnable = VK_TRUE;
+  rasterizer.depthBiasConstantFactor = kDepthBiasConstant;
+  rasterizer.depthBiasSlopeFactor = kDepthBiasSlope;
+
+  VkPipelineMultisampleStateCreateInfo multisampling =
+      init::PipelineMultisampleStateCreateInfo();
+
+  VkPipelineDepthStencilStateCreateInfo depth_stencil =
+      init::PipelineDepthStencilStateCreateInfo(true, true,
+                                                VK_COMPARE_OP_LESS_OR_EQUAL);
+
+  VkGraphicsPipelineCreateInfo pipeline_info = {};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipeline_info.pNext = nullptr;
+  pipeline_info.stageCount = 2;
+  pipeline_info.pStages = stages;
+  pipeline_info.pVertexInputState = &vertex_input;
+  pipeline_info.pInputAssemblyState = &input_assembly;
+  pipeline_info.pViewportState = &viewport_state;
+  pipeline_info.pRasterizationState = &rasterizer;
+  pipeline_info.pMultisampleState = &multisampling;
+  pipeline_info.pDepthStencilState = &depth_stencil;
+  // Depth only, so there is no color blend state.
+  pipeline_info.pColorBlendState = nullptr;
+  pipeline_info.layout = pipeline_layout_;
+  pipeline_info.renderPass = render_pass;
+  pipeline_info.subpass = 0;
+  pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+
+  if (vkCreateGraphicsPipelines(device_, VK_NULL_HANDLE, 1, &pipeline_info,
+                                nullptr, &pipeline_) != VK_SUCCESS) {
+    std::cerr << "Error creating the shadow pipeline.\n";
+    return false;
+  }
+  return true;
+}
+
+bool CascadedShadows::InitCache(VkFormat depth_format) {
+  VkImageCreateInfo image_info = init::ImageCreateInfo(
+      depth_format,
+      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+          VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+      {kShadowMapSize, kShadowMapSize, 1});
+  image_info.arrayLayers = kCachedCascadeCount;
+
+  VmaAllocationCreateInfo allocation_info = {};
+  allocation_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+  if (vmaCreateImage(allocator_, &image_info, &allocation_info,
+                     &cache_image_.image, &cache_image_.allocation,
+                     nullptr) != VK_SUCCESS) {
+    std::cerr << "Error creating the shadow cache.\n";
+    return false;
+  }
+
+  VkImageViewCreateInfo view_info = init::ImageViewCreateInfo(
+      depth_format, cache_image_.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+  view_info.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+  view_info.subresourceRange.layerCount = kCachedCascadeCount;
+
+  if (vkCreateImageView(device_, &view_info, nullptr, &cache_view_) !=
+      VK_SUCCESS) {
+    std::cerr << "Error creating the shadow cache view.\n";
+    return false;
+  }
+  return true;
+}
+
+CascadedShadows::Cascade CascadedShadows::FitCascade(
+    util::Span<const ViewCorners> views, float near_depth, float far_depth,
+    bool cached) const {
+  // A bounding sphere of the slice keeps the cascade size constant while the
+  // camera rotates.
+  glm::vec3 corners[8 * kMaxViews];
+  const size_t corner_count = 8 * views.size();
+  glm::vec3 center(0.f);
+  for (size_t v = 0; v < views.size(); v++) {
+    const ViewCorners& view = views[v];
+    for (size_t i = 0; i < 4; i++) {
+      glm::vec3& near_corner = corners[8 * v + i];
+      glm::vec3& far_corner = corners[8 * v + i + 4];
+      near_corner = glm::vec3(view.camera_to_world *
+                              glm::vec4(view.rays[i] * near_depth, 1.f));
+      far_corner = glm::vec3(view.camera_to_world *
+                             glm::vec4(view.rays[i] * far_depth, 1.f));
+      center = center + near_corner + far_corner;
+    }
+  }
+  center = center / static_cast<float>(corner_count);
+
+  float radius = 0.f;
+  for (size_t i = 0; i < corner_count; i++) {
+    radius = std::max(radius, glm::length(corners[i] - center));
+  }
+  radius = std::ceil(radius * 16.f) / 16.f;
+
+  const glm::mat4 light_view = LightView(light_direction_);
+  glm::vec3 light_center = glm::vec3(light_view * glm::vec4(center, 1.f));
+
+  float extent = radius;
+  if (cached) {
+    // Snapping to a grid of half the radius means the cascade only moves
+    // when the camera crosses a cell. It is grown by half a cell diagonal so
+    // that it still covers the slice anywhere within the cell.
+    const float cell = radius * 0.5f;
+    light_center = glm::floor(light_center / cell + glm::vec3(0.5f)) * cell;
+    extent = radius + cell * 0.87f;
+  } else {
+    // Moving in whole texels keeps shadow edges from shimmering.
+    const float texel = 2.f * extent / (kShadowMapSize * resolution_scale_);
+    light_center.x = std::floor(light_center.x / texel) * texel;
+    light_center.y = std::floor(light_center.y / texel) * texel;
+  }
+
+  // The light looks down -z. Casters up to kCasterReach towards the light are
+  // kept in front of the near plane.
+  Cascade cascade;
+  cascade.center = light_center;
+  cascade.radius = extent;
+  cascade.depth = 2.f * extent + kCasterReach;
+  cascade.view_projection =
+      OrthoZeroToOne(light_center.x - extent, light_center.x + extent,
+                     light_center.y - extent, light_center.y + extent,
+                     -(light_center.z + extent + kCasterReach),
+                     -(light_center.z - extent)) *
+      light_view;
+  return cascade;
+}
+
+void CascadedShadows::Update(uint32_t frame_index,
+                             util::Span<const RenderView> views,
+                             float near_plane,
+                             const glm::vec3& light_direction,
+                             util::Span<const ShadowCaster> casters,
+                             util::LinearArena& arena) {
+  FrameShadows& frame = frames_[frame_index];
+
+  const glm::vec3 direction = glm::normalize(light_direction);
+  if (glm::dot(direction, light_direction_) < 0.99999f) {
+    light_direction_ = direction;
+    cache_valid_ = false;
+  }
+
+  // View space rays through the corners of the screen, scaled to z = -1.
+  std::array<ViewCorners, kMaxViews> view_corners;
+  const size_t view_count = std::min<size_t>(views.size(), kMaxViews);
+  const float corners[4][2] = {{-1.f, -1.f}, {1.f, -1.f}, {-1.f, 1.f},
+                               {1.f, 1.f}};
+  for (size_t v = 0; v < view_count; v++) {
+    const glm::mat4 inverse_projection = glm::inverse(views[v].projection);
+    for (size_t i = 0; i < 4; i++) {
+      glm::vec4 corner = inverse_projection *
+                         glm::vec4(corners[i][0], corners[i][1], 1.f, 1.f);
+      view_corners[v].rays[i] = glm::vec3(corner) / -corner.z;
+    }
+    view_corners[v].camera_to_world = glm::inverse(views[v].view);
+  }
+  const util::Span<const ViewCorners> fit_views(view_corners.data(),
+                                                view_count);
+
+  GpuCascadeData data;
+  float split_near = near_plane;
+  for (uint32_t i = 0; i < kCascadeCount; i++) {
+    const float t = static_cast<float>(i + 1) / kCascadeCount;
+    const float uniform = near_plane + (kShadowDistance - near_plane) * t;
+    const float logarithmic =
+        near_plane * std::pow(kShadowDistance / near_plane, t);
+    const float split_far =
+        uniform + (logarithmic - uniform) * kSplitLambda;
+
+    const bool cached = i >= kFirstCachedCascade;
+    Cascade cascade = FitCascade(fit_views, split_near, split_far, cached);
+    if (cached && (cascade.radius != cascades_[i].radius ||
+                   glm::length(cascade.center - cascades_[i].center) > 0.f)) {
+      cache_valid_ = false;
+    }
+    cascades_[i] = cascade;
+
+    // Culling works on the full cascade; only the GPU, which both renders and
+    // samples through these matrices, sees the scaled down viewport.
+    data.view_projection[i] =
+        cached ? cascade.view_projection
+               : ScaleToCorner(resolution_scale_) * cascade.view_projection;
+    data.split_depths[i] = split_far;
+    split_near = split_far;
+  }
+  data.light_direction = glm::vec4(light_direction_, 0.f);
+
+  void* mapped;
+  vmaMapMemory(allocator_, frame.cascade_buffer.allocation, &mapped);
+  memcpy(mapped, &data, sizeof(GpuCascadeData));
+  vmaUnmapMemory(allocator_, frame.cascade_buffer.allocation);
+
+  redraw_cache_ = !cache_valid_;
+  cache_redrawn_ = redraw_cache_;
+  cache_recorded_ = false;
+
+  // Per cascade culling. Every caster goes to the uncached cascades it
+  // touches; the cached ones only get dynamic casters, except when the cache
+  // itself is redrawn.
+  constexpr uint32_t kUncachedMask = (1u << kFirstCachedCascade) - 1;
+  util::SpanBuilder<ShadowDraw> draws(arena, casters.size());
+  util::SpanBuilder<ShadowDraw> cache_draws(
+      arena, redraw_cache_ ? casters.size() : 0);
+
+  for (const ShadowCaster& caster : casters) {
+    const glm::vec3 center = glm::vec3(
+        caster.transform * glm::vec4(caster.mesh->bounds_center, 1.f));
+    const float scale = std::max(
+        {glm::length(glm::vec3(caster.transform[0])),
+         glm::length(glm::vec3(caster.transform[1])),
+         glm::length(glm::vec3(caster.transform[2]))});
+    const float radius = caster.mesh->bounds_radius * scale;
+
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < kCascadeCount; i++) {
+      const Cascade& cascade = cascades_[i];
+      const glm::vec4 p = cascade.view_projection * glm::vec4(center, 1.f);
+      const float radius_xy = radius / cascade.radius;
+      const float radius_z = radius / cascade.depth;
+      if (std::abs(p.x) <= 1.f + radius_xy &&
+          std::abs(p.y) <= 1.f + radius_xy && p.z - radius_z <= 1.f &&
+          p.z + radius_z >= 0.f) {
+        mask |= 1u << i;
+      }
+    }
+
+    const uint32_t frame_mask =
+        caster.is_static ? mask & kUncachedMask : mask;
+    if (frame_mask != 0) {
+      draws.push_back({caster.mesh, caster.object_index, frame_mask});
+    }
+    const uint32_t cache_mask = mask & ~kUncachedMask;
+    if (redraw_cache_ && caster.is_static && cache_mask != 0) {
+      cache_draws.push_back({caster.mesh, caster.object_index, cache_mask});
+    }
+  }
+
+  frame.draws = draws.Build();
+  frame.cache_draws = cache_draws.Build();
+}
+
+GraphImage CascadedShadows::AddPasses(RenderGraph& graph,
+                                      uint32_t frame_index,
+                                      VkDescriptorSet object_descriptor) {
+  FrameShadows& frame = frames_[frame_index];
+  const VkExtent2D extent = {kShadowMapSize, kShadowMapSize};
+
+  GraphImage shadow_map =
+      graph.CreateImage("shadow_map", depth_format_, extent, kCascadeCount);
+
+  // The previous frame's copy may still be reading the cache.
+  GraphImage cache = graph.ImportImage(
+      "shadow_cache", cache_image_.image, cache_view_,
+      {depth_format_, extent,
+       VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+           VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+       VK_SAMPLE_COUNT_1_BIT, kCachedCascadeCount},
+      {cache_layout_, VK_PIPELINE_STAGE_TRANSFER_BIT, 0},
+      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+  cache_recorded_ = true;
+
+  if (redraw_cache_) {
+    graph
+        .AddPass("shadow_cache",
+                 [this, &frame, object_descriptor](VkCommandBuffer cmd) {
+                   RecordDraws(cmd, frame.cache_draws, object_descriptor,
+                               frame.descriptor, kFirstCachedCascade);
+                 })
+        .WriteDepth(cache, 1.f);
+  }
+
+  graph
+      .AddPass("shadow_cache_copy",
+               [&graph, cache, shadow_map](VkCommandBuffer cmd) {
+                 VkImageCopy copy = {};
+                 copy.srcSubresource = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 0,
+                                        kCachedCascadeCount};
+                 copy.dstSubresource = {VK_IMAGE_ASPECT_DEPTH_BIT, 0,
+                                        kFirstCachedCascade,
+                                        kCachedCascadeCount};
+                 copy.extent = {kShadowMapSize, kShadowMapSize, 1};
+                 vkCmdCopyImage(cmd, graph.GetImage(cache),
+                                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                graph.GetImage(shadow_map),
+                                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                                &copy);
+               })
+      .CopyFrom(cache)
+      .CopyTo(shadow_map);
+
+  // The uncached cascades are cleared inside the pass; the cached ones keep
+  // the copied static depth.
+  graph
+      .AddPass("shadows",
+               [this, &frame, object_descriptor](VkCommandBuffer cmd) {
+                 VkClearAttachment clear = {};
+                 clear.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+                 clear.clearValue.depthStencil = {1.f, 0};
+                 VkClearRect rect = {
+                     {{0, 0}, {kShadowMapSize, kShadowMapSize}},
+                     0,
+                     kFirstCachedCascade};
+                 vkCmdClearAttachments(cmd, 1, &clear, 1, &rect);
+
+                 RecordDraws(cmd, frame.draws, object_descriptor,
+                             frame.descriptor, 0);
+               })
+      .WriteDepth(shadow_map);
+
+  return shadow_map;
+}
+
+void CascadedShadows::RecordDraws(VkCommandBuffer cmd,
+                                  util::Span<ShadowDraw> draws,
+                                  VkDescriptorSet object_descriptor,
+                                  VkDescriptorSet cascade_descriptor,
+                                  uint32_t first_cascade) {
+  if (draws.empty()) {
+    return;
+  }
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_);
+  VkDescriptorSet sets[] = {object_descriptor, cascade_descriptor};
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          pipeline_layout_, 0, 2, sets, 0, nullptr);
+
+  const Mesh* last_mesh = nullptr;
+  for (const ShadowDraw& draw : draws) {
+    ShadowPushConstants constants = {draw.cascade_mask, first_cascade};
+    vkCmdPushConstants(cmd, pipeline_layout_, VK_SHADER_STAGE_GEOMETRY_BIT, 0,
+                       sizeof(ShadowPushConstants), &constants);
+
+    const bool is_indexed_draw = !draw.mesh->indices.empty();
+    if (draw.mesh != last_mesh) {
+      VkDeviceSize offset = 0;
+      vkCmdBindVertexBuffers(cmd, 0, 1, &draw.mesh->position_buffer.buffer,
+                             &offset);
+      if (is_indexed_draw) {
+        vkCmdBindIndexBuffer(cmd, draw.mesh->index_buffer.buffer, 0,
+                             VK_INDEX_TYPE_UINT32);
+      }
+      last_mesh = draw.mesh;
+    }
+
+    if (is_indexed_draw) {
+      vkCmdDrawIndexed(cmd, static_cast<uint32_t>(draw.mesh->indices.size()),
+                       1, 0, 0, draw.object_index);
+    } else {
+      vkCmdDraw(cmd, static_cast<uint32_t>(draw.mesh->vertices.size()), 1, 0,
+                draw.object_index);
+    }
+  }
+}
+
+void CascadedShadows::BindShadowMap(const RenderGraph& graph,
+                                    GraphImage shadow_map,
+                                    uint32_t frame_index) {
+  FrameShadows& frame = frames_[frame_index];
+  VkImageView view = graph.GetView(shadow_map);
+  if (view == frame.bound_view) {
+    return;
+  }
+
+  VkDescriptorImageInfo image_info = {};
+  image_info.sampler = sampler_;
+  image_info.imageView = view;
+  image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+  VkWriteDescriptorSet write = {};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.pNext = nullptr;
+  write.dstSet = frame.descriptor;
+  write.dstBinding = 1;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  write.pImageInfo = &image_info;
+  vkUpdateDescriptorSets(device_, 1, &write, 0, nullptr);
+
+  frame.bound_view = view;
+}
+
+void CascadedShadows::Submitted() {
+  if (cache_redrawn_) {
+    cache_valid_ = true;
+    cache_redrawn_ = false;
+  }
+  if (cache_recorded_) {
+    cache_layout_ = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    cache_recorded_ = false;
+  }
+}
+
+void CascadedShadows::Release(DeletionQueue& queue) {
+  queue.Push(pipeline_);
+  queue.Push(pipeline_layout_);
+  queue.Push(set_layout_);
+  queue.Push(sampler_);
+  queue.Push(cache_view_);
+  queue.Push(cache_image_.image, cache_image_.allocation);
+  for (FrameShadows& frame : frames_) {
+    queue.Push(frame.cascade_buffer.buffer, frame.cascade_buffer.allocation);
+  }
+  frames_.clear();
+}
+
+}  // namespace vk
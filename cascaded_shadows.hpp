@@ -0,0 +1,197 @@
+#pragma once
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <vector>
+
+#include "camera.hpp"
+#include "deletion_queue.hpp"
+#include "linear_arena.hpp"
+#include "render_graph.hpp"
+#include "vk_mesh.hpp"
+#include "vk_types.hpp"
+
+namespace vk {
+
+struct ShadowCaster {
+  const Mesh* mesh;
+  glm::mat4 transform;
+  // Index of the object's matrix in the object buffer.
+  uint32_t object_index;
+  // Static casters are cached in the far cascades.
+  bool is_static;
+};
+
+// Cascaded shadow maps for the sun.
+//
+// The view frustums up to kShadowDistance are split into kCascadeCount
+// slices, each covered by an orthographic shadow map layer. With several
+// views a cascade covers the same slice of all of them. All cascades are
+// drawn in a single layered pass: a geometry shader instanced once per
+// cascade routes each triangle to the layers whose bounds the object
+// overlaps, so casters are culled per cascade.
+//
+// Cascades from kFirstCachedCascade on are snapped to a coarse grid and only
+// move when the camera travels a good part of their size. Their static
+// casters are rendered into a persistent cache when the light, the static set
+// or the cascade bounds change. Every frame the cache is copied into the
+// frame's shadow map and only dynamic casters are drawn on top, so the
+// steady-state cost of the far cascades follows the dynamic content.
+//
+// Descriptor set layout (set 3 of the mesh pipelines):
+//   binding 0: cascade matrices and split depths.
+//   binding 1: the shadow map, with a depth compare sampler.
+class CascadedShadows {
+ public:
+  constexpr static uint32_t kCascadeCount = 4;
+  constexpr static uint32_t kFirstCachedCascade = 2;
+  constexpr static uint32_t kCachedCascadeCount =
+      kCascadeCount - kFirstCachedCascade;
+  constexpr static uint32_t kShadowMapSize = 2048;
+  constexpr static float kShadowDistance = 80.f;
+
+  // Matches CascadeData in lighting.glsl and shadow.geom.
+  struct GpuCascadeData {
+    glm::mat4 view_projection[kCascadeCount];
+    // View depth at which each cascade ends.
+    glm::vec4 split_depths;
+    // xyz: direction the sunlight travels in, in world space.
+    glm::vec4 light_direction;
+  };
+
+  CascadedShadows(VkDevice device, VmaAllocator allocator)
+      : device_(device), allocator_(allocator) {}
+
+  bool Init(VkDescriptorPool pool, VkDescriptorSetLayout object_set_layout,
+            RenderGraph& graph, VkFormat depth_format,
+            uint32_t frames_in_flight);
+
+  // Forces the static cache to be redrawn, e.g. after static casters were
+  // added, removed or moved.
+  void InvalidateCache() {
+    cache_valid_ = false;
+    cache_redrawn_ = false;
+  }
+
+  // Renders the cascades below kFirstCachedCascade into the top left `scale`
+  // of their layers, trading shadow detail near the camera for fill rate.
+  // Takes effect on the next Update().
+  void set_resolution_scale(float scale) {
+    resolution_scale_ = std::clamp(scale, 0.25f, 1.f);
+  }
+
+  // Fits the cascades to the views and sorts the casters into this frame's
+  // draw lists, which are allocated from `arena`.
+  void Update(uint32_t frame_index, util::Span<const RenderView> views,
+              float near_plane,
+              const glm::vec3& light_direction,
+              util::Span<const ShadowCaster> casters,
+              util::LinearArena& arena);
+
+  // Adds the shadow passes and returns the shadow map. Shading passes must
+  // declare a ReadTexture() of it and call BindShadowMap() once the graph is
+  // compiled.
+  GraphImage AddPasses(RenderGraph& graph, uint32_t frame_index,
+                       VkDescriptorSet object_descriptor);
+
+  // Points `frame_index`'s descriptor set at the compiled shadow map.
+  void BindShadowMap(const RenderGraph& graph, GraphImage shadow_map,
+                     uint32_t frame_index);
+
+  // Called once the frame's commands were submitted. Until then a redrawn
+  // cache and the layout the frame leaves it in are only pending, so an
+  // abandoned frame leaves the cache to be redrawn by the next one.
+  void Submitted();
+
+  VkDescriptorSetLayout set_layout() const { return set_layout_; }
+  VkDescriptorSet descriptor(uint32_t frame_index) const {
+    return frames_[frame_index].descriptor;
+  }
+
+  // Hands every resource to `queue`. Used at shutdown.
+  void Release(DeletionQueue& queue);
+
+ private:
+  struct ShadowDraw {
+    const Mesh* mesh;
+    uint32_t object_index;
+    // Bit i set if the caster overlaps cascade i.
+    uint32_t cascade_mask;
+  };
+
+  // Matches the push constants in shadow.geom.
+  struct ShadowPushConstants {
+    uint32_t cascade_mask;
+    // Cascade rendered to layer 0 of the target.
+    uint32_t first_cascade;
+  };
+
+  struct FrameShadows {
+    AllocatedBuffer cascade_buffer;
+    VkDescriptorSet descriptor;
+    VkImageView bound_view;
+    // Draw lists for this frame, in the frame's arena.
+    util::Span<ShadowDraw> draws;
+    util::Span<ShadowDraw> cache_draws;
+  };
+
+  struct Cascade {
+    glm::mat4 view_projection;
+    // Light space center and half extent; used to detect when a cached
+    // cascade has moved.
+    glm::vec3 center;
+    float radius;
+    // Depth range covered by the projection.
+    float depth;
+  };
+
+  bool InitPipeline(VkDescriptorSetLayout object_set_layout,
+                    VkRenderPass render_pass);
+  // World space origin and view space corner rays of a view's frustum.
+  struct ViewCorners {
+    glm::mat4 camera_to_world;
+    std::array<glm::vec3, 4> rays;
+  };
+
+  bool InitCache(VkFormat depth_format);
+  Cascade FitCascade(util::Span<const ViewCorners> views, float near_depth,
+                     float far_depth, bool cached) const;
+  void RecordDraws(VkCommandBuffer cmd, util::Span<ShadowDraw> draws,
+                   VkDescriptorSet object_descriptor,
+                   VkDescriptorSet cascade_descriptor,
+                   uint32_t first_cascade);
+
+  VkDevice device_;
+  VmaAllocator allocator_;
+
+  VkFormat depth_format_ = VK_FORMAT_UNDEFINED;
+  VkDescriptorSetLayout set_layout_ = VK_NULL_HANDLE;
+  VkPipelineLayout pipeline_layout_ = VK_NULL_HANDLE;
+  VkPipeline pipeline_ = VK_NULL_HANDLE;
+  VkSampler sampler_ = VK_NULL_HANDLE;
+
+  // Static casters of the cached cascades, one layer per cascade.
+  AllocatedImage cache_image_;
+  VkImageView cache_view_ = VK_NULL_HANDLE;
+  VkImageLayout cache_layout_ = VK_IMAGE_LAYOUT_UNDEFINED;
+  bool cache_valid_ = false;
+  bool redraw_cache_ = false;
+  // What the frame being recorded does to the cache, committed by
+  // Submitted().
+  bool cache_redrawn_ = false;
+  bool cache_recorded_ = false;
+  float resolution_scale_ = 1.f;
+
+  glm::vec3 light_direction_ = {0.f, 0.f, 0.f};
+  std::array<Cascade, kCascadeCount> cascades_ = {};
+  std::vector<FrameShadows> frames_;
+};
+
+}  // namespace vk
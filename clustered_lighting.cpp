@@ -0,0 +1,269 @@
+#include "clustered_lighting.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <iostream>
+
+#include "defer.hpp"
+#include "shader.hpp"
+#include "vk_init.hpp"
+
+namespace vk {
+
+namespace {
+
+constexpr uint32_t kBinningGroupSize = 64;
+
+static_assert(ClusteredLighting::kClusterCount % kBinningGroupSize == 0,
+              "The binning dispatch assumes whole workgroups");
+
+// The shaders declare the counts of kMaxViews grids up front; the index lists
+// are only allocated for the views in use.
+VkDeviceSize ClusterBufferSize(uint32_t view_count) {
+  return sizeof(uint32_t) * ClusteredLighting::kClusterCount *
+         (kMaxViews + view_count * ClusteredLighting::kMaxLightsPerCluster);
+}
+
+}  // namespace
+
+bool ClusteredLighting::Init(VkDescriptorPool pool, uint32_t frames_in_flight,
+                             uint32_t view_count,
+                             const std::vector<uint32_t>& queue_families) {
+  max_view_count_ = view_count;
+
+  VkDescriptorSetLayoutBinding light_binding =
+      init::DescriptorSetLayoutBinding(
+          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0);
+  VkDescriptorSetLayoutBinding cluster_binding =
+      init::DescriptorSetLayoutBinding(
+          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 1);
+  VkDescriptorSetLayoutBinding view_binding =
+      init::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                                       VK_SHADER_STAGE_COMPUTE_BIT, 2);
+  VkDescriptorSetLayoutBinding bindings[] = {light_binding, cluster_binding,
+                                             view_binding};
+
+  VkDescriptorSetLayoutCreateInfo set_layout_info = {};
+  set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  set_layout_info.pNext = nullptr;
+  set_layout_info.flags = 0;
+  set_layout_info.bindingCount = 3;
+  set_layout_info.pBindings = bindings;
+
+  if (vkCreateDescriptorSetLayout(device_, &set_layout_info, nullptr,
+                                  &set_layout_) != VK_SUCCESS) {
+    std::cerr << "Error creating the light descriptor set layout.\n";
+    return false;
+  }
+
+  const VkDeviceSize cluster_buffer_size = ClusterBufferSize(view_count);
+
+  frames_.resize(frames_in_flight);
+  for (FrameLights& frame : frames_) {
+    frame.buffer = CreateBuffer(allocator_, sizeof(GpuLight) * kMaxLights,
+                                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                VMA_MEMORY_USAGE_CPU_TO_GPU, queue_families);
+    frame.cluster_buffer = CreateBuffer(
+        allocator_, cluster_buffer_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY, queue_families);
+    frame.view_buffer = CreateBuffer(allocator_, sizeof(GpuViews),
+                                     VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                                     VMA_MEMORY_USAGE_CPU_TO_GPU,
+                                     queue_families);
+    frame.constants = {};
+    frame.view_count = 0;
+
+    VkDescriptorSetAllocateInfo allocate_info = {};
+    allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocate_info.pNext = nullptr;
+    allocate_info.descriptorPool = pool;
+    allocate_info.descriptorSetCount = 1;
+    allocate_info.pSetLayouts = &set_layout_;
+
+    if (vkAllocateDescriptorSets(device_, &allocate_info, &frame.descriptor) !=
+        VK_SUCCESS) {
+      std::cerr << "Error allocating a light descriptor set.\n";
+      return false;
+    }
+
+    VkDescriptorBufferInfo light_info = {};
+    light_info.buffer = frame.buffer.buffer;
+    light_info.offset = 0;
+    light_info.range = sizeof(GpuLight) * kMaxLights;
+
+    VkDescriptorBufferInfo cluster_info = {};
+    cluster_info.buffer = frame.cluster_buffer.buffer;
+    cluster_info.offset = 0;
+    cluster_info.range = cluster_buffer_size;
+
+    VkDescriptorBufferInfo view_info = {};
+    view_info.buffer = frame.view_buffer.buffer;
+    view_info.offset = 0;
+    view_info.range = sizeof(GpuViews);
+
+    VkWriteDescriptorSet writes[] = {
+        init::WriteDescriptorSet(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                 frame.descriptor, &light_info, 0),
+        init::WriteDescriptorSet(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                 frame.descriptor, &cluster_info, 1),
+        init::WriteDescriptorSet(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                                 frame.descriptor, &view_info, 2),
+    };
+    vkUpdateDescriptorSets(device_, 3, writes, 0, nullptr);
+  }
+
+  return InitPipeline();
+}
+
+bool ClusteredLighting::InitPipeline() {
+  VkPushConstantRange push_constant;
+  push_constant.offset = 0;
+  push_constant.size = sizeof(BinningConstants);
+  push_constant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkPipelineLayoutCreateInfo layout_info = init::PipelineLayoutCreateInfo();
+  layout_info.setLayoutCount = 1;
+  layout_info.pSetLayouts = &set_layout_;
+  layout_info.pushConstantRangeCount = 1;
+  layout_info.pPushConstantRanges = &push_constant;
+
+  if (vkCreatePipelineLayout(device_, &layout_info, nullptr,
+                             &pipeline_layout_) != VK_SUCCESS) {
+    std::cerr << "Error creating the light binning pipeline layout.\n";
+    return false;
+  }
+
+  VkShaderModule shader;
+  if (!LoadShader(device_, "shaders/cluster_lights.comp.spv", &shader)) {
+    std::cerr << "Unable to load file: cluster_lights.comp.spv" << std::endl;
+    return false;
+  }
+  DEFER([&]() { vkDestroyShaderModule(device_, shader, nullptr); });
+
+  VkComputePipelineCreateInfo pipeline_info = {};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipeline_info.pNext = nullptr;
+  pipeline_info.stage = init::PipelineShaderStageCreateInfo(
+      VK_SHADER_STAGE_COMPUTE_BIT, shader);
+  pipeline_info.layout = pipeline_layout_;
+
+  if (vkCreateComputePipelines(device_, VK_NULL_HANDLE, 1, &pipeline_info,
+                               nullptr, &pipeline_) != VK_SUCCESS) {
+    std::cerr << "Error creating the light binning pipeline.\n";
+    return false;
+  }
+  return true;
+}
+
+void ClusteredLighting::Update(uint32_t frame_index,
+                               const std::vector<Light>& lights,
+                               util::Span<const RenderView> views,
+                               VkExtent2D extent, float near_plane,
+                               float far_plane) {
+  FrameLights& frame = frames_[frame_index];
+
+  const uint32_t count =
+      static_cast<uint32_t>(std::min<size_t>(lights.size(), kMaxLights));
+
+  void* data;
+  vmaMapMemory(allocator_, frame.buffer.allocation, &data);
+  GpuLight* gpu_lights = static_cast<GpuLight*>(data);
+  for (uint32_t i = 0; i < count; i++) {
+    const Light& light = lights[i];
+    GpuLight& gpu_light = gpu_lights[i];
+
+    gpu_light.position_range = glm::vec4(light.position, light.range);
+
+    // Point lights get a cone that covers every direction. Spot lights need
+    // the inner cosine above the outer one for the shader's smoothstep.
+    float outer = light.outer_cone_cos;
+    float inner = light.inner_cone_cos;
+    if (outer <= -1.f) {
+      outer = -2.f;
+      inner = -1.f;
+    } else {
+      inner = std::max(inner, outer + 1e-4f);
+    }
+    gpu_light.color_inner = glm::vec4(light.color * light.intensity, inner);
+    gpu_light.direction_outer =
+        glm::vec4(glm::normalize(light.direction), outer);
+  }
+  vmaUnmapMemory(allocator_, frame.buffer.allocation);
+
+  frame.view_count = static_cast<uint32_t>(
+      std::min<size_t>(views.size(), max_view_count_));
+  GpuViews gpu_views = {};
+  for (uint32_t i = 0; i < frame.view_count; i++) {
+    gpu_views.view[i] = views[i].view;
+    gpu_views.inverse_projection[i] = glm::inverse(views[i].projection);
+  }
+  vmaMapMemory(allocator_, frame.view_buffer.allocation, &data);
+  memcpy(data, &gpu_views, sizeof(GpuViews));
+  vmaUnmapMemory(allocator_, frame.view_buffer.allocation);
+
+  frame.constants.viewport =
+      glm::vec4(static_cast<float>(extent.width),
+                static_cast<float>(extent.height), near_plane, far_plane);
+  frame.constants.light_count = count;
+  frame.constants.max_lights_per_cluster = max_lights_per_cluster_;
+
+  // Slices are spaced exponentially so that clusters stay roughly cubic:
+  // slice = log(depth / near) / log(far / near) * slices.
+  const float log_ratio = std::log(far_plane / near_plane);
+  const float slices = static_cast<float>(kClusterSlices);
+  params_.scale_bias = glm::vec4(
+      kClusterTilesX / static_cast<float>(extent.width),
+      kClusterTilesY / static_cast<float>(extent.height), slices / log_ratio,
+      -slices * std::log(near_plane) / log_ratio);
+}
+
+GraphBuffer ClusteredLighting::AddPass(RenderGraph& graph,
+                                       uint32_t frame_index) {
+  GraphBuffer clusters = ImportClusters(graph, frame_index);
+  graph
+      .AddPass("light_binning",
+               [this, frame_index](VkCommandBuffer cmd) {
+                 RecordBinning(cmd, frame_index);
+               })
+      .WriteBuffer(clusters, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                   VK_ACCESS_SHADER_WRITE_BIT);
+  return clusters;
+}
+
+void ClusteredLighting::RecordBinning(VkCommandBuffer cmd,
+                                      uint32_t frame_index) {
+  const FrameLights& frame = frames_[frame_index];
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          pipeline_layout_, 0, 1, &frame.descriptor, 0,
+                          nullptr);
+  vkCmdPushConstants(cmd, pipeline_layout_, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                     sizeof(BinningConstants), &frame.constants);
+  vkCmdDispatch(cmd, kClusterCount / kBinningGroupSize, frame.view_count, 1);
+}
+
+GraphBuffer ClusteredLighting::ImportClusters(RenderGraph& graph,
+                                              uint32_t frame_index) {
+  // The clusters belong to the frame, whose previous shading has completed
+  // by the time its fence was waited on, so there is nothing to wait for.
+  return graph.ImportBuffer("light_clusters",
+                            frames_[frame_index].cluster_buffer.buffer);
+}
+
+void ClusteredLighting::Release(DeletionQueue& queue) {
+  queue.Push(pipeline_);
+  queue.Push(pipeline_layout_);
+  queue.Push(set_layout_);
+  for (FrameLights& frame : frames_) {
+    queue.Push(frame.buffer.buffer, frame.buffer.allocation);
+    queue.Push(frame.view_buffer.buffer, frame.view_buffer.allocation);
+    queue.Push(frame.cluster_buffer.buffer, frame.cluster_buffer.allocation);
+  }
+  frames_.clear();
+}
+
+}  // namespace vk
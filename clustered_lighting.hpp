@@ -0,0 +1,163 @@
+#pragma once
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <vector>
+
+#include "buffer.hpp"
+#include "camera.hpp"
+#include "deletion_queue.hpp"
+#include "linear_arena.hpp"
+#include "render_graph.hpp"
+
+namespace vk {
+
+// A point light, or a spot light when `outer_cone_cos` is above -1.
+struct Light {
+  glm::vec3 position;
+  float range;
+  glm::vec3 color;
+  float intensity;
+
+  // Spot lights only. Direction the cone points in and the cosines of the
+  // angles at which the falloff starts and ends.
+  glm::vec3 direction = {0.f, -1.f, 0.f};
+  float inner_cone_cos = -1.f;
+  float outer_cone_cos = -1.f;
+};
+
+// Clustered forward lighting.
+//
+// The view frustum is split into a grid of clusters: kClusterTilesX by
+// kClusterTilesY screen tiles, each cut into kClusterSlices slices that grow
+// exponentially with depth. Every frame a compute pass tests all lights
+// against every cluster and writes a list of the lights touching it. The
+// fragment shader then only loops over the list of its own cluster, so the
+// cost per pixel depends on how many lights actually reach it. With
+// multiview every view has its own grid, binned in the same dispatch.
+//
+// Descriptor set layout (used as set 2 by the mesh pipelines):
+//   binding 0: lights of the current frame, in world space.
+//   binding 1: per-cluster light counts of all views followed by the light
+//              index lists.
+//   binding 2: view matrices used for binning.
+class ClusteredLighting {
+ public:
+  // Must match the defines in cluster_lights.comp and lighting.glsl.
+  constexpr static uint32_t kClusterTilesX = 16;
+  constexpr static uint32_t kClusterTilesY = 9;
+  constexpr static uint32_t kClusterSlices = 24;
+  constexpr static uint32_t kClusterCount =
+      kClusterTilesX * kClusterTilesY * kClusterSlices;
+  constexpr static uint32_t kMaxLightsPerCluster = 128;
+  constexpr static uint32_t kMaxLights = 4096;
+
+  // What the fragment shader needs to find its cluster. Lives in the scene
+  // uniform buffer.
+  struct ClusterParams {
+    // xy: tiles per pixel, z: slice scale, w: slice bias. The slice of a
+    // fragment at view depth d is floor(log(d) * z + w).
+    glm::vec4 scale_bias;
+  };
+
+  ClusteredLighting(VkDevice device, VmaAllocator allocator)
+      : device_(device), allocator_(allocator) {}
+
+  // Creates the set layout, buffers, descriptor sets and the binning
+  // pipeline for up to `view_count` views. Descriptor sets are allocated
+  // from `pool`. Buffers are shared between all `queue_families`, for
+  // binning on an async compute queue.
+  bool Init(VkDescriptorPool pool, uint32_t frames_in_flight,
+            uint32_t view_count,
+            const std::vector<uint32_t>& queue_families = {});
+
+  // Uploads `lights` and `views` for the frame using `frame_index`'s
+  // buffers. Anything beyond kMaxLights is dropped. All views share the
+  // viewport `extent` and the depth range.
+  void Update(uint32_t frame_index, const std::vector<Light>& lights,
+              util::Span<const RenderView> views, VkExtent2D extent,
+              float near_plane, float far_plane);
+
+  // Adds the binning pass. Passes that shade with the clusters must declare
+  // a fragment shader read of the returned buffer.
+  GraphBuffer AddPass(RenderGraph& graph, uint32_t frame_index);
+
+  // Records the binning outside the graph, e.g. on an async compute queue.
+  // The graph then only imports the result with ImportClusters(); the
+  // submission that reads it must wait on the one that bins.
+  void RecordBinning(VkCommandBuffer cmd, uint32_t frame_index);
+  GraphBuffer ImportClusters(RenderGraph& graph, uint32_t frame_index);
+
+  VkDescriptorSetLayout set_layout() const { return set_layout_; }
+  VkDescriptorSet descriptor(uint32_t frame_index) const {
+    return frames_[frame_index].descriptor;
+  }
+  const ClusterParams& params() const { return params_; }
+
+  // Caps the light lists below kMaxLightsPerCluster to bound the shading
+  // cost per pixel. Lights past the cap are dropped from the cluster. Takes
+  // effect on the next Update().
+  void set_max_lights_per_cluster(uint32_t count) {
+    max_lights_per_cluster_ = std::min(count, kMaxLightsPerCluster);
+  }
+
+  // Hands every resource to `queue`. Used at shutdown.
+  void Release(DeletionQueue& queue);
+
+ private:
+  struct GpuLight {
+    // xyz: world space position, w: range.
+    glm::vec4 position_range;
+    // rgb: color premultiplied by intensity, w: inner cone cosine.
+    glm::vec4 color_inner;
+    // xyz: world space direction, w: outer cone cosine.
+    glm::vec4 direction_outer;
+  };
+
+  // Matches ViewBuffer in cluster_lights.comp.
+  struct GpuViews {
+    glm::mat4 view[kMaxViews];
+    glm::mat4 inverse_projection[kMaxViews];
+  };
+
+  struct BinningConstants {
+    // xy: viewport size in pixels, z: near plane, w: far plane.
+    glm::vec4 viewport;
+    uint32_t light_count;
+    uint32_t max_lights_per_cluster;
+  };
+
+  struct FrameLights {
+    AllocatedBuffer buffer;
+    AllocatedBuffer view_buffer;
+    // Written by the binning and read by the shading of the same frame.
+    // Each frame has its own so that the binning of one frame can run
+    // while the previous one is still shading.
+    AllocatedBuffer cluster_buffer;
+    VkDescriptorSet descriptor;
+    BinningConstants constants;
+    uint32_t view_count;
+  };
+
+  bool InitPipeline();
+
+  VkDevice device_;
+  VmaAllocator allocator_;
+
+  VkDescriptorSetLayout set_layout_ = VK_NULL_HANDLE;
+  VkPipelineLayout pipeline_layout_ = VK_NULL_HANDLE;
+  VkPipeline pipeline_ = VK_NULL_HANDLE;
+  uint32_t max_view_count_ = 1;
+
+  std::vector<FrameLights> frames_;
+  ClusterParams params_ = {};
+  uint32_t max_lights_per_cluster_ = kMaxLightsPerCluster;
+};
+
+}  // namespace vk
@@ -23,7 +23,7 @@ auto defer(Fn action) {
 
     inline ~DeferImpl() { action_(); }
   };
-  return DeferImpl(std::move(fn));
+  return DeferImpl(std::move(action));
 }
 
 };  // namespace util
@@ -0,0 +1,263 @@
+#include "defragmenter.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+namespace vk {
+
+void Defragmenter::Track(AllocatedBuffer& buffer,
+                         const VkBufferCreateInfo& info) {
+  Resource& resource = resources_[buffer.allocation];
+  resource.buffer = &buffer;
+  resource.buffer_info = info;
+  resource.buffer_info.pNext = nullptr;
+}
+
+void Defragmenter::Track(AllocatedImage& image, const VkImageCreateInfo& info,
+                         VkImageLayout layout, VkImageAspectFlags aspect,
+                         std::function<void(VkImage)> on_moved) {
+  Resource& resource = resources_[image.allocation];
+  resource.image = &image;
+  resource.image_info = info;
+  resource.image_info.pNext = nullptr;
+  resource.image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  resource.layout = layout;
+  resource.aspect = aspect;
+  resource.on_moved = std::move(on_moved);
+}
+
+void Defragmenter::Untrack(VmaAllocation allocation) {
+  resources_.erase(allocation);
+}
+
+void Defragmenter::Update(uint64_t frame) {
+  frame_ = frame;
+
+  if (pass_pending_) {
+    // The copies were recorded into a frame that has now completed.
+    if (frame - pass_frame_ >= frames_in_flight_) {
+      EndPass();
+    }
+    return;
+  }
+
+  if (context_ == VK_NULL_HANDLE && frame >= next_check_frame_) {
+    next_check_frame_ = frame + kCheckInterval;
+    if (IsFragmented()) {
+      Begin();
+    }
+  }
+}
+
+void Defragmenter::RecordMoves(VkCommandBuffer cmd) {
+  if (context_ == VK_NULL_HANDLE || pass_pending_) {
+    return;
+  }
+
+  VkResult result = vmaBeginDefragmentationPass(allocator_, context_, &pass_);
+  if (result != VK_INCOMPLETE) {
+    // Either nothing is left to move or the pass could not start.
+    Finish();
+    return;
+  }
+
+  bool moved_buffers = false;
+  for (uint32_t i = 0; i < pass_.moveCount; i++) {
+    VmaDefragmentationMove& move = pass_.pMoves[i];
+    auto it = resources_.find(move.srcAllocation);
+
+    bool moved = false;
+    if (it != resources_.end()) {
+      Resource& resource = it->second;
+      moved = resource.buffer != nullptr
+                  ? MoveBuffer(cmd, resource, move.dstTmpAllocation)
+                  : MoveImage(cmd, resource, move.dstTmpAllocation);
+      moved_buffers |= moved && resource.buffer != nullptr;
+    }
+    if (!moved) {
+      move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+    }
+  }
+
+  if (moved_buffers) {
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.pNext = nullptr;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0,
+                         nullptr, 0, nullptr);
+  }
+
+  pass_pending_ = true;
+  pass_frame_ = frame_;
+}
+
+void Defragmenter::Finish() {
+  if (context_ == VK_NULL_HANDLE) {
+    return;
+  }
+  if (pass_pending_) {
+    stale_.Flush(device_, allocator_);
+    vmaEndDefragmentationPass(allocator_, context_, &pass_);
+    pass_pending_ = false;
+  }
+
+  VmaDefragmentationStats stats = {};
+  vmaEndDefragmentation(allocator_, context_, &stats);
+  context_ = VK_NULL_HANDLE;
+}
+
+bool Defragmenter::IsFragmented() const {
+  const VkPhysicalDeviceMemoryProperties* memory_properties;
+  vmaGetMemoryProperties(allocator_, &memory_properties);
+
+  VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+  vmaGetHeapBudgets(allocator_, budgets);
+
+  VkDeviceSize block_bytes = 0;
+  VkDeviceSize allocation_bytes = 0;
+  for (uint32_t i = 0; i < memory_properties->memoryHeapCount; i++) {
+    block_bytes += budgets[i].statistics.blockBytes;
+    allocation_bytes += budgets[i].statistics.allocationBytes;
+  }
+
+  const VkDeviceSize unused = block_bytes - allocation_bytes;
+  return unused >= kMinReclaimableBytes && unused * 4 >= block_bytes;
+}
+
+void Defragmenter::Begin() {
+  VmaDefragmentationInfo info = {};
+  info.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT;
+  info.pool = VK_NULL_HANDLE;
+  info.maxBytesPerPass = kMaxBytesPerPass;
+  info.maxAllocationsPerPass = kMaxMovesPerPass;
+
+  if (vmaBeginDefragmentation(allocator_, &info, &context_) != VK_SUCCESS) {
+    std::cerr << "Error starting defragmentation.\n";
+    context_ = VK_NULL_HANDLE;
+  }
+}
+
+void Defragmenter::EndPass() {
+  // Nothing references the old resources anymore, and they must be gone
+  // before VMA releases the memory they are bound to.
+  stale_.Flush(device_, allocator_);
+
+  VkResult result = vmaEndDefragmentationPass(allocator_, context_, &pass_);
+  pass_pending_ = false;
+  if (result != VK_INCOMPLETE) {
+    Finish();
+  }
+}
+
+bool Defragmenter::MoveBuffer(VkCommandBuffer cmd, Resource& resource,
+                              VmaAllocation destination) {
+  VkBuffer buffer;
+  if (vkCreateBuffer(device_, &resource.buffer_info, nullptr, &buffer) !=
+      VK_SUCCESS) {
+    return false;
+  }
+  if (vmaBindBufferMemory(allocator_, destination, buffer) != VK_SUCCESS) {
+    vkDestroyBuffer(device_, buffer, nullptr);
+    return false;
+  }
+
+  VkBufferCopy copy;
+  copy.srcOffset = 0;
+  copy.dstOffset = 0;
+  copy.size = resource.buffer_info.size;
+  vkCmdCopyBuffer(cmd, resource.buffer->buffer, buffer, 1, &copy);
+
+  // The allocation handle stays the same; VMA points it at the new memory
+  // when the pass ends.
+  stale_.Push(resource.buffer->buffer, VmaAllocation{VK_NULL_HANDLE});
+  resource.buffer->buffer = buffer;
+  return true;
+}
+
+bool Defragmenter::MoveImage(VkCommandBuffer cmd, Resource& resource,
+                             VmaAllocation destination) {
+  VkImage image;
+  if (vkCreateImage(device_, &resource.image_info, nullptr, &image) !=
+      VK_SUCCESS) {
+    return false;
+  }
+  if (vmaBindImageMemory(allocator_, destination, image) != VK_SUCCESS) {
+    vkDestroyImage(device_, image, nullptr);
+    return false;
+  }
+
+  const VkImageCreateInfo& info = resource.image_info;
+
+  VkImageSubresourceRange range;
+  range.aspectMask = resource.aspect;
+  range.baseMipLevel = 0;
+  range.levelCount = info.mipLevels;
+  range.baseArrayLayer = 0;
+  range.layerCount = info.arrayLayers;
+
+  VkImageMemoryBarrier barriers[2] = {};
+  barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[0].subresourceRange = range;
+  barriers[1] = barriers[0];
+
+  barriers[0].image = resource.image->image;
+  barriers[0].oldLayout = resource.layout;
+  barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barriers[0].srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+  barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+  barriers[1].image = image;
+  barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barriers[1].srcAccessMask = 0;
+  barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 2, barriers);
+
+  std::vector<VkImageCopy> regions(info.mipLevels);
+  for (uint32_t level = 0; level < info.mipLevels; level++) {
+    VkImageCopy& region = regions[level];
+    region.srcSubresource.aspectMask = resource.aspect;
+    region.srcSubresource.mipLevel = level;
+    region.srcSubresource.baseArrayLayer = 0;
+    region.srcSubresource.layerCount = info.arrayLayers;
+    region.srcOffset = {0, 0, 0};
+    region.dstSubresource = region.srcSubresource;
+    region.dstOffset = {0, 0, 0};
+    region.extent.width = std::max(info.extent.width >> level, 1u);
+    region.extent.height = std::max(info.extent.height >> level, 1u);
+    region.extent.depth = std::max(info.extent.depth >> level, 1u);
+  }
+  vkCmdCopyImage(cmd, resource.image->image,
+                 VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image,
+                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                 static_cast<uint32_t>(regions.size()), regions.data());
+
+  VkImageMemoryBarrier ready = barriers[1];
+  ready.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  ready.newLayout = resource.layout;
+  ready.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  ready.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &ready);
+
+  stale_.Push(resource.image->image, VmaAllocation{VK_NULL_HANDLE});
+  resource.image->image = image;
+  if (resource.on_moved) {
+    resource.on_moved(image);
+  }
+  return true;
+}
+
+}  // namespace vk
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+#include "buffer.hpp"
+#include "deletion_queue.hpp"
+#include "vk_types.hpp"
+
+namespace vk {
+
+// Compacts device memory incrementally while the renderer keeps running.
+//
+// Resources opt in with Track(); everything else (host visible buffers, render
+// target blocks, textures whose owners move around, models in the asset cache)
+// stays where it is. When
+// the heaps become fragmented, a VMA defragmentation context is started and
+// each frame records at most one bounded batch of copies ahead of its draws.
+// Tracked handles are switched to the new resources immediately, so the frame
+// that records the copies already renders from them. The old resources and
+// memory are released once that frame has completed on the GPU, so nothing
+// ever waits on the device.
+class Defragmenter {
+ public:
+  Defragmenter(VkDevice device, VmaAllocator allocator,
+               uint32_t frames_in_flight)
+      : device_(device),
+        allocator_(allocator),
+        frames_in_flight_(frames_in_flight) {}
+
+  // `buffer` is updated in place when its memory moves and must stay at the
+  // same address until Untrack(). The buffer needs
+  // VK_BUFFER_USAGE_TRANSFER_SRC_BIT.
+  void Track(AllocatedBuffer& buffer, const VkBufferCreateInfo& info);
+
+  // Like the above for images, which must be in `layout` whenever frames are
+  // recorded and have VK_IMAGE_USAGE_TRANSFER_SRC_BIT. `on_moved` is called
+  // with the new image so views and descriptors can be recreated.
+  void Track(AllocatedImage& image, const VkImageCreateInfo& info,
+             VkImageLayout layout, VkImageAspectFlags aspect,
+             std::function<void(VkImage)> on_moved);
+
+  // Stops moving the resource. It may then be destroyed or retired as usual.
+  void Untrack(VmaAllocation allocation);
+
+  // Called once per frame after the frame's fence has been waited on and
+  // before anything retired in earlier frames is destroyed. Completes the
+  // pass recorded `frames_in_flight` frames ago and, every so often, checks
+  // whether the heaps are worth compacting.
+  void Update(uint64_t frame);
+
+  // Records the next batch of moves. Must be called outside a render pass
+  // and before any command that uses the tracked resources.
+  void RecordMoves(VkCommandBuffer cmd);
+
+  // Ends any defragmentation in progress. The device must be idle.
+  void Finish();
+
+  bool active() const { return context_ != VK_NULL_HANDLE; }
+
+ private:
+  struct Resource {
+    AllocatedBuffer* buffer = nullptr;
+    VkBufferCreateInfo buffer_info;
+
+    AllocatedImage* image = nullptr;
+    VkImageCreateInfo image_info;
+    VkImageLayout layout;
+    VkImageAspectFlags aspect;
+    std::function<void(VkImage)> on_moved;
+  };
+
+  // Fragmentation is checked this often rather than every frame.
+  constexpr static uint64_t kCheckInterval = 600;
+  // Defragmentation starts when at least this many bytes sit unused in
+  // allocated blocks, and they make up at least a quarter of the blocks.
+  constexpr static VkDeviceSize kMinReclaimableBytes = 32 * 1024 * 1024;
+  constexpr static VkDeviceSize kMaxBytesPerPass = 16 * 1024 * 1024;
+  constexpr static uint32_t kMaxMovesPerPass = 64;
+
+  bool IsFragmented() const;
+  void Begin();
+  void EndPass();
+
+  bool MoveBuffer(VkCommandBuffer cmd, Resource& resource,
+                  VmaAllocation destination);
+  bool MoveImage(VkCommandBuffer cmd, Resource& resource,
+                 VmaAllocation destination);
+
+  VkDevice device_;
+  VmaAllocator allocator_;
+  uint32_t frames_in_flight_;
+
+  std::unordered_map<VmaAllocation, Resource> resources_;
+
+  uint64_t frame_ = 0;
+  uint64_t next_check_frame_ = kCheckInterval;
+
+  VmaDefragmentationContext context_ = VK_NULL_HANDLE;
+  VmaDefragmentationPassMoveInfo pass_ = {};
+  bool pass_pending_ = false;
+  uint64_t pass_frame_ = 0;
+
+  // Resources that were moved away from, destroyed when the pass ends. Their
+  // memory is released by VMA.
+  DeletionQueue stale_{kMaxMovesPerPass};
+};
+
+}  // namespace vk
@@ -0,0 +1,106 @@
+#include "deletion_queue.hpp"
+
+namespace vk {
+
+namespace {
+
+template <typename Handle>
+Handle As(uint64_t handle) {
+  return reinterpret_cast<Handle>(handle);
+}
+
+}  // namespace
+
+void DeletionQueue::Flush(VkDevice device, VmaAllocator allocator) {
+  // One sweep per type keeps Vulkan's parent/child ordering without sorting or
+  // scratch memory. The number of types is small and fixed.
+  for (uint8_t type = 0; type < static_cast<uint8_t>(HandleType::kCount);
+       type++) {
+    for (auto it = entries_.rbegin(); it != entries_.rend(); it++) {
+      if (static_cast<uint8_t>(it->type) == type) {
+        Destroy(device, allocator, *it);
+      }
+    }
+  }
+  entries_.clear();
+}
+
+void DeletionQueue::Append(DeletionQueue& other) {
+  entries_.insert(entries_.end(), other.entries_.begin(),
+                  other.entries_.end());
+  other.entries_.clear();
+}
+
+void DeletionQueue::Destroy(VkDevice device, VmaAllocator allocator,
+                            const Entry& entry) {
+  switch (entry.type) {
+    case HandleType::kFramebuffer:
+      vkDestroyFramebuffer(device, As<VkFramebuffer>(entry.handle), nullptr);
+      break;
+    case HandleType::kPipeline:
+      vkDestroyPipeline(device, As<VkPipeline>(entry.handle), nullptr);
+      break;
+    case HandleType::kPipelineLayout:
+      vkDestroyPipelineLayout(device, As<VkPipelineLayout>(entry.handle),
+                              nullptr);
+      break;
+    case HandleType::kDescriptorPool:
+      vkDestroyDescriptorPool(device, As<VkDescriptorPool>(entry.handle),
+                              nullptr);
+      break;
+    case HandleType::kDescriptorSetLayout:
+      vkDestroyDescriptorSetLayout(
+          device, As<VkDescriptorSetLayout>(entry.handle), nullptr);
+      break;
+    case HandleType::kRenderPass:
+      vkDestroyRenderPass(device, As<VkRenderPass>(entry.handle), nullptr);
+      break;
+    case HandleType::kImageView:
+      vkDestroyImageView(device, As<VkImageView>(entry.handle), nullptr);
+      break;
+    case HandleType::kSampler:
+      vkDestroySampler(device, As<VkSampler>(entry.handle), nullptr);
+      break;
+    case HandleType::kImage:
+      if (entry.allocation) {
+        vmaDestroyImage(allocator, As<VkImage>(entry.handle),
+                        entry.allocation);
+      } else {
+        vkDestroyImage(device, As<VkImage>(entry.handle), nullptr);
+      }
+      break;
+    case HandleType::kBuffer:
+      if (entry.allocation) {
+        vmaDestroyBuffer(allocator, As<VkBuffer>(entry.handle),
+                         entry.allocation);
+      } else {
+        vkDestroyBuffer(device, As<VkBuffer>(entry.handle), nullptr);
+      }
+      break;
+    case HandleType::kAllocation:
+      vmaFreeMemory(allocator, entry.allocation);
+      break;
+    case HandleType::kShaderModule:
+      vkDestroyShaderModule(device, As<VkShaderModule>(entry.handle), nullptr);
+      break;
+    case HandleType::kQueryPool:
+      vkDestroyQueryPool(device, As<VkQueryPool>(entry.handle), nullptr);
+      break;
+    case HandleType::kCommandPool:
+      vkDestroyCommandPool(device, As<VkCommandPool>(entry.handle), nullptr);
+      break;
+    case HandleType::kFence:
+      vkDestroyFence(device, As<VkFence>(entry.handle), nullptr);
+      break;
+    case HandleType::kSemaphore:
+      vkDestroySemaphore(device, As<VkSemaphore>(entry.handle), nullptr);
+      break;
+    case HandleType::kSwapchain:
+      vkDestroySwapchainKHR(device, As<VkSwapchainKHR>(entry.handle), nullptr);
+      break;
+    case HandleType::kCount:
+      break;
+  }
+}
+
+}  // namespace vk
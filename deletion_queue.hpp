@@ -0,0 +1,130 @@
+#pragma once
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace vk {
+
+// The typed Push overloads rely on non-dispatchable handles being distinct
+// pointer types, which is only the case on 64-bit targets. On 32-bit ones
+// they are all uint64_t, so the project only has x64 configurations.
+static_assert(sizeof(void*) == sizeof(uint64_t),
+              "DeletionQueue requires a 64-bit target");
+
+// Records Vulkan handles for later destruction. Entries are stored as flat
+// (type, handle, allocation) tuples rather than closures, so pushing never
+// allocates once the queue has reached its working capacity and flushing is a
+// handful of tight loops.
+//
+// Flush() destroys entries one type at a time, children before parents (e.g.
+// framebuffers before image views before images), and in reverse push order
+// within a type. The queue does not own the device: the same queue can be
+// flushed at shutdown or reused every frame for resource retirement.
+class DeletionQueue {
+ public:
+  // Destruction order. Types earlier in the list are destroyed first.
+  enum class HandleType : uint8_t {
+    kFramebuffer,
+    kPipeline,
+    kPipelineLayout,
+    kDescriptorPool,
+    kDescriptorSetLayout,
+    kRenderPass,
+    kImageView,
+    kSampler,
+    kImage,
+    kBuffer,
+    kAllocation,
+    kShaderModule,
+    kQueryPool,
+    kCommandPool,
+    kFence,
+    kSemaphore,
+    kSwapchain,
+    kCount,
+  };
+
+  explicit DeletionQueue(size_t capacity = kDefaultCapacity) {
+    entries_.reserve(capacity);
+  }
+
+  DeletionQueue(DeletionQueue&& other) noexcept = default;
+  DeletionQueue& operator=(DeletionQueue&& other) noexcept = default;
+
+  DeletionQueue(const DeletionQueue&) = delete;
+  DeletionQueue& operator=(const DeletionQueue&) = delete;
+
+  // Images and buffers created through VMA are destroyed together with their
+  // allocation. Passing VK_NULL_HANDLE for the allocation destroys only the
+  // handle (e.g. a buffer that was bound to memory owned by someone else).
+  void Push(VkBuffer buffer, VmaAllocation allocation) {
+    Push(HandleType::kBuffer, buffer, allocation);
+  }
+  void Push(VkImage image, VmaAllocation allocation) {
+    Push(HandleType::kImage, image, allocation);
+  }
+  void Push(VmaAllocation allocation) {
+    Push(HandleType::kAllocation, allocation, allocation);
+  }
+
+  void Push(VkFramebuffer framebuffer) {
+    Push(HandleType::kFramebuffer, framebuffer);
+  }
+  void Push(VkPipeline pipeline) { Push(HandleType::kPipeline, pipeline); }
+  void Push(VkPipelineLayout layout) {
+    Push(HandleType::kPipelineLayout, layout);
+  }
+  void Push(VkDescriptorPool pool) { Push(HandleType::kDescriptorPool, pool); }
+  void Push(VkDescriptorSetLayout layout) {
+    Push(HandleType::kDescriptorSetLayout, layout);
+  }
+  void Push(VkRenderPass renderpass) {
+    Push(HandleType::kRenderPass, renderpass);
+  }
+  void Push(VkImageView view) { Push(HandleType::kImageView, view); }
+  void Push(VkSampler sampler) { Push(HandleType::kSampler, sampler); }
+  void Push(VkShaderModule module) { Push(HandleType::kShaderModule, module); }
+  void Push(VkQueryPool pool) { Push(HandleType::kQueryPool, pool); }
+  void Push(VkCommandPool pool) { Push(HandleType::kCommandPool, pool); }
+  void Push(VkFence fence) { Push(HandleType::kFence, fence); }
+  void Push(VkSemaphore semaphore) { Push(HandleType::kSemaphore, semaphore); }
+  void Push(VkSwapchainKHR swapchain) {
+    Push(HandleType::kSwapchain, swapchain);
+  }
+
+  // Destroys every recorded handle and empties the queue, keeping its storage.
+  void Flush(VkDevice device, VmaAllocator allocator);
+
+  // Moves all entries of `other` to the back of this queue.
+  void Append(DeletionQueue& other);
+
+  bool empty() const { return entries_.empty(); }
+  size_t size() const { return entries_.size(); }
+
+ private:
+  struct Entry {
+    uint64_t handle;
+    VmaAllocation allocation;
+    HandleType type;
+  };
+
+  constexpr static size_t kDefaultCapacity = 256;
+
+  template <typename Handle>
+  void Push(HandleType type, Handle handle,
+            VmaAllocation allocation = VK_NULL_HANDLE) {
+    if (handle == VK_NULL_HANDLE) return;
+    entries_.push_back(
+        {reinterpret_cast<uint64_t>(handle), allocation, type});
+  }
+
+  static void Destroy(VkDevice device, VmaAllocator allocator,
+                      const Entry& entry);
+
+  std::vector<Entry> entries_;
+};
+
+}  // namespace vk
@@ -0,0 +1,439 @@
+#include "device_context.hpp"
+
+#include <cstring>
+#include <iostream>
+
+#include "async_compute.hpp"
+
+namespace {
+
+using vk::SwapchainDetails;
+
+#ifdef _DEBUG
+constexpr bool kEnableValidationLayers = true;
+#else
+constexpr bool kEnableValidationLayers = false;
+#endif
+
+const std::vector<const char*> kValidationLayers = {
+    "VK_LAYER_KHRONOS_validation"};
+
+const std::vector<const char*> kDeviceExtensions = {
+    VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+    VK_KHR_SHADER_DRAW_PARAMETERS_EXTENSION_NAME,
+};
+
+bool VerifyValidationLayersSupported(const std::vector<const char*>& layers) {
+  uint32_t layer_count;
+  vkEnumerateInstanceLayerProperties(&layer_count, nullptr);
+  std::vector<VkLayerProperties> available_layers(layer_count);
+  vkEnumerateInstanceLayerProperties(&layer_count, available_layers.data());
+
+  for (const char* layer_name : layers) {
+    bool layer_found = false;
+    for (const auto& properties : available_layers) {
+      if (strcmp(layer_name, properties.layerName) == 0) {
+        layer_found = true;
+        break;
+      }
+    }
+
+    if (!layer_found) return false;
+  }
+  return true;
+}
+
+bool VerifyDeviceExtensionsSupported(VkPhysicalDevice device) {
+  uint32_t count;
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &count, nullptr);
+  std::vector<VkExtensionProperties> available(count);
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &count,
+                                       available.data());
+
+  int supported = 0;
+  for (const auto& extension : available) {
+    for (const char* required : kDeviceExtensions) {
+      if (strcmp(extension.extensionName, required)) {
+        supported++;
+        break;
+      }
+    }
+    if (supported == kDeviceExtensions.size()) return true;
+  }
+
+  return false;
+}
+
+// Optional: pipelines built from separately compiled parts. Needs
+// VK_KHR_pipeline_library as well.
+bool SupportsGraphicsPipelineLibrary(VkPhysicalDevice device) {
+  uint32_t count;
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &count, nullptr);
+  std::vector<VkExtensionProperties> available(count);
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &count,
+                                       available.data());
+
+  int found = 0;
+  for (const auto& extension : available) {
+    if (strcmp(extension.extensionName,
+               VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME) == 0 ||
+        strcmp(extension.extensionName,
+               VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) == 0) {
+      found++;
+    }
+  }
+  if (found < 2) {
+    return false;
+  }
+
+  VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT library_feature = {};
+  library_feature.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+  library_feature.pNext = nullptr;
+
+  VkPhysicalDeviceFeatures2 features;
+  features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  features.pNext = &library_feature;
+  vkGetPhysicalDeviceFeatures2(device, &features);
+  return library_feature.graphicsPipelineLibrary == VK_TRUE;
+}
+
+struct SelectedDeviceDetails {
+  VkPhysicalDevice device;
+  VkPhysicalDeviceProperties properties;
+  uint32_t graphics_queue_family;
+};
+
+std::optional<uint32_t> GetQueueFamilyIndices(VkPhysicalDevice device,
+                                              VkSurfaceKHR& surface) {
+  uint32_t count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(device, &count, nullptr);
+  std::vector<VkQueueFamilyProperties> families(count);
+
+  vkGetPhysicalDeviceQueueFamilyProperties(device, &count, families.data());
+  std::optional<uint32_t> result = std::nullopt;
+  for (int i = 0; i < count; i++) {
+    // Without a surface nothing is presented.
+    VkBool32 present_supported = surface == VK_NULL_HANDLE;
+    if (surface != VK_NULL_HANDLE) {
+      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
+                                           &present_supported);
+    }
+    if (present_supported && families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+      result = i;
+    }
+  }
+  return result;
+}
+
+std::optional<SwapchainDetails> QuerySwapchainDetails(VkPhysicalDevice device,
+                                                      VkSurfaceKHR surface) {
+  // We need to query three properties.
+  // 1. Basic surface capabilities (min/max number of images in swapchain,
+  // width/height of images).
+  // 2. Surface formats (pixel format, color space).
+  // 3. Available presentation modes.
+
+  SwapchainDetails details;
+
+  uint32_t format_count;
+  vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &format_count, nullptr);
+  if (format_count == 0) {
+    return std::nullopt;
+  }
+  details.formats.resize(format_count);
+  vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &format_count,
+                                       details.formats.data());
+
+  uint32_t present_mode_count;
+  vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface,
+                                            &present_mode_count, nullptr);
+  if (present_mode_count == 0) {
+    return std::nullopt;
+  }
+  details.present_modes.resize(present_mode_count);
+  vkGetPhysicalDeviceSurfacePresentModesKHR(
+      device, surface, &present_mode_count, details.present_modes.data());
+
+  vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface,
+                                            &details.capabilities);
+
+  return details;
+}
+
+
+std::optional<SelectedDeviceDetails> SelectDevice(
+    std::vector<VkPhysicalDevice>& devices, VkSurfaceKHR& surface) {
+  std::vector<int> scores(devices.size());
+  int max_score = 0;
+  int max_index = -1;
+  uint32_t max_queue_family = 0;
+  for (int i = 0; i < devices.size(); i++) {
+    VkPhysicalDevice device = devices[i];
+    std::optional<uint32_t> queue_family =
+        GetQueueFamilyIndices(device, surface);
+    // Get the graphics queue. If there isn't one, this device isn't supported.
+    if (!queue_family.has_value()) {
+      continue;
+    }
+
+    if (!VerifyDeviceExtensionsSupported(device)) {
+      continue;
+    }
+
+    if (surface != VK_NULL_HANDLE &&
+        !QuerySwapchainDetails(device, surface).has_value()) {
+      continue;
+    }
+
+    //  Get device properties.
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+
+    // Multiple views are rendered in a single pass.
+    VkPhysicalDeviceMultiviewFeatures multiview_feature = {};
+    multiview_feature.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES;
+    multiview_feature.pNext = nullptr;
+
+    // We want to support the SPIR-V DrawParameters capability.
+    VkPhysicalDeviceShaderDrawParametersFeatures ext_feature = {};
+    ext_feature.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_DRAW_PARAMETERS_FEATURES;
+    ext_feature.pNext = &multiview_feature;
+
+    VkPhysicalDeviceFeatures2 features;
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &ext_feature;
+    vkGetPhysicalDeviceFeatures2(device, &features);
+    if (ext_feature.shaderDrawParameters == VK_FALSE) continue;
+    if (multiview_feature.multiview == VK_FALSE) continue;
+    if (features.features.geometryShader == VK_FALSE) continue;
+    if (properties.apiVersion < VK_API_VERSION_1_1) continue;
+    // Rate suitability.
+    int score = 0;
+    // Discrete GPUs have performance advantages.
+    if (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
+      score += 1000;
+    }
+    // Maximum possible size of textures.
+    score += properties.limits.maxImageDimension2D;
+
+    if (score > max_score) {
+      max_score = score;
+      max_index = i;
+      max_queue_family = queue_family.value();
+    }
+  }
+  if (max_index < 0) {
+    // Unable to find a suitable device.
+    return std::nullopt;
+  }
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(devices[max_index], &properties);
+
+  return std::make_optional<SelectedDeviceDetails>(
+      {devices[max_index], properties, max_queue_family});
+}
+
+}  // namespace
+
+namespace vk {
+
+DeviceContext::~DeviceContext() {
+  asset_cache_.reset();
+  if (pipeline_cache_ != VK_NULL_HANDLE) {
+    vkDestroyPipelineCache(device_, pipeline_cache_, nullptr);
+  }
+  if (allocator_ != VK_NULL_HANDLE) {
+    vmaDestroyAllocator(allocator_);
+  }
+  if (device_ != VK_NULL_HANDLE) {
+    vkDestroyDevice(device_, nullptr);
+  }
+  if (surface_ != VK_NULL_HANDLE) {
+    vkDestroySurfaceKHR(instance_, surface_, nullptr);
+  }
+  if (instance_ != VK_NULL_HANDLE) {
+    vkDestroyInstance(instance_, nullptr);
+  }
+}
+
+bool DeviceContext::Init(const Params& params) {
+  const bool headless = params.window_handle == nullptr;
+
+  // Initialize Vulkan application.
+  VkApplicationInfo app_info = {};
+  app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+  app_info.pNext = nullptr;
+  app_info.pApplicationName = params.application_name.c_str();
+  app_info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+  app_info.pEngineName = "vk-renderer";
+  app_info.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+  app_info.apiVersion = VK_API_VERSION_1_1;
+
+  // Initialize Vulkan instance.
+  VkInstanceCreateInfo instance_info = {};
+  instance_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+  instance_info.pNext = nullptr;
+  instance_info.pApplicationInfo = &app_info;
+  instance_info.enabledExtensionCount = params.extensions.size();
+  instance_info.ppEnabledExtensionNames = params.extensions.data();
+  if (kEnableValidationLayers) {
+    if (!VerifyValidationLayersSupported(kValidationLayers)) {
+      return false;
+    }
+    instance_info.enabledLayerCount =
+        static_cast<uint32_t>(kValidationLayers.size());
+    instance_info.ppEnabledLayerNames = kValidationLayers.data();
+  } else {
+    instance_info.enabledLayerCount = 0;
+  }
+
+  if (vkCreateInstance(&instance_info, nullptr, &instance_) != VK_SUCCESS) {
+    return false;
+  }
+
+  // Create the surface.
+  if (!headless) {
+    VkWin32SurfaceCreateInfoKHR surface_info = {};
+    surface_info.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
+    surface_info.pNext = nullptr;
+    surface_info.hwnd = params.window_handle;
+    surface_info.hinstance = GetModuleHandle(nullptr);
+    if (vkCreateWin32SurfaceKHR(instance_, &surface_info, nullptr,
+                                &surface_) != VK_SUCCESS) {
+      return false;
+    }
+  }
+
+  // Initialize the physical gpu.
+  uint32_t device_count = 0;
+  vkEnumeratePhysicalDevices(instance_, &device_count, nullptr);
+  if (device_count == 0) {
+    return false;
+  }
+  std::vector<VkPhysicalDevice> devices(device_count);
+  vkEnumeratePhysicalDevices(instance_, &device_count, devices.data());
+  std::optional<SelectedDeviceDetails> maybe_selected_device =
+      SelectDevice(devices, surface_);
+  if (!maybe_selected_device.has_value()) {
+    return false;
+  }
+  SelectedDeviceDetails& selected_device = maybe_selected_device.value();
+  gpu_ = selected_device.device;
+  gpu_properties_ = selected_device.properties;
+
+  // Initialize the device queue.
+  VkDeviceQueueCreateInfo queue_info = {};
+  queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+  queue_info.pNext = nullptr;
+  queue_info.queueFamilyIndex = selected_device.graphics_queue_family;
+  queue_info.queueCount = 1;
+  float queue_priority = 1.0f;  // Highest priority since we only have 1.
+  queue_info.pQueuePriorities = &queue_priority;
+  graphics_queue_family_ = selected_device.graphics_queue_family;
+
+  std::vector<VkDeviceQueueCreateInfo> queue_infos = {queue_info};
+  if (params.async_compute) {
+    compute_queue_family_ = AsyncCompute::FindQueueFamily(gpu_);
+    if (compute_queue_family_.has_value()) {
+      VkDeviceQueueCreateInfo compute_queue_info = queue_info;
+      compute_queue_info.queueFamilyIndex = compute_queue_family_.value();
+      queue_infos.push_back(compute_queue_info);
+    }
+  }
+
+  // Initialize the logical device.
+  VkPhysicalDeviceFeatures device_features = {};
+  device_features.geometryShader = VK_TRUE;
+
+  // The mesh shaders read gl_ViewIndex.
+  VkPhysicalDeviceMultiviewFeatures multiview_features = {};
+  multiview_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES;
+  multiview_features.pNext = nullptr;
+  multiview_features.multiview = VK_TRUE;
+
+  VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT library_features = {};
+  library_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+  library_features.pNext = nullptr;
+  library_features.graphicsPipelineLibrary = VK_TRUE;
+
+  graphics_pipeline_library_ = SupportsGraphicsPipelineLibrary(gpu_);
+  if (graphics_pipeline_library_) {
+    multiview_features.pNext = &library_features;
+  }
+
+  VkDeviceCreateInfo device_info = {};
+  device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  device_info.pNext = &multiview_features;
+
+  device_info.queueCreateInfoCount = static_cast<uint32_t>(queue_infos.size());
+  device_info.pQueueCreateInfos = queue_infos.data();
+  device_info.pEnabledFeatures = &device_features;
+  // Headless devices need not support presentation.
+  std::vector<const char*> device_extensions;
+  for (const char* extension : kDeviceExtensions) {
+    if (!headless || strcmp(extension, VK_KHR_SWAPCHAIN_EXTENSION_NAME)) {
+      device_extensions.push_back(extension);
+    }
+  }
+  if (graphics_pipeline_library_) {
+    device_extensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+    device_extensions.push_back(
+        VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+  }
+  device_info.enabledExtensionCount =
+      static_cast<uint32_t>(device_extensions.size());
+  device_info.ppEnabledExtensionNames = device_extensions.data();
+
+  if (kEnableValidationLayers) {
+    device_info.enabledLayerCount =
+        static_cast<uint32_t>(kValidationLayers.size());
+    device_info.ppEnabledLayerNames = kValidationLayers.data();
+  } else {
+    device_info.enabledLayerCount = 0;
+  }
+
+  if (vkCreateDevice(gpu_, &device_info, nullptr, &device_) != VK_SUCCESS) {
+    return false;
+  }
+
+  // Initialize memory allocator.
+  VmaAllocatorCreateInfo allocator_info = {};
+  allocator_info.physicalDevice = gpu_;
+  allocator_info.device = device_;
+  allocator_info.instance = instance_;
+  vmaCreateAllocator(&allocator_info, &allocator_);
+  asset_cache_ = std::make_unique<AssetCache>(device_, allocator_,
+                                              params.asset_cache_budget);
+
+  // Initialize the queues.
+  vkGetDeviceQueue(device_, graphics_queue_family_, 0, &graphics_queue_);
+  if (compute_queue_family_.has_value()) {
+    vkGetDeviceQueue(device_, compute_queue_family_.value(), 0,
+                     &compute_queue_);
+  }
+
+  VkPipelineCacheCreateInfo cache_info = {};
+  cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  cache_info.pNext = nullptr;
+  if (vkCreatePipelineCache(device_, &cache_info, nullptr, &pipeline_cache_) !=
+      VK_SUCCESS) {
+    return false;
+  }
+
+  return true;
+}
+
+std::optional<SwapchainDetails> DeviceContext::GetSwapchainDetails() const {
+  if (surface_ == VK_NULL_HANDLE) {
+    return std::nullopt;
+  }
+  return QuerySwapchainDetails(gpu_, surface_);
+}
+
+}  // namespace vk
@@ -0,0 +1,111 @@
+#pragma once
+
+#define VK_USE_PLATFORM_WIN32_KHR
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "asset_cache.hpp"
+
+namespace vk {
+
+struct SwapchainDetails {
+  VkSurfaceCapabilitiesKHR capabilities;
+  std::vector<VkSurfaceFormatKHR> formats;
+  std::vector<VkPresentModeKHR> present_modes;
+};
+
+// The Vulkan objects that every renderer on a GPU can share: the instance,
+// the device and its queues, the memory allocator, a pipeline cache and the
+// models loaded so far.
+//
+// A Renderer creates a context of its own unless it is handed one, so a
+// process serving several scenes, e.g. one per tenant, can run many headless
+// renderers on one context: they share device memory and compiled pipelines
+// instead of each bringing up a device. Each renderer keeps its own command
+// buffers, descriptors, targets and scene, so they may run on separate
+// threads; submissions to the shared queues are serialized with
+// queue_mutex(), as Vulkan requires.
+//
+// Destroyed along with the last renderer holding it.
+class DeviceContext {
+ public:
+  struct Params {
+    std::string application_name;
+    std::vector<const char*> extensions;
+    // The device is picked to present to this window. Null for headless
+    // contexts.
+    HWND window_handle = nullptr;
+    // Also create a queue on a dedicated compute family, if there is one.
+    bool async_compute = false;
+    // Device memory the asset cache may keep beyond what is in use.
+    VkDeviceSize asset_cache_budget = VkDeviceSize{256} << 20;
+  };
+
+  DeviceContext() = default;
+  ~DeviceContext();
+
+  DeviceContext(const DeviceContext&) = delete;
+  DeviceContext& operator=(const DeviceContext&) = delete;
+
+  bool Init(const Params& params);
+
+  // Formats, present modes and capabilities of the window's surface.
+  std::optional<SwapchainDetails> GetSwapchainDetails() const;
+
+  VkInstance instance() const { return instance_; }
+  VkPhysicalDevice gpu() const { return gpu_; }
+  const VkPhysicalDeviceProperties& gpu_properties() const {
+    return gpu_properties_;
+  }
+  VkDevice device() const { return device_; }
+  VmaAllocator allocator() const { return allocator_; }
+  // Null for headless contexts.
+  VkSurfaceKHR surface() const { return surface_; }
+  bool headless() const { return surface_ == VK_NULL_HANDLE; }
+
+  VkQueue graphics_queue() const { return graphics_queue_; }
+  uint32_t graphics_queue_family() const { return graphics_queue_family_; }
+  // Only with Params::async_compute on GPUs with a dedicated compute family.
+  VkQueue compute_queue() const { return compute_queue_; }
+  std::optional<uint32_t> compute_queue_family() const {
+    return compute_queue_family_;
+  }
+
+  VkPipelineCache pipeline_cache() const { return pipeline_cache_; }
+  // Whether VK_EXT_graphics_pipeline_library is enabled, so pipelines can be
+  // linked from separately compiled parts.
+  bool graphics_pipeline_library() const { return graphics_pipeline_library_; }
+  AssetCache& asset_cache() { return *asset_cache_; }
+
+  // Held around every vkQueueSubmit and vkQueuePresentKHR on the context's
+  // queues.
+  std::mutex& queue_mutex() { return queue_mutex_; }
+
+ private:
+  VkInstance instance_ = VK_NULL_HANDLE;
+  VkPhysicalDevice gpu_ = VK_NULL_HANDLE;
+  VkPhysicalDeviceProperties gpu_properties_;
+  VkDevice device_ = VK_NULL_HANDLE;
+  VmaAllocator allocator_ = VK_NULL_HANDLE;
+  VkSurfaceKHR surface_ = VK_NULL_HANDLE;
+
+  VkQueue graphics_queue_ = VK_NULL_HANDLE;
+  uint32_t graphics_queue_family_ = 0;
+  VkQueue compute_queue_ = VK_NULL_HANDLE;
+  std::optional<uint32_t> compute_queue_family_;
+
+  VkPipelineCache pipeline_cache_ = VK_NULL_HANDLE;
+  bool graphics_pipeline_library_ = false;
+  std::unique_ptr<AssetCache> asset_cache_;
+
+  std::mutex queue_mutex_;
+};
+
+}  // namespace vk
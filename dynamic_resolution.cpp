@@ -0,0 +1,55 @@
+#include "dynamic_resolution.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace vk {
+
+namespace {
+
+// Changes smaller than this are ignored so that the resolution does not
+// jitter while the frame time hovers around the budget.
+constexpr float kMinScaleStep = 0.02f;
+
+constexpr float kDecreaseRate = 0.75f;
+constexpr float kIncreaseRate = 0.25f;
+
+}  // namespace
+
+void DynamicResolution::AddSample(float gpu_ms) {
+  sample_sum_ += gpu_ms;
+  sample_count_++;
+  if (sample_count_ < settings_.interval) {
+    return;
+  }
+
+  const float average = sample_sum_ / static_cast<float>(sample_count_);
+  sample_sum_ = 0.f;
+  sample_count_ = 0;
+  if (average <= 0.f) {
+    return;
+  }
+
+  // Pixels, and so GPU time, grow with the square of the scale.
+  const float target = scale_ * std::sqrt(settings_.budget_ms / average);
+  const float rate = target < scale_ ? kDecreaseRate : kIncreaseRate;
+  const float next =
+      std::clamp(scale_ + (target - scale_) * rate, settings_.min_scale,
+                 settings_.max_scale);
+
+  // Always snap to the bounds so that full resolution is actually reached.
+  if (std::abs(next - scale_) >= kMinScaleStep ||
+      next == settings_.min_scale || next == settings_.max_scale) {
+    scale_ = next;
+  }
+}
+
+VkExtent2D DynamicResolution::Apply(VkExtent2D full) const {
+  if (scale_ >= 1.f) {
+    return full;
+  }
+  return {std::max(1u, static_cast<uint32_t>(full.width * scale_)),
+          std::max(1u, static_cast<uint32_t>(full.height * scale_))};
+}
+
+}  // namespace vk
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+
+namespace vk {
+
+// Picks the internal render resolution from measured GPU frame times.
+//
+// Samples are averaged over `interval` frames and the scale is then moved
+// towards the one expected to hit the budget, assuming GPU time is roughly
+// proportional to the number of pixels shaded. The scale drops quickly when
+// over budget, to avoid missed frames, and recovers more slowly.
+class DynamicResolution {
+ public:
+  struct Settings {
+    // GPU time per frame to aim for. Should leave some headroom below the
+    // display's refresh interval.
+    float budget_ms = 14.f;
+    // Bounds of the per-axis scale.
+    float min_scale = 0.5f;
+    float max_scale = 1.f;
+    // Frames averaged between adjustments.
+    uint32_t interval = 8;
+  };
+
+  DynamicResolution() = default;
+  explicit DynamicResolution(const Settings& settings)
+      : settings_(settings), scale_(settings.max_scale) {}
+
+  void AddSample(float gpu_ms);
+
+  // The render extent for a `full` size output.
+  VkExtent2D Apply(VkExtent2D full) const;
+
+  float scale() const { return scale_; }
+  bool at_min() const { return scale_ <= settings_.min_scale; }
+  bool at_max() const { return scale_ >= settings_.max_scale; }
+  const Settings& settings() const { return settings_; }
+
+ private:
+  Settings settings_;
+  float scale_ = 1.f;
+
+  float sample_sum_ = 0.f;
+  uint32_t sample_count_ = 0;
+};
+
+}  // namespace vk
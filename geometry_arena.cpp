@@ -0,0 +1,164 @@
+#include "geometry_arena.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+#include "defer.hpp"
+
+namespace vk {
+
+void GeometryArena::Init(Capacity capacity) {
+  capacity_ = capacity;
+
+  vertex_buffer_ = CreateBuffer(
+      allocator_, vertex_buffer_size(),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY);
+  index_buffer_ = CreateBuffer(
+      allocator_, index_buffer_size(),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY);
+
+  free_vertices_.Reset(capacity.vertices);
+  free_indices_.Reset(capacity.indices);
+}
+
+std::optional<GeometryRange> GeometryArena::Upload(
+    const Mesh& mesh, QueueSubmitter& queue_submitter) {
+  std::vector<uint32_t> trivial_indices;
+  const std::vector<uint32_t>* indices = &mesh.indices;
+  if (indices->empty()) {
+    trivial_indices.resize(mesh.vertices.size());
+    std::iota(trivial_indices.begin(), trivial_indices.end(), 0);
+    indices = &trivial_indices;
+  }
+
+  GeometryRange range;
+  range.vertex_count = static_cast<uint32_t>(mesh.vertices.size());
+  range.index_count = static_cast<uint32_t>(indices->size());
+  if (range.vertex_count == 0 || range.index_count == 0) {
+    return std::nullopt;
+  }
+
+  std::optional<uint32_t> first_vertex =
+      free_vertices_.Allocate(range.vertex_count);
+  if (!first_vertex.has_value()) {
+    return std::nullopt;
+  }
+  std::optional<uint32_t> first_index =
+      free_indices_.Allocate(range.index_count);
+  if (!first_index.has_value()) {
+    free_vertices_.Free(first_vertex.value(), range.vertex_count);
+    return std::nullopt;
+  }
+  range.first_vertex = first_vertex.value();
+  range.first_index = first_index.value();
+
+  const size_t vertex_size = sizeof(Vertex) * range.vertex_count;
+  const size_t index_size = sizeof(uint32_t) * range.index_count;
+  AllocatedBuffer staging_buffer =
+      CreateBuffer(allocator_, vertex_size + index_size,
+                   VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+  DEFER([&]() {
+    vmaDestroyBuffer(allocator_, staging_buffer.buffer,
+                     staging_buffer.allocation);
+  });
+
+  void* data;
+  vmaMapMemory(allocator_, staging_buffer.allocation, &data);
+  memcpy(data, mesh.vertices.data(), vertex_size);
+  memcpy(static_cast<char*>(data) + vertex_size, indices->data(),
+         index_size);
+  vmaUnmapMemory(allocator_, staging_buffer.allocation);
+
+  queue_submitter.SubmitImmediate([&](VkCommandBuffer cmd) {
+    VkBufferCopy vertex_copy = {};
+    vertex_copy.srcOffset = 0;
+    vertex_copy.dstOffset = VkDeviceSize{range.first_vertex} * sizeof(Vertex);
+    vertex_copy.size = vertex_size;
+    vkCmdCopyBuffer(cmd, staging_buffer.buffer, vertex_buffer_.buffer, 1,
+                    &vertex_copy);
+
+    VkBufferCopy index_copy = {};
+    index_copy.srcOffset = vertex_size;
+    index_copy.dstOffset = VkDeviceSize{range.first_index} * sizeof(uint32_t);
+    index_copy.size = index_size;
+    vkCmdCopyBuffer(cmd, staging_buffer.buffer, index_buffer_.buffer, 1,
+                    &index_copy);
+  });
+
+  return range;
+}
+
+void GeometryArena::Free(const GeometryRange& range, uint64_t frame) {
+  if (!range.empty()) {
+    pending_frees_.push_back({frame, range});
+  }
+}
+
+void GeometryArena::Collect(uint64_t completed_frame) {
+  auto completed = std::partition(
+      pending_frees_.begin(), pending_frees_.end(),
+      [=](const PendingFree& pending) {
+        return pending.frame > completed_frame;
+      });
+  for (auto it = completed; it != pending_frees_.end(); ++it) {
+    free_vertices_.Free(it->range.first_vertex, it->range.vertex_count);
+    free_indices_.Free(it->range.first_index, it->range.index_count);
+  }
+  pending_frees_.erase(completed, pending_frees_.end());
+}
+
+void GeometryArena::Release(DeletionQueue& queue) {
+  queue.Push(vertex_buffer_.buffer, vertex_buffer_.allocation);
+  queue.Push(index_buffer_.buffer, index_buffer_.allocation);
+  vertex_buffer_ = {};
+  index_buffer_ = {};
+  pending_frees_.clear();
+}
+
+void GeometryArena::FreeList::Reset(uint32_t capacity) {
+  ranges_.clear();
+  ranges_.push_back({0, capacity});
+}
+
+std::optional<uint32_t> GeometryArena::FreeList::Allocate(uint32_t count) {
+  for (auto it = ranges_.begin(); it != ranges_.end(); ++it) {
+    if (it->count < count) {
+      continue;
+    }
+    const uint32_t offset = it->offset;
+    it->offset += count;
+    it->count -= count;
+    if (it->count == 0) {
+      ranges_.erase(it);
+    }
+    return offset;
+  }
+  return std::nullopt;
+}
+
+void GeometryArena::FreeList::Free(uint32_t offset, uint32_t count) {
+  auto next = std::lower_bound(
+      ranges_.begin(), ranges_.end(), offset,
+      [](const Range& range, uint32_t value) { return range.offset < value; });
+  next = ranges_.insert(next, {offset, count});
+
+  // Merge with the following range, then with the preceding one.
+  auto following = next + 1;
+  if (following != ranges_.end() &&
+      next->offset + next->count == following->offset) {
+    next->count += following->count;
+    ranges_.erase(following);
+  }
+  if (next != ranges_.begin()) {
+    auto preceding = next - 1;
+    if (preceding->offset + preceding->count == next->offset) {
+      preceding->count += next->count;
+      ranges_.erase(next);
+    }
+  }
+}
+
+}  // namespace vk
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "buffer.hpp"
+#include "deletion_queue.hpp"
+#include "queue_submitter.hpp"
+#include "vk_mesh.hpp"
+
+namespace vk {
+
+// All mesh geometry in one vertex and one index storage buffer, so shaders
+// can fetch the triangles of any object by offset, e.g. to shade a
+// visibility buffer.
+//
+// Ranges are handed out first fit from free lists. Freed ranges become
+// available again once the frames that may still read them have completed,
+// see Collect().
+class GeometryArena {
+ public:
+  struct Capacity {
+    uint32_t vertices = 1 << 20;
+    uint32_t indices = 1 << 22;
+  };
+
+  GeometryArena(VkDevice device, VmaAllocator allocator)
+      : device_(device), allocator_(allocator) {}
+
+  void Init(Capacity capacity);
+
+  // Copies `mesh` into the arena. Returns nothing if it does not fit.
+  std::optional<GeometryRange> Upload(const Mesh& mesh,
+                                      QueueSubmitter& queue_submitter);
+
+  // `frame` is the last frame that may read the range.
+  void Free(const GeometryRange& range, uint64_t frame);
+  // Makes the ranges freed in frames up to `completed_frame` reusable.
+  void Collect(uint64_t completed_frame);
+
+  // Vertex layout matches Vertex, as tightly packed floats.
+  VkBuffer vertex_buffer() const { return vertex_buffer_.buffer; }
+  VkBuffer index_buffer() const { return index_buffer_.buffer; }
+  VkDeviceSize vertex_buffer_size() const {
+    return VkDeviceSize{capacity_.vertices} * sizeof(Vertex);
+  }
+  VkDeviceSize index_buffer_size() const {
+    return VkDeviceSize{capacity_.indices} * sizeof(uint32_t);
+  }
+
+  // Hands the buffers to `queue`. Used at shutdown.
+  void Release(DeletionQueue& queue);
+
+ private:
+  // Free ranges of one buffer, sorted by offset and merged with their
+  // neighbors.
+  class FreeList {
+   public:
+    void Reset(uint32_t capacity);
+    std::optional<uint32_t> Allocate(uint32_t count);
+    void Free(uint32_t offset, uint32_t count);
+
+   private:
+    struct Range {
+      uint32_t offset;
+      uint32_t count;
+    };
+    std::vector<Range> ranges_;
+  };
+
+  struct PendingFree {
+    uint64_t frame;
+    GeometryRange range;
+  };
+
+  VkDevice device_;
+  VmaAllocator allocator_;
+  Capacity capacity_;
+
+  AllocatedBuffer vertex_buffer_;
+  AllocatedBuffer index_buffer_;
+  FreeList free_vertices_;
+  FreeList free_indices_;
+  std::vector<PendingFree> pending_frees_;
+};
+
+}  // namespace vk
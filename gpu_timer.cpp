@@ -0,0 +1,83 @@
+#include "gpu_timer.hpp"
+
+#include <iostream>
+
+namespace vk {
+
+bool GpuTimer::Init(VkPhysicalDevice gpu, uint32_t queue_family,
+                    uint32_t frames_in_flight) {
+  pending_.assign(frames_in_flight, false);
+
+  uint32_t count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(gpu, &count, nullptr);
+  std::vector<VkQueueFamilyProperties> families(count);
+  vkGetPhysicalDeviceQueueFamilyProperties(gpu, &count, families.data());
+  const uint32_t valid_bits = families[queue_family].timestampValidBits;
+  if (valid_bits == 0) {
+    return true;
+  }
+  mask_ = valid_bits >= 64 ? ~uint64_t{0} : (uint64_t{1} << valid_bits) - 1;
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(gpu, &properties);
+  period_ = properties.limits.timestampPeriod;
+
+  VkQueryPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  pool_info.pNext = nullptr;
+  pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  pool_info.queryCount = 2 * frames_in_flight;
+
+  if (vkCreateQueryPool(device_, &pool_info, nullptr, &query_pool_) !=
+      VK_SUCCESS) {
+    std::cerr << "Error creating the timestamp query pool.\n";
+    return false;
+  }
+  return true;
+}
+
+void GpuTimer::Begin(VkCommandBuffer cmd, uint32_t frame_index,
+                     VkPipelineStageFlagBits start_stage) {
+  if (query_pool_ == VK_NULL_HANDLE) {
+    return;
+  }
+  vkCmdResetQueryPool(cmd, query_pool_, 2 * frame_index, 2);
+  vkCmdWriteTimestamp(cmd, start_stage, query_pool_, 2 * frame_index);
+}
+
+void GpuTimer::End(VkCommandBuffer cmd, uint32_t frame_index) {
+  if (query_pool_ == VK_NULL_HANDLE) {
+    return;
+  }
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool_,
+                      2 * frame_index + 1);
+  pending_[frame_index] = true;
+}
+
+std::optional<GpuTimer::Interval> GpuTimer::Read(uint32_t frame_index) {
+  if (!pending_[frame_index]) {
+    return std::nullopt;
+  }
+  pending_[frame_index] = false;
+
+  // The frame's fence has signaled, so the results are available; don't wait
+  // if they somehow are not.
+  uint64_t timestamps[2];
+  if (vkGetQueryPoolResults(device_, query_pool_, 2 * frame_index, 2,
+                            sizeof(timestamps), timestamps, sizeof(uint64_t),
+                            VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+    return std::nullopt;
+  }
+  // Compute the end from the elapsed ticks in case the counter wrapped.
+  const uint64_t ticks = (timestamps[1] - timestamps[0]) & mask_;
+  const double begin_ms = static_cast<double>(timestamps[0] & mask_) *
+                          period_ * 1e-6;
+  return Interval{begin_ms, begin_ms + ticks * double{period_} * 1e-6};
+}
+
+void GpuTimer::Release(DeletionQueue& queue) {
+  queue.Push(query_pool_);
+  query_pool_ = VK_NULL_HANDLE;
+}
+
+}  // namespace vk
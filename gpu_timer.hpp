@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "deletion_queue.hpp"
+
+namespace vk {
+
+// Measures how long the GPU spends on each frame with a pair of timestamps
+// around the frame's commands. Results are read back once the frame's fence
+// has signaled, so reading never stalls.
+class GpuTimer {
+ public:
+  // When a frame's work started and ended on the GPU. Timestamps of all
+  // queues of a device share a time base, so intervals measured on
+  // different queues can be compared.
+  struct Interval {
+    double begin_ms;
+    double end_ms;
+
+    float ms() const { return static_cast<float>(end_ms - begin_ms); }
+  };
+
+  explicit GpuTimer(VkDevice device) : device_(device) {}
+
+  // Returns false if the query pool cannot be created. Queues without
+  // timestamp support leave the timer disabled: Read() never returns a value.
+  bool Init(VkPhysicalDevice gpu, uint32_t queue_family,
+            uint32_t frames_in_flight);
+
+  // Resets `frame_index`'s queries and writes the start timestamp. Must be
+  // recorded outside a render pass, before the frame's other commands.
+  //
+  // The timestamp is taken once `start_stage` may run. Frames whose submit
+  // waits on semaphores pass the latest stage waited on, so that time spent
+  // waiting, e.g. for a swapchain image under vsync, is not counted as work.
+  void Begin(VkCommandBuffer cmd, uint32_t frame_index,
+             VkPipelineStageFlagBits start_stage =
+                 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+  // Writes the end timestamp once all of the frame's work has completed.
+  void End(VkCommandBuffer cmd, uint32_t frame_index);
+
+  // GPU interval of the last frame recorded with `frame_index`. Call after
+  // that frame's fence has been waited on.
+  std::optional<Interval> Read(uint32_t frame_index);
+
+  // Hands the query pool to `queue`. Used at shutdown.
+  void Release(DeletionQueue& queue);
+
+ private:
+  VkDevice device_;
+  VkQueryPool query_pool_ = VK_NULL_HANDLE;
+  // Nanoseconds per timestamp tick.
+  float period_ = 0.f;
+  // Only the low bits of a timestamp are valid.
+  uint64_t mask_ = 0;
+  // Whether the frame's queries were written and not read yet.
+  std::vector<bool> pending_;
+};
+
+}  // namespace vk
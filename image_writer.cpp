@@ -0,0 +1,327 @@
+#include "image_writer.hpp"
+
+#include <stb_image_write.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace util {
+
+namespace {
+
+// IEEE half from a float, rounding to nearest. Only needs the range of
+// linearized 8-bit colors, so infinities and NaNs are not handled.
+uint16_t ToHalf(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const uint32_t sign = (bits >> 16) & 0x8000u;
+  const int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = bits & 0x7fffffu;
+  if (exponent <= 0) {
+    // Subnormal or zero.
+    if (exponent < -10) {
+      return static_cast<uint16_t>(sign);
+    }
+    mantissa |= 0x800000u;
+    const uint32_t shift = static_cast<uint32_t>(14 - exponent);
+    return static_cast<uint16_t>(sign |
+                                 ((mantissa + (1u << (shift - 1))) >> shift));
+  }
+  const uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) |
+                        (mantissa >> 13);
+  // Round to nearest; a carry into the exponent is still correct.
+  return static_cast<uint16_t>(half + ((mantissa >> 12) & 1u));
+}
+
+// sRGB to linear for every 8-bit value.
+std::array<uint16_t, 256> MakeLinearTable() {
+  std::array<uint16_t, 256> table;
+  for (int i = 0; i < 256; i++) {
+    const float c = i / 255.f;
+    const float linear = c <= 0.04045f
+                             ? c / 12.92f
+                             : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    table[i] = ToHalf(linear);
+  }
+  return table;
+}
+
+// EXR is little endian, as is every platform this runs on.
+template <typename T>
+void Put(std::vector<char>& out, T value) {
+  const char* bytes = reinterpret_cast<const char*>(&value);
+  out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+void PutString(std::vector<char>& out, const char* value) {
+  out.insert(out.end(), value, value + std::strlen(value) + 1);
+}
+
+void PutAttribute(std::vector<char>& out, const char* name, const char* type,
+                  int32_t size) {
+  PutString(out, name);
+  PutString(out, type);
+  Put(out, size);
+}
+
+// Big endian, as PNG wants.
+void PutBigEndian(std::vector<char>& out, uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out.push_back(static_cast<char>((value >> shift) & 0xff));
+  }
+}
+
+std::array<uint32_t, 256> MakeCrcTable() {
+  std::array<uint32_t, 256> table;
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) {
+      c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+    }
+    table[i] = c;
+  }
+  return table;
+}
+
+uint32_t Crc32(const char* type, const std::vector<char>& data) {
+  static const std::array<uint32_t, 256> kTable = MakeCrcTable();
+  uint32_t crc = 0xffffffffu;
+  auto add = [&](char byte) {
+    crc = kTable[(crc ^ static_cast<uint8_t>(byte)) & 0xff] ^ (crc >> 8);
+  };
+  for (const char* c = type; *c; c++) {
+    add(*c);
+  }
+  for (char byte : data) {
+    add(byte);
+  }
+  return crc ^ 0xffffffffu;
+}
+
+// Largest deflate stored block.
+constexpr size_t kMaxStoredBlock = 65535;
+
+}  // namespace
+
+const char* ImageExtension(ImageFormat format) {
+  switch (format) {
+    case ImageFormat::kPng:
+      return ".png";
+    case ImageFormat::kExr:
+      return ".exr";
+  }
+  return "";
+}
+
+bool WriteImage(const std::string& path, ImageFormat format, uint32_t width,
+                uint32_t height, const uint8_t* pixels) {
+  switch (format) {
+    case ImageFormat::kPng:
+      return stbi_write_png(path.c_str(), static_cast<int>(width),
+                            static_cast<int>(height), 4, pixels,
+                            static_cast<int>(width * 4)) != 0;
+    case ImageFormat::kExr: {
+      ImageStreamWriter writer;
+      return writer.Open(path, format, width, height) &&
+             writer.WriteRows(pixels, height) && writer.Close();
+    }
+  }
+  return false;
+}
+
+bool ImageStreamWriter::Open(const std::string& path, ImageFormat format,
+                             uint32_t width, uint32_t height) {
+  file_.open(path, std::ios::binary);
+  if (!file_) {
+    return false;
+  }
+  format_ = format;
+  width_ = width;
+  height_ = height;
+  rows_written_ = 0;
+
+  std::vector<char> header;
+  if (format == ImageFormat::kPng) {
+    const char kSignature[] = "\x89PNG\r\n\x1a\n";
+    file_.write(kSignature, 8);
+
+    PutBigEndian(header, width);
+    PutBigEndian(header, height);
+    header.push_back(8);  // Bit depth.
+    header.push_back(6);  // RGBA.
+    header.push_back(0);  // Deflate.
+    header.push_back(0);  // Adaptive filtering.
+    header.push_back(0);  // Not interlaced.
+    WriteChunk("IHDR", header);
+
+    // Zlib header for deflate with a 32K window and no preset dictionary.
+    pending_ = {0x78, 0x01};
+    WriteChunk("IDAT", pending_);
+    pending_.clear();
+    adler_a_ = 1;
+    adler_b_ = 0;
+    return static_cast<bool>(file_);
+  }
+
+  // Single part scanline EXR, one uncompressed line per block, half RGBA.
+  // Channels are stored in alphabetical order.
+  constexpr const char* kChannels[] = {"A", "B", "G", "R"};
+  constexpr int32_t kHalf = 1;
+
+  Put(header, uint32_t{20000630});  // Magic number.
+  Put(header, uint32_t{2});         // Version, scanline.
+
+  PutAttribute(header, "channels", "chlist", 4 * 18 + 1);
+  for (const char* channel : kChannels) {
+    PutString(header, channel);
+    Put(header, kHalf);
+    Put(header, uint32_t{0});  // pLinear and reserved.
+    Put(header, int32_t{1});   // x sampling.
+    Put(header, int32_t{1});   // y sampling.
+  }
+  header.push_back(0);
+
+  PutAttribute(header, "compression", "compression", 1);
+  header.push_back(0);  // None.
+
+  const int32_t window[] = {0, 0, static_cast<int32_t>(width) - 1,
+                            static_cast<int32_t>(height) - 1};
+  for (const char* name : {"dataWindow", "displayWindow"}) {
+    PutAttribute(header, name, "box2i", 16);
+    for (int32_t value : window) {
+      Put(header, value);
+    }
+  }
+
+  PutAttribute(header, "lineOrder", "lineOrder", 1);
+  header.push_back(0);  // Increasing y.
+  PutAttribute(header, "pixelAspectRatio", "float", 4);
+  Put(header, 1.f);
+  PutAttribute(header, "screenWindowCenter", "v2f", 8);
+  Put(header, 0.f);
+  Put(header, 0.f);
+  PutAttribute(header, "screenWindowWidth", "float", 4);
+  Put(header, 1.f);
+  header.push_back(0);  // End of header.
+
+  // Every block has the same size, so the offset table can be written
+  // before any of them.
+  const uint64_t line_size = uint64_t{width} * 4 * sizeof(uint16_t);
+  const uint64_t block_size = 2 * sizeof(int32_t) + line_size;
+  uint64_t offset = header.size() + uint64_t{height} * sizeof(uint64_t);
+  for (uint32_t y = 0; y < height; y++) {
+    Put(header, offset);
+    offset += block_size;
+  }
+  file_.write(header.data(), header.size());
+  return static_cast<bool>(file_);
+}
+
+bool ImageStreamWriter::WriteRows(const uint8_t* pixels, uint32_t count) {
+  if (!file_.is_open() || rows_written_ + count > height_) {
+    return false;
+  }
+  for (uint32_t y = 0; y < count; y++) {
+    const uint8_t* row = pixels + size_t{y} * width_ * 4;
+    if (format_ == ImageFormat::kPng) {
+      WritePngRow(row);
+    } else {
+      WriteExrRow(row);
+    }
+    rows_written_++;
+  }
+  return static_cast<bool>(file_);
+}
+
+bool ImageStreamWriter::Close() {
+  if (!file_.is_open()) {
+    return false;
+  }
+  const bool complete = rows_written_ == height_;
+  if (complete && format_ == ImageFormat::kPng) {
+    WritePngBlock(true);
+    std::vector<char> adler;
+    PutBigEndian(adler, (adler_b_ << 16) | adler_a_);
+    WriteChunk("IDAT", adler);
+    WriteChunk("IEND", {});
+  }
+  const bool written = static_cast<bool>(file_);
+  file_.close();
+  return complete && written;
+}
+
+void ImageStreamWriter::WriteExrRow(const uint8_t* row) {
+  static const std::array<uint16_t, 256> kLinear = MakeLinearTable();
+  // Components in the order of the channels, see Open().
+  constexpr int kComponents[] = {3, 2, 1, 0};
+  const uint32_t line_size = width_ * 4 * sizeof(uint16_t);
+
+  std::vector<char> block;
+  block.reserve(2 * sizeof(int32_t) + line_size);
+  Put(block, static_cast<int32_t>(rows_written_));
+  Put(block, static_cast<int32_t>(line_size));
+  for (int component : kComponents) {
+    for (uint32_t x = 0; x < width_; x++) {
+      const uint8_t value = row[x * 4 + component];
+      // Alpha is linear already.
+      Put(block, component == 3 ? ToHalf(value / 255.f) : kLinear[value]);
+    }
+  }
+  file_.write(block.data(), block.size());
+}
+
+void ImageStreamWriter::WritePngRow(const uint8_t* row) {
+  // Each row starts with its filter type, none here.
+  pending_.push_back(0);
+  pending_.insert(pending_.end(), row, row + size_t{width_} * 4);
+
+  // Adler-32 over the row, with the sums reduced often enough not to
+  // overflow.
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(pending_.data()) +
+                         pending_.size() - (size_t{width_} * 4 + 1);
+  size_t left = size_t{width_} * 4 + 1;
+  while (left > 0) {
+    const size_t run = std::min<size_t>(left, 5552);
+    for (size_t i = 0; i < run; i++) {
+      adler_a_ += bytes[i];
+      adler_b_ += adler_a_;
+    }
+    adler_a_ %= 65521;
+    adler_b_ %= 65521;
+    bytes += run;
+    left -= run;
+  }
+
+  while (pending_.size() >= kMaxStoredBlock) {
+    WritePngBlock(false);
+  }
+}
+
+void ImageStreamWriter::WritePngBlock(bool last) {
+  const size_t size = std::min(pending_.size(), kMaxStoredBlock);
+  std::vector<char> block;
+  block.reserve(size + 5);
+  block.push_back(last ? 1 : 0);  // BFINAL, stored.
+  Put(block, static_cast<uint16_t>(size));
+  Put(block, static_cast<uint16_t>(~size));
+  block.insert(block.end(), pending_.begin(), pending_.begin() + size);
+  WriteChunk("IDAT", block);
+  pending_.erase(pending_.begin(), pending_.begin() + size);
+}
+
+void ImageStreamWriter::WriteChunk(const char* type,
+                                   const std::vector<char>& data) {
+  std::vector<char> chunk;
+  chunk.reserve(data.size() + 12);
+  PutBigEndian(chunk, static_cast<uint32_t>(data.size()));
+  chunk.insert(chunk.end(), type, type + 4);
+  chunk.insert(chunk.end(), data.begin(), data.end());
+  PutBigEndian(chunk, Crc32(type, data));
+  file_.write(chunk.data(), chunk.size());
+}
+
+}  // namespace util
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace util {
+
+enum class ImageFormat { kPng, kExr };
+
+// File extension of `format`, including the dot.
+const char* ImageExtension(ImageFormat format);
+
+// Writes `width` x `height` RGBA8 pixels, rows tightly packed top to bottom
+// and in sRGB, to `path`. EXR files hold the pixels converted to linear half
+// floats, uncompressed. Thread-safe.
+bool WriteImage(const std::string& path, ImageFormat format, uint32_t width,
+                uint32_t height, const uint8_t* pixels);
+
+// Writes an image a band of rows at a time, top to bottom, so that only the
+// band has to be in memory, e.g. for images larger than RAM. Same pixels and
+// EXR encoding as WriteImage(); PNGs are stored uncompressed since deflate
+// would need the whole image to do well.
+class ImageStreamWriter {
+ public:
+  ImageStreamWriter() = default;
+
+  ImageStreamWriter(const ImageStreamWriter&) = delete;
+  ImageStreamWriter& operator=(const ImageStreamWriter&) = delete;
+
+  // Creates the file and writes the header.
+  bool Open(const std::string& path, ImageFormat format, uint32_t width,
+            uint32_t height);
+  // The next `count` rows.
+  bool WriteRows(const uint8_t* pixels, uint32_t count);
+  // Ends the file. Fails unless every row has been written.
+  bool Close();
+
+  uint32_t rows_written() const { return rows_written_; }
+
+ private:
+  void WriteExrRow(const uint8_t* row);
+  void WritePngRow(const uint8_t* row);
+  void WritePngBlock(bool last);
+  void WriteChunk(const char* type, const std::vector<char>& data);
+
+  std::ofstream file_;
+  ImageFormat format_ = ImageFormat::kPng;
+  uint32_t width_ = 0;
+  uint32_t height_ = 0;
+  uint32_t rows_written_ = 0;
+
+  // Deflate input not yet written out as a stored block, and the running
+  // Adler-32 of the whole input.
+  std::vector<char> pending_;
+  uint32_t adler_a_ = 1;
+  uint32_t adler_b_ = 0;
+};
+
+}  // namespace util
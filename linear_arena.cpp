@@ -0,0 +1,112 @@
+#include "linear_arena.hpp"
+
+#include <algorithm>
+
+namespace util {
+
+LinearArena::LinearArena(size_t capacity) {
+  if (capacity > 0) {
+    block_ = AllocateBlock(capacity);
+    capacity_ = capacity;
+  }
+}
+
+LinearArena::~LinearArena() { Release(); }
+
+LinearArena::LinearArena(LinearArena&& other) noexcept
+    : block_{other.block_},
+      capacity_{other.capacity_},
+      offset_{other.offset_},
+      overflow_bytes_{other.overflow_bytes_},
+      high_water_{other.high_water_},
+      overflow_{std::move(other.overflow_)} {
+  other.block_ = nullptr;
+  other.capacity_ = 0;
+  other.offset_ = 0;
+  other.overflow_bytes_ = 0;
+}
+
+LinearArena& LinearArena::operator=(LinearArena&& other) noexcept {
+  if (this != &other) {
+    Release();
+    block_ = other.block_;
+    capacity_ = other.capacity_;
+    offset_ = other.offset_;
+    overflow_bytes_ = other.overflow_bytes_;
+    high_water_ = other.high_water_;
+    overflow_ = std::move(other.overflow_);
+
+    other.block_ = nullptr;
+    other.capacity_ = 0;
+    other.offset_ = 0;
+    other.overflow_bytes_ = 0;
+  }
+  return *this;
+}
+
+void* LinearArena::Allocate(size_t size, size_t alignment) {
+  assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+  assert(alignment <= kBlockAlignment);
+
+  const size_t aligned_offset = (offset_ + alignment - 1) & ~(alignment - 1);
+  if (aligned_offset + size <= capacity_) {
+    offset_ = aligned_offset + size;
+    high_water_ = std::max(high_water_, used());
+    return block_ + aligned_offset;
+  }
+
+  // Out of space for this frame. Fall back to the heap and remember how much
+  // was needed so the next Reset() can size the block to fit.
+  std::byte* block = AllocateBlock(size);
+  overflow_.push_back(block);
+  overflow_bytes_ += size + alignment;
+  high_water_ = std::max(high_water_, used());
+  return block;
+}
+
+void LinearArena::Reset() {
+  for (void* block : overflow_) {
+    FreeBlock(block);
+  }
+  overflow_.clear();
+
+  if (high_water_ > capacity_) {
+    // Leave some headroom so a slowly growing workload does not reallocate
+    // every frame.
+    const size_t capacity = high_water_ + high_water_ / 4;
+    if (block_) {
+      FreeBlock(block_);
+    }
+    block_ = AllocateBlock(capacity);
+    capacity_ = capacity;
+  }
+
+  offset_ = 0;
+  overflow_bytes_ = 0;
+}
+
+std::byte* LinearArena::AllocateBlock(size_t size) {
+  return static_cast<std::byte*>(
+      ::operator new(size, std::align_val_t{kBlockAlignment}));
+}
+
+void LinearArena::FreeBlock(void* block) {
+  ::operator delete(block, std::align_val_t{kBlockAlignment});
+}
+
+void LinearArena::Release() {
+  for (void* block : overflow_) {
+    FreeBlock(block);
+  }
+  overflow_.clear();
+
+  if (block_) {
+    FreeBlock(block_);
+    block_ = nullptr;
+  }
+  capacity_ = 0;
+  offset_ = 0;
+  overflow_bytes_ = 0;
+}
+
+}  // namespace util
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace util {
+
+// Bump allocator for short-lived CPU data such as per-frame draw lists and
+// culling results. Allocation is a pointer increment and Reset() releases
+// everything at once. Destructors are never run, so only trivially
+// destructible types should be placed in the arena.
+//
+// If a frame needs more than the arena's capacity, the excess is served from
+// the heap and the arena grows to the high-water mark on the next Reset(), so
+// steady-state frames do not touch the general heap at all.
+//
+// Not thread-safe. Each thread producing frame data needs its own arena.
+class LinearArena {
+ public:
+  explicit LinearArena(size_t capacity = 0);
+  ~LinearArena();
+
+  LinearArena(LinearArena&& other) noexcept;
+  LinearArena& operator=(LinearArena&& other) noexcept;
+
+  LinearArena(const LinearArena&) = delete;
+  LinearArena& operator=(const LinearArena&) = delete;
+
+  void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+  // Uninitialized storage for `count` objects of type T.
+  template <typename T>
+  T* AllocateArray(size_t count) {
+    static_assert(std::is_trivially_destructible_v<T>,
+                  "Arena memory is released without running destructors");
+    return static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+  }
+
+  // Releases every allocation made since the last reset.
+  void Reset();
+
+  size_t used() const { return offset_ + overflow_bytes_; }
+  size_t capacity() const { return capacity_; }
+  size_t high_water() const { return high_water_; }
+
+ private:
+  // Every block is aligned to this, which bounds the supported alignment.
+  constexpr static size_t kBlockAlignment = 64;
+
+  static std::byte* AllocateBlock(size_t size);
+  static void FreeBlock(void* block);
+
+  void Release();
+
+  std::byte* block_ = nullptr;
+  size_t capacity_ = 0;
+  size_t offset_ = 0;
+
+  // Bytes served from the heap since the last reset.
+  size_t overflow_bytes_ = 0;
+  size_t high_water_ = 0;
+
+  std::vector<void*> overflow_;
+};
+
+// Non-owning view of a contiguous array.
+template <typename T>
+class Span {
+ public:
+  Span() = default;
+  Span(T* data, size_t size) : data_(data), size_(size) {}
+
+  T* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  T* begin() const { return data_; }
+  T* end() const { return data_ + size_; }
+
+  T& operator[](size_t i) const {
+    assert(i < size_);
+    return data_[i];
+  }
+
+ private:
+  T* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Appends up to a fixed number of elements into arena storage and hands them
+// out as a Span. Useful when an upper bound is known, e.g. visible objects
+// can never exceed the number of renderables.
+template <typename T>
+class SpanBuilder {
+ public:
+  SpanBuilder(LinearArena& arena, size_t max_size)
+      : data_(arena.AllocateArray<T>(max_size)), capacity_(max_size) {}
+
+  void push_back(const T& value) {
+    assert(size_ < capacity_);
+    data_[size_++] = value;
+  }
+
+  template <typename... Args>
+  T& emplace_back(Args&&... args) {
+    assert(size_ < capacity_);
+    return *new (&data_[size_++]) T{std::forward<Args>(args)...};
+  }
+
+  size_t size() const { return size_; }
+  bool full() const { return size_ == capacity_; }
+
+  Span<T> Build() const { return Span<T>(data_, size_); }
+
+ private:
+  T* data_;
+  size_t size_ = 0;
+  size_t capacity_;
+};
+
+// Vector with room for N elements inline that spills into an arena when it
+// outgrows them. Elements must be trivially copyable since growth is a
+// memcpy and nothing is destroyed.
+template <typename T, size_t N>
+class SmallVector {
+ public:
+  static_assert(N > 0, "Use an ArenaVector when no inline storage is needed");
+  static_assert(std::is_trivially_copyable_v<T> &&
+                    std::is_trivially_destructible_v<T>,
+                "SmallVector elements are moved with memcpy");
+
+  explicit SmallVector(LinearArena& arena) : arena_(&arena) {}
+
+  SmallVector(const SmallVector&) = delete;
+  SmallVector& operator=(const SmallVector&) = delete;
+
+  void push_back(const T& value) {
+    if (size_ == capacity_) {
+      Grow(capacity_ * 2);
+    }
+    data_[size_++] = value;
+  }
+
+  void reserve(size_t capacity) {
+    if (capacity > capacity_) {
+      Grow(capacity);
+    }
+  }
+
+  void clear() { size_ = 0; }
+
+  T* data() { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  T* begin() { return data_; }
+  T* end() { return data_ + size_; }
+
+  T& operator[](size_t i) {
+    assert(i < size_);
+    return data_[i];
+  }
+
+  Span<T> span() { return Span<T>(data_, size_); }
+
+ private:
+  void Grow(size_t capacity) {
+    T* data = arena_->AllocateArray<T>(capacity);
+    memcpy(data, data_, size_ * sizeof(T));
+    data_ = data;
+    capacity_ = capacity;
+  }
+
+  LinearArena* arena_;
+  alignas(T) std::byte inline_storage_[N * sizeof(T)];
+  T* data_ = reinterpret_cast<T*>(inline_storage_);
+  size_t size_ = 0;
+  size_t capacity_ = N;
+};
+
+// Standard allocator adapter so that std containers can live in an arena.
+// Deallocation is a no-op.
+template <typename T>
+class ArenaAllocator {
+ public:
+  using value_type = T;
+
+  explicit ArenaAllocator(LinearArena& arena) : arena_(&arena) {}
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena()) {}
+
+  T* allocate(size_t count) {
+    return static_cast<T*>(arena_->Allocate(sizeof(T) * count, alignof(T)));
+  }
+  void deallocate(T*, size_t) {}
+
+  LinearArena* arena() const { return arena_; }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U>& other) const {
+    return arena_ == other.arena();
+  }
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U>& other) const {
+    return arena_ != other.arena();
+  }
+
+ private:
+  LinearArena* arena_;
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+}  // namespace util
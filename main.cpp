@@ -3,9 +3,15 @@
 #include <SDL_vulkan.h>
 
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <optional>
+#include <string>
 #include <vector>
 
+#include "batch_render.hpp"
+#include "render_thread.hpp"
 #include "renderer.hpp"
 
 constexpr int kWindowWidth = 1700;
@@ -14,9 +20,16 @@ constexpr int kWindowHeight = 900;
 vk::Renderer renderer;
 
 void MainLoop() {
+  // This thread runs the simulation and publishes a snapshot of the scene
+  // every step; the render thread records and submits frames from them
+  // meanwhile.
+  vk::RenderThread render_thread(renderer);
+  const vk::SceneSnapshot initial_scene = renderer.CaptureScene();
+  render_thread.Start();
+
   SDL_Event e;
   bool quit = false;
-  while (!quit) {
+  for (uint64_t step = 0; !quit; step++) {
     Uint64 start = SDL_GetPerformanceCounter();
 
     while (SDL_PollEvent(&e) != 0) {
@@ -24,19 +37,62 @@ void MainLoop() {
         quit = true;
       }
     }
-    renderer.Draw();
+
+    // Nothing moves yet, so no objects are published and they keep the
+    // state given by the renderer's scene changes.
+    vk::SceneSnapshot& scene = render_thread.snapshot();
+    scene.step = step;
+    scene.objects.clear();
+    scene.transforms.clear();
+    scene.is_static.clear();
+    scene.cameras = initial_scene.cameras;
+    scene.lights = initial_scene.lights;
+    render_thread.Publish();
 
     Uint64 end = SDL_GetPerformanceCounter();
 
-    // Hacky method of controlling rendering time by capping at 60FPS.
+    // Hacky method of controlling the simulation rate by capping at 60
+    // steps per second, which also paces the render thread.
     float elapsed_millisecs =
         (end - start) /
         static_cast<float>(SDL_GetPerformanceFrequency() * 1000.f);
     SDL_Delay(std::floor(16.666f - elapsed_millisecs));
   }
+
+  render_thread.Stop();
+}
+
+// Renders the views of a job file offscreen, see BatchJob.
+int RunBatch(const char *job_path) {
+  std::optional<vk::BatchJob> job = vk::LoadBatchJob(job_path);
+  if (!job.has_value()) {
+    return -1;
+  }
+  std::optional<vk::BatchStats> stats = vk::RunBatchJob(job.value());
+  if (!stats.has_value()) {
+    return -1;
+  }
+  std::cout << stats->images << " images in " << stats->seconds << " s, "
+            << stats->images_per_second() << " images/s.\n";
+  return stats->failed == 0 ? 0 : -1;
 }
 
 int main(int argc, char *argv[]) {
+  if (argc == 3 && std::strcmp(argv[1], "--batch") == 0) {
+    return RunBatch(argv[2]);
+  }
+
+  // Remembering pipelines across sessions is opt-in, since it writes the
+  // file on exit.
+  std::string pipeline_manifest;
+  if (argc == 3 && std::strcmp(argv[1], "--pipeline-manifest") == 0) {
+    pipeline_manifest = argv[2];
+  } else if (argc != 1) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--batch <job> | --pipeline-manifest <path>]\n";
+    return -1;
+  }
+
   // Initialize SDL2
   SDL_Init(SDL_INIT_VIDEO);
 
@@ -67,6 +123,12 @@ int main(int argc, char *argv[]) {
   renderer_params.application_name = "Vulkan Renderer";
   renderer_params.extensions = std::move(extensions);
   renderer_params.window_handle = window_info.info.win.window;
+  renderer_params.dynamic_resolution = vk::DynamicResolution::Settings{};
+  renderer_params.quality_governor = vk::QualityGovernor::Settings{};
+  renderer_params.async_compute = true;
+  renderer_params.post_process = vk::PostProcess::Settings{};
+  renderer_params.geometry_arena = vk::GeometryArena::Capacity{};
+  renderer_params.pipeline_manifest = pipeline_manifest;
 
   if (!renderer.Init(renderer_params)) {
     renderer.Shutdown();
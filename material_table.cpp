@@ -0,0 +1,76 @@
+#include "material_table.hpp"
+
+#include <cstring>
+
+namespace vk {
+
+namespace {
+
+MaterialTable::GpuMaterial ToGpu(const MaterialParams& params) {
+  MaterialTable::GpuMaterial material;
+  material.base_color = params.base_color;
+  material.emissive = glm::vec4(params.emissive, 0.f);
+  material.features = glm::uvec4(params.features, 0u, 0u, 0u);
+  return material;
+}
+
+}  // namespace
+
+bool MaterialTable::Init(uint32_t frames_in_flight) {
+  frames_.resize(frames_in_flight);
+  for (FrameTable& frame : frames_) {
+    frame.buffer = CreateBuffer(allocator_, size(),
+                                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                VMA_MEMORY_USAGE_CPU_TO_GPU);
+  }
+  materials_.reserve(kMaxMaterials);
+  return true;
+}
+
+std::optional<uint32_t> MaterialTable::Add(const MaterialParams& params) {
+  uint32_t index;
+  if (!free_slots_.empty()) {
+    index = free_slots_.back();
+    free_slots_.pop_back();
+  } else if (materials_.size() < kMaxMaterials) {
+    index = static_cast<uint32_t>(materials_.size());
+    materials_.emplace_back();
+  } else {
+    return std::nullopt;
+  }
+  Set(index, params);
+  return index;
+}
+
+void MaterialTable::Set(uint32_t index, const MaterialParams& params) {
+  materials_[index] = ToGpu(params);
+  version_++;
+}
+
+void MaterialTable::Remove(uint32_t index) {
+  // Frames in flight keep their own copy, so the slot is free right away.
+  free_slots_.push_back(index);
+}
+
+void MaterialTable::Upload(uint32_t frame_index) {
+  FrameTable& frame = frames_[frame_index];
+  if (frame.version == version_) {
+    return;
+  }
+
+  void* data;
+  vmaMapMemory(allocator_, frame.buffer.allocation, &data);
+  std::memcpy(data, materials_.data(),
+              materials_.size() * sizeof(GpuMaterial));
+  vmaUnmapMemory(allocator_, frame.buffer.allocation);
+  frame.version = version_;
+}
+
+void MaterialTable::Release(DeletionQueue& queue) {
+  for (FrameTable& frame : frames_) {
+    queue.Push(frame.buffer.buffer, frame.buffer.allocation);
+  }
+  frames_.clear();
+}
+
+}  // namespace vk
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <optional>
+#include <vector>
+
+#include "buffer.hpp"
+#include "deletion_queue.hpp"
+
+namespace vk {
+
+// Shader features a material can toggle. Every combination is a pipeline
+// variant of the mesh shaders, built with the bits as specialization
+// constants so that disabled features cost nothing.
+enum MaterialFeature : uint32_t {
+  // Skip lighting and shadows; the surface shows its color as is.
+  kMaterialUnlit = 1u << 0,
+  // Multiply the base color by the vertex colors.
+  kMaterialVertexColor = 1u << 1,
+};
+constexpr uint32_t kMaterialFeatureCount = 2;
+constexpr uint32_t kMaterialVariantCount = 1u << kMaterialFeatureCount;
+
+struct MaterialParams {
+  glm::vec4 base_color = {1.f, 1.f, 1.f, 1.f};
+  // Added after lighting.
+  glm::vec3 emissive = {0.f, 0.f, 0.f};
+  // MaterialFeature bits.
+  uint32_t features = kMaterialVertexColor;
+};
+
+// The parameters of every material instance in one GPU buffer, indexed per
+// object, so instances differing only in parameters share pipelines and
+// descriptors and draw in one batch.
+//
+// The table is edited on the CPU and copied to a buffer per frame in flight
+// when it changed since that frame last used it, so edits never touch a
+// buffer the GPU may be reading and slots can be reused right away.
+class MaterialTable {
+ public:
+  constexpr static uint32_t kMaxMaterials = 4096;
+
+  // Matches MaterialData in the shaders.
+  struct GpuMaterial {
+    glm::vec4 base_color;
+    glm::vec4 emissive;
+    // x: MaterialFeature bits.
+    glm::uvec4 features;
+  };
+
+  explicit MaterialTable(VmaAllocator allocator) : allocator_(allocator) {}
+
+  bool Init(uint32_t frames_in_flight);
+
+  // The slot of a new instance, none if the table is full.
+  std::optional<uint32_t> Add(const MaterialParams& params);
+  void Set(uint32_t index, const MaterialParams& params);
+  void Remove(uint32_t index);
+
+  // Brings `frame_index`'s buffer up to date. Only call once the frame's
+  // previous use of it has completed.
+  void Upload(uint32_t frame_index);
+
+  VkBuffer buffer(uint32_t frame_index) const {
+    return frames_[frame_index].buffer.buffer;
+  }
+  constexpr static VkDeviceSize size() {
+    return sizeof(GpuMaterial) * kMaxMaterials;
+  }
+
+  // Hands every resource to `queue`. Used at shutdown.
+  void Release(DeletionQueue& queue);
+
+ private:
+  struct FrameTable {
+    AllocatedBuffer buffer;
+    // version_ when last uploaded.
+    uint64_t version = 0;
+  };
+
+  VmaAllocator allocator_;
+
+  std::vector<GpuMaterial> materials_;
+  std::vector<uint32_t> free_slots_;
+  // Bumped by every edit. Starts ahead of the frames so the first upload
+  // happens.
+  uint64_t version_ = 1;
+
+  std::vector<FrameTable> frames_;
+};
+
+}  // namespace vk
@@ -0,0 +1,58 @@
+#include "pipeline_manifest.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace vk {
+
+bool PipelineManifest::Load(const std::string& path) {
+  std::ifstream file(path);
+  if (!file) {
+    return true;
+  }
+
+  std::string text;
+  for (int line_number = 1; std::getline(file, text); line_number++) {
+    text = text.substr(0, text.find('#'));
+    std::istringstream line(text);
+    std::string key;
+    if (!(line >> key)) {
+      continue;
+    }
+
+    bool valid = true;
+    if (key == "material") {
+      uint32_t features;
+      valid = static_cast<bool>(line >> features);
+      if (valid) {
+        materials_.insert(features);
+      }
+    } else {
+      valid = false;
+    }
+
+    if (!valid) {
+      std::cerr << path << ":" << line_number << ": invalid line: " << text
+                << "\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool PipelineManifest::Save(const std::string& path) const {
+  std::ofstream file(path, std::ios::trunc);
+  if (!file) {
+    std::cerr << "Unable to write the pipeline manifest " << path << ".\n";
+    return false;
+  }
+
+  file << "# Pipelines used in the last session, built at startup.\n";
+  for (uint32_t features : materials_) {
+    file << "material " << features << "\n";
+  }
+  return static_cast<bool>(file);
+}
+
+}  // namespace vk
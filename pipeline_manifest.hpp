@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <set>
+#include <string>
+
+namespace vk {
+
+// The pipelines a session needed beyond the ones every session builds, so
+// that the next launch can build them all up front, in parallel, instead of
+// stalling a frame on first use.
+//
+// Saved as text, one pipeline per line:
+//
+//   material <MaterialFeature bits>
+//
+// Keys only name what varies between pipelines, never the render pass or
+// formats, so a manifest stays valid when those change.
+class PipelineManifest {
+ public:
+  // A missing file is an empty manifest, as on a first launch. Fails on
+  // malformed files.
+  bool Load(const std::string& path);
+  bool Save(const std::string& path) const;
+
+  // Whether the key was new.
+  bool RecordMaterial(uint32_t features) {
+    return materials_.insert(features).second;
+  }
+  const std::set<uint32_t>& materials() const { return materials_; }
+
+ private:
+  std::set<uint32_t> materials_;
+};
+
+}  // namespace vk
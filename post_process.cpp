@@ -0,0 +1,323 @@
+#include "post_process.hpp"
+
+#include <cstring>
+#include <iostream>
+
+#include "barrier_batch.hpp"
+#include "buffer.hpp"
+#include "defer.hpp"
+#include "shader.hpp"
+#include "vk_init.hpp"
+
+namespace vk {
+
+bool PostProcess::Init(VkDescriptorPool pool, QueueSubmitter& queue_submitter,
+                       uint32_t frames_in_flight, Settings settings) {
+  settings_ = std::move(settings);
+
+  VkSamplerCreateInfo sampler_info = {};
+  sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  sampler_info.pNext = nullptr;
+  sampler_info.magFilter = VK_FILTER_LINEAR;
+  sampler_info.minFilter = VK_FILTER_LINEAR;
+  sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.maxLod = 0.f;
+
+  if (vkCreateSampler(device_, &sampler_info, nullptr, &sampler_) !=
+      VK_SUCCESS) {
+    std::cerr << "Error creating the post-processing sampler.\n";
+    return false;
+  }
+
+  VkDescriptorSetLayoutBinding bindings[] = {
+      init::DescriptorSetLayoutBinding(
+          VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          VK_SHADER_STAGE_COMPUTE_BIT, 0),
+      init::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                                       VK_SHADER_STAGE_COMPUTE_BIT, 1),
+      init::DescriptorSetLayoutBinding(
+          VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          VK_SHADER_STAGE_COMPUTE_BIT, 2),
+  };
+
+  VkDescriptorSetLayoutCreateInfo set_layout_info = {};
+  set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  set_layout_info.pNext = nullptr;
+  set_layout_info.flags = 0;
+  set_layout_info.bindingCount = 3;
+  set_layout_info.pBindings = bindings;
+
+  if (vkCreateDescriptorSetLayout(device_, &set_layout_info, nullptr,
+                                  &set_layout_) != VK_SUCCESS) {
+    std::cerr << "Error creating the post-processing set layout.\n";
+    return false;
+  }
+
+  if (!InitLut(queue_submitter)) {
+    return false;
+  }
+
+  VkDescriptorImageInfo lut_info = {};
+  lut_info.sampler = sampler_;
+  lut_info.imageView = lut_view_;
+  lut_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+  frames_.resize(frames_in_flight);
+  for (FramePost& frame : frames_) {
+    frame = {};
+
+    VkDescriptorSetAllocateInfo allocate_info = {};
+    allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocate_info.pNext = nullptr;
+    allocate_info.descriptorPool = pool;
+    allocate_info.descriptorSetCount = 1;
+    allocate_info.pSetLayouts = &set_layout_;
+
+    if (vkAllocateDescriptorSets(device_, &allocate_info, &frame.descriptor) !=
+        VK_SUCCESS) {
+      std::cerr << "Error allocating a post-processing descriptor set.\n";
+      return false;
+    }
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.pNext = nullptr;
+    write.dstSet = frame.descriptor;
+    write.dstBinding = 2;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &lut_info;
+    vkUpdateDescriptorSets(device_, 1, &write, 0, nullptr);
+  }
+
+  return InitPipeline();
+}
+
+bool PostProcess::InitLut(QueueSubmitter& queue_submitter) {
+  constexpr uint32_t kTexelCount = kLutSize * kLutSize * kLutSize;
+
+  std::vector<uint32_t> identity;
+  const std::vector<uint32_t>* lut = &settings_.lut;
+  if (lut->size() != kTexelCount) {
+    if (!lut->empty()) {
+      std::cerr << "Color grading LUT has the wrong size, it is ignored.\n";
+    }
+    identity.resize(kTexelCount);
+    for (uint32_t b = 0; b < kLutSize; b++) {
+      for (uint32_t g = 0; g < kLutSize; g++) {
+        for (uint32_t r = 0; r < kLutSize; r++) {
+          const uint32_t scale = kLutSize - 1;
+          identity[(b * kLutSize + g) * kLutSize + r] =
+              (r * 255 / scale) | (g * 255 / scale) << 8 |
+              (b * 255 / scale) << 16 | 0xff000000u;
+        }
+      }
+    }
+    lut = &identity;
+  }
+  // The LUT lives on the GPU from here on.
+  settings_.lut.clear();
+  settings_.lut.shrink_to_fit();
+
+  const size_t lut_size = sizeof(uint32_t) * kTexelCount;
+  AllocatedBuffer staging_buffer =
+      CreateBuffer(allocator_, lut_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                   VMA_MEMORY_USAGE_CPU_ONLY);
+  DEFER([&]() {
+    vmaDestroyBuffer(allocator_, staging_buffer.buffer,
+                     staging_buffer.allocation);
+  });
+
+  void* data;
+  vmaMapMemory(allocator_, staging_buffer.allocation, &data);
+  memcpy(data, lut->data(), lut_size);
+  vmaUnmapMemory(allocator_, staging_buffer.allocation);
+
+  VkImageCreateInfo image_info = init::ImageCreateInfo(
+      VK_FORMAT_R8G8B8A8_UNORM,
+      VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+      {kLutSize, kLutSize, kLutSize});
+  image_info.imageType = VK_IMAGE_TYPE_3D;
+
+  VmaAllocationCreateInfo allocation_info = {};
+  allocation_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+  if (vmaCreateImage(allocator_, &image_info, &allocation_info,
+                     &lut_image_.image, &lut_image_.allocation,
+                     nullptr) != VK_SUCCESS) {
+    std::cerr << "Error creating the color grading LUT.\n";
+    return false;
+  }
+
+  queue_submitter.SubmitImmediate([&](VkCommandBuffer cmd) {
+    const VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0,
+                                           1};
+    BarrierBatch barriers;
+    barriers.Image(lut_image_.image, range,
+                   {VK_IMAGE_LAYOUT_UNDEFINED,
+                    VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0},
+                   {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_ACCESS_TRANSFER_WRITE_BIT});
+    barriers.Flush(cmd);
+
+    VkBufferImageCopy copy_region = {};
+    copy_region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    copy_region.imageExtent = image_info.extent;
+    vkCmdCopyBufferToImage(cmd, staging_buffer.buffer, lut_image_.image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                           &copy_region);
+
+    barriers.Image(lut_image_.image, range,
+                   {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_ACCESS_TRANSFER_WRITE_BIT},
+                   {VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT});
+    barriers.Flush(cmd);
+  });
+
+  VkImageViewCreateInfo view_info = init::ImageViewCreateInfo(
+      VK_FORMAT_R8G8B8A8_UNORM, lut_image_.image, VK_IMAGE_ASPECT_COLOR_BIT);
+  view_info.viewType = VK_IMAGE_VIEW_TYPE_3D;
+
+  if (vkCreateImageView(device_, &view_info, nullptr, &lut_view_) !=
+      VK_SUCCESS) {
+    std::cerr << "Error creating the color grading LUT view.\n";
+    return false;
+  }
+  return true;
+}
+
+bool PostProcess::InitPipeline() {
+  VkPushConstantRange push_constant;
+  push_constant.offset = 0;
+  push_constant.size = sizeof(PostConstants);
+  push_constant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkPipelineLayoutCreateInfo layout_info = init::PipelineLayoutCreateInfo();
+  layout_info.setLayoutCount = 1;
+  layout_info.pSetLayouts = &set_layout_;
+  layout_info.pushConstantRangeCount = 1;
+  layout_info.pPushConstantRanges = &push_constant;
+
+  if (vkCreatePipelineLayout(device_, &layout_info, nullptr,
+                             &pipeline_layout_) != VK_SUCCESS) {
+    std::cerr << "Error creating the post-processing pipeline layout.\n";
+    return false;
+  }
+
+  VkShaderModule shader;
+  if (!LoadShader(device_, "shaders/post_process.comp.spv", &shader)) {
+    std::cerr << "Unable to load file: post_process.comp.spv" << std::endl;
+    return false;
+  }
+  DEFER([&]() { vkDestroyShaderModule(device_, shader, nullptr); });
+
+  VkComputePipelineCreateInfo pipeline_info = {};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipeline_info.pNext = nullptr;
+  pipeline_info.stage = init::PipelineShaderStageCreateInfo(
+      VK_SHADER_STAGE_COMPUTE_BIT, shader);
+  pipeline_info.layout = pipeline_layout_;
+
+  if (vkCreateComputePipelines(device_, VK_NULL_HANDLE, 1, &pipeline_info,
+                               nullptr, &pipeline_) != VK_SUCCESS) {
+    std::cerr << "Error creating the post-processing pipeline.\n";
+    return false;
+  }
+  return true;
+}
+
+GraphImage PostProcess::AddPass(RenderGraph& graph, uint32_t frame_index,
+                                GraphImage scene, VkExtent2D size,
+                                uint32_t layers, VkExtent2D extent) {
+  // Sized like the scene rather than the extent so that changing the
+  // resolution does not reallocate it.
+  GraphImage output =
+      graph.CreateImage("post_output", kOutputFormat, size, layers);
+
+  graph
+      .AddPass("post_process",
+               [this, &graph, frame_index, scene, output, extent,
+                layers](VkCommandBuffer cmd) {
+                 BindImages(graph, frame_index, scene, output);
+
+                 PostConstants constants;
+                 constants.width = extent.width;
+                 constants.height = extent.height;
+                 constants.exposure = settings_.exposure;
+                 constants.vignette = settings_.vignette;
+                 constants.fxaa = settings_.fxaa ? 1 : 0;
+
+                 vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                   pipeline_);
+                 vkCmdBindDescriptorSets(
+                     cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout_, 0,
+                     1, &frames_[frame_index].descriptor, 0, nullptr);
+                 vkCmdPushConstants(cmd, pipeline_layout_,
+                                    VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                                    sizeof(PostConstants), &constants);
+                 vkCmdDispatch(cmd, (extent.width + kTileSize - 1) / kTileSize,
+                               (extent.height + kTileSize - 1) / kTileSize,
+                               layers);
+               })
+      .ReadTexture(scene, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
+      .WriteStorage(output, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+  return output;
+}
+
+void PostProcess::BindImages(const RenderGraph& graph, uint32_t frame_index,
+                             GraphImage scene, GraphImage output) {
+  FramePost& frame = frames_[frame_index];
+  VkImageView scene_view = graph.GetView(scene);
+  VkImageView output_view = graph.GetView(output);
+  if (scene_view == frame.bound_scene && output_view == frame.bound_output) {
+    return;
+  }
+
+  VkDescriptorImageInfo scene_info = {};
+  scene_info.sampler = sampler_;
+  scene_info.imageView = scene_view;
+  scene_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+  VkDescriptorImageInfo output_info = {};
+  output_info.sampler = VK_NULL_HANDLE;
+  output_info.imageView = output_view;
+  output_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+  VkWriteDescriptorSet writes[2] = {};
+  for (VkWriteDescriptorSet& write : writes) {
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.pNext = nullptr;
+    write.dstSet = frame.descriptor;
+    write.descriptorCount = 1;
+  }
+  writes[0].dstBinding = 0;
+  writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  writes[0].pImageInfo = &scene_info;
+  writes[1].dstBinding = 1;
+  writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  writes[1].pImageInfo = &output_info;
+  vkUpdateDescriptorSets(device_, 2, writes, 0, nullptr);
+
+  frame.bound_scene = scene_view;
+  frame.bound_output = output_view;
+}
+
+void PostProcess::Release(DeletionQueue& queue) {
+  queue.Push(pipeline_);
+  queue.Push(pipeline_layout_);
+  queue.Push(set_layout_);
+  queue.Push(sampler_);
+  queue.Push(lut_view_);
+  queue.Push(lut_image_.image, lut_image_.allocation);
+  frames_.clear();
+}
+
+}  // namespace vk
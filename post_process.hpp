@@ -0,0 +1,110 @@
+#pragma once
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "deletion_queue.hpp"
+#include "queue_submitter.hpp"
+#include "render_graph.hpp"
+#include "vk_types.hpp"
+
+namespace vk {
+
+// Post-processing of the HDR scene in a single compute pass.
+//
+// Tonemapping, LUT color grading, FXAA and the vignette are fused into one
+// shader working on 8x8 tiles: each workgroup tonemaps and grades its tile
+// plus a one pixel border into shared memory once, antialiases from there
+// and writes the final color. The scene is read and the output written once
+// per pixel instead of once per effect.
+//
+// The output is linear LDR color in kOutputFormat, with a layer per view;
+// the caller blits it to the swapchain, which also applies the sRGB encoding.
+//
+// Descriptor set layout:
+//   binding 0: the HDR scene.
+//   binding 1: the output, as a storage image.
+//   binding 2: the color grading LUT.
+class PostProcess {
+ public:
+  constexpr static VkFormat kSceneFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+  constexpr static VkFormat kOutputFormat = VK_FORMAT_R8G8B8A8_UNORM;
+  // Must match TILE_SIZE in post_process.comp.
+  constexpr static uint32_t kTileSize = 8;
+  constexpr static uint32_t kLutSize = 32;
+
+  struct Settings {
+    // Scene color multiplier applied before tonemapping.
+    float exposure = 1.f;
+    // Darkening at the corners of each view, 0 to disable.
+    float vignette = 0.3f;
+    bool fxaa = true;
+    // kLutSize^3 texels of packed RGBA8, red varying fastest, mapping
+    // tonemapped color to graded color. Empty for no grading.
+    std::vector<uint32_t> lut;
+  };
+
+  PostProcess(VkDevice device, VmaAllocator allocator)
+      : device_(device), allocator_(allocator) {}
+
+  // Creates the pipeline, uploads the LUT with `queue_submitter` and
+  // allocates a descriptor set per frame from `pool`.
+  bool Init(VkDescriptorPool pool, QueueSubmitter& queue_submitter,
+            uint32_t frames_in_flight, Settings settings);
+
+  // Adds the post-processing pass over the top left `extent` of each layer
+  // of `scene`, which is `size` with `layers` layers, and returns the output
+  // of the same dimensions.
+  GraphImage AddPass(RenderGraph& graph, uint32_t frame_index,
+                     GraphImage scene, VkExtent2D size, uint32_t layers,
+                     VkExtent2D extent);
+
+  const Settings& settings() const { return settings_; }
+  void set_exposure(float exposure) { settings_.exposure = exposure; }
+  void set_vignette(float vignette) { settings_.vignette = vignette; }
+  void set_fxaa(bool enabled) { settings_.fxaa = enabled; }
+
+  // Hands every resource to `queue`. Used at shutdown.
+  void Release(DeletionQueue& queue);
+
+ private:
+  // Matches the push constants in post_process.comp.
+  struct PostConstants {
+    uint32_t width;
+    uint32_t height;
+    float exposure;
+    float vignette;
+    uint32_t fxaa;
+  };
+
+  struct FramePost {
+    VkDescriptorSet descriptor;
+    VkImageView bound_scene;
+    VkImageView bound_output;
+  };
+
+  bool InitLut(QueueSubmitter& queue_submitter);
+  bool InitPipeline();
+  // Points `frame_index`'s descriptor set at the compiled images.
+  void BindImages(const RenderGraph& graph, uint32_t frame_index,
+                  GraphImage scene, GraphImage output);
+
+  VkDevice device_;
+  VmaAllocator allocator_;
+  Settings settings_;
+
+  VkDescriptorSetLayout set_layout_ = VK_NULL_HANDLE;
+  VkPipelineLayout pipeline_layout_ = VK_NULL_HANDLE;
+  VkPipeline pipeline_ = VK_NULL_HANDLE;
+  VkSampler sampler_ = VK_NULL_HANDLE;
+
+  AllocatedImage lut_image_;
+  VkImageView lut_view_ = VK_NULL_HANDLE;
+
+  std::vector<FramePost> frames_;
+};
+
+}  // namespace vk
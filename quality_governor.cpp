@@ -0,0 +1,71 @@
+#include "quality_governor.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+namespace vk {
+
+namespace {
+
+// From full quality down. Each level lowers one setting a notch.
+const QualitySettings kLevels[] = {
+    {200.f, 1.f, 128}, {150.f, 1.f, 128},  {150.f, 0.75f, 128},
+    {150.f, 0.75f, 64}, {100.f, 0.75f, 64}, {100.f, 0.5f, 64},
+    {100.f, 0.5f, 32},  {60.f, 0.5f, 32},   {60.f, 0.5f, 16},
+};
+
+}  // namespace
+
+void QualityGovernor::AddSample(float cpu_ms, float gpu_ms,
+                                bool can_lower_resolution,
+                                bool can_raise_resolution) {
+  cpu_sum_ += cpu_ms;
+  gpu_sum_ += gpu_ms;
+  sample_count_++;
+  if (sample_count_ < settings_.interval) {
+    return;
+  }
+
+  const float cpu = cpu_sum_ / static_cast<float>(sample_count_);
+  const float gpu = gpu_sum_ / static_cast<float>(sample_count_);
+  cpu_sum_ = 0.f;
+  gpu_sum_ = 0.f;
+  sample_count_ = 0;
+
+  if (settling_) {
+    settling_ = false;
+    return;
+  }
+
+  const float frame = std::max(cpu, gpu);
+  if (frame > settings_.target_ms) {
+    fast_intervals_ = 0;
+    const bool gpu_bound = gpu >= cpu;
+    if ((gpu_bound && can_lower_resolution) || level_ + 1 == level_count()) {
+      return;
+    }
+    level_++;
+    settling_ = true;
+  } else if (frame < settings_.target_ms * settings_.raise_threshold) {
+    if (can_raise_resolution || level_ == 0) {
+      return;
+    }
+    if (++fast_intervals_ >= settings_.raise_intervals) {
+      fast_intervals_ = 0;
+      level_--;
+      settling_ = true;
+    }
+  } else {
+    fast_intervals_ = 0;
+  }
+}
+
+const QualitySettings& QualityGovernor::quality() const {
+  return kLevels[level_];
+}
+
+uint32_t QualityGovernor::level_count() {
+  return static_cast<uint32_t>(std::size(kLevels));
+}
+
+}  // namespace vk
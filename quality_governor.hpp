@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+
+namespace vk {
+
+// Rendering settings the governor trades for frame time. The defaults are
+// full quality.
+struct QualitySettings {
+  // Objects whose bounds lie entirely beyond this distance from the camera
+  // are not drawn.
+  float draw_distance = 200.f;
+  // Fraction of the shadow map side used by the cascades that are redrawn
+  // every frame.
+  float shadow_resolution_scale = 1.f;
+  // Lights kept per light cluster, at most
+  // ClusteredLighting::kMaxLightsPerCluster.
+  uint32_t max_lights_per_cluster = 128;
+};
+
+// Holds a frame time target by stepping through a fixed ladder of quality
+// levels, each giving up a little more than the one before in priority
+// order: draw distance first, then shadow resolution, then lights per
+// cluster.
+//
+// Frame times are averaged over `interval` frames. Quality drops by one level
+// as soon as an interval is over the target, and only rises again after
+// `raise_intervals` consecutive intervals well under it, so that it does not
+// oscillate around the target. The interval after a change is ignored while
+// the new settings take effect.
+class QualityGovernor {
+ public:
+  struct Settings {
+    float target_ms = 16.6f;
+    // Quality is raised once frames take less than this fraction of the
+    // target.
+    float raise_threshold = 0.8f;
+    // Frames averaged per decision.
+    uint32_t interval = 30;
+    // Consecutive fast intervals needed before raising quality.
+    uint32_t raise_intervals = 4;
+  };
+
+  QualityGovernor() = default;
+  explicit QualityGovernor(const Settings& settings) : settings_(settings) {}
+
+  // Adds the times of a completed frame. When the GPU is the bottleneck and
+  // `can_lower_resolution` is set, the governor leaves it to dynamic
+  // resolution. Likewise quality is only raised once `can_raise_resolution`
+  // is clear, so resolution is restored first.
+  void AddSample(float cpu_ms, float gpu_ms, bool can_lower_resolution,
+                 bool can_raise_resolution);
+
+  const QualitySettings& quality() const;
+  uint32_t level() const { return level_; }
+  static uint32_t level_count();
+
+ private:
+  Settings settings_;
+  uint32_t level_ = 0;
+
+  float cpu_sum_ = 0.f;
+  float gpu_sum_ = 0.f;
+  uint32_t sample_count_ = 0;
+  uint32_t fast_intervals_ = 0;
+  bool settling_ = false;
+};
+
+}  // namespace vk
@@ -27,9 +27,13 @@ void QueueSubmitter::SubmitImmediate(
 
   VkSubmitInfo submit = init::SubmitInfo(&upload_context_.command_buffer);
 
-  if (vkQueueSubmit(queue_, 1, &submit, upload_context_.fence) != VK_SUCCESS) {
-    std::cerr << "Error performing submit immediate queue submit.\n";
-    abort();
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    if (vkQueueSubmit(queue_, 1, &submit, upload_context_.fence) !=
+        VK_SUCCESS) {
+      std::cerr << "Error performing submit immediate queue submit.\n";
+      abort();
+    }
   }
 
   vkWaitForFences(device_, 1, &upload_context_.fence, true, 9'999'999'999);
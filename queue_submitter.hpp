@@ -3,6 +3,7 @@
 #include <vulkan/vulkan.h>
 
 #include <functional>
+#include <mutex>
 
 namespace vk {
 
@@ -14,9 +15,13 @@ struct UploadContext {
 
 class QueueSubmitter {
  public:
-  explicit QueueSubmitter(VkDevice device, VkQueue queue,
-                          UploadContext upload_context)
-      : device_(device), queue_(queue), upload_context_(upload_context) {}
+  // `queue_mutex` is held while submitting to `queue`.
+  QueueSubmitter(VkDevice device, VkQueue queue, UploadContext upload_context,
+                 std::mutex& queue_mutex)
+      : device_(device),
+        queue_(queue),
+        upload_context_(upload_context),
+        queue_mutex_(queue_mutex) {}
 
   void SubmitImmediate(std::function<void(VkCommandBuffer cmd)>&& function);
 
@@ -24,6 +29,7 @@ class QueueSubmitter {
   VkDevice device_;
   VkQueue queue_;
   UploadContext upload_context_;
+  std::mutex& queue_mutex_;
 };
 
 }  // namespace vk
@@ -0,0 +1,141 @@
+#include "readback_ring.hpp"
+
+#include <algorithm>
+
+#include "barrier_batch.hpp"
+
+namespace vk {
+
+std::future<ReadbackRing::Image> ReadbackRing::Request(uint64_t frame) {
+  Pending pending;
+  pending.frame = frame;
+  std::future<Image> future = pending.promise.get_future();
+  pending_.push_back(std::move(pending));
+  return future;
+}
+
+bool ReadbackRing::requested(uint64_t frame) const {
+  return std::any_of(
+      pending_.begin(), pending_.end(),
+      [=](const Pending& pending) { return pending.frame == frame; });
+}
+
+void ReadbackRing::Record(VkCommandBuffer cmd, VkImage image,
+                          VkExtent2D extent, uint32_t texel_size,
+                          uint64_t frame) {
+  const VkDeviceSize size =
+      VkDeviceSize{extent.width} * extent.height * texel_size;
+
+  // Several requests for the same frame share its copy.
+  std::shared_ptr<Slot> slot;
+  for (Pending& pending : pending_) {
+    if (pending.frame != frame) {
+      continue;
+    }
+    if (!slot) {
+      slot = AcquireSlot(size);
+      slot->in_flight = true;
+
+      VkBufferImageCopy copy_region = {};
+      copy_region.bufferOffset = 0;
+      // Tightly packed rows.
+      copy_region.bufferRowLength = 0;
+      copy_region.bufferImageHeight = 0;
+      copy_region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+      copy_region.imageExtent = {extent.width, extent.height, 1};
+      vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                             slot->buffer.buffer, 1, &copy_region);
+
+      // The fence only orders the copy before the host wait; the writes
+      // still have to be made visible to host reads.
+      BarrierBatch barriers;
+      barriers.Memory(
+          {VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_TRANSFER_BIT,
+           VK_ACCESS_TRANSFER_WRITE_BIT},
+          {VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_HOST_BIT,
+           VK_ACCESS_HOST_READ_BIT});
+      barriers.Flush(cmd);
+    }
+    pending.slot = slot;
+    pending.image.width_ = extent.width;
+    pending.image.height_ = extent.height;
+    pending.image.texel_size_ = texel_size;
+    pending.image.frame_ = frame;
+  }
+}
+
+void ReadbackRing::Cancel(uint64_t frame) {
+  for (Pending& pending : pending_) {
+    if (pending.frame == frame && pending.slot) {
+      // Its copy was recorded but never submitted.
+      pending.slot->in_flight = false;
+    }
+  }
+  pending_.erase(
+      std::remove_if(
+          pending_.begin(), pending_.end(),
+          [=](const Pending& pending) { return pending.frame == frame; }),
+      pending_.end());
+}
+
+void ReadbackRing::Collect(uint64_t completed_frame) {
+  auto completed = std::partition(
+      pending_.begin(), pending_.end(), [=](const Pending& pending) {
+        return !pending.slot || pending.frame > completed_frame;
+      });
+  for (auto it = completed; it != pending_.end(); ++it) {
+    Slot& slot = *it->slot;
+    if (slot.in_flight) {
+      vmaInvalidateAllocation(allocator_, slot.buffer.allocation, 0,
+                              VK_WHOLE_SIZE);
+      slot.in_flight = false;
+    }
+    it->image.slot_ = std::move(it->slot);
+    it->promise.set_value(std::move(it->image));
+  }
+  pending_.erase(completed, pending_.end());
+}
+
+void ReadbackRing::Release(DeletionQueue& queue) {
+  pending_.clear();
+  for (std::shared_ptr<Slot>& slot : slots_) {
+    vmaUnmapMemory(allocator_, slot->buffer.allocation);
+    queue.Push(slot->buffer.buffer, slot->buffer.allocation);
+  }
+  slots_.clear();
+}
+
+std::shared_ptr<ReadbackRing::Slot> ReadbackRing::AcquireSlot(
+    VkDeviceSize size) {
+  // A slot is free once its frame has completed and no Image refers to it.
+  // Free slots that are too small, e.g. after a resize, are replaced.
+  std::shared_ptr<Slot>* free_slot = nullptr;
+  for (std::shared_ptr<Slot>& slot : slots_) {
+    if (slot->in_flight || slot.use_count() > 1) {
+      continue;
+    }
+    if (slot->size >= size) {
+      return slot;
+    }
+    free_slot = &slot;
+  }
+
+  if (free_slot == nullptr) {
+    slots_.push_back(std::make_shared<Slot>());
+    free_slot = &slots_.back();
+  } else {
+    vmaUnmapMemory(allocator_, (*free_slot)->buffer.allocation);
+    vmaDestroyBuffer(allocator_, (*free_slot)->buffer.buffer,
+                     (*free_slot)->buffer.allocation);
+  }
+
+  Slot& slot = **free_slot;
+  // Host cached memory, since the CPU reads every byte.
+  slot.buffer = CreateBuffer(allocator_, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                             VMA_MEMORY_USAGE_GPU_TO_CPU);
+  slot.size = size;
+  vmaMapMemory(allocator_, slot.buffer.allocation, &slot.data);
+  return *free_slot;
+}
+
+}  // namespace vk
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "buffer.hpp"
+#include "deletion_queue.hpp"
+
+namespace vk {
+
+// Copies rendered images back to host memory without stalling.
+//
+// A requested frame copies its image into a slot of the ring: a persistently
+// mapped, host cached buffer. The future handed out by Request() is fulfilled
+// by the Collect() that reports the frame as completed, i.e. once its fence
+// has been waited on, so neither the CPU nor the GPU ever waits on a copy.
+// The consumer reads the pixels in place while later frames render, and the
+// slot is reused once the Image is dropped. When every slot is still held the
+// ring grows, so a slow consumer costs memory rather than throughput.
+class ReadbackRing {
+ private:
+  struct Slot {
+    AllocatedBuffer buffer;
+    VkDeviceSize size = 0;
+    void* data = nullptr;
+    bool in_flight = false;
+  };
+
+ public:
+  // Pixels of one frame, rows tightly packed. May be read from any thread.
+  // Must be dropped before the ring is released.
+  class Image {
+   public:
+    Image() = default;
+
+    uint32_t width() const { return width_; }
+    uint32_t height() const { return height_; }
+    uint32_t texel_size() const { return texel_size_; }
+    uint64_t frame() const { return frame_; }
+    const uint8_t* data() const {
+      return static_cast<const uint8_t*>(slot_->data);
+    }
+    size_t size() const { return size_t{width_} * height_ * texel_size_; }
+
+   private:
+    friend class ReadbackRing;
+
+    std::shared_ptr<const Slot> slot_;
+    uint32_t width_ = 0;
+    uint32_t height_ = 0;
+    uint32_t texel_size_ = 0;
+    uint64_t frame_ = 0;
+  };
+
+  explicit ReadbackRing(VmaAllocator allocator) : allocator_(allocator) {}
+
+  // Asks for the image that Record() copies in `frame`.
+  std::future<Image> Request(uint64_t frame);
+  bool requested(uint64_t frame) const;
+
+  // Copies `image`, in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, into a slot if
+  // `frame` was requested.
+  void Record(VkCommandBuffer cmd, VkImage image, VkExtent2D extent,
+              uint32_t texel_size, uint64_t frame);
+
+  // Breaks the requests of `frame`, e.g. when it was never submitted, and
+  // frees their slot.
+  void Cancel(uint64_t frame);
+
+  // Fulfills the requests of frames up to and including `completed_frame`.
+  void Collect(uint64_t completed_frame);
+
+  // Hands the buffers to `queue` and breaks pending requests. Used at
+  // shutdown.
+  void Release(DeletionQueue& queue);
+
+ private:
+  struct Pending {
+    uint64_t frame;
+    std::promise<Image> promise;
+    std::shared_ptr<Slot> slot;
+    Image image;
+  };
+
+  std::shared_ptr<Slot> AcquireSlot(VkDeviceSize size);
+
+  VmaAllocator allocator_;
+
+  std::vector<std::shared_ptr<Slot>> slots_;
+  std::vector<Pending> pending_;
+};
+
+}  // namespace vk
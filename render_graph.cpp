@@ -0,0 +1,786 @@
+#include "render_graph.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+namespace vk {
+
+namespace {
+
+constexpr VkAccessFlags kWriteAccess =
+    VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT |
+    VK_ACCESS_MEMORY_WRITE_BIT;
+
+constexpr VkImageUsageFlags kAttachmentUsage =
+    VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+    VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+    VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+
+constexpr VkPipelineStageFlags kDepthStages =
+    VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+    VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+
+// A single view renders without multiview.
+uint32_t ViewMask(uint32_t view_count) {
+  return view_count > 1 ? (1u << view_count) - 1 : 0;
+}
+
+}  // namespace
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::WriteColor(
+    GraphImage image, std::optional<VkClearColorValue> clear) {
+  Use use = {};
+  use.resource = image.id;
+  use.state = {VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+               VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+               VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                   VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT};
+  use.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  use.attachment = Attachment::kColor;
+  use.write = true;
+  use.clear = clear.has_value();
+  if (clear.has_value()) {
+    use.clear_value.color = clear.value();
+  }
+  graph_.AddUse(pass_, use);
+  return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::WriteDepth(
+    GraphImage image, std::optional<float> clear) {
+  Use use = {};
+  use.resource = image.id;
+  use.state = {VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, kDepthStages,
+               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                   VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT};
+  use.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  use.attachment = Attachment::kDepth;
+  use.write = true;
+  use.clear = clear.has_value();
+  if (clear.has_value()) {
+    use.clear_value.depthStencil = {clear.value(), 0};
+  }
+  graph_.AddUse(pass_, use);
+  return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::ReadDepth(
+    GraphImage image) {
+  Use use = {};
+  use.resource = image.id;
+  use.state = {VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, kDepthStages,
+               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT};
+  use.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  use.attachment = Attachment::kDepth;
+  graph_.AddUse(pass_, use);
+  return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::ReadTexture(
+    GraphImage image, VkPipelineStageFlags stages) {
+  Use use = {};
+  use.resource = image.id;
+  use.state = {VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, stages,
+               VK_ACCESS_SHADER_READ_BIT};
+  use.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+  graph_.AddUse(pass_, use);
+  return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::ReadStorage(
+    GraphImage image, VkPipelineStageFlags stages) {
+  Use use = {};
+  use.resource = image.id;
+  use.state = {VK_IMAGE_LAYOUT_GENERAL, stages, VK_ACCESS_SHADER_READ_BIT};
+  use.usage = VK_IMAGE_USAGE_STORAGE_BIT;
+  graph_.AddUse(pass_, use);
+  return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::WriteStorage(
+    GraphImage image, VkPipelineStageFlags stages) {
+  Use use = {};
+  use.resource = image.id;
+  use.state = {VK_IMAGE_LAYOUT_GENERAL, stages,
+               VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT};
+  use.usage = VK_IMAGE_USAGE_STORAGE_BIT;
+  use.write = true;
+  graph_.AddUse(pass_, use);
+  return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::CopyFrom(
+    GraphImage image) {
+  Use use = {};
+  use.resource = image.id;
+  use.state = {VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+               VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT};
+  use.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  graph_.AddUse(pass_, use);
+  return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::CopyTo(GraphImage image) {
+  Use use = {};
+  use.resource = image.id;
+  use.state = {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+               VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT};
+  use.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  use.write = true;
+  graph_.AddUse(pass_, use);
+  return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::ReadBuffer(
+    GraphBuffer buffer, VkPipelineStageFlags stages, VkAccessFlags access) {
+  Use use = {};
+  use.resource = buffer.id;
+  use.state = {VK_IMAGE_LAYOUT_UNDEFINED, stages, access};
+  graph_.AddUse(pass_, use);
+  return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::WriteBuffer(
+    GraphBuffer buffer, VkPipelineStageFlags stages, VkAccessFlags access) {
+  Use use = {};
+  use.resource = buffer.id;
+  use.state = {VK_IMAGE_LAYOUT_UNDEFINED, stages, access};
+  use.write = true;
+  graph_.AddUse(pass_, use);
+  return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::SideEffects() {
+  graph_.passes_[pass_].side_effects = true;
+  return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::RenderArea(
+    VkExtent2D extent) {
+  graph_.passes_[pass_].render_area = extent;
+  return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::Multiview(
+    uint32_t view_count) {
+  graph_.passes_[pass_].view_mask = ViewMask(view_count);
+  return *this;
+}
+
+void RenderGraph::BeginFrame(uint64_t frame) {
+  frame_ = frame;
+  pass_count_ = 0;
+  resources_.clear();
+
+  for (auto it = framebuffers_.begin(); it != framebuffers_.end();) {
+    if (frame_ - it->second.last_used_frame > kFramebufferEvictFrames) {
+      retirement_queue_.Retire(frame_, it->second.framebuffer);
+      it = framebuffers_.erase(it);
+    } else {
+      it++;
+    }
+  }
+}
+
+GraphImage RenderGraph::CreateImage(const char* name, VkFormat format,
+                                    VkExtent2D extent, uint32_t layers,
+                                    VkSampleCountFlagBits samples) {
+  Resource resource = {};
+  resource.name = name;
+  resource.desc = {format, extent, 0, samples, layers};
+  resources_.push_back(resource);
+  return {static_cast<uint32_t>(resources_.size() - 1)};
+}
+
+GraphImage RenderGraph::ImportImage(const char* name, VkImage image,
+                                    VkImageView view,
+                                    const RenderTargetDesc& desc,
+                                    const ResourceState& initial,
+                                    VkImageLayout final_layout) {
+  Resource resource = {};
+  resource.name = name;
+  resource.imported = true;
+  resource.desc = desc;
+  resource.initial = initial;
+  resource.final_layout = final_layout;
+  resource.image = image;
+  resource.view = view;
+  resources_.push_back(resource);
+  return {static_cast<uint32_t>(resources_.size() - 1)};
+}
+
+GraphBuffer RenderGraph::ImportBuffer(const char* name, VkBuffer buffer,
+                                      const ResourceState& initial) {
+  Resource resource = {};
+  resource.name = name;
+  resource.imported = true;
+  resource.is_buffer = true;
+  resource.initial = initial;
+  resource.buffer = buffer;
+  resources_.push_back(resource);
+  return {static_cast<uint32_t>(resources_.size() - 1)};
+}
+
+RenderGraph::PassBuilder RenderGraph::AddPass(const char* name,
+                                              ExecuteFunction execute) {
+  if (pass_count_ == passes_.size()) {
+    passes_.emplace_back();
+  }
+  Pass& pass = passes_[pass_count_];
+  pass.name = name;
+  pass.execute = std::move(execute);
+  pass.uses.clear();
+  pass.side_effects = false;
+  pass.render_area = {0, 0};
+  pass.view_mask = 0;
+  return PassBuilder(*this, pass_count_++);
+}
+
+void RenderGraph::AddUse(uint32_t pass, const Use& use) {
+  Resource& resource = resources_[use.resource];
+  if (!resource.imported) {
+    resource.desc.usage |= use.usage;
+  }
+  passes_[pass].uses.push_back(use);
+}
+
+bool RenderGraph::Compile() {
+  // Images that never leave the tile memory of a render pass can be lazily
+  // allocated.
+  for (Resource& resource : resources_) {
+    if (!resource.imported && resource.desc.usage != 0 &&
+        (resource.desc.usage & ~kAttachmentUsage) == 0) {
+      resource.desc.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    }
+  }
+
+  BuildSignature();
+  if (signature_ == compiled_signature_) {
+    return AllocateTransients();
+  }
+
+  if (!CompileGraph()) {
+    compiled_signature_.clear();
+    return false;
+  }
+  compiled_signature_.swap(signature_);
+  return true;
+}
+
+void RenderGraph::BuildSignature() {
+  signature_.clear();
+  for (const Resource& resource : resources_) {
+    signature_.push_back(resource.imported | (resource.is_buffer << 1));
+    signature_.push_back(resource.desc.format |
+                         (uint64_t{resource.desc.usage} << 32));
+    signature_.push_back(resource.desc.extent.width |
+                         (uint64_t{resource.desc.extent.height} << 32));
+    signature_.push_back(resource.desc.samples |
+                         (uint64_t{resource.desc.layers} << 32));
+    signature_.push_back(resource.initial.layout |
+                         (uint64_t{resource.final_layout} << 32));
+    signature_.push_back(resource.initial.stages |
+                         (uint64_t{resource.initial.access} << 32));
+  }
+  for (uint32_t p = 0; p < pass_count_; p++) {
+    const Pass& pass = passes_[p];
+    signature_.push_back(pass.uses.size() |
+                         (uint64_t{pass.side_effects} << 32) |
+                         (uint64_t{pass.view_mask} << 40));
+    for (const Use& use : pass.uses) {
+      signature_.push_back(use.resource | (uint64_t{use.state.layout} << 32));
+      signature_.push_back(use.state.stages |
+                           (uint64_t{use.state.access} << 32));
+      signature_.push_back(static_cast<uint64_t>(use.attachment) |
+                           (uint64_t{use.write} << 8) |
+                           (uint64_t{use.clear} << 9));
+    }
+  }
+}
+
+bool RenderGraph::CompileGraph() {
+  compiled_.clear();
+  final_barriers_.clear();
+  transients_.clear();
+
+  // Cull passes, walking backwards from what is visible outside the graph.
+  // `needed` marks resources whose current contents a later pass (or the
+  // outside world, for imported resources) reads.
+  std::vector<bool> needed(resources_.size());
+  for (size_t r = 0; r < resources_.size(); r++) {
+    needed[r] = resources_[r].imported;
+  }
+  std::vector<uint32_t> live;
+  for (uint32_t p = pass_count_; p-- > 0;) {
+    const Pass& pass = passes_[p];
+    bool keep = pass.side_effects;
+    for (const Use& use : pass.uses) {
+      keep |= use.write && needed[use.resource];
+    }
+    if (!keep) {
+      continue;
+    }
+    live.push_back(p);
+
+    // A clear makes earlier contents irrelevant, any other use depends on
+    // them.
+    for (const Use& use : pass.uses) {
+      if (use.clear) {
+        needed[use.resource] = false;
+      }
+    }
+    for (const Use& use : pass.uses) {
+      if (!use.clear && (!use.write || use.attachment != Attachment::kNone)) {
+        needed[use.resource] = true;
+      }
+    }
+  }
+  std::reverse(live.begin(), live.end());
+
+  // Lifetimes of transient images, in units of live passes.
+  std::vector<int64_t> first_use(resources_.size(), -1);
+  std::vector<int64_t> last_use(resources_.size(), -1);
+  for (uint32_t i = 0; i < live.size(); i++) {
+    for (const Use& use : passes_[live[i]].uses) {
+      if (first_use[use.resource] < 0) {
+        first_use[use.resource] = i;
+      }
+      last_use[use.resource] = i;
+    }
+  }
+  for (uint32_t r = 0; r < resources_.size(); r++) {
+    if (!resources_[r].imported && first_use[r] >= 0) {
+      transients_.push_back({r, static_cast<uint32_t>(first_use[r]),
+                             static_cast<uint32_t>(last_use[r]), 0});
+    }
+  }
+  if (!AllocateTransients()) {
+    return false;
+  }
+
+  // Simulate the frame to find the barriers each pass needs.
+  struct Tracked {
+    ResourceState state;
+    // Stages of the last write or layout transition, and the stages that
+    // have been made to wait on it since.
+    VkPipelineStageFlags write_stages;
+    VkPipelineStageFlags visible_stages;
+    bool defined;
+  };
+
+  // Stages every transient is touched in. An aliased image's first use has
+  // to wait for whichever image occupied its memory before.
+  ResourceState transient_uses = {};
+  for (uint32_t p : live) {
+    for (const Use& use : passes_[p].uses) {
+      if (!resources_[use.resource].imported) {
+        transient_uses.stages |= use.state.stages;
+        transient_uses.access |= use.state.access & kWriteAccess;
+      }
+    }
+  }
+
+  std::vector<Tracked> tracked(resources_.size());
+  for (uint32_t r = 0; r < resources_.size(); r++) {
+    const Resource& resource = resources_[r];
+    Tracked& t = tracked[r];
+    if (resource.imported) {
+      t.state = resource.initial;
+      t.state.access &= kWriteAccess;
+      t.write_stages = resource.initial.stages;
+      t.defined = resource.is_buffer ||
+                  resource.initial.layout != VK_IMAGE_LAYOUT_UNDEFINED;
+      continue;
+    }
+    if (last_use[r] < 0) {
+      continue;
+    }
+    // Transients start undefined, but the previous frame's use of the same
+    // image may still be in flight.
+    for (const Use& use : passes_[live[last_use[r]]].uses) {
+      if (use.resource == r) {
+        t.state.stages |= use.state.stages;
+        t.state.access |= use.state.access & kWriteAccess;
+      }
+    }
+    const Transient& transient = *std::find_if(
+        transients_.begin(), transients_.end(),
+        [=](const Transient& tr) { return tr.resource == r; });
+    if (pool_.Get(transient.target).aliased) {
+      t.state.stages |= transient_uses.stages;
+      t.state.access |= transient_uses.access;
+    }
+    t.write_stages = t.state.stages;
+  }
+
+  for (uint32_t i = 0; i < live.size(); i++) {
+    const Pass& pass = passes_[live[i]];
+    CompiledPass compiled = {};
+    compiled.pass = live[i];
+
+    RenderPassKey key;
+    key.view_mask = pass.view_mask;
+    for (uint32_t u = 0; u < pass.uses.size(); u++) {
+      const Use& use = pass.uses[u];
+      const Resource& resource = resources_[use.resource];
+      Tracked& t = tracked[use.resource];
+
+      const bool discard = use.clear || !t.defined;
+      const bool layout_change =
+          !resource.is_buffer && t.state.layout != use.state.layout;
+      const bool unsynchronized =
+          t.write_stages != 0 && (use.state.stages & ~t.visible_stages) != 0;
+
+      if (use.write || layout_change || unsynchronized) {
+        Barrier barrier = {};
+        barrier.resource = use.resource;
+        barrier.from = t.state;
+        if (!use.write && !layout_change) {
+          // Only needs to see the last write.
+          barrier.from.stages = t.write_stages;
+        }
+        if (discard && !resource.is_buffer) {
+          barrier.from.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        }
+        barrier.to = use.state;
+        compiled.barriers.push_back(barrier);
+
+        if (use.write || layout_change) {
+          t.state.layout = use.state.layout;
+          t.state.stages = use.state.stages;
+          t.state.access = use.write ? use.state.access & kWriteAccess : 0;
+          t.write_stages = use.state.stages;
+          t.visible_stages = use.write ? 0 : use.state.stages;
+        } else {
+          t.state.stages |= use.state.stages;
+          t.visible_stages |= use.state.stages;
+        }
+      } else {
+        t.state.stages |= use.state.stages;
+      }
+
+      if (use.attachment != Attachment::kNone) {
+        AttachmentKey attachment;
+        attachment.format = resource.desc.format;
+        attachment.samples = resource.desc.samples;
+        attachment.load = use.clear ? VK_ATTACHMENT_LOAD_OP_CLEAR
+                          : discard ? VK_ATTACHMENT_LOAD_OP_DONT_CARE
+                                    : VK_ATTACHMENT_LOAD_OP_LOAD;
+        attachment.store = resource.imported || last_use[use.resource] > i
+                               ? VK_ATTACHMENT_STORE_OP_STORE
+                               : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachment.layout = use.state.layout;
+
+        if (use.attachment == Attachment::kDepth) {
+          key.depth = attachment;
+        } else {
+          key.colors.push_back(attachment);
+          compiled.attachments.push_back(u);
+        }
+        if (compiled.extent.width == 0) {
+          compiled.extent = resource.desc.extent;
+          // Multiview framebuffers have a single layer; the views select
+          // the attachment layers.
+          compiled.layers = pass.view_mask != 0 ? 1 : resource.desc.layers;
+        }
+      }
+
+      t.defined |= use.write;
+    }
+
+    if (key.depth.has_value()) {
+      // The depth attachment always goes last.
+      for (uint32_t u = 0; u < pass.uses.size(); u++) {
+        if (pass.uses[u].attachment == Attachment::kDepth) {
+          compiled.attachments.push_back(u);
+        }
+      }
+    }
+    if (!compiled.attachments.empty()) {
+      if (compiled.attachments.size() > kMaxAttachments) {
+        std::cerr << "Too many attachments in pass " << pass.name << ".\n";
+        return false;
+      }
+      std::optional<VkRenderPass> render_pass = GetRenderPass(key);
+      if (!render_pass.has_value()) {
+        return false;
+      }
+      compiled.render_pass = render_pass.value();
+    }
+
+    compiled_.push_back(std::move(compiled));
+  }
+
+  for (uint32_t r = 0; r < resources_.size(); r++) {
+    const Resource& resource = resources_[r];
+    if (!resource.imported || resource.is_buffer ||
+        resource.final_layout == VK_IMAGE_LAYOUT_UNDEFINED ||
+        resource.final_layout == tracked[r].state.layout) {
+      continue;
+    }
+    Barrier barrier = {};
+    barrier.resource = r;
+    barrier.from = tracked[r].state;
+    barrier.to = {resource.final_layout, 0, 0};
+    final_barriers_.push_back(barrier);
+  }
+  return true;
+}
+
+bool RenderGraph::AllocateTransients() {
+  pool_.BeginFrame(frame_);
+  for (Transient& transient : transients_) {
+    transient.target = pool_.Request(resources_[transient.resource].desc,
+                                     transient.first_use, transient.last_use);
+  }
+  if (!pool_.Allocate()) {
+    return false;
+  }
+  for (const Transient& transient : transients_) {
+    const RenderTarget& target = pool_.Get(transient.target);
+    resources_[transient.resource].image = target.image;
+    resources_[transient.resource].view = target.view;
+  }
+  return true;
+}
+
+void RenderGraph::Execute(VkCommandBuffer cmd) {
+  auto add_barrier = [&](const Barrier& barrier) {
+    const Resource& resource = resources_[barrier.resource];
+    if (resource.is_buffer) {
+      barriers_.Memory(barrier.from, barrier.to);
+    } else {
+      barriers_.Image(resource.image, GetRange(resource), barrier.from,
+                      barrier.to);
+    }
+  };
+
+  for (const CompiledPass& compiled : compiled_) {
+    for (const Barrier& barrier : compiled.barriers) {
+      add_barrier(barrier);
+    }
+    barriers_.Flush(cmd);
+
+    Pass& pass = passes_[compiled.pass];
+    if (compiled.render_pass == VK_NULL_HANDLE) {
+      pass.execute(cmd);
+      continue;
+    }
+
+    std::optional<VkFramebuffer> framebuffer = GetFramebuffer(compiled);
+    if (!framebuffer.has_value()) {
+      std::cerr << "Error creating framebuffer for pass " << pass.name
+                << ".\n";
+      continue;
+    }
+
+    clear_values_.clear();
+    for (uint32_t u : compiled.attachments) {
+      clear_values_.push_back(pass.uses[u].clear_value);
+    }
+
+    VkRenderPassBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.renderPass = compiled.render_pass;
+    begin_info.framebuffer = framebuffer.value();
+    begin_info.renderArea.offset = {0, 0};
+    begin_info.renderArea.extent = compiled.extent;
+    if (pass.render_area.width != 0) {
+      begin_info.renderArea.extent.width =
+          std::min(pass.render_area.width, compiled.extent.width);
+      begin_info.renderArea.extent.height =
+          std::min(pass.render_area.height, compiled.extent.height);
+    }
+    begin_info.clearValueCount = static_cast<uint32_t>(clear_values_.size());
+    begin_info.pClearValues = clear_values_.data();
+
+    vkCmdBeginRenderPass(cmd, &begin_info, VK_SUBPASS_CONTENTS_INLINE);
+    pass.execute(cmd);
+    vkCmdEndRenderPass(cmd);
+  }
+
+  for (const Barrier& barrier : final_barriers_) {
+    add_barrier(barrier);
+  }
+  barriers_.Flush(cmd);
+}
+
+VkRenderPass RenderGraph::GetCompatibleRenderPass(
+    const std::vector<VkFormat>& colors, VkFormat depth,
+    uint32_t view_count) {
+  // Load and store ops and layouts do not affect compatibility.
+  RenderPassKey key;
+  key.view_mask = ViewMask(view_count);
+  for (VkFormat format : colors) {
+    key.colors.push_back({format, VK_SAMPLE_COUNT_1_BIT,
+                          VK_ATTACHMENT_LOAD_OP_CLEAR,
+                          VK_ATTACHMENT_STORE_OP_STORE,
+                          VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL});
+  }
+  if (depth != VK_FORMAT_UNDEFINED) {
+    key.depth = {depth, VK_SAMPLE_COUNT_1_BIT, VK_ATTACHMENT_LOAD_OP_CLEAR,
+                 VK_ATTACHMENT_STORE_OP_STORE,
+                 VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+  }
+  return GetRenderPass(key).value_or(VK_NULL_HANDLE);
+}
+
+std::optional<VkRenderPass> RenderGraph::GetRenderPass(
+    const RenderPassKey& key) {
+  for (const auto& [cached_key, render_pass] : render_passes_) {
+    if (cached_key == key) {
+      return render_pass;
+    }
+  }
+
+  std::vector<VkAttachmentDescription> attachments;
+  std::vector<VkAttachmentReference> color_refs;
+  auto add_attachment = [&](const AttachmentKey& attachment) {
+    // Layout transitions are done by the graph's barriers, so the render
+    // pass keeps every attachment in the layout it is used in.
+    VkAttachmentDescription description = {};
+    description.format = attachment.format;
+    description.samples = attachment.samples;
+    description.loadOp = attachment.load;
+    description.storeOp = attachment.store;
+    description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    description.initialLayout = attachment.layout;
+    description.finalLayout = attachment.layout;
+    attachments.push_back(description);
+    return VkAttachmentReference{
+        static_cast<uint32_t>(attachments.size() - 1), attachment.layout};
+  };
+
+  for (const AttachmentKey& color : key.colors) {
+    color_refs.push_back(add_attachment(color));
+  }
+  VkAttachmentReference depth_ref = {};
+  if (key.depth.has_value()) {
+    depth_ref = add_attachment(key.depth.value());
+  }
+
+  VkSubpassDescription subpass = {};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = static_cast<uint32_t>(color_refs.size());
+  subpass.pColorAttachments = color_refs.data();
+  subpass.pDepthStencilAttachment =
+      key.depth.has_value() ? &depth_ref : nullptr;
+
+  VkRenderPassCreateInfo renderpass_info = {};
+  renderpass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  renderpass_info.pNext = nullptr;
+  renderpass_info.attachmentCount = static_cast<uint32_t>(attachments.size());
+  renderpass_info.pAttachments = attachments.data();
+  renderpass_info.subpassCount = 1;
+  renderpass_info.pSubpasses = &subpass;
+
+  // The views are assumed to overlap, e.g. several cameras looking at the
+  // same scene, which lets the implementation share work between them.
+  VkRenderPassMultiviewCreateInfo multiview_info = {};
+  multiview_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO;
+  multiview_info.pNext = nullptr;
+  multiview_info.subpassCount = 1;
+  multiview_info.pViewMasks = &key.view_mask;
+  multiview_info.correlationMaskCount = 1;
+  multiview_info.pCorrelationMasks = &key.view_mask;
+  if (key.view_mask != 0) {
+    renderpass_info.pNext = &multiview_info;
+  }
+
+  VkRenderPass render_pass;
+  if (vkCreateRenderPass(device_, &renderpass_info, nullptr, &render_pass) !=
+      VK_SUCCESS) {
+    std::cerr << "Error creating render pass.\n";
+    return std::nullopt;
+  }
+  render_passes_.emplace_back(key, render_pass);
+  return render_pass;
+}
+
+std::optional<VkFramebuffer> RenderGraph::GetFramebuffer(
+    const CompiledPass& compiled) {
+  const Pass& pass = passes_[compiled.pass];
+
+  FramebufferKey key = {};
+  key.render_pass = compiled.render_pass;
+  for (size_t i = 0; i < compiled.attachments.size(); i++) {
+    key.views[i] = resources_[pass.uses[compiled.attachments[i]].resource].view;
+  }
+  key.width = compiled.extent.width;
+  key.height = compiled.extent.height;
+  key.layers = compiled.layers;
+
+  auto it = framebuffers_.find(key);
+  if (it != framebuffers_.end()) {
+    it->second.last_used_frame = frame_;
+    return it->second.framebuffer;
+  }
+
+  VkFramebufferCreateInfo framebuffer_info = {};
+  framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  framebuffer_info.pNext = nullptr;
+  framebuffer_info.renderPass = compiled.render_pass;
+  framebuffer_info.attachmentCount =
+      static_cast<uint32_t>(compiled.attachments.size());
+  framebuffer_info.pAttachments = key.views.data();
+  framebuffer_info.width = key.width;
+  framebuffer_info.height = key.height;
+  framebuffer_info.layers = key.layers;
+
+  VkFramebuffer framebuffer;
+  if (vkCreateFramebuffer(device_, &framebuffer_info, nullptr, &framebuffer) !=
+      VK_SUCCESS) {
+    return std::nullopt;
+  }
+  framebuffers_[key] = {framebuffer, frame_};
+  return framebuffer;
+}
+
+VkImageSubresourceRange RenderGraph::GetRange(const Resource& resource) const {
+  VkImageSubresourceRange range;
+  range.aspectMask = IsDepthFormat(resource.desc.format)
+                         ? VK_IMAGE_ASPECT_DEPTH_BIT
+                         : VK_IMAGE_ASPECT_COLOR_BIT;
+  range.baseMipLevel = 0;
+  range.levelCount = 1;
+  range.baseArrayLayer = 0;
+  range.layerCount = resource.desc.layers;
+  return range;
+}
+
+size_t RenderGraph::FramebufferKeyHash::operator()(
+    const FramebufferKey& key) const {
+  // Combined in 64 bits whatever the width of size_t.
+  uint64_t hash = 0;
+  const auto combine = [&hash](uint64_t value) {
+    hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+  };
+  combine(std::hash<VkRenderPass>()(key.render_pass));
+  for (VkImageView view : key.views) {
+    combine(std::hash<VkImageView>()(view));
+  }
+  combine(uint64_t{key.width} << 32 | key.height);
+  combine(key.layers);
+  return static_cast<size_t>(hash ^ (hash >> 32));
+}
+
+void RenderGraph::Release(DeletionQueue& queue) {
+  for (const auto& [key, render_pass] : render_passes_) {
+    queue.Push(render_pass);
+  }
+  render_passes_.clear();
+
+  for (const auto& [key, cached] : framebuffers_) {
+    queue.Push(cached.framebuffer);
+  }
+  framebuffers_.clear();
+
+  compiled_signature_.clear();
+  compiled_.clear();
+}
+
+}  // namespace vk
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "barrier_batch.hpp"
+#include "deletion_queue.hpp"
+#include "render_target_pool.hpp"
+#include "retirement_queue.hpp"
+
+namespace vk {
+
+struct GraphImage {
+  uint32_t id = UINT32_MAX;
+  bool valid() const { return id != UINT32_MAX; }
+};
+
+struct GraphBuffer {
+  uint32_t id = UINT32_MAX;
+  bool valid() const { return id != UINT32_MAX; }
+};
+
+// Frame graph. Each frame the renderer declares its passes and the images and
+// buffers each of them reads and writes; Compile() then
+//  - drops passes whose results nothing consumes,
+//  - places transient images in the RenderTargetPool, aliasing memory between
+//    images whose lifetimes do not overlap,
+//  - works out the layout transitions and the minimal set of barriers, batched
+//    into one vkCmdPipelineBarrier per pass,
+//  - creates render passes with load/store ops derived from the declared uses.
+// The compiled result is reused for as long as the declarations stay the same,
+// which is almost every frame; only imported handles (e.g. the swapchain
+// image) are looked up again.
+//
+// Graphics passes run inside a render pass that the graph begins and ends.
+// Pipelines for them are created against GetCompatibleRenderPass().
+class RenderGraph {
+ public:
+  using ExecuteFunction = std::function<void(VkCommandBuffer cmd)>;
+
+  class PassBuilder {
+   public:
+    // Attachments. Without a clear value, existing contents are loaded.
+    PassBuilder& WriteColor(GraphImage image,
+                            std::optional<VkClearColorValue> clear = {});
+    PassBuilder& WriteDepth(GraphImage image,
+                            std::optional<float> clear = std::nullopt);
+    // Depth attachment that is tested against but not written.
+    PassBuilder& ReadDepth(GraphImage image);
+
+    PassBuilder& ReadTexture(GraphImage image, VkPipelineStageFlags stages);
+    PassBuilder& ReadStorage(GraphImage image, VkPipelineStageFlags stages);
+    PassBuilder& WriteStorage(GraphImage image, VkPipelineStageFlags stages);
+    PassBuilder& CopyFrom(GraphImage image);
+    PassBuilder& CopyTo(GraphImage image);
+
+    PassBuilder& ReadBuffer(GraphBuffer buffer, VkPipelineStageFlags stages,
+                            VkAccessFlags access);
+    PassBuilder& WriteBuffer(GraphBuffer buffer, VkPipelineStageFlags stages,
+                             VkAccessFlags access);
+
+    // Keeps the pass even if nothing in the graph consumes its output, e.g.
+    // readbacks.
+    PassBuilder& SideEffects();
+
+    // Restricts rendering to the top left `extent` of the attachments, e.g.
+    // when drawing at a lower resolution into full size targets. Clears only
+    // touch the render area.
+    PassBuilder& RenderArea(VkExtent2D extent);
+
+    // Renders the first `view_count` layers of the attachments in one go
+    // with multiview: draws are broadcast to every layer and shaders select
+    // per view data with gl_ViewIndex. Pipelines must be created against
+    // GetCompatibleRenderPass() with the same view count.
+    PassBuilder& Multiview(uint32_t view_count);
+
+   private:
+    friend class RenderGraph;
+
+    PassBuilder(RenderGraph& graph, uint32_t pass)
+        : graph_(graph), pass_(pass) {}
+
+    RenderGraph& graph_;
+    uint32_t pass_;
+  };
+
+  RenderGraph(VkDevice device, RenderTargetPool& pool,
+              RetirementQueue& retirement_queue)
+      : device_(device), pool_(pool), retirement_queue_(retirement_queue) {}
+
+  // Starts declaring the graph for `frame`. Handles from earlier frames are
+  // invalid afterwards.
+  void BeginFrame(uint64_t frame);
+
+  // An image that only lives within the frame. Its usage flags are derived
+  // from the passes that use it.
+  GraphImage CreateImage(const char* name, VkFormat format, VkExtent2D extent,
+                         uint32_t layers = 1,
+                         VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT);
+
+  // An image owned outside the graph. It is in `initial` when the frame
+  // starts and is transitioned to `final_layout` at the end, unless that is
+  // VK_IMAGE_LAYOUT_UNDEFINED.
+  GraphImage ImportImage(const char* name, VkImage image, VkImageView view,
+                         const RenderTargetDesc& desc,
+                         const ResourceState& initial,
+                         VkImageLayout final_layout);
+
+  GraphBuffer ImportBuffer(const char* name, VkBuffer buffer,
+                           const ResourceState& initial = {});
+
+  PassBuilder AddPass(const char* name, ExecuteFunction execute);
+
+  bool Compile();
+  void Execute(VkCommandBuffer cmd);
+
+  // Valid between Compile() and the next BeginFrame().
+  VkImage GetImage(GraphImage image) const {
+    return resources_[image.id].image;
+  }
+  // Images created in the graph have 2D array views whatever their layer
+  // count, so shaders bind them as arrays; imported images keep the view
+  // they were imported with.
+  VkImageView GetView(GraphImage image) const {
+    return resources_[image.id].view;
+  }
+  VkBuffer GetBuffer(GraphBuffer buffer) const {
+    return resources_[buffer.id].buffer;
+  }
+
+  // A render pass compatible with every pass that writes the given formats
+  // with the given number of views. Pass VK_FORMAT_UNDEFINED for no depth
+  // attachment.
+  VkRenderPass GetCompatibleRenderPass(const std::vector<VkFormat>& colors,
+                                       VkFormat depth,
+                                       uint32_t view_count = 1);
+
+  // Hands all render passes and framebuffers to `queue`. Used at shutdown.
+  void Release(DeletionQueue& queue);
+
+ private:
+  enum class Attachment : uint8_t { kNone, kColor, kDepth };
+
+  struct Use {
+    uint32_t resource;
+    ResourceState state;
+    VkImageUsageFlags usage;
+    Attachment attachment;
+    bool write;
+    bool clear;
+    VkClearValue clear_value;
+  };
+
+  struct Pass {
+    const char* name;
+    ExecuteFunction execute;
+    std::vector<Use> uses;
+    bool side_effects;
+    // Zero for the whole attachment.
+    VkExtent2D render_area;
+    // Zero without multiview.
+    uint32_t view_mask;
+  };
+
+  struct Resource {
+    const char* name;
+    bool imported;
+    bool is_buffer;
+    RenderTargetDesc desc;
+    ResourceState initial;
+    VkImageLayout final_layout;
+
+    VkImage image;
+    VkImageView view;
+    VkBuffer buffer;
+  };
+
+  struct Barrier {
+    uint32_t resource;
+    ResourceState from;
+    ResourceState to;
+  };
+
+  struct CompiledPass {
+    uint32_t pass;
+    std::vector<Barrier> barriers;
+    VkRenderPass render_pass;
+    // Indices into the pass's uses, in attachment order.
+    std::vector<uint32_t> attachments;
+    VkExtent2D extent;
+    uint32_t layers;
+  };
+
+  struct Transient {
+    uint32_t resource;
+    uint32_t first_use;
+    uint32_t last_use;
+    RenderTargetHandle target;
+  };
+
+  struct AttachmentKey {
+    VkFormat format;
+    VkSampleCountFlagBits samples;
+    VkAttachmentLoadOp load;
+    VkAttachmentStoreOp store;
+    VkImageLayout layout;
+
+    bool operator==(const AttachmentKey& other) const {
+      return format == other.format && samples == other.samples &&
+             load == other.load && store == other.store &&
+             layout == other.layout;
+    }
+  };
+
+  struct RenderPassKey {
+    std::vector<AttachmentKey> colors;
+    std::optional<AttachmentKey> depth;
+    uint32_t view_mask = 0;
+
+    bool operator==(const RenderPassKey& other) const {
+      return colors == other.colors && depth == other.depth &&
+             view_mask == other.view_mask;
+    }
+  };
+
+  constexpr static size_t kMaxAttachments = 8;
+
+  struct FramebufferKey {
+    VkRenderPass render_pass;
+    std::array<VkImageView, kMaxAttachments> views;
+    uint32_t width;
+    uint32_t height;
+    uint32_t layers;
+
+    bool operator==(const FramebufferKey& other) const {
+      return render_pass == other.render_pass && views == other.views &&
+             width == other.width && height == other.height &&
+             layers == other.layers;
+    }
+  };
+
+  struct FramebufferKeyHash {
+    size_t operator()(const FramebufferKey& key) const;
+  };
+
+  struct CachedFramebuffer {
+    VkFramebuffer framebuffer;
+    uint64_t last_used_frame;
+  };
+
+  // Framebuffers reference image views, so they have to go well before the
+  // render target pool evicts the images behind them.
+  constexpr static uint64_t kFramebufferEvictFrames = 60;
+
+  void AddUse(uint32_t pass, const Use& use);
+
+  void BuildSignature();
+  bool CompileGraph();
+  bool AllocateTransients();
+  std::optional<VkRenderPass> GetRenderPass(const RenderPassKey& key);
+  std::optional<VkFramebuffer> GetFramebuffer(const CompiledPass& compiled);
+  VkImageSubresourceRange GetRange(const Resource& resource) const;
+
+  VkDevice device_;
+  RenderTargetPool& pool_;
+  RetirementQueue& retirement_queue_;
+
+  uint64_t frame_ = 0;
+
+  // Declarations for the current frame. Pass objects are reused across frames
+  // so that their use lists keep their capacity.
+  std::vector<Pass> passes_;
+  uint32_t pass_count_ = 0;
+  std::vector<Resource> resources_;
+
+  // Compiled state, valid while signature_ matches the declarations.
+  std::vector<uint64_t> signature_;
+  std::vector<uint64_t> compiled_signature_;
+  std::vector<CompiledPass> compiled_;
+  std::vector<Barrier> final_barriers_;
+  std::vector<Transient> transients_;
+
+  BarrierBatch barriers_;
+  std::vector<VkClearValue> clear_values_;
+
+  std::vector<std::pair<RenderPassKey, VkRenderPass>> render_passes_;
+  std::unordered_map<FramebufferKey, CachedFramebuffer, FramebufferKeyHash>
+      framebuffers_;
+};
+
+}  // namespace vk
@@ -0,0 +1,289 @@
+#include "render_target_pool.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+
+#include "vk_init.hpp"
+
+namespace vk {
+
+bool IsDepthFormat(VkFormat format) {
+  switch (format) {
+    case VK_FORMAT_D16_UNORM:
+    case VK_FORMAT_X8_D24_UNORM_PACK32:
+    case VK_FORMAT_D32_SFLOAT:
+    case VK_FORMAT_D16_UNORM_S8_UINT:
+    case VK_FORMAT_D24_UNORM_S8_UINT:
+    case VK_FORMAT_D32_SFLOAT_S8_UINT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void RenderTargetPool::BeginFrame(uint64_t frame) {
+  frame_ = frame;
+  previous_requests_.swap(requests_);
+  requests_.clear();
+  Evict();
+}
+
+RenderTargetHandle RenderTargetPool::Request(const RenderTargetDesc& desc,
+                                             uint32_t first_use,
+                                             uint32_t last_use) {
+  requests_.push_back({desc, first_use, std::max(first_use, last_use)});
+  return static_cast<RenderTargetHandle>(requests_.size() - 1);
+}
+
+bool RenderTargetPool::Allocate() {
+  // Most frames declare exactly what the previous frame did, in which case
+  // the previous assignment still holds.
+  if (requests_ != previous_requests_ ||
+      assignments_.size() != requests_.size()) {
+    for (PooledTarget& target : targets_) {
+      target.assigned = false;
+    }
+    for (MemoryBlock& block : blocks_) {
+      block.busy_until = -1;
+      block.occupants = 0;
+    }
+    assignments_.assign(requests_.size(), 0);
+
+    // Greedy interval assignment: visiting requests in order of first use
+    // means a block is free for a request as soon as its last occupant's
+    // lifetime ended before the request's first use.
+    std::vector<size_t> order(requests_.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return requests_[a].first_use < requests_[b].first_use;
+    });
+
+    for (size_t index : order) {
+      if (!Assign(index)) {
+        return false;
+      }
+    }
+
+    for (PooledTarget& target : targets_) {
+      if (target.assigned) {
+        target.target.aliased = blocks_[target.block].occupants > 1;
+      }
+    }
+  }
+
+  for (PooledTarget& target : targets_) {
+    if (target.assigned) {
+      target.last_used_frame = frame_;
+      blocks_[target.block].last_used_frame = frame_;
+    }
+  }
+  return true;
+}
+
+bool RenderTargetPool::Assign(size_t request_index) {
+  const TargetRequest& request = requests_[request_index];
+
+  // Prefer an existing image of the same shape whose memory is free for the
+  // whole lifetime of this request.
+  for (size_t i = 0; i < targets_.size(); i++) {
+    PooledTarget& candidate = targets_[i];
+    if (candidate.target.image == VK_NULL_HANDLE || candidate.assigned ||
+        candidate.target.desc != request.desc) {
+      continue;
+    }
+    MemoryBlock& block = blocks_[candidate.block];
+    if (block.busy_until >= static_cast<int64_t>(request.first_use)) {
+      continue;
+    }
+
+    candidate.assigned = true;
+    block.busy_until = request.last_use;
+    block.occupants++;
+    assignments_[request_index] = i;
+    return true;
+  }
+
+  PooledTarget pooled = {};
+  pooled.target.desc = request.desc;
+
+  VkExtent3D extent = {request.desc.extent.width, request.desc.extent.height,
+                       1};
+  VkImageCreateInfo image_info =
+      init::ImageCreateInfo(request.desc.format, request.desc.usage, extent);
+  image_info.samples = request.desc.samples;
+  image_info.arrayLayers = request.desc.layers;
+
+  if (vkCreateImage(device_, &image_info, nullptr, &pooled.target.image) !=
+      VK_SUCCESS) {
+    std::cerr << "Error creating render target image.\n";
+    return false;
+  }
+  vkGetImageMemoryRequirements(device_, pooled.target.image,
+                               &pooled.requirements);
+
+  std::optional<size_t> block =
+      FindBlock(pooled.requirements, request.first_use);
+  if (!block.has_value()) {
+    const bool transient =
+        request.desc.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    block = CreateBlock(pooled.requirements, transient);
+  }
+  if (!block.has_value() ||
+      vmaBindImageMemory(allocator_, blocks_[block.value()].allocation,
+                         pooled.target.image) != VK_SUCCESS ||
+      !CreateView(pooled.target)) {
+    std::cerr << "Error allocating render target memory.\n";
+    vkDestroyImage(device_, pooled.target.image, nullptr);
+    return false;
+  }
+
+  pooled.block = block.value();
+  pooled.assigned = true;
+  pooled.last_used_frame = frame_;
+
+  MemoryBlock& memory = blocks_[pooled.block];
+  memory.busy_until = request.last_use;
+  memory.occupants++;
+
+  // Reuse a slot freed by eviction so that indices stay stable.
+  auto slot = std::find_if(
+      targets_.begin(), targets_.end(),
+      [](const PooledTarget& t) { return t.target.image == VK_NULL_HANDLE; });
+  if (slot == targets_.end()) {
+    targets_.push_back(pooled);
+    slot = targets_.end() - 1;
+  } else {
+    *slot = pooled;
+  }
+  assignments_[request_index] = slot - targets_.begin();
+  return true;
+}
+
+std::optional<size_t> RenderTargetPool::FindBlock(
+    const VkMemoryRequirements& requirements, uint32_t first_use) const {
+  std::optional<size_t> best = std::nullopt;
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    const MemoryBlock& block = blocks_[i];
+    if (block.allocation == VK_NULL_HANDLE ||
+        block.busy_until >= static_cast<int64_t>(first_use) ||
+        block.size < requirements.size ||
+        block.alignment % requirements.alignment != 0 ||
+        !(requirements.memoryTypeBits & (1u << block.memory_type))) {
+      continue;
+    }
+    // Best fit keeps large blocks available for large targets.
+    if (!best.has_value() || block.size < blocks_[best.value()].size) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+std::optional<size_t> RenderTargetPool::CreateBlock(
+    const VkMemoryRequirements& requirements, bool transient) {
+  VkMemoryRequirements block_requirements = requirements;
+  block_requirements.alignment =
+      std::max(requirements.alignment, kMinBlockAlignment);
+
+  VmaAllocationCreateInfo allocation_info = {};
+  allocation_info.flags = VMA_ALLOCATION_CREATE_CAN_ALIAS_BIT;
+  allocation_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+  if (transient) {
+    // Lazily allocated memory mostly exists on tiled GPUs. Everywhere else
+    // transient targets simply go to device local memory.
+    VmaAllocationCreateInfo lazy_info = allocation_info;
+    lazy_info.usage = VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED;
+    uint32_t memory_type;
+    if (vmaFindMemoryTypeIndex(allocator_, requirements.memoryTypeBits,
+                               &lazy_info, &memory_type) == VK_SUCCESS) {
+      allocation_info = lazy_info;
+    }
+  }
+
+  MemoryBlock block = {};
+  VmaAllocationInfo info;
+  if (vmaAllocateMemory(allocator_, &block_requirements, &allocation_info,
+                        &block.allocation, &info) != VK_SUCCESS) {
+    return std::nullopt;
+  }
+  block.size = requirements.size;
+  block.alignment = block_requirements.alignment;
+  block.memory_type = info.memoryType;
+  block.last_used_frame = frame_;
+  block.busy_until = -1;
+  block.occupants = 0;
+
+  auto slot = std::find_if(
+      blocks_.begin(), blocks_.end(),
+      [](const MemoryBlock& b) { return b.allocation == VK_NULL_HANDLE; });
+  if (slot == blocks_.end()) {
+    blocks_.push_back(block);
+    return blocks_.size() - 1;
+  }
+  *slot = block;
+  return slot - blocks_.begin();
+}
+
+bool RenderTargetPool::CreateView(RenderTarget& target) {
+  VkImageAspectFlags aspect = IsDepthFormat(target.desc.format)
+                                  ? VK_IMAGE_ASPECT_DEPTH_BIT
+                                  : VK_IMAGE_ASPECT_COLOR_BIT;
+  VkImageViewCreateInfo view_info =
+      init::ImageViewCreateInfo(target.desc.format, target.image, aspect);
+  // Arrayed even with a single layer: the shaders that sample or store to
+  // targets declare them as arrays, one layer per view, and the view type
+  // must match whatever the view count.
+  view_info.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+  view_info.subresourceRange.layerCount = target.desc.layers;
+  return vkCreateImageView(device_, &view_info, nullptr, &target.view) ==
+         VK_SUCCESS;
+}
+
+void RenderTargetPool::Evict() {
+  for (PooledTarget& pooled : targets_) {
+    if (pooled.target.image == VK_NULL_HANDLE || pooled.assigned ||
+        frame_ - pooled.last_used_frame < kEvictAfterFrames) {
+      continue;
+    }
+    // The memory belongs to the block, so only the image itself is destroyed.
+    retirement_queue_.Retire(frame_, pooled.target.view);
+    retirement_queue_.Retire(frame_, pooled.target.image,
+                             VmaAllocation{VK_NULL_HANDLE});
+    pooled.target.image = VK_NULL_HANDLE;
+    pooled.target.view = VK_NULL_HANDLE;
+  }
+
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    MemoryBlock& block = blocks_[i];
+    if (block.allocation == VK_NULL_HANDLE ||
+        frame_ - block.last_used_frame < kEvictAfterFrames) {
+      continue;
+    }
+    const bool referenced =
+        std::any_of(targets_.begin(), targets_.end(), [=](const auto& t) {
+          return t.target.image != VK_NULL_HANDLE && t.block == i;
+        });
+    if (!referenced) {
+      retirement_queue_.Retire(frame_, block.allocation);
+      block.allocation = VK_NULL_HANDLE;
+    }
+  }
+}
+
+void RenderTargetPool::Release(DeletionQueue& queue) {
+  for (PooledTarget& pooled : targets_) {
+    queue.Push(pooled.target.view);
+    queue.Push(pooled.target.image, VmaAllocation{VK_NULL_HANDLE});
+  }
+  targets_.clear();
+  assignments_.clear();
+
+  for (MemoryBlock& block : blocks_) {
+    queue.Push(block.allocation);
+  }
+  blocks_.clear();
+}
+
+}  // namespace vk
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "deletion_queue.hpp"
+#include "retirement_queue.hpp"
+
+namespace vk {
+
+struct RenderTargetDesc {
+  VkFormat format;
+  VkExtent2D extent;
+  VkImageUsageFlags usage;
+  VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+  uint32_t layers = 1;
+
+  bool operator==(const RenderTargetDesc& other) const {
+    return format == other.format && extent.width == other.extent.width &&
+           extent.height == other.extent.height && usage == other.usage &&
+           samples == other.samples && layers == other.layers;
+  }
+  bool operator!=(const RenderTargetDesc& other) const {
+    return !(*this == other);
+  }
+};
+
+struct RenderTarget {
+  VkImage image = VK_NULL_HANDLE;
+  // A 2D array view of every layer, even for single layer targets.
+  VkImageView view = VK_NULL_HANDLE;
+  RenderTargetDesc desc;
+  // True when the target's memory is shared with another target in the same
+  // frame. Its contents do not survive outside of its declared lifetime and
+  // it must be treated as VK_IMAGE_LAYOUT_UNDEFINED on first use.
+  bool aliased = false;
+};
+
+using RenderTargetHandle = uint32_t;
+
+bool IsDepthFormat(VkFormat format);
+
+// Hands out intermediate render targets (depth buffers, offscreen color
+// targets, shadow maps) and reuses them across frames.
+//
+// Each frame, callers declare the targets they need together with the range of
+// passes that use them. Allocate() then assigns images so that targets whose
+// lifetimes do not overlap share memory. Images and memory blocks are cached,
+// so a frame with the same requests as the previous one creates nothing.
+// Targets with VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT are placed in lazily
+// allocated memory when the device has it, which on tiled GPUs means they may
+// never be backed by physical memory at all.
+class RenderTargetPool {
+ public:
+  RenderTargetPool(VkDevice device, VmaAllocator allocator,
+                   RetirementQueue& retirement_queue)
+      : device_(device),
+        allocator_(allocator),
+        retirement_queue_(retirement_queue) {}
+
+  // Starts declaring the targets for `frame`. Targets that went unused for a
+  // while are retired here.
+  void BeginFrame(uint64_t frame);
+
+  // Declares a target used from pass `first_use` through pass `last_use`.
+  // The handle is valid until the next BeginFrame().
+  RenderTargetHandle Request(const RenderTargetDesc& desc, uint32_t first_use,
+                             uint32_t last_use);
+
+  // Assigns images to every request made since BeginFrame().
+  bool Allocate();
+
+  const RenderTarget& Get(RenderTargetHandle handle) const {
+    return targets_[assignments_[handle]].target;
+  }
+
+  // Hands every image and memory block to `queue`. Used at shutdown.
+  void Release(DeletionQueue& queue);
+
+ private:
+  struct TargetRequest {
+    RenderTargetDesc desc;
+    uint32_t first_use;
+    uint32_t last_use;
+
+    bool operator==(const TargetRequest& other) const {
+      return desc == other.desc && first_use == other.first_use &&
+             last_use == other.last_use;
+    }
+  };
+
+  struct MemoryBlock {
+    VmaAllocation allocation;
+    VkDeviceSize size;
+    VkDeviceSize alignment;
+    uint32_t memory_type;
+    uint64_t last_used_frame;
+    // Last pass of the most recent target placed in this block while
+    // assigning the current frame, or -1 if none.
+    int64_t busy_until;
+    // Number of targets bound to this block in the current frame.
+    uint32_t occupants;
+  };
+
+  struct PooledTarget {
+    RenderTarget target;
+    VkMemoryRequirements requirements;
+    size_t block;
+    uint64_t last_used_frame;
+    bool assigned;
+  };
+
+  constexpr static uint64_t kEvictAfterFrames = 120;
+  constexpr static VkDeviceSize kMinBlockAlignment = 64 * 1024;
+
+  bool Assign(size_t request_index);
+  std::optional<size_t> FindBlock(const VkMemoryRequirements& requirements,
+                                  uint32_t first_use) const;
+  std::optional<size_t> CreateBlock(const VkMemoryRequirements& requirements,
+                                    bool transient);
+  bool CreateView(RenderTarget& target);
+  void Evict();
+
+  VkDevice device_;
+  VmaAllocator allocator_;
+  RetirementQueue& retirement_queue_;
+
+  uint64_t frame_ = 0;
+
+  std::vector<TargetRequest> requests_;
+  std::vector<TargetRequest> previous_requests_;
+  // Index into targets_ for each request.
+  std::vector<size_t> assignments_;
+
+  std::vector<PooledTarget> targets_;
+  std::vector<MemoryBlock> blocks_;
+};
+
+}  // namespace vk
@@ -0,0 +1,53 @@
+#include "render_thread.hpp"
+
+namespace vk {
+
+RenderThread::~RenderThread() { Stop(); }
+
+void RenderThread::Start() {
+  if (thread_.joinable()) {
+    return;
+  }
+  stopping_ = false;
+  thread_ = std::thread([this]() { Run(); });
+}
+
+void RenderThread::Stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  published_.notify_one();
+  thread_.join();
+}
+
+void RenderThread::Publish() {
+  snapshots_.Publish();
+  // Taking the lock orders the publication with the render thread's check,
+  // so the wakeup cannot be missed.
+  { std::lock_guard<std::mutex> lock(mutex_); }
+  published_.notify_one();
+}
+
+void RenderThread::Run() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      published_.wait(lock,
+                      [this]() { return stopping_ || snapshots_.fresh(); });
+      if (stopping_) {
+        return;
+      }
+    }
+
+    snapshots_.Acquire();
+    renderer_.ApplyScene(snapshots_.read_buffer());
+    renderer_.Draw();
+    frames_++;
+  }
+}
+
+}  // namespace vk
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "renderer.hpp"
+#include "scene_snapshot.hpp"
+#include "triple_buffer.hpp"
+
+namespace vk {
+
+// Draws frames with a Renderer on a thread of its own, from the scene
+// snapshots the simulation publishes, so that simulating the next step and
+// recording the previous one's command buffers overlap.
+//
+// Snapshots go through a triple buffer: the simulation never waits for the
+// renderer, and the renderer always draws the newest step. Steps published
+// faster than they are drawn are skipped, and the render thread sleeps until
+// a new step arrives, so frames are paced by the simulation.
+//
+// While started, the renderer belongs to the render thread; other threads
+// must not call it.
+class RenderThread {
+ public:
+  explicit RenderThread(Renderer& renderer) : renderer_(renderer) {}
+  // Stops the thread.
+  ~RenderThread();
+
+  RenderThread(const RenderThread&) = delete;
+  RenderThread& operator=(const RenderThread&) = delete;
+
+  void Start();
+  // Returns once the frame being drawn, if any, has been submitted.
+  void Stop();
+
+  // Simulation side. The snapshot for the next step. It holds an older
+  // step, so every field the simulation uses must be written.
+  SceneSnapshot& snapshot() { return snapshots_.write_buffer(); }
+  // Hands snapshot() to the render thread.
+  void Publish();
+
+  // Frames drawn so far.
+  uint64_t frames() const { return frames_; }
+
+ private:
+  void Run();
+
+  Renderer& renderer_;
+  util::TripleBuffer<SceneSnapshot> snapshots_;
+  std::atomic<uint64_t> frames_{0};
+
+  // Only for sleeping while no snapshot is waiting.
+  std::mutex mutex_;
+  std::condition_variable published_;
+  bool stopping_ = false;
+
+  std::thread thread_;
+};
+
+}  // namespace vk
@@ -4,151 +4,52 @@
 #include <vk_mem_alloc.h>
 
 #include <algorithm>
+#include <cassert>
+#include <chrono>
 #include <cmath>
 #include <filesystem>
 #include <glm/gtx/transform.hpp>
 #include <iostream>
+#include <iterator>
 #include <optional>
-#include <unordered_set>
+#include <thread>
+#include <tuple>
 
+#include "defer.hpp"
+#include "pipeline_manifest.hpp"
 #include "shader.hpp"
 #include "vk_init.hpp"
 
 namespace {
 
+// Matches CameraBuffer in the mesh shaders, one entry per view.
 struct GpuCameraData {
-  glm::mat4 view;
-  glm::mat4 projection;
-  glm::mat4 view_projection;
+  vk::RenderView views[vk::kMaxViews];
 };
 
+// Matches ObjectData in the mesh shaders.
 struct GpuObjectData {
   glm::mat4 model;
+  // Index into the material table.
+  uint32_t material;
+  uint32_t pad[3];
 };
 
-constexpr uint64_t kTimeoutNanoSecs = 1000000000;
-
-#ifdef _DEBUG
-constexpr bool kEnableValidationLayers = true;
-#else
-constexpr bool kEnableValidationLayers = false;
-#endif
-
-const std::vector<const char*> kValidationLayers = {
-    "VK_LAYER_KHRONOS_validation"};
-
-const std::vector<const char*> kDeviceExtensions = {
-    VK_KHR_SWAPCHAIN_EXTENSION_NAME,
-    VK_KHR_SHADER_DRAW_PARAMETERS_EXTENSION_NAME,
-};
-
-bool VerifyValidationLayersSupported(const std::vector<const char*>& layers) {
-  uint32_t layer_count;
-  vkEnumerateInstanceLayerProperties(&layer_count, nullptr);
-  std::vector<VkLayerProperties> available_layers(layer_count);
-  vkEnumerateInstanceLayerProperties(&layer_count, available_layers.data());
-
-  for (const char* layer_name : layers) {
-    bool layer_found = false;
-    for (const auto& properties : available_layers) {
-      if (strcmp(layer_name, properties.layerName) == 0) {
-        layer_found = true;
-        break;
-      }
-    }
-
-    if (!layer_found) return false;
-  }
-  return true;
-}
-
-bool VerifyDeviceExtensionsSupported(VkPhysicalDevice device) {
-  uint32_t count;
-  vkEnumerateDeviceExtensionProperties(device, nullptr, &count, nullptr);
-  std::vector<VkExtensionProperties> available(count);
-  vkEnumerateDeviceExtensionProperties(device, nullptr, &count,
-                                       available.data());
-
-  int supported = 0;
-  for (const auto& extension : available) {
-    for (const char* required : kDeviceExtensions) {
-      if (strcmp(extension.extensionName, required)) {
-        supported++;
-        break;
-      }
-    }
-    if (supported == kDeviceExtensions.size()) return true;
-  }
-
-  return false;
-}
-
-struct SwapchainDetails {
-  VkSurfaceCapabilitiesKHR capabilities;
-  std::vector<VkSurfaceFormatKHR> formats;
-  std::vector<VkPresentModeKHR> present_modes;
-};
-
-struct SelectedDeviceDetails {
-  VkPhysicalDevice device;
-  VkPhysicalDeviceProperties properties;
-  uint32_t graphics_queue_family;
-  SwapchainDetails swapchain_details;
+// Matches ObjectGeometry in visibility_resolve.frag.
+struct GpuObjectGeometry {
+  uint32_t first_vertex;
+  uint32_t first_index;
 };
 
-std::optional<uint32_t> GetQueueFamilyIndices(VkPhysicalDevice device,
-                                              VkSurfaceKHR& surface) {
-  uint32_t count = 0;
-  vkGetPhysicalDeviceQueueFamilyProperties(device, &count, nullptr);
-  std::vector<VkQueueFamilyProperties> families(count);
-
-  vkGetPhysicalDeviceQueueFamilyProperties(device, &count, families.data());
-  std::optional<uint32_t> result = std::nullopt;
-  for (int i = 0; i < count; i++) {
-    VkBool32 present_supported = false;
-    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
-                                         &present_supported);
-    if (present_supported && families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-      result = i;
-    }
-  }
-  return result;
-}
-
-std::optional<SwapchainDetails> GetSwapchainDetails(VkPhysicalDevice device,
-                                                    VkSurfaceKHR surface) {
-  // We need to query three properties.
-  // 1. Basic surface capabilities (min/max number of images in swapchain,
-  // width/height of images).
-  // 2. Surface formats (pixel format, color space).
-  // 3. Available presentation modes.
-
-  SwapchainDetails details;
-
-  uint32_t format_count;
-  vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &format_count, nullptr);
-  if (format_count == 0) {
-    return std::nullopt;
-  }
-  details.formats.resize(format_count);
-  vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &format_count,
-                                       details.formats.data());
+// Capacity of the per frame object buffers. Creates beyond it are dropped.
+constexpr uint32_t kMaxObjects = 10'000;
 
-  uint32_t present_mode_count;
-  vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface,
-                                            &present_mode_count, nullptr);
-  if (present_mode_count == 0) {
-    return std::nullopt;
-  }
-  details.present_modes.resize(present_mode_count);
-  vkGetPhysicalDeviceSurfacePresentModesKHR(
-      device, surface, &present_mode_count, details.present_modes.data());
+constexpr uint64_t kTimeoutNanoSecs = 1000000000;
 
-  vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface,
-                                            &details.capabilities);
+constexpr size_t kFrameArenaSize = 1024 * 1024;
 
-  return details;
-}
+constexpr float kNearPlane = 0.1f;
+constexpr float kFarPlane = 200.f;
 
 VkSurfaceFormatKHR SelectSwapSurfaceFormat(
     const std::vector<VkSurfaceFormatKHR>& available_formats) {
@@ -187,279 +88,160 @@ VkExtent2D SelectSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities,
   return extent;
 }
 
-std::optional<SelectedDeviceDetails> SelectDevice(
-    std::vector<VkPhysicalDevice>& devices, VkSurfaceKHR& surface) {
-  std::vector<int> scores(devices.size());
-  int max_score = 0;
-  int max_index = -1;
-  uint32_t max_queue_family = 0;
-  SwapchainDetails max_swapchain_details;
-  for (int i = 0; i < devices.size(); i++) {
-    VkPhysicalDevice device = devices[i];
-    std::optional<uint32_t> queue_family =
-        GetQueueFamilyIndices(device, surface);
-    // Get the graphics queue. If there isn't one, this device isn't supported.
-    if (!queue_family.has_value()) {
-      continue;
-    }
-
-    if (!VerifyDeviceExtensionsSupported(device)) {
-      continue;
-    }
-
-    std::optional<SwapchainDetails> swapchain_details =
-        GetSwapchainDetails(device, surface);
-    if (!swapchain_details.has_value()) {
-      continue;
-    }
-
-    //  Get device properties.
-    VkPhysicalDeviceProperties properties;
-    vkGetPhysicalDeviceProperties(device, &properties);
-
-    // We want to support the SPIR-V DrawParameters capability.
-    VkPhysicalDeviceShaderDrawParametersFeatures ext_feature = {};
-    ext_feature.sType =
-        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_DRAW_PARAMETERS_FEATURES;
-    ext_feature.pNext = nullptr;
-
-    VkPhysicalDeviceFeatures2 features;
-    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
-    features.pNext = &ext_feature;
-    vkGetPhysicalDeviceFeatures2(device, &features);
-    if (ext_feature.shaderDrawParameters == VK_FALSE) continue;
-    if (features.features.geometryShader == VK_FALSE) continue;
-    if (properties.apiVersion < VK_API_VERSION_1_1) continue;
-    // Rate suitability.
-    int score = 0;
-    // Discrete GPUs have performance advantages.
-    if (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
-      score += 1000;
-    }
-    // Maximum possible size of textures.
-    score += properties.limits.maxImageDimension2D;
-
-    if (score > max_score) {
-      max_score = score;
-      max_index = i;
-      max_queue_family = queue_family.value();
-      max_swapchain_details = std::move(swapchain_details.value());
-    }
-  }
-  if (max_index < 0) {
-    // Unable to find a suitable device.
-    return std::nullopt;
-  }
-
-  VkPhysicalDeviceProperties properties;
-  vkGetPhysicalDeviceProperties(devices[max_index], &properties);
-
-  return std::make_optional<SelectedDeviceDetails>(
-      {devices[max_index], properties, max_queue_family,
-       std::move(max_swapchain_details)});
-}
-
 }  // namespace
 
 namespace vk {
 
 bool Renderer::Init(InitParams params) {
-  // Initialize Vulkan application.
-  VkApplicationInfo app_info = {};
-  app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-  app_info.pNext = nullptr;
-  app_info.pApplicationName = params.application_name.c_str();
-  app_info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
-  app_info.pEngineName = "vk-renderer";
-  app_info.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-  app_info.apiVersion = VK_API_VERSION_1_1;
-
-  // Initialize Vulkan instance.
-  VkInstanceCreateInfo instance_info = {};
-  instance_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-  instance_info.pNext = nullptr;
-  instance_info.pApplicationInfo = &app_info;
-  instance_info.enabledExtensionCount = params.extensions.size();
-  instance_info.ppEnabledExtensionNames = params.extensions.data();
-  if (kEnableValidationLayers) {
-    if (!VerifyValidationLayersSupported(kValidationLayers)) {
+  depth_prepass_ = params.depth_prepass;
+  headless_ = params.headless;
+
+  // The device, allocator and queues may be shared with other renderers.
+  context_ = params.context;
+  if (!context_) {
+    DeviceContext::Params context_params;
+    context_params.application_name = params.application_name;
+    context_params.extensions = params.extensions;
+    context_params.window_handle = headless_ ? nullptr : params.window_handle;
+    context_params.async_compute = params.async_compute;
+    context_ = std::make_shared<DeviceContext>();
+    if (!context_->Init(context_params)) {
       return false;
     }
-    instance_info.enabledLayerCount =
-        static_cast<uint32_t>(kValidationLayers.size());
-    instance_info.ppEnabledLayerNames = kValidationLayers.data();
-  } else {
-    instance_info.enabledLayerCount = 0;
-  }
-
-  if (vkCreateInstance(&instance_info, nullptr, &instance_) != VK_SUCCESS) {
-    return false;
-  }
-  deletion_stack_.Push([=]() { vkDestroyInstance(instance_, nullptr); });
-
-  // Create the surface.
-  VkWin32SurfaceCreateInfoKHR surface_info = {};
-  surface_info.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
-  surface_info.pNext = nullptr;
-  surface_info.hwnd = params.window_handle;
-  surface_info.hinstance = GetModuleHandle(nullptr);
-  if (vkCreateWin32SurfaceKHR(instance_, &surface_info, nullptr, &surface_) !=
-      VK_SUCCESS) {
-    return false;
-  }
-  deletion_stack_.Push(
-      [&]() { vkDestroySurfaceKHR(instance_, surface_, nullptr); });
-
-  // Initialize the physical gpu.
-  uint32_t device_count = 0;
-  vkEnumeratePhysicalDevices(instance_, &device_count, nullptr);
-  if (device_count == 0) {
-    return false;
-  }
-  std::vector<VkPhysicalDevice> devices(device_count);
-  vkEnumeratePhysicalDevices(instance_, &device_count, devices.data());
-  std::optional<SelectedDeviceDetails> maybe_selected_device =
-      SelectDevice(devices, surface_);
-  if (!maybe_selected_device.has_value()) {
+  } else if (!headless_ && context_->headless()) {
+    std::cerr << "A windowed renderer needs a context with its window.\n";
     return false;
   }
-  SelectedDeviceDetails& selected_device = maybe_selected_device.value();
-  gpu_ = selected_device.device;
-  gpu_properties_ = selected_device.properties;
-
-  // Initialize the device queue.
-  VkDeviceQueueCreateInfo queue_info = {};
-  queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-  queue_info.pNext = nullptr;
-  queue_info.queueFamilyIndex = selected_device.graphics_queue_family;
-  queue_info.queueCount = 1;
-  float queue_priority = 1.0f;  // Highest priority since we only have 1.
-  queue_info.pQueuePriorities = &queue_priority;
-  graphics_queue_family_ = selected_device.graphics_queue_family;
-
-  // Initialize the logical device.
-  VkPhysicalDeviceFeatures device_features = {};
-  device_features.geometryShader = VK_TRUE;
-
-  VkDeviceCreateInfo device_info = {};
-  device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-  device_info.pNext = nullptr;
-
-  device_info.queueCreateInfoCount = 1;
-  device_info.pQueueCreateInfos = &queue_info;
-  device_info.pEnabledFeatures = &device_features;
-  device_info.enabledExtensionCount =
-      static_cast<uint32_t>(kDeviceExtensions.size());
-  device_info.ppEnabledExtensionNames = kDeviceExtensions.data();
-
-  if (kEnableValidationLayers) {
-    device_info.enabledLayerCount =
-        static_cast<uint32_t>(kValidationLayers.size());
-    device_info.ppEnabledLayerNames = kValidationLayers.data();
+  gpu_ = context_->gpu();
+  gpu_properties_ = context_->gpu_properties();
+  device_ = context_->device();
+  allocator_ = context_->allocator();
+  graphics_queue_ = context_->graphics_queue();
+  graphics_queue_family_ = context_->graphics_queue_family();
+  pipeline_cache_ = context_->pipeline_cache();
+
+  // Headless, an offscreen image stands in for the swapchain and frames are
+  // read back instead of presented.
+  if (headless_) {
+    swapchain_extent_ = {static_cast<uint32_t>(params.width),
+                         static_cast<uint32_t>(params.height)};
+    swapchain_image_format_ = kOffscreenFormat;
+    if (!InitOffscreenImage()) {
+      return false;
+    }
+    readback_ring_ = std::make_unique<ReadbackRing>(allocator_);
   } else {
-    device_info.enabledLayerCount = 0;
-  }
-
-  if (vkCreateDevice(gpu_, &device_info, nullptr, &device_) != VK_SUCCESS) {
-    return false;
+    // Initialize the swapchain.
+    std::optional<SwapchainDetails> swapchain_details =
+        context_->GetSwapchainDetails();
+    if (!swapchain_details.has_value()) {
+      return false;
+    }
+    VkSurfaceFormatKHR surface_format =
+        SelectSwapSurfaceFormat(swapchain_details->formats);
+    VkPresentModeKHR present_mode =
+        SelectSwapPresentMode(swapchain_details->present_modes);
+    swapchain_extent_ = SelectSwapExtent(swapchain_details->capabilities,
+                                         params.width, params.height);
+    swapchain_image_format_ = surface_format.format;
+
+    uint32_t image_count = std::clamp(
+        swapchain_details->capabilities.minImageCount + 1,
+        swapchain_details->capabilities.minImageCount,
+        swapchain_details->capabilities.maxImageCount);
+
+    VkSwapchainCreateInfoKHR swapchain_info = {};
+    swapchain_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+    swapchain_info.pNext = nullptr;
+
+    swapchain_info.surface = context_->surface();
+    swapchain_info.minImageCount = image_count;
+    swapchain_info.imageFormat = surface_format.format;
+    swapchain_info.imageColorSpace = surface_format.colorSpace;
+    swapchain_info.imageExtent = swapchain_extent_;
+    swapchain_info.imageArrayLayers = 1;
+    // Transfers for composing the views, upscaled or post-processed, into
+    // the swapchain. Without them the scene can only be drawn to it
+    // directly, so everything that composes is turned off.
+    swapchain_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    if (swapchain_details->capabilities.supportedUsageFlags &
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT) {
+      swapchain_info.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    } else if (params.view_count > 1 ||
+               params.dynamic_resolution.has_value() ||
+               params.post_process.has_value()) {
+      std::cerr << "The swapchain cannot be a transfer destination, multiple "
+                   "views, dynamic resolution and post-processing are "
+                   "disabled.\n";
+      params.view_count = 1;
+      params.dynamic_resolution.reset();
+      params.post_process.reset();
+    }
+    // Currently, we're using the same queue for graphics and presentation.
+    // This would change if we weren't.
+    swapchain_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    swapchain_info.queueFamilyIndexCount = 0;
+    swapchain_info.pQueueFamilyIndices = nullptr;
+
+    // I.e. no rotation, etc.
+    swapchain_info.preTransform =
+        swapchain_details->capabilities.currentTransform;
+    // Alpha channel used for blending with other windows.
+    swapchain_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    swapchain_info.presentMode = present_mode;
+    swapchain_info.clipped = VK_TRUE;
+    // Specified when the window size changes.
+    swapchain_info.oldSwapchain = VK_NULL_HANDLE;
+
+    if (vkCreateSwapchainKHR(device_, &swapchain_info, nullptr,
+                             &swapchain_) != VK_SUCCESS) {
+      return false;
+    }
+    deletion_queue_.Push(swapchain_);
+
+    uint32_t swapchain_image_count;
+    vkGetSwapchainImagesKHR(device_, swapchain_, &swapchain_image_count,
+                            nullptr);
+    swapchain_images_.resize(swapchain_image_count);
+    vkGetSwapchainImagesKHR(device_, swapchain_, &swapchain_image_count,
+                            swapchain_images_.data());
   }
-  deletion_stack_.Push([&]() { vkDestroyDevice(device_, nullptr); });
-
-  // Initialize memory allocator.
-  VmaAllocatorCreateInfo allocator_info = {};
-  allocator_info.physicalDevice = gpu_;
-  allocator_info.device = device_;
-  allocator_info.instance = instance_;
-  vmaCreateAllocator(&allocator_info, &allocator_);
-  deletion_stack_.Push([&]() { vmaDestroyAllocator(allocator_); });
-
-  // Initialize the graphics queue.
-  vkGetDeviceQueue(device_, graphics_queue_family_, 0, &graphics_queue_);
-
-  // Initialize the swapchain.
-  VkSurfaceFormatKHR surface_format =
-      SelectSwapSurfaceFormat(selected_device.swapchain_details.formats);
-  VkPresentModeKHR present_mode =
-      SelectSwapPresentMode(selected_device.swapchain_details.present_modes);
-  swapchain_extent_ =
-      SelectSwapExtent(selected_device.swapchain_details.capabilities,
-                       params.width, params.height);
-  swapchain_image_format_ = surface_format.format;
-
-  uint32_t image_count = std::clamp(
-      selected_device.swapchain_details.capabilities.minImageCount + 1,
-      selected_device.swapchain_details.capabilities.minImageCount,
-      selected_device.swapchain_details.capabilities.maxImageCount);
-
-  VkSwapchainCreateInfoKHR swapchain_info = {};
-  swapchain_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-  swapchain_info.pNext = nullptr;
-
-  swapchain_info.surface = surface_;
-  swapchain_info.minImageCount = image_count;
-  swapchain_info.imageFormat = surface_format.format;
-  swapchain_info.imageColorSpace = surface_format.colorSpace;
-  swapchain_info.imageExtent = swapchain_extent_;
-  swapchain_info.imageArrayLayers = 1;
-  swapchain_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-  // Currently, we're using the same queue for graphics and presentation. This
-  // would change if we weren't.
-  swapchain_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-  swapchain_info.queueFamilyIndexCount = 0;
-  swapchain_info.pQueueFamilyIndices = nullptr;
-
-  // I.e. no rotation, etc.
-  swapchain_info.preTransform =
-      selected_device.swapchain_details.capabilities.currentTransform;
-  // Alpha channel used for blending with other windows.
-  swapchain_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-  swapchain_info.presentMode = present_mode;
-  swapchain_info.clipped = VK_TRUE;
-  // Specified when the window size changes.
-  swapchain_info.oldSwapchain = VK_NULL_HANDLE;
-
-  if (vkCreateSwapchainKHR(device_, &swapchain_info, nullptr, &swapchain_) !=
-      VK_SUCCESS) {
-    return false;
+  view_count_ = std::clamp(params.view_count, 1u, kMaxViews);
+  view_extent_ = {swapchain_extent_.width / view_count_,
+                  swapchain_extent_.height};
+  render_extent_ = view_extent_;
+
+  if (params.dynamic_resolution.has_value()) {
+    // The scene is upscaled with a linear blit.
+    VkFormatProperties format_properties;
+    vkGetPhysicalDeviceFormatProperties(gpu_, swapchain_image_format_,
+                                        &format_properties);
+    constexpr VkFormatFeatureFlags kBlitFeatures =
+        VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    if ((format_properties.optimalTilingFeatures & kBlitFeatures) ==
+        kBlitFeatures) {
+      dynamic_resolution_.emplace(params.dynamic_resolution.value());
+    } else {
+      std::cerr << "Swapchain format cannot be blitted, dynamic resolution "
+                   "is disabled.\n";
+    }
   }
-  deletion_stack_.Push(
-      [=]() { vkDestroySwapchainKHR(device_, swapchain_, nullptr); });
 
-  uint32_t swapchain_image_count;
-  vkGetSwapchainImagesKHR(device_, swapchain_, &swapchain_image_count, nullptr);
-  swapchain_images_.resize(swapchain_image_count);
-  vkGetSwapchainImagesKHR(device_, swapchain_, &swapchain_image_count,
-                          swapchain_images_.data());
-
-  // Initialize the depth image.
-  VkExtent3D depth_image_extent = {swapchain_extent_.width,
-                                   swapchain_extent_.height, 1};
+  // Intermediate targets such as the depth buffer are declared every frame
+  // in the render graph, which allocates them from the pool.
   depth_format_ = VK_FORMAT_D32_SFLOAT;
 
-  VkImageCreateInfo depth_image_info = init::ImageCreateInfo(
-      depth_format_, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-      depth_image_extent);
-
-  VmaAllocationCreateInfo depth_allocation_info = {};
-  depth_allocation_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-  depth_allocation_info.requiredFlags =
-      VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-  vmaCreateImage(allocator_, &depth_image_info, &depth_allocation_info,
-                 &depth_image_.image, &depth_image_.allocation, nullptr);
-  deletion_stack_.Push([=]() {
-    vmaDestroyImage(allocator_, depth_image_.image, depth_image_.allocation);
-  });
-
-  VkImageViewCreateInfo depth_image_view_info = init::ImageViewCreateInfo(
-      depth_format_, depth_image_.image, VK_IMAGE_ASPECT_DEPTH_BIT);
-
-  if (vkCreateImageView(device_, &depth_image_view_info, nullptr,
-                        &depth_image_view_) != VK_SUCCESS) {
-    return false;
+  render_target_pool_ = std::make_unique<RenderTargetPool>(device_, allocator_,
+                                                           retirement_queue_);
+  render_graph_ = std::make_unique<RenderGraph>(device_, *render_target_pool_,
+                                                retirement_queue_);
+  // A defragmentation moves memory across the whole allocator, so only a
+  // renderer with a context of its own may run one.
+  if (!params.context) {
+    defragmenter_ =
+        std::make_unique<Defragmenter>(device_, allocator_, kFrameOverlap);
   }
-  deletion_stack_.Push(
-      [=]() { vkDestroyImageView(device_, depth_image_view_, nullptr); });
 
   // Initialize the Image Views.
   VkImageViewCreateInfo image_view_info = {};
@@ -477,7 +259,7 @@ bool Renderer::Init(InitParams params) {
   image_view_info.subresourceRange.baseArrayLayer = 0;
   image_view_info.subresourceRange.layerCount = 1;
 
-  swapchain_image_views_.resize(swapchain_image_count);
+  swapchain_image_views_.resize(swapchain_images_.size());
   for (int i = 0; i < swapchain_image_views_.size(); i++) {
     image_view_info.image = swapchain_images_[i];
     if (vkCreateImageView(device_, &image_view_info, nullptr,
@@ -485,9 +267,7 @@ bool Renderer::Init(InitParams params) {
       return false;
     }
 
-    deletion_stack_.Push([=]() {
-      vkDestroyImageView(device_, swapchain_image_views_[i], nullptr);
-    });
+    deletion_queue_.Push(swapchain_image_views_[i]);
   }
 
   // Initialize the commands.
@@ -495,14 +275,14 @@ bool Renderer::Init(InitParams params) {
       graphics_queue_family_, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
 
   for (int i = 0; i < kFrameOverlap; i++) {
+    frames_[i].arena = util::LinearArena(kFrameArenaSize);
+
     if (vkCreateCommandPool(device_, &command_pool_info, nullptr,
                             &frames_[i].command_pool) != VK_SUCCESS) {
       return false;
     }
 
-    deletion_stack_.Push([=]() {
-      vkDestroyCommandPool(device_, frames_[i].command_pool, nullptr);
-    });
+    deletion_queue_.Push(frames_[i].command_pool);
 
     VkCommandBufferAllocateInfo allocate_info =
         init::CommandBufferAllocateInfo(frames_[i].command_pool, 1);
@@ -521,9 +301,7 @@ bool Renderer::Init(InitParams params) {
                           &upload_context.command_pool) != VK_SUCCESS) {
     return false;
   }
-  deletion_stack_.Push([=]() {
-    vkDestroyCommandPool(device_, upload_context.command_pool, nullptr);
-  });
+  deletion_queue_.Push(upload_context.command_pool);
 
   VkCommandBufferAllocateInfo upload_allocate_info =
       init::CommandBufferAllocateInfo(upload_context.command_pool, 1);
@@ -533,109 +311,6 @@ bool Renderer::Init(InitParams params) {
     return false;
   }
 
-  // Initialize the default renderpass.
-  VkAttachmentDescription color_attachment = {};
-  color_attachment.format = swapchain_image_format_;
-  color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
-  color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-  color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-  VkAttachmentReference color_attachment_ref = {};
-  color_attachment_ref.attachment = 0;
-  color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-  VkAttachmentDescription depth_attachment = {};
-  depth_attachment.flags = 0;
-  depth_attachment.format = depth_format_;
-  depth_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
-  depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-  depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  depth_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  depth_attachment.finalLayout =
-      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-  VkAttachmentReference depth_attachment_ref = {};
-  depth_attachment_ref.attachment = 1;
-  depth_attachment_ref.layout =
-      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-  VkSubpassDescription subpass = {};
-  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-  subpass.colorAttachmentCount = 1;
-  subpass.pColorAttachments = &color_attachment_ref;
-  subpass.pDepthStencilAttachment = &depth_attachment_ref;
-
-  VkAttachmentDescription attachments[2] = {color_attachment, depth_attachment};
-
-  VkSubpassDependency color_dependency = {};
-  color_dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-  color_dependency.dstSubpass = 0;
-  color_dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  color_dependency.srcAccessMask = 0;
-  color_dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  color_dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-  VkSubpassDependency depth_dependency = {};
-  depth_dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-  depth_dependency.dstSubpass = 0;
-  depth_dependency.srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
-                                  VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
-  depth_dependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
-                                  VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
-  depth_dependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
-  VkSubpassDependency dependencies[2] = {color_dependency, depth_dependency};
-
-  VkRenderPassCreateInfo renderpass_info = {};
-  renderpass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-  renderpass_info.pNext = nullptr;
-  renderpass_info.attachmentCount = 2;
-  renderpass_info.pAttachments = &attachments[0];
-  renderpass_info.subpassCount = 1;
-  renderpass_info.pSubpasses = &subpass;
-  renderpass_info.dependencyCount = 2;
-  renderpass_info.pDependencies = &dependencies[0];
-
-  if (vkCreateRenderPass(device_, &renderpass_info, nullptr, &renderpass_)) {
-    return false;
-  }
-  deletion_stack_.Push(
-      [=]() { vkDestroyRenderPass(device_, renderpass_, nullptr); });
-
-  // Initialize the framebuffers.
-  VkFramebufferCreateInfo framebuffer_info = {};
-  framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-  framebuffer_info.pNext = nullptr;
-
-  framebuffer_info.renderPass = renderpass_;
-  framebuffer_info.attachmentCount = 1;
-  framebuffer_info.width = swapchain_extent_.width;
-  framebuffer_info.height = swapchain_extent_.height;
-  framebuffer_info.layers = 1;
-
-  framebuffers_.resize(swapchain_image_count);
-  for (int i = 0; i < swapchain_image_count; i++) {
-    VkImageView attachments[2];
-    attachments[0] = swapchain_image_views_[i];
-    attachments[1] = depth_image_view_;
-
-    framebuffer_info.attachmentCount = 2;
-    framebuffer_info.pAttachments = attachments;
-
-    if (vkCreateFramebuffer(device_, &framebuffer_info, nullptr,
-                            &framebuffers_[i])) {
-      return false;
-    }
-    deletion_stack_.Push(
-        [=]() { vkDestroyFramebuffer(device_, framebuffers_[i], nullptr); });
-  }
-
   // Create synchronization structures.
   for (int i = 0; i < kFrameOverlap; i++) {
     VkFenceCreateInfo fence_info =
@@ -646,8 +321,7 @@ bool Renderer::Init(InitParams params) {
       return false;
     }
 
-    deletion_stack_.Push(
-        [=]() { vkDestroyFence(device_, frames_[i].render_fence, nullptr); });
+    deletion_queue_.Push(frames_[i].render_fence);
 
     VkSemaphoreCreateInfo semaphore_info = init::SemaphoreCreateInfo();
 
@@ -656,18 +330,14 @@ bool Renderer::Init(InitParams params) {
       return false;
     }
 
-    deletion_stack_.Push([=]() {
-      vkDestroySemaphore(device_, frames_[i].render_semaphore, nullptr);
-    });
+    deletion_queue_.Push(frames_[i].render_semaphore);
 
     if (vkCreateSemaphore(device_, &semaphore_info, nullptr,
                           &frames_[i].present_semaphore)) {
       return false;
     }
 
-    deletion_stack_.Push([=]() {
-      vkDestroySemaphore(device_, frames_[i].present_semaphore, nullptr);
-    });
+    deletion_queue_.Push(frames_[i].present_semaphore);
   }
 
   // We do not need to wait for this fence so we won't set
@@ -677,17 +347,85 @@ bool Renderer::Init(InitParams params) {
                     &upload_context.fence) != VK_SUCCESS) {
     return false;
   }
-  deletion_stack_.Push(
-      [=]() { vkDestroyFence(device_, upload_context.fence, nullptr); });
+  deletion_queue_.Push(upload_context.fence);
+
+  queue_submitter_ = std::make_unique<QueueSubmitter>(
+      device_, graphics_queue_, upload_context, context_->queue_mutex());
+
+  gpu_timer_ = std::make_unique<GpuTimer>(device_);
+  if (!gpu_timer_->Init(gpu_, graphics_queue_family_, kFrameOverlap)) {
+    return false;
+  }
+  // Buffers shared by both queues are created with concurrent sharing, so
+  // no ownership transfers are needed.
+  std::vector<uint32_t> lighting_queue_families;
+  std::optional<uint32_t> compute_queue_family;
+  if (params.async_compute) {
+    compute_queue_family = context_->compute_queue_family();
+  }
+  if (compute_queue_family.has_value()) {
+    async_compute_ = std::make_unique<AsyncCompute>(
+        device_, context_->compute_queue(), compute_queue_family.value(),
+        context_->queue_mutex());
+    if (!async_compute_->Init(kFrameOverlap)) {
+      return false;
+    }
+    compute_timer_ = std::make_unique<GpuTimer>(device_);
+    if (!compute_timer_->Init(gpu_, compute_queue_family.value(),
+                              kFrameOverlap)) {
+      return false;
+    }
+    lighting_queue_families = {graphics_queue_family_,
+                               compute_queue_family.value()};
+  }
+  if (params.quality_governor.has_value()) {
+    quality_governor_.emplace(params.quality_governor.value());
+  }
 
-  queue_submitter_ = std::make_unique<QueueSubmitter>(device_, graphics_queue_,
-                                                      upload_context);
   InitDescriptors();
 
+  lighting_ = std::make_unique<ClusteredLighting>(device_, allocator_);
+  if (!lighting_->Init(descriptor_pool_, kFrameOverlap, view_count_,
+                       lighting_queue_families)) {
+    return false;
+  }
+
+  shadows_ = std::make_unique<CascadedShadows>(device_, allocator_);
+  if (!shadows_->Init(descriptor_pool_, object_set_layout_, *render_graph_,
+                      depth_format_, kFrameOverlap)) {
+    return false;
+  }
+
+  scene_format_ = swapchain_image_format_;
+  if (params.post_process.has_value()) {
+    post_process_ = std::make_unique<PostProcess>(device_, allocator_);
+    if (!post_process_->Init(descriptor_pool_, *queue_submitter_,
+                             kFrameOverlap,
+                             std::move(params.post_process.value()))) {
+      return false;
+    }
+    scene_format_ = PostProcess::kSceneFormat;
+  }
+
+  pipeline_manifest_path_ = params.pipeline_manifest;
   if (!InitPipeline()) {
     return false;
   }
 
+  if (params.geometry_arena.has_value()) {
+    // The visibility shading binds a fifth set.
+    if (gpu_properties_.limits.maxBoundDescriptorSets < 5) {
+      std::cerr << "Too few descriptor sets, the visibility buffer is "
+                   "disabled.\n";
+    } else {
+      geometry_arena_ = std::make_unique<GeometryArena>(device_, allocator_);
+      geometry_arena_->Init(params.geometry_arena.value());
+      if (!InitVisibilityBuffer()) {
+        return false;
+      }
+    }
+  }
+
   if (!LoadMeshes()) {
     return false;
   }
@@ -696,6 +434,7 @@ bool Renderer::Init(InitParams params) {
 
   // Everything is initialized.
   initialized_ = true;
+  return true;
 }
 
 void Renderer::Shutdown() {
@@ -706,34 +445,221 @@ void Renderer::Shutdown() {
       return;
     }
   }
-  deletion_stack_.Flush();
-}
+  if (device_ != VK_NULL_HANDLE) {
+    if (defragmenter_) {
+      defragmenter_->Finish();
+    }
+    if (!pipeline_manifest_path_.empty()) {
+      pipeline_usage_.Save(pipeline_manifest_path_);
+    }
+    // Lets the optimized links still running finish, so that their
+    // pipelines are destroyed below.
+    pipeline_optimizer_.reset();
+    ApplyOptimizedVariants();
+    retirement_queue_.Flush(device_, allocator_);
+
+    // Meshes and materials own their resources so that they can be released
+    // individually at runtime.
+    for (auto& [name, mesh] : meshes_) {
+      if (cached_meshes_.count(name) > 0) {
+        continue;
+      }
+      deletion_queue_.Push(mesh.vertex_buffer.buffer,
+                           mesh.vertex_buffer.allocation);
+      deletion_queue_.Push(mesh.position_buffer.buffer,
+                           mesh.position_buffer.allocation);
+      deletion_queue_.Push(mesh.index_buffer.buffer,
+                           mesh.index_buffer.allocation);
+    }
+    meshes_.clear();
+    cached_meshes_.clear();
+    retired_models_.clear();
+
+    materials_.clear();
+    for (MaterialVariant& variant : material_variants_) {
+      for (VkPipeline pipeline :
+           {variant.pipeline, variant.prepass_pipeline,
+            variant.fragment_library, variant.prepass_fragment_library}) {
+        if (pipeline != VK_NULL_HANDLE) {
+          deletion_queue_.Push(pipeline);
+        }
+      }
+      variant = MaterialVariant{};
+    }
+    if (material_table_) {
+      material_table_->Release(deletion_queue_);
+    }
+
+    if (lighting_) {
+      lighting_->Release(deletion_queue_);
+    }
+    if (shadows_) {
+      shadows_->Release(deletion_queue_);
+    }
+    if (post_process_) {
+      post_process_->Release(deletion_queue_);
+    }
+    if (geometry_arena_) {
+      geometry_arena_->Release(deletion_queue_);
+    }
+    if (readback_ring_) {
+      readback_ring_->Release(deletion_queue_);
+    }
+    if (gpu_timer_) {
+      gpu_timer_->Release(deletion_queue_);
+    }
+    if (compute_timer_) {
+      compute_timer_->Release(deletion_queue_);
+    }
+    if (async_compute_) {
+      async_compute_->Release(deletion_queue_);
+    }
+    if (render_graph_) {
+      render_graph_->Release(deletion_queue_);
+    }
+    if (render_target_pool_) {
+      render_target_pool_->Release(deletion_queue_);
+    }
+
+    deletion_queue_.Flush(device_, allocator_);
+  }
 
-void Renderer::Draw() {
-  // TODO: Handle errors gracefully.
+  // The device-level objects belong to the context, which is destroyed
+  // along with the last renderer using it.
+  allocator_ = VK_NULL_HANDLE;
+  device_ = VK_NULL_HANDLE;
+  context_.reset();
+}
 
+bool Renderer::Draw() {
   FrameData& frame = GetFrame();
 
+  // A frame that is not submitted drops its readback requests, or the next
+  // frame, which takes over its number, would fulfill them with its image.
+  bool submitted = false;
+  DEFER([&]() {
+    if (!submitted && readback_ring_) {
+      readback_ring_->Cancel(framenumber_);
+    }
+  });
+
   // Wait until the GPU has finished rendering the last frame.
   if (vkWaitForFences(device_, 1, &frame.render_fence, true,
                       kTimeoutNanoSecs) != VK_SUCCESS) {
-    return;
+    return false;
   }
-  if (vkResetFences(device_, 1, &frame.render_fence) != VK_SUCCESS) {
-    return;
+
+  // Semaphores signaled for this frame that its graphics submit has not
+  // waited on yet. A frame abandoned after signaling them still submits an
+  // empty batch that waits on them and signals the fence, so that they are
+  // not signaled twice and the slot's next use waits for the GPU work
+  // already queued, e.g. before reusing the compute command buffer.
+  VkSemaphore pending_semaphores[2];
+  uint32_t pending_count = 0;
+  DEFER([&]() {
+    if (pending_count == 0) {
+      return;
+    }
+    const VkPipelineStageFlags stages[2] = {
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT};
+    VkSubmitInfo submit = {};
+    submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit.pNext = nullptr;
+    submit.waitSemaphoreCount = pending_count;
+    submit.pWaitSemaphores = pending_semaphores;
+    submit.pWaitDstStageMask = stages;
+    if (vkResetFences(device_, 1, &frame.render_fence) == VK_SUCCESS) {
+      std::lock_guard<std::mutex> lock(context_->queue_mutex());
+      vkQueueSubmit(graphics_queue_, 1, &submit, frame.render_fence);
+    }
+  });
+
+  // The fence guarantees that every frame up to this one's previous use of
+  // the same FrameData has completed. Defragmentation moves are completed
+  // first since they may reference memory of resources retired since.
+  if (defragmenter_) {
+    defragmenter_->Update(framenumber_);
+  }
+  if (framenumber_ >= kFrameOverlap) {
+    retirement_queue_.Collect(framenumber_ - kFrameOverlap, device_,
+                              allocator_);
+    if (geometry_arena_) {
+      geometry_arena_->Collect(framenumber_ - kFrameOverlap);
+    }
+    if (readback_ring_) {
+      readback_ring_->Collect(framenumber_ - kFrameOverlap);
+    }
+    retired_models_.erase(
+        std::remove_if(retired_models_.begin(), retired_models_.end(),
+                       [&](const auto& retired) {
+                         return retired.first <= framenumber_ - kFrameOverlap;
+                       }),
+        retired_models_.end());
+  }
+  frame.arena.Reset();
+
+  // CPU time excludes waiting for the GPU.
+  const auto cpu_start = std::chrono::steady_clock::now();
+  const uint32_t frame_index = framenumber_ % kFrameOverlap;
+
+  ApplyOptimizedVariants();
+  ApplySceneChanges();
+
+  // The fence also means the frame's timestamps are ready.
+  std::optional<GpuTimer::Interval> gpu_interval =
+      gpu_timer_->Read(frame_index);
+  std::optional<float> gpu_time_ms;
+  if (gpu_interval.has_value()) {
+    gpu_time_ms = gpu_interval->ms();
+    frame_stats_.gpu_ms = gpu_time_ms.value();
+  }
+  if (compute_timer_) {
+    std::optional<GpuTimer::Interval> compute_interval =
+        compute_timer_->Read(frame_index);
+    if (compute_interval.has_value()) {
+      frame_stats_.compute_ms = compute_interval->ms();
+      frame_stats_.compute_overlap_ms = 0.f;
+      if (last_gpu_interval_.has_value()) {
+        const double overlap =
+            std::min(compute_interval->end_ms, last_gpu_interval_->end_ms) -
+            std::max(compute_interval->begin_ms,
+                     last_gpu_interval_->begin_ms);
+        frame_stats_.compute_overlap_ms =
+            static_cast<float>(std::max(overlap, 0.0));
+      }
+    }
+  }
+  last_gpu_interval_ = gpu_interval;
+  if (dynamic_resolution_.has_value()) {
+    if (gpu_time_ms.has_value()) {
+      dynamic_resolution_->AddSample(gpu_time_ms.value());
+    }
+    render_extent_ = dynamic_resolution_->Apply(view_extent_);
+  }
+  if (quality_governor_.has_value() && framenumber_ > 0) {
+    const bool adaptive = dynamic_resolution_.has_value();
+    quality_governor_->AddSample(
+        frame_stats_.cpu_ms, gpu_time_ms.value_or(0.f),
+        adaptive && !dynamic_resolution_->at_min(),
+        adaptive && !dynamic_resolution_->at_max());
+    ApplyQuality(quality_governor_->quality());
   }
 
   // Request an image from the swapchain.
-  uint32_t swapchain_image_index;
-  if (vkAcquireNextImageKHR(device_, swapchain_, kTimeoutNanoSecs,
+  uint32_t swapchain_image_index = 0;
+  if (!headless_ &&
+      vkAcquireNextImageKHR(device_, swapchain_, kTimeoutNanoSecs,
                             frame.present_semaphore, nullptr,
                             &swapchain_image_index) != VK_SUCCESS) {
-    return;
+    return false;
+  }
+  if (!headless_) {
+    pending_semaphores[pending_count++] = frame.present_semaphore;
   }
 
   // Now we can safely reset the command buffer.
   if (vkResetCommandBuffer(frame.command_buffer, 0) != VK_SUCCESS) {
-    return;
+    return false;
   }
 
   VkCommandBufferBeginInfo begin_info = {};
@@ -743,38 +669,196 @@ void Renderer::Draw() {
   begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
   if (vkBeginCommandBuffer(frame.command_buffer, &begin_info) != VK_SUCCESS) {
-    return;
+    return false;
   }
 
-  VkClearValue color_value;
-  color_value.color = {{0.1f, 0.2f, 0.3f, 1.0f}};
+  // The submit waits for the swapchain image at COLOR_ATTACHMENT_OUTPUT and
+  // for the light clusters at FRAGMENT_SHADER; both are done once color
+  // output may run, so the waits are left out of the GPU time that dynamic
+  // resolution budgets.
+  gpu_timer_->Begin(frame.command_buffer, frame_index,
+                    headless_ && !async_compute_
+                        ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT
+                        : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+  if (defragmenter_) {
+    defragmenter_->RecordMoves(frame.command_buffer);
+  }
 
-  VkClearValue depth_value;
-  depth_value.depthStencil.depth = 1.f;
+  render_graph_->BeginFrame(framenumber_);
+
+  GraphImage swapchain_image;
+  if (headless_) {
+    // The offscreen image is shared by the frames in flight, so the previous
+    // frame's writes and readback have to finish first.
+    swapchain_image = render_graph_->ImportImage(
+        "offscreen", offscreen_image_.image, swapchain_image_views_[0],
+        {swapchain_image_format_, swapchain_extent_,
+         VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+             VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+             VK_IMAGE_USAGE_TRANSFER_SRC_BIT},
+        {VK_IMAGE_LAYOUT_UNDEFINED,
+         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+             VK_PIPELINE_STAGE_TRANSFER_BIT,
+         VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT},
+        VK_IMAGE_LAYOUT_UNDEFINED);
+  } else {
+    swapchain_image = render_graph_->ImportImage(
+        "swapchain", swapchain_images_[swapchain_image_index],
+        swapchain_image_views_[swapchain_image_index],
+        {swapchain_image_format_, swapchain_extent_,
+         VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT},
+        {VK_IMAGE_LAYOUT_UNDEFINED,
+         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0},
+        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+  }
+  // Intermediate targets have a layer per view at the full view size, and
+  // the scene only covers the render extent of them, so changing the
+  // resolution neither reallocates targets nor recompiles the graph.
+  GraphImage depth_image = render_graph_->CreateImage(
+      "depth", depth_format_, view_extent_, view_count_);
+
+  // A single view at full resolution without post-processing renders
+  // straight to the swapchain. Otherwise the views are composed into their
+  // tiles with a blit.
+  const bool compose = view_count_ > 1 || post_process_ ||
+                       render_extent_.width != view_extent_.width ||
+                       render_extent_.height != view_extent_.height;
+  GraphImage scene_color = swapchain_image;
+  if (compose) {
+    scene_color = render_graph_->CreateImage("scene_color", scene_format_,
+                                             view_extent_, view_count_);
+  }
 
-  VkRenderPassBeginInfo renderpass_info = {};
-  renderpass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-  renderpass_info.pNext = nullptr;
+  UploadFrameData(renderables_.data(), renderables_.size());
+
+  // With async compute the binning is submitted right away, so it runs while
+  // the graphics queue is still busy with the previous frame.
+  GraphBuffer light_clusters;
+  if (async_compute_) {
+    VkCommandBuffer compute_cmd = async_compute_->Begin(frame_index);
+    compute_timer_->Begin(compute_cmd, frame_index);
+    lighting_->RecordBinning(compute_cmd, frame_index);
+    compute_timer_->End(compute_cmd, frame_index);
+    if (!async_compute_->Submit(frame_index)) {
+      return false;
+    }
+    pending_semaphores[pending_count++] =
+        async_compute_->semaphore(frame_index);
+    light_clusters = lighting_->ImportClusters(*render_graph_, frame_index);
+  } else {
+    light_clusters = lighting_->AddPass(*render_graph_, frame_index);
+  }
+  GraphImage shadow_map = shadows_->AddPasses(*render_graph_, frame_index,
+                                              frame.object_descriptor);
+
+  const util::Span<const uint32_t> visible(frame.visible_objects.data(),
+                                           frame.visible_objects.size());
+  const VkClearColorValue background = {{0.1f, 0.2f, 0.3f, 1.f}};
+  if (visibility_buffer_) {
+    GraphImage visibility = render_graph_->CreateImage(
+        "visibility", VK_FORMAT_R32_UINT, view_extent_, view_count_);
+    VkClearColorValue empty_id;
+    empty_id.uint32[0] = UINT32_MAX;
+    empty_id.uint32[1] = UINT32_MAX;
+    empty_id.uint32[2] = UINT32_MAX;
+    empty_id.uint32[3] = UINT32_MAX;
+    render_graph_
+        ->AddPass("visibility",
+                  [this, visible](VkCommandBuffer cmd) {
+                    DrawPositions(cmd, visibility_pipeline_,
+                                  renderables_.data(), visible);
+                  })
+        .WriteColor(visibility, empty_id)
+        .WriteDepth(depth_image, 1.f)
+        .RenderArea(render_extent_)
+        .Multiview(view_count_);
+
+    render_graph_
+        ->AddPass("visibility_resolve",
+                  [this, visibility](VkCommandBuffer cmd) {
+                    ResolveVisibility(cmd, visibility);
+                  })
+        .WriteColor(scene_color, background)
+        .ReadTexture(visibility, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT)
+        .ReadBuffer(light_clusters, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT)
+        .ReadTexture(shadow_map, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT)
+        .RenderArea(render_extent_)
+        .Multiview(view_count_);
+  } else {
+    const bool depth_prepass = depth_prepass_;
+    if (depth_prepass) {
+      render_graph_
+          ->AddPass("depth_prepass",
+                    [this, visible](VkCommandBuffer cmd) {
+                      DrawPositions(cmd, depth_prepass_pipeline_,
+                                    renderables_.data(), visible);
+                    })
+          .WriteDepth(depth_image, 1.f)
+          .RenderArea(render_extent_)
+          .Multiview(view_count_);
+    }
 
-  renderpass_info.renderPass = renderpass_;
-  renderpass_info.renderArea.offset.x = 0;
-  renderpass_info.renderArea.offset.y = 0;
-  renderpass_info.renderArea.extent = swapchain_extent_;
-  renderpass_info.framebuffer = framebuffers_[swapchain_image_index];
+    RenderGraph::PassBuilder forward =
+        render_graph_
+            ->AddPass("forward",
+                      [this, visible, depth_prepass](VkCommandBuffer cmd) {
+                        DrawObjects(cmd, renderables_.data(), visible,
+                                    depth_prepass);
+                      })
+            .WriteColor(scene_color, background)
+            .ReadBuffer(light_clusters, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                        VK_ACCESS_SHADER_READ_BIT)
+            .ReadTexture(shadow_map, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT)
+            .RenderArea(render_extent_)
+            .Multiview(view_count_);
+    if (depth_prepass) {
+      forward.ReadDepth(depth_image);
+    } else {
+      forward.WriteDepth(depth_image, 1.f);
+    }
+  }
 
-  VkClearValue clear_values[2] = {color_value, depth_value};
+  GraphImage final_color = scene_color;
+  if (post_process_) {
+    final_color =
+        post_process_->AddPass(*render_graph_, frame_index, scene_color,
+                               view_extent_, view_count_, render_extent_);
+  }
 
-  renderpass_info.clearValueCount = 2;
-  renderpass_info.pClearValues = &clear_values[0];
+  if (compose) {
+    render_graph_
+        ->AddPass("compose",
+                  [this, final_color, swapchain_image](VkCommandBuffer cmd) {
+                    ComposeViews(cmd, render_graph_->GetImage(final_color),
+                                 render_graph_->GetImage(swapchain_image));
+                  })
+        .CopyFrom(final_color)
+        .CopyTo(swapchain_image);
+  }
 
-  vkCmdBeginRenderPass(frame.command_buffer, &renderpass_info,
-                       VK_SUBPASS_CONTENTS_INLINE);
+  if (readback_ring_ && readback_ring_->requested(framenumber_)) {
+    const uint64_t framenumber = framenumber_;
+    render_graph_
+        ->AddPass("readback",
+                  [this, swapchain_image, framenumber](VkCommandBuffer cmd) {
+                    readback_ring_->Record(
+                        cmd, render_graph_->GetImage(swapchain_image),
+                        swapchain_extent_, kOffscreenTexelSize, framenumber);
+                  })
+        .CopyFrom(swapchain_image)
+        .SideEffects();
+  }
 
-  DrawObjects(frame.command_buffer, renderables_.data(), renderables_.size());
+  if (!render_graph_->Compile()) {
+    return false;
+  }
+  shadows_->BindShadowMap(*render_graph_, shadow_map, frame_index);
+  render_graph_->Execute(frame.command_buffer);
+  gpu_timer_->End(frame.command_buffer, frame_index);
 
-  vkCmdEndRenderPass(frame.command_buffer);
   if (vkEndCommandBuffer(frame.command_buffer) != VK_SUCCESS) {
-    return;
+    return false;
   }
 
   // Submit.
@@ -782,23 +866,64 @@ void Renderer::Draw() {
   submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
   submit.pNext = nullptr;
 
-  VkPipelineStageFlags wait_stage =
-      VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+  VkSemaphore wait_semaphores[2];
+  VkPipelineStageFlags wait_stages[2];
+  uint32_t wait_count = 0;
+  if (!headless_) {
+    wait_semaphores[wait_count] = frame.present_semaphore;
+    wait_stages[wait_count] = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+    wait_count++;
+  }
+  if (async_compute_) {
+    // Only the shading reads the clusters.
+    wait_semaphores[wait_count] = async_compute_->semaphore(frame_index);
+    wait_stages[wait_count] = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    wait_count++;
+  }
 
-  submit.pWaitDstStageMask = &wait_stage;
+  submit.pWaitDstStageMask = wait_stages;
 
-  submit.waitSemaphoreCount = 1;
-  submit.pWaitSemaphores = &frame.present_semaphore;
+  submit.waitSemaphoreCount = wait_count;
+  submit.pWaitSemaphores = wait_semaphores;
 
-  submit.signalSemaphoreCount = 1;
+  // Nothing waits on headless frames but the fence.
+  submit.signalSemaphoreCount = headless_ ? 0 : 1;
   submit.pSignalSemaphores = &frame.render_semaphore;
 
   submit.commandBufferCount = 1;
   submit.pCommandBuffers = &frame.command_buffer;
 
-  if (vkQueueSubmit(graphics_queue_, 1, &submit, frame.render_fence) !=
-      VK_SUCCESS) {
-    return;
+  // Only reset right before the submit that signals it again: a frame
+  // abandoned earlier must leave the fence signaled, or the next Draw() on
+  // this slot would wait for it forever.
+  if (vkResetFences(device_, 1, &frame.render_fence) != VK_SUCCESS) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(context_->queue_mutex());
+    if (vkQueueSubmit(graphics_queue_, 1, &submit, frame.render_fence) !=
+        VK_SUCCESS) {
+      return false;
+    }
+  }
+  pending_count = 0;
+  submitted = true;
+  shadows_->Submitted();
+
+  frame_stats_.cpu_ms = std::chrono::duration<float, std::milli>(
+                            std::chrono::steady_clock::now() - cpu_start)
+                            .count();
+  frame_stats_.render_extent = render_extent_;
+  frame_stats_.quality = quality_;
+  frame_stats_.quality_level =
+      quality_governor_.has_value() ? quality_governor_->level() : 0;
+  frame_stats_.drawn_objects =
+      static_cast<uint32_t>(frame.visible_objects.size());
+
+  // The frame is in flight even if presenting it fails.
+  framenumber_++;
+  if (headless_) {
+    return true;
   }
 
   VkPresentInfoKHR present_info = {};
@@ -813,24 +938,129 @@ void Renderer::Draw() {
 
   present_info.pImageIndices = &swapchain_image_index;
 
-  if (vkQueuePresentKHR(graphics_queue_, &present_info) != VK_SUCCESS) {
+  {
+    std::lock_guard<std::mutex> lock(context_->queue_mutex());
+    if (vkQueuePresentKHR(graphics_queue_, &present_info) != VK_SUCCESS) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::future<ReadbackRing::Image> Renderer::ReadNextFrame() {
+  if (!readback_ring_) {
+    // Broken right away, there is nothing to read back from.
+    std::cerr << "Frames can only be read back headless.\n";
+    return std::promise<ReadbackRing::Image>().get_future();
+  }
+  return readback_ring_->Request(framenumber_);
+}
+
+void Renderer::FlushReadbacks() {
+  if (!readback_ring_ || framenumber_ == 0) {
     return;
   }
+  for (int i = 0; i < kFrameOverlap; i++) {
+    if (vkWaitForFences(device_, 1, &frames_[i].render_fence, true,
+                        kTimeoutNanoSecs) != VK_SUCCESS) {
+      return;
+    }
+  }
+  readback_ring_->Collect(framenumber_ - 1);
+}
 
-  framenumber_++;
+bool Renderer::InitOffscreenImage() {
+  VkImageCreateInfo image_info = init::ImageCreateInfo(
+      kOffscreenFormat,
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+          VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+      {swapchain_extent_.width, swapchain_extent_.height, 1});
+
+  VmaAllocationCreateInfo allocation_info = {};
+  allocation_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+  if (vmaCreateImage(allocator_, &image_info, &allocation_info,
+                     &offscreen_image_.image, &offscreen_image_.allocation,
+                     nullptr) != VK_SUCCESS) {
+    std::cerr << "Error creating the offscreen image.\n";
+    return false;
+  }
+  deletion_queue_.Push(offscreen_image_.image, offscreen_image_.allocation);
+
+  // Its view is created along with those of swapchain images.
+  swapchain_images_ = {offscreen_image_.image};
+  return true;
 }
 
 std::optional<VkPipeline> Renderer::PipelineBuilder::Build(
-    VkDevice device, VkRenderPass renderpass) {
+    VkDevice device, VkRenderPass renderpass, VkPipelineCache cache) {
+  return Create(device, renderpass, cache, 0);
+}
+
+std::optional<VkPipeline> Renderer::PipelineBuilder::BuildLibrary(
+    VkDevice device, VkRenderPass renderpass, VkPipelineCache cache,
+    VkGraphicsPipelineLibraryFlagsEXT parts) {
+  return Create(device, renderpass, cache, parts);
+}
+
+std::optional<VkPipeline> Renderer::PipelineBuilder::Link(
+    VkDevice device, const std::vector<VkPipeline>& libraries,
+    VkPipelineLayout layout, VkPipelineCache cache, bool optimize) {
+  VkPipelineLibraryCreateInfoKHR library_info = {};
+  library_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+  library_info.pNext = nullptr;
+  library_info.libraryCount = static_cast<uint32_t>(libraries.size());
+  library_info.pLibraries = libraries.data();
+
+  VkGraphicsPipelineCreateInfo pipeline_info = {};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipeline_info.pNext = &library_info;
+  pipeline_info.flags =
+      optimize ? VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT : 0;
+  pipeline_info.layout = layout;
+
+  VkPipeline pipeline;
+  if (vkCreateGraphicsPipelines(device, cache, 1, &pipeline_info, nullptr,
+                                &pipeline) != VK_SUCCESS) {
+    return std::nullopt;
+  }
+  return pipeline;
+}
+
+std::optional<VkPipeline> Renderer::PipelineBuilder::Create(
+    VkDevice device, VkRenderPass renderpass, VkPipelineCache cache,
+    VkGraphicsPipelineLibraryFlagsEXT parts) {
+  // A library only takes the shader stages of its part. State of the other
+  // parts is ignored.
+  std::vector<VkPipelineShaderStageCreateInfo> stages;
+  for (const VkPipelineShaderStageCreateInfo& stage : shader_stages) {
+    const VkGraphicsPipelineLibraryFlagsEXT part =
+        stage.stage == VK_SHADER_STAGE_FRAGMENT_BIT
+            ? VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT
+            : VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT;
+    if (parts == 0 || (parts & part) != 0) {
+      stages.push_back(stage);
+    }
+  }
+
   VkPipelineViewportStateCreateInfo viewport_state = {};
   viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
   viewport_state.pNext = nullptr;
 
-  // We don't support multiple viewports or scissors.
+  // We don't support multiple viewports or scissors. Both are set when
+  // drawing, see SetRenderViewport().
   viewport_state.viewportCount = 1;
-  viewport_state.pViewports = &viewport;
+  viewport_state.pViewports = nullptr;
   viewport_state.scissorCount = 1;
-  viewport_state.pScissors = &scissor;
+  viewport_state.pScissors = nullptr;
+
+  VkDynamicState dynamic_states[] = {VK_DYNAMIC_STATE_VIEWPORT,
+                                     VK_DYNAMIC_STATE_SCISSOR};
+  VkPipelineDynamicStateCreateInfo dynamic_state = {};
+  dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamic_state.pNext = nullptr;
+  dynamic_state.dynamicStateCount = 2;
+  dynamic_state.pDynamicStates = dynamic_states;
 
   VkPipelineColorBlendStateCreateInfo color_blending = {};
   color_blending.sType =
@@ -847,14 +1077,28 @@ std::optional<VkPipeline> Renderer::PipelineBuilder::Build(
   pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
   pipeline_info.pNext = nullptr;
 
-  pipeline_info.stageCount = shader_stages.size();
-  pipeline_info.pStages = shader_stages.data();
+  VkGraphicsPipelineLibraryCreateInfoEXT library_info = {};
+  library_info.sType =
+      VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+  library_info.pNext = nullptr;
+  library_info.flags = parts;
+  if (parts != 0) {
+    // Keep what the optimized link needs.
+    pipeline_info.pNext = &library_info;
+    pipeline_info.flags =
+        VK_PIPELINE_CREATE_LIBRARY_BIT_KHR |
+        VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+  }
+
+  pipeline_info.stageCount = static_cast<uint32_t>(stages.size());
+  pipeline_info.pStages = stages.data();
   pipeline_info.pVertexInputState = &vertex_input_info;
   pipeline_info.pInputAssemblyState = &input_assembly;
   pipeline_info.pViewportState = &viewport_state;
   pipeline_info.pRasterizationState = &rasterizer;
   pipeline_info.pMultisampleState = &multisampling;
   pipeline_info.pColorBlendState = &color_blending;
+  pipeline_info.pDynamicState = &dynamic_state;
   pipeline_info.layout = layout;
   pipeline_info.renderPass = renderpass;
   pipeline_info.subpass = 0;
@@ -862,7 +1106,7 @@ std::optional<VkPipeline> Renderer::PipelineBuilder::Build(
   pipeline_info.pDepthStencilState = &depth_stencil;
 
   VkPipeline pipeline;
-  if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_info,
+  if (vkCreateGraphicsPipelines(device, cache, 1, &pipeline_info,
                                 nullptr, &pipeline) != VK_SUCCESS) {
     return std::nullopt;
   }
@@ -880,16 +1124,6 @@ bool Renderer::InitPipeline() {
   builder.depth_stencil = init::PipelineDepthStencilStateCreateInfo(
       true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
 
-  builder.viewport.x = 0.f;
-  builder.viewport.y = 0.f;
-  builder.viewport.width = static_cast<float>(swapchain_extent_.width);
-  builder.viewport.height = static_cast<float>(swapchain_extent_.height);
-  builder.viewport.minDepth = 0.f;
-  builder.viewport.maxDepth = 1.f;
-
-  builder.scissor.offset = {0, 0};
-  builder.scissor.extent = swapchain_extent_;
-
   builder.rasterizer =
       init::PipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL);
 
@@ -908,34 +1142,33 @@ bool Renderer::InitPipeline() {
   mesh_pipeline_layout_info.pushConstantRangeCount = 1;
   mesh_pipeline_layout_info.pPushConstantRanges = &push_constant;
 
-  VkDescriptorSetLayout set_layouts[] = {global_set_layout_,
-                                         object_set_layout_};
+  VkDescriptorSetLayout set_layouts[] = {
+      global_set_layout_, object_set_layout_, lighting_->set_layout(),
+      shadows_->set_layout()};
 
-  mesh_pipeline_layout_info.setLayoutCount = 2;
+  mesh_pipeline_layout_info.setLayoutCount = 4;
   mesh_pipeline_layout_info.pSetLayouts = set_layouts;
 
   if (vkCreatePipelineLayout(device_, &mesh_pipeline_layout_info, nullptr,
                              &mesh_pipeline_layout_) != VK_SUCCESS) {
     return false;
   }
-  deletion_stack_.Push([=]() {
-    vkDestroyPipelineLayout(device_, mesh_pipeline_layout_, nullptr);
-  });
+  deletion_queue_.Push(mesh_pipeline_layout_);
 
   builder.layout = mesh_pipeline_layout_;
 
-  VertexInputDescription vertex_description = Vertex::GetDescription();
+  mesh_vertex_description_ = Vertex::GetDescription();
 
   // Connect the pipeline builder vertex input info to the one from the vertex.
   builder.vertex_input_info.vertexAttributeDescriptionCount =
-      vertex_description.attributes.size();
+      mesh_vertex_description_.attributes.size();
   builder.vertex_input_info.pVertexAttributeDescriptions =
-      vertex_description.attributes.data();
+      mesh_vertex_description_.attributes.data();
 
   builder.vertex_input_info.vertexBindingDescriptionCount =
-      vertex_description.bindings.size();
+      mesh_vertex_description_.bindings.size();
   builder.vertex_input_info.pVertexBindingDescriptions =
-      vertex_description.bindings.data();
+      mesh_vertex_description_.bindings.data();
 
   VkShaderModule mesh_vert;
   if (!LoadShader(device_, "shaders/mesh_triangle.vert.spv", &mesh_vert)) {
@@ -954,20 +1187,269 @@ bool Renderer::InitPipeline() {
   builder.shader_stages.push_back(init::PipelineShaderStageCreateInfo(
       VK_SHADER_STAGE_FRAGMENT_BIT, mesh_frag));
 
-  std::optional<VkPipeline> maybe_pipeline =
-      builder.Build(device_, renderpass_);
-  if (!maybe_pipeline.has_value()) {
+  // Material variants are built on demand, so the modules live as long as
+  // the renderer.
+  deletion_queue_.Push(mesh_vert);
+  deletion_queue_.Push(mesh_frag);
+
+  mesh_pipeline_builder_ = builder;
+  forward_pass_ = render_graph_->GetCompatibleRenderPass(
+      {scene_format_}, depth_format_, view_count_);
+  if (context_->graphics_pipeline_library()) {
+    InitMeshLibraries();
+  }
+
+  if (!pipeline_manifest_path_.empty()) {
+    PipelineManifest manifest;
+    if (manifest.Load(pipeline_manifest_path_)) {
+      PrewarmPipelines(manifest);
+    }
+  }
+
+  if (!CreateMaterial("default", MaterialParams{})) {
     return false;
   }
 
-  mesh_pipeline_ = maybe_pipeline.value();
-  deletion_stack_.Push(
-      [=]() { vkDestroyPipeline(device_, mesh_pipeline_, nullptr); });
+  // Depth prepass: positions only and no fragment shader.
+  VkShaderModule depth_vert;
+  if (!LoadShader(device_, "shaders/depth_prepass.vert.spv", &depth_vert)) {
+    std::cerr << "Unable to load file: depth_prepass.vert.spv" << std::endl;
+    return false;
+  }
+  DEFER([&]() { vkDestroyShaderModule(device_, depth_vert, nullptr); });
 
-  CreateMaterial(mesh_pipeline_, mesh_pipeline_layout_, "default");
+  PositionInputDescription position_description =
+      Vertex::GetPositionDescription();
+  builder.vertex_input_info.vertexAttributeDescriptionCount =
+      position_description.attributes.size();
+  builder.vertex_input_info.pVertexAttributeDescriptions =
+      position_description.attributes.data();
+  builder.vertex_input_info.vertexBindingDescriptionCount =
+      position_description.bindings.size();
+  builder.vertex_input_info.pVertexBindingDescriptions =
+      position_description.bindings.data();
 
-  vkDestroyShaderModule(device_, mesh_vert, nullptr);
-  vkDestroyShaderModule(device_, mesh_frag, nullptr);
+  builder.shader_stages.clear();
+  builder.shader_stages.push_back(init::PipelineShaderStageCreateInfo(
+      VK_SHADER_STAGE_VERTEX_BIT, depth_vert));
+
+  builder.depth_stencil = init::PipelineDepthStencilStateCreateInfo(
+      true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
+
+  std::optional<VkPipeline> maybe_depth_pipeline = builder.Build(
+      device_,
+      render_graph_->GetCompatibleRenderPass({}, depth_format_, view_count_),
+      pipeline_cache_);
+  if (!maybe_depth_pipeline.has_value()) {
+    return false;
+  }
+  depth_prepass_pipeline_ = maybe_depth_pipeline.value();
+  deletion_queue_.Push(depth_prepass_pipeline_);
+
+  return true;
+}
+
+bool Renderer::InitVisibilityBuffer() {
+  // The IDs are read with texelFetch, the filter never applies.
+  VkSamplerCreateInfo sampler_info = {};
+  sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  sampler_info.pNext = nullptr;
+  sampler_info.magFilter = VK_FILTER_NEAREST;
+  sampler_info.minFilter = VK_FILTER_NEAREST;
+  sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  if (vkCreateSampler(device_, &sampler_info, nullptr,
+                      &visibility_sampler_) != VK_SUCCESS) {
+    std::cerr << "Error creating the visibility buffer sampler.\n";
+    return false;
+  }
+  deletion_queue_.Push(visibility_sampler_);
+
+  // Set 4 of the resolve pipeline: the IDs, the arena and the arena
+  // location of each object's mesh.
+  VkDescriptorSetLayoutBinding bindings[] = {
+      init::DescriptorSetLayoutBinding(
+          VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          VK_SHADER_STAGE_FRAGMENT_BIT, 0),
+      init::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                       VK_SHADER_STAGE_FRAGMENT_BIT, 1),
+      init::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                       VK_SHADER_STAGE_FRAGMENT_BIT, 2),
+      init::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                       VK_SHADER_STAGE_FRAGMENT_BIT, 3),
+  };
+
+  VkDescriptorSetLayoutCreateInfo set_layout_info = {};
+  set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  set_layout_info.pNext = nullptr;
+  set_layout_info.flags = 0;
+  set_layout_info.bindingCount = 4;
+  set_layout_info.pBindings = bindings;
+
+  if (vkCreateDescriptorSetLayout(device_, &set_layout_info, nullptr,
+                                  &visibility_set_layout_) != VK_SUCCESS) {
+    std::cerr << "Error creating the visibility buffer set layout.\n";
+    return false;
+  }
+  deletion_queue_.Push(visibility_set_layout_);
+
+  VkPushConstantRange push_constant;
+  push_constant.offset = 0;
+  push_constant.size = sizeof(glm::vec2);
+  push_constant.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorSetLayout set_layouts[] = {
+      global_set_layout_, object_set_layout_, lighting_->set_layout(),
+      shadows_->set_layout(), visibility_set_layout_};
+
+  VkPipelineLayoutCreateInfo layout_info = init::PipelineLayoutCreateInfo();
+  layout_info.setLayoutCount = 5;
+  layout_info.pSetLayouts = set_layouts;
+  layout_info.pushConstantRangeCount = 1;
+  layout_info.pPushConstantRanges = &push_constant;
+
+  if (vkCreatePipelineLayout(device_, &layout_info, nullptr,
+                             &visibility_pipeline_layout_) != VK_SUCCESS) {
+    std::cerr << "Error creating the visibility buffer pipeline layout.\n";
+    return false;
+  }
+  deletion_queue_.Push(visibility_pipeline_layout_);
+
+  for (int i = 0; i < kFrameOverlap; i++) {
+    FrameData& frame = frames_[i];
+    frame.geometry_buffer = CreateBuffer(
+        allocator_, sizeof(GpuObjectGeometry) * kMaxObjects,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    deletion_queue_.Push(frame.geometry_buffer.buffer,
+                         frame.geometry_buffer.allocation);
+    frame.bound_visibility_view = VK_NULL_HANDLE;
+
+    VkDescriptorSetAllocateInfo allocate_info = {};
+    allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocate_info.pNext = nullptr;
+    allocate_info.descriptorPool = descriptor_pool_;
+    allocate_info.descriptorSetCount = 1;
+    allocate_info.pSetLayouts = &visibility_set_layout_;
+
+    if (vkAllocateDescriptorSets(device_, &allocate_info,
+                                 &frame.visibility_descriptor) != VK_SUCCESS) {
+      std::cerr << "Error allocating a visibility buffer descriptor set.\n";
+      return false;
+    }
+
+    VkDescriptorBufferInfo vertex_info = {};
+    vertex_info.buffer = geometry_arena_->vertex_buffer();
+    vertex_info.offset = 0;
+    vertex_info.range = geometry_arena_->vertex_buffer_size();
+
+    VkDescriptorBufferInfo index_info = {};
+    index_info.buffer = geometry_arena_->index_buffer();
+    index_info.offset = 0;
+    index_info.range = geometry_arena_->index_buffer_size();
+
+    VkDescriptorBufferInfo geometry_info = {};
+    geometry_info.buffer = frame.geometry_buffer.buffer;
+    geometry_info.offset = 0;
+    geometry_info.range = sizeof(GpuObjectGeometry) * kMaxObjects;
+
+    VkWriteDescriptorSet writes[] = {
+        init::WriteDescriptorSet(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                 frame.visibility_descriptor, &vertex_info, 1),
+        init::WriteDescriptorSet(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                 frame.visibility_descriptor, &index_info, 2),
+        init::WriteDescriptorSet(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                 frame.visibility_descriptor, &geometry_info,
+                                 3),
+    };
+    vkUpdateDescriptorSets(device_, 3, writes, 0, nullptr);
+  }
+
+  VkShaderModule id_vert;
+  if (!LoadShader(device_, "shaders/visibility.vert.spv", &id_vert)) {
+    std::cerr << "Unable to load file: visibility.vert.spv" << std::endl;
+    return false;
+  }
+  DEFER([&]() { vkDestroyShaderModule(device_, id_vert, nullptr); });
+  VkShaderModule id_frag;
+  if (!LoadShader(device_, "shaders/visibility.frag.spv", &id_frag)) {
+    std::cerr << "Unable to load file: visibility.frag.spv" << std::endl;
+    return false;
+  }
+  DEFER([&]() { vkDestroyShaderModule(device_, id_frag, nullptr); });
+  VkShaderModule fullscreen_vert;
+  if (!LoadShader(device_, "shaders/fullscreen.vert.spv", &fullscreen_vert)) {
+    std::cerr << "Unable to load file: fullscreen.vert.spv" << std::endl;
+    return false;
+  }
+  DEFER([&]() { vkDestroyShaderModule(device_, fullscreen_vert, nullptr); });
+  VkShaderModule resolve_frag;
+  if (!LoadShader(device_, "shaders/visibility_resolve.frag.spv",
+                  &resolve_frag)) {
+    std::cerr << "Unable to load file: visibility_resolve.frag.spv"
+              << std::endl;
+    return false;
+  }
+  DEFER([&]() { vkDestroyShaderModule(device_, resolve_frag, nullptr); });
+
+  // ID pass: positions only, the mesh pipeline layout.
+  PipelineBuilder builder;
+  PositionInputDescription position_description =
+      Vertex::GetPositionDescription();
+  builder.vertex_input_info = init::PipelineVertexInputStateCreateInfo();
+  builder.vertex_input_info.vertexAttributeDescriptionCount =
+      position_description.attributes.size();
+  builder.vertex_input_info.pVertexAttributeDescriptions =
+      position_description.attributes.data();
+  builder.vertex_input_info.vertexBindingDescriptionCount =
+      position_description.bindings.size();
+  builder.vertex_input_info.pVertexBindingDescriptions =
+      position_description.bindings.data();
+  builder.input_assembly = init::PipelineInputAssemblyStateCreateInfo(
+      VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+  builder.depth_stencil = init::PipelineDepthStencilStateCreateInfo(
+      true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
+  builder.rasterizer =
+      init::PipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL);
+  builder.multisampling = init::PipelineMultisampleStateCreateInfo();
+  builder.color_blend_attachment = init::PipelineColorBlendAttachmentState();
+  builder.layout = mesh_pipeline_layout_;
+  builder.shader_stages.push_back(init::PipelineShaderStageCreateInfo(
+      VK_SHADER_STAGE_VERTEX_BIT, id_vert));
+  builder.shader_stages.push_back(init::PipelineShaderStageCreateInfo(
+      VK_SHADER_STAGE_FRAGMENT_BIT, id_frag));
+
+  std::optional<VkPipeline> maybe_id_pipeline = builder.Build(
+      device_, render_graph_->GetCompatibleRenderPass(
+                   {VK_FORMAT_R32_UINT}, depth_format_, view_count_),
+      pipeline_cache_);
+  if (!maybe_id_pipeline.has_value()) {
+    return false;
+  }
+  visibility_pipeline_ = maybe_id_pipeline.value();
+  deletion_queue_.Push(visibility_pipeline_);
+
+  // Resolve: a full screen triangle without vertex input or depth.
+  builder.vertex_input_info = init::PipelineVertexInputStateCreateInfo();
+  builder.depth_stencil = init::PipelineDepthStencilStateCreateInfo(
+      false, false, VK_COMPARE_OP_ALWAYS);
+  builder.layout = visibility_pipeline_layout_;
+  builder.shader_stages.clear();
+  builder.shader_stages.push_back(init::PipelineShaderStageCreateInfo(
+      VK_SHADER_STAGE_VERTEX_BIT, fullscreen_vert));
+  builder.shader_stages.push_back(init::PipelineShaderStageCreateInfo(
+      VK_SHADER_STAGE_FRAGMENT_BIT, resolve_frag));
+
+  std::optional<VkPipeline> maybe_resolve_pipeline = builder.Build(
+      device_, render_graph_->GetCompatibleRenderPass(
+                   {scene_format_}, VK_FORMAT_UNDEFINED, view_count_),
+      pipeline_cache_);
+  if (!maybe_resolve_pipeline.has_value()) {
+    return false;
+  }
+  visibility_resolve_pipeline_ = maybe_resolve_pipeline.value();
+  deletion_queue_.Push(visibility_resolve_pipeline_);
 
   return true;
 }
@@ -987,43 +1469,103 @@ bool Renderer::LoadMeshes() {
 
   // Note: We don't care about vertex normals yet.
 
-  if (!UploadMesh(triangle_mesh_)) {
+  // Meshes are uploaded in place since their buffers are tracked by address.
+  meshes_["triangle"] = triangle_mesh_;
+  if (!UploadMesh(meshes_["triangle"])) {
     return false;
   }
 
-  meshes_["triangle"] = triangle_mesh_;
+  return LoadModel("assets/models/shiba/scene.gltf", "shiba");
+}
 
-  shiba_model_ = LoadFromFile("assets/models/shiba/scene.gltf", allocator_,
-                              device_, *queue_submitter_.get());
-  if (shiba_model_.meshes.empty()) {
+bool Renderer::LoadModel(const std::string& path, const std::string& name) {
+  AssetCache::Handle model =
+      context_->asset_cache().Load(path, *queue_submitter_);
+  if (!model) {
     return false;
   }
 
   int count = 1;
-  for (Mesh& m : shiba_model_.meshes) {
-    if (!UploadMesh(m)) {
-      return false;
+  for (const Mesh& m : model->meshes) {
+    std::string mesh_name = name + "_" + std::to_string(count++);
+    if (meshes_.count(mesh_name) > 0) {
+      ReleaseMesh(mesh_name);
     }
-    std::string name = "shiba_" + std::to_string(count++);
-    meshes_[name] = m;
+    // The buffers are shared, only the geometry arena copy is our own. They
+    // are not tracked for defragmentation, see AssetCache.
+    meshes_[mesh_name] = m;
+    meshes_[mesh_name].geometry = {};
+    AddToGeometryArena(meshes_[mesh_name]);
+    cached_meshes_[mesh_name] = model;
   }
 
-  deletion_stack_.Push([=]() { shiba_model_.textures.clear(); });
-
   return true;
 }
 
 bool Renderer::UploadMesh(Mesh& mesh) {
-  util::TaskStack local_del;
-  // Uploads mesh to GPU-only memory by first copying into CPU writeable buffer
+  ComputeBounds(mesh);
+
+  const size_t size = mesh.vertices.size() * sizeof(Vertex);
+  if (!UploadBuffer(mesh.vertices.data(), size,
+                    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, mesh.vertex_buffer)) {
+    return false;
+  }
+
+  // The depth prepass reads positions only, so they also get a stream of
+  // their own.
+  std::vector<glm::vec3> positions(mesh.vertices.size());
+  for (size_t i = 0; i < mesh.vertices.size(); i++) {
+    positions[i] = mesh.vertices[i].position;
+  }
+  if (!UploadBuffer(positions.data(), positions.size() * sizeof(glm::vec3),
+                    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                    mesh.position_buffer)) {
+    return false;
+  }
+
+  AddToGeometryArena(mesh);
+
+  if (mesh.indices.empty()) {
+    return true;
+  }
+
+  return UploadBuffer(mesh.indices.data(),
+                      mesh.indices.size() * sizeof(uint32_t),
+                      VK_BUFFER_USAGE_INDEX_BUFFER_BIT, mesh.index_buffer);
+}
+
+void Renderer::AddToGeometryArena(Mesh& mesh) {
+  if (!geometry_arena_) {
+    return;
+  }
+
+  // Visibility buffer IDs only have room for so many triangles per mesh.
+  const size_t triangle_count =
+      (mesh.indices.empty() ? mesh.vertices.size() : mesh.indices.size()) / 3;
+  std::optional<GeometryRange> range;
+  if (triangle_count <= (size_t{1} << kVisibilityTriangleBits)) {
+    range = geometry_arena_->Upload(mesh, *queue_submitter_);
+  }
+  if (range.has_value()) {
+    mesh.geometry = range.value();
+  } else {
+    std::cerr << "Mesh does not fit the geometry arena, it is not drawn "
+                 "with the visibility buffer.\n";
+  }
+}
+
+bool Renderer::UploadBuffer(const void* source, size_t size,
+                            VkBufferUsageFlags usage,
+                            AllocatedBuffer& buffer) {
+  DeletionQueue staging_deletion_queue(1);
+  DEFER([&]() { staging_deletion_queue.Flush(device_, allocator_); });
+
+  // Uploads data to GPU-only memory by first copying into CPU writeable buffer
   // and encoding a copy command in a VkCommandBuffer and submitting to a queue.
   // GPU native memory is much faster than CPU/GPU memory.
 
-  // 1. Allocate a CPU side buffer to hold the mesh before uploading it to the
+  // 1. Allocate a CPU side buffer to hold the data before uploading it to the
   // GPU.
-  const size_t size = mesh.vertices.size() * sizeof(Vertex);
-
-  // Allocate staging buffer.
   VkBufferCreateInfo staging_buffer_info = {};
   staging_buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
   staging_buffer_info.pNext = nullptr;
@@ -1042,119 +1584,324 @@ bool Renderer::UploadMesh(Mesh& mesh) {
                       nullptr) != VK_SUCCESS) {
     return false;
   }
-  local_del.Push([=]() {
-    vmaDestroyBuffer(allocator_, staging_buffer.buffer,
-                     staging_buffer.allocation);
-  });
+  staging_deletion_queue.Push(staging_buffer.buffer,
+                              staging_buffer.allocation);
 
-  // Copy the vertex data.
   void* data;
   vmaMapMemory(allocator_, staging_buffer.allocation, &data);
-  memcpy(data, mesh.vertices.data(), size);
+  memcpy(data, source, size);
   vmaUnmapMemory(allocator_, staging_buffer.allocation);
 
-  // 2. Allocate GPU side buffer.
-  VkBufferCreateInfo vertex_buffer_info = {};
-  vertex_buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-  vertex_buffer_info.pNext = nullptr;
+  // 2. Allocate GPU side buffer. TRANSFER_SRC allows the defragmenter to move
+  // it.
+  VkBufferCreateInfo buffer_info = {};
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.pNext = nullptr;
 
-  vertex_buffer_info.size = size;
-  vertex_buffer_info.usage =
-      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  buffer_info.size = size;
+  buffer_info.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
 
   // Let VMA lib know that this data should be GPU native.
   vma_alloc_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 
-  if (vmaCreateBuffer(allocator_, &vertex_buffer_info, &vma_alloc_info,
-                      &mesh.vertex_buffer.buffer,
-                      &mesh.vertex_buffer.allocation, nullptr) != VK_SUCCESS) {
+  if (vmaCreateBuffer(allocator_, &buffer_info, &vma_alloc_info,
+                      &buffer.buffer, &buffer.allocation,
+                      nullptr) != VK_SUCCESS) {
     return false;
   }
 
-  deletion_stack_.Push([=]() {
-    vmaDestroyBuffer(allocator_, mesh.vertex_buffer.buffer,
-                     mesh.vertex_buffer.allocation);
-  });
-
   queue_submitter_->SubmitImmediate([=](VkCommandBuffer cmd) {
     VkBufferCopy copy;
     copy.srcOffset = 0;
     copy.dstOffset = 0;
     copy.size = size;
-    vkCmdCopyBuffer(cmd, staging_buffer.buffer, mesh.vertex_buffer.buffer, 1,
-                    &copy);
+    vkCmdCopyBuffer(cmd, staging_buffer.buffer, buffer.buffer, 1, &copy);
   });
+  if (defragmenter_) {
+    defragmenter_->Track(buffer, buffer_info);
+  }
 
-  if (mesh.indices.empty()) {
-    return true;
+  return true;
+}
+
+bool Renderer::CreateMaterial(const std::string& name,
+                              const MaterialParams& params) {
+  if (materials_.count(name) != 0) {
+    std::cerr << "Material " << name << " already exists.\n";
+    return false;
+  }
+  if (params.features >= kMaterialVariantCount) {
+    std::cerr << "Material " << name << " has unknown features.\n";
+    return false;
+  }
+  const MaterialVariant* variant = GetMaterialVariant(params.features);
+  if (variant == nullptr) {
+    return false;
+  }
+  std::optional<uint32_t> index = material_table_->Add(params);
+  if (!index.has_value()) {
+    std::cerr << "Too many materials for " << name << ".\n";
+    return false;
   }
 
-  // Repeat the above for the indices buffer.
+  Material material;
+  material.index = index.value();
+  material.params = params;
+  material.variant = variant;
+  materials_[name] = material;
+  return true;
+}
 
-  uint32_t indices_size = mesh.indices.size() * sizeof(uint32_t);
+bool Renderer::SetMaterialParams(const std::string& name,
+                                 const MaterialParams& params) {
+  Material* material = GetMaterial(name);
+  if (material == nullptr) {
+    std::cerr << "Unknown material " << name << ".\n";
+    return false;
+  }
+  if (params.features >= kMaterialVariantCount) {
+    std::cerr << "Material " << name << " has unknown features.\n";
+    return false;
+  }
+  const MaterialVariant* variant = GetMaterialVariant(params.features);
+  if (variant == nullptr) {
+    return false;
+  }
 
-  vma_alloc_info.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+  material_table_->Set(material->index, params);
+  material->params = params;
+  material->variant = variant;
+  return true;
+}
 
-  AllocatedBuffer index_staging_buffer;
+std::optional<Renderer::MaterialVariant> Renderer::BuildMaterialVariant(
+    uint32_t features) const {
+  // Feature bit i is the boolean specialization constant i of the fragment
+  // shader.
+  std::array<VkBool32, kMaterialFeatureCount> constants;
+  std::array<VkSpecializationMapEntry, kMaterialFeatureCount> entries;
+  for (uint32_t bit = 0; bit < kMaterialFeatureCount; bit++) {
+    constants[bit] = (features >> bit) & 1u;
+    entries[bit].constantID = bit;
+    entries[bit].offset = bit * sizeof(VkBool32);
+    entries[bit].size = sizeof(VkBool32);
+  }
+  VkSpecializationInfo specialization = {};
+  specialization.mapEntryCount = static_cast<uint32_t>(entries.size());
+  specialization.pMapEntries = entries.data();
+  specialization.dataSize = sizeof(constants);
+  specialization.pData = constants.data();
+
+  PipelineBuilder builder = mesh_pipeline_builder_;
+  builder.shader_stages[1].pSpecializationInfo = &specialization;
+
+  MaterialVariant variant;
+  if (mesh_libraries_.fragment_output != VK_NULL_HANDLE) {
+    // Only the fragment shader is compiled per variant, the other parts are
+    // shared and the pipelines are a fast link of the four.
+    std::optional<VkPipeline> fragment = builder.BuildLibrary(
+        device_, forward_pass_, pipeline_cache_,
+        VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT);
+    builder.depth_stencil = init::PipelineDepthStencilStateCreateInfo(
+        true, false, VK_COMPARE_OP_EQUAL);
+    std::optional<VkPipeline> prepass_fragment = builder.BuildLibrary(
+        device_, forward_pass_, pipeline_cache_,
+        VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT);
+    variant.fragment_library = fragment.value_or(VK_NULL_HANDLE);
+    variant.prepass_fragment_library =
+        prepass_fragment.value_or(VK_NULL_HANDLE);
+
+    if (fragment.has_value() && prepass_fragment.has_value()) {
+      variant.pipeline =
+          PipelineBuilder::Link(device_,
+                                {mesh_libraries_.vertex_input,
+                                 mesh_libraries_.pre_rasterization,
+                                 variant.fragment_library,
+                                 mesh_libraries_.fragment_output},
+                                mesh_pipeline_layout_, pipeline_cache_, false)
+              .value_or(VK_NULL_HANDLE);
+      variant.prepass_pipeline =
+          PipelineBuilder::Link(device_,
+                                {mesh_libraries_.vertex_input,
+                                 mesh_libraries_.pre_rasterization,
+                                 variant.prepass_fragment_library,
+                                 mesh_libraries_.fragment_output},
+                                mesh_pipeline_layout_, pipeline_cache_, false)
+              .value_or(VK_NULL_HANDLE);
+    }
 
-  if (vmaCreateBuffer(allocator_, &staging_buffer_info, &vma_alloc_info,
-                      &index_staging_buffer.buffer,
-                      &index_staging_buffer.allocation,
-                      nullptr) != VK_SUCCESS) {
-    return false;
+    if (variant.pipeline == VK_NULL_HANDLE ||
+        variant.prepass_pipeline == VK_NULL_HANDLE) {
+      for (VkPipeline pipeline :
+           {variant.pipeline, variant.prepass_pipeline,
+            variant.fragment_library, variant.prepass_fragment_library}) {
+        if (pipeline != VK_NULL_HANDLE) {
+          vkDestroyPipeline(device_, pipeline, nullptr);
+        }
+      }
+      return std::nullopt;
+    }
+    return variant;
   }
-  local_del.Push([=]() {
-    vmaDestroyBuffer(allocator_, index_staging_buffer.buffer,
-                     index_staging_buffer.allocation);
-  });
 
-  // Copy the indices data.
-  vmaMapMemory(allocator_, index_staging_buffer.allocation, &data);
-  memcpy(data, mesh.indices.data(), indices_size);
-  vmaUnmapMemory(allocator_, index_staging_buffer.allocation);
+  std::optional<VkPipeline> pipeline =
+      builder.Build(device_, forward_pass_, pipeline_cache_);
+  if (!pipeline.has_value()) {
+    return std::nullopt;
+  }
+  variant.pipeline = pipeline.value();
 
-  VkBufferCreateInfo index_buffer_info = {};
-  index_buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-  index_buffer_info.pNext = nullptr;
+  // After the prepass the depth buffer already holds the closest surface, so
+  // only fragments exactly at that depth are shaded.
+  builder.depth_stencil = init::PipelineDepthStencilStateCreateInfo(
+      true, false, VK_COMPARE_OP_EQUAL);
+  std::optional<VkPipeline> prepass_pipeline =
+      builder.Build(device_, forward_pass_, pipeline_cache_);
+  if (!prepass_pipeline.has_value()) {
+    vkDestroyPipeline(device_, variant.pipeline, nullptr);
+    return std::nullopt;
+  }
+  variant.prepass_pipeline = prepass_pipeline.value();
+  return variant;
+}
 
-  index_buffer_info.size = indices_size;
-  index_buffer_info.usage =
-      VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+const Renderer::MaterialVariant* Renderer::GetMaterialVariant(
+    uint32_t features) {
+  MaterialVariant& variant = material_variants_[features];
+  if (variant.pipeline == VK_NULL_HANDLE) {
+    std::optional<MaterialVariant> built = BuildMaterialVariant(features);
+    if (!built.has_value()) {
+      std::cerr << "Unable to build the pipelines of material features "
+                << features << ".\n";
+      return nullptr;
+    }
+    variant = built.value();
+    OptimizeMaterialVariant(features);
+  }
+  pipeline_usage_.RecordMaterial(features);
+  return &variant;
+}
 
-  vma_alloc_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+void Renderer::PrewarmPipelines(const PipelineManifest& manifest) {
+  std::vector<uint32_t> missing;
+  for (uint32_t features : manifest.materials()) {
+    if (features < kMaterialVariantCount &&
+        material_variants_[features].pipeline == VK_NULL_HANDLE) {
+      missing.push_back(features);
+    }
+  }
+  if (missing.empty()) {
+    return;
+  }
 
-  if (vmaCreateBuffer(allocator_, &index_buffer_info, &vma_alloc_info,
-                      &mesh.index_buffer.buffer, &mesh.index_buffer.allocation,
-                      nullptr) != VK_SUCCESS) {
-    return false;
+  // Pipeline creation and the pipeline cache are thread safe, and each task
+  // fills its own slot. Variants that fail are retried, and reported, on
+  // first use.
+  std::vector<std::optional<MaterialVariant>> built(missing.size());
+  {
+    const size_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+    util::WorkerPool workers(std::min(missing.size(), cores));
+    for (size_t i = 0; i < missing.size(); i++) {
+      workers.Submit([this, &built, &missing, i]() {
+        built[i] = BuildMaterialVariant(missing[i]);
+      });
+    }
+    workers.Wait();
   }
 
-  deletion_stack_.Push([=]() {
-    vmaDestroyBuffer(allocator_, mesh.index_buffer.buffer,
-                     mesh.index_buffer.allocation);
-  });
+  for (size_t i = 0; i < missing.size(); i++) {
+    if (built[i].has_value()) {
+      material_variants_[missing[i]] = built[i].value();
+      OptimizeMaterialVariant(missing[i]);
+    }
+  }
+}
 
-  queue_submitter_->SubmitImmediate([=](VkCommandBuffer cmd) {
-    VkBufferCopy copy;
-    copy.srcOffset = 0;
-    copy.dstOffset = 0;
-    copy.size = indices_size;
-    vkCmdCopyBuffer(cmd, index_staging_buffer.buffer, mesh.index_buffer.buffer,
-                    1, &copy);
-  });
+void Renderer::InitMeshLibraries() {
+  const VkGraphicsPipelineLibraryFlagsEXT parts[] = {
+      VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT,
+      VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+      VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT};
+  VkPipeline* libraries[] = {&mesh_libraries_.vertex_input,
+                             &mesh_libraries_.pre_rasterization,
+                             &mesh_libraries_.fragment_output};
+
+  for (size_t i = 0; i < std::size(parts); i++) {
+    std::optional<VkPipeline> library = mesh_pipeline_builder_.BuildLibrary(
+        device_, forward_pass_, pipeline_cache_, parts[i]);
+    if (!library.has_value()) {
+      std::cerr << "Unable to build the mesh pipeline libraries, material "
+                   "variants are built whole.\n";
+      for (VkPipeline* built : libraries) {
+        if (*built != VK_NULL_HANDLE) {
+          vkDestroyPipeline(device_, *built, nullptr);
+          *built = VK_NULL_HANDLE;
+        }
+      }
+      return;
+    }
+    *libraries[i] = library.value();
+  }
 
-  return true;
+  for (VkPipeline* library : libraries) {
+    deletion_queue_.Push(*library);
+  }
+  pipeline_optimizer_ = std::make_unique<util::WorkerPool>(1);
 }
 
-Renderer::Material* Renderer::CreateMaterial(VkPipeline pipeline,
-                                             VkPipelineLayout layout,
-                                             const std::string& name) {
-  Material material;
-  material.pipeline = pipeline;
-  material.pipeline_layout = layout;
-  materials_[name] = material;
+void Renderer::OptimizeMaterialVariant(uint32_t features) {
+  if (!pipeline_optimizer_) {
+    return;
+  }
+
+  const MaterialVariant& variant = material_variants_[features];
+  std::vector<VkPipeline> libraries = {
+      mesh_libraries_.vertex_input, mesh_libraries_.pre_rasterization,
+      variant.fragment_library, mesh_libraries_.fragment_output};
+  std::vector<VkPipeline> prepass_libraries = libraries;
+  prepass_libraries[2] = variant.prepass_fragment_library;
+
+  // The libraries live until shutdown, which waits for this task.
+  pipeline_optimizer_->Submit([this, features, libraries,
+                               prepass_libraries]() {
+    std::optional<VkPipeline> pipeline = PipelineBuilder::Link(
+        device_, libraries, mesh_pipeline_layout_, pipeline_cache_, true);
+    std::optional<VkPipeline> prepass_pipeline =
+        PipelineBuilder::Link(device_, prepass_libraries,
+                              mesh_pipeline_layout_, pipeline_cache_, true);
+    if (!pipeline.has_value() || !prepass_pipeline.has_value()) {
+      // The fast links stay in use.
+      if (pipeline.has_value()) {
+        vkDestroyPipeline(device_, pipeline.value(), nullptr);
+      }
+      if (prepass_pipeline.has_value()) {
+        vkDestroyPipeline(device_, prepass_pipeline.value(), nullptr);
+      }
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(optimized_mutex_);
+    optimized_variants_.push_back(
+        {features, pipeline.value(), prepass_pipeline.value()});
+  });
+}
 
-  return &materials_[name];
+void Renderer::ApplyOptimizedVariants() {
+  std::vector<OptimizedVariant> optimized;
+  {
+    std::lock_guard<std::mutex> lock(optimized_mutex_);
+    optimized.swap(optimized_variants_);
+  }
+
+  // Materials point at the variant, so they all pick the new pipelines up.
+  for (const OptimizedVariant& link : optimized) {
+    MaterialVariant& variant = material_variants_[link.features];
+    Retire(variant.pipeline);
+    Retire(variant.prepass_pipeline);
+    variant.pipeline = link.pipeline;
+    variant.prepass_pipeline = link.prepass_pipeline;
+  }
 }
 
 Renderer::Material* Renderer::GetMaterial(const std::string& name) {
@@ -1166,6 +1913,62 @@ Renderer::Material* Renderer::GetMaterial(const std::string& name) {
   return &(*it).second;
 }
 
+void Renderer::ReleaseMesh(const std::string& name) {
+  auto it = meshes_.find(name);
+  if (it == meshes_.end()) {
+    return;
+  }
+
+  Mesh* mesh = &it->second;
+  renderables_.erase(
+      std::remove_if(renderables_.begin(), renderables_.end(),
+                     [=](const RenderObject& r) { return r.mesh == mesh; }),
+      renderables_.end());
+  IndexObjects();
+
+  auto cached = cached_meshes_.find(name);
+  if (cached != cached_meshes_.end()) {
+    // The buffers belong to the asset cache, only our reference goes.
+    retired_models_.emplace_back(framenumber_, std::move(cached->second));
+    cached_meshes_.erase(cached);
+  } else {
+    if (defragmenter_) {
+      defragmenter_->Untrack(mesh->vertex_buffer.allocation);
+      defragmenter_->Untrack(mesh->position_buffer.allocation);
+      defragmenter_->Untrack(mesh->index_buffer.allocation);
+    }
+    Retire(mesh->vertex_buffer.buffer, mesh->vertex_buffer.allocation);
+    Retire(mesh->position_buffer.buffer, mesh->position_buffer.allocation);
+    Retire(mesh->index_buffer.buffer, mesh->index_buffer.allocation);
+  }
+  shadows_->InvalidateCache();
+  if (geometry_arena_) {
+    geometry_arena_->Free(mesh->geometry, framenumber_);
+  }
+  meshes_.erase(it);
+}
+
+void Renderer::ReleaseMaterial(const std::string& name) {
+  auto it = materials_.find(name);
+  if (it == materials_.end()) {
+    return;
+  }
+
+  Material* material = &it->second;
+  renderables_.erase(std::remove_if(renderables_.begin(), renderables_.end(),
+                                    [=](const RenderObject& r) {
+                                      return r.material == material;
+                                    }),
+                     renderables_.end());
+  IndexObjects();
+  shadows_->InvalidateCache();
+
+  // Pipelines belong to the variants and live until shutdown. Frames in
+  // flight read their own copy of the table, so the slot is free at once.
+  material_table_->Remove(material->index);
+  materials_.erase(it);
+}
+
 Mesh* Renderer::GetMesh(const std::string& name) {
   auto it = meshes_.find(name);
   if (it == meshes_.end()) {
@@ -1175,38 +1978,54 @@ Mesh* Renderer::GetMesh(const std::string& name) {
   return &(*it).second;
 }
 
-void Renderer::DrawObjects(VkCommandBuffer cmd, RenderObject* first,
-                           int count) {
-  glm::vec3 camera_position = {0.f, -6.f, -10.f};
-
-  glm::mat4 view = glm::translate(glm::mat4(1.f), camera_position);
-
-  glm::mat4 projection =
-      glm::perspective(glm::radians(70.f),
-                       static_cast<float>(swapchain_extent_.width) /
-                           static_cast<float>(swapchain_extent_.height),
-                       0.1f, 200.0f);
-  projection[1][1] *= -1;
+void Renderer::UploadFrameData(RenderObject* first, int count) {
+  const float aspect = static_cast<float>(view_extent_.width) /
+                       static_cast<float>(view_extent_.height);
 
   // Fill a GpuCameraData struct.
-  GpuCameraData camera_data;
-  camera_data.projection = projection;
-  camera_data.view = view;
-  camera_data.view_projection = projection * view;
+  GpuCameraData camera_data = {};
+  for (uint32_t i = 0; i < view_count_; i++) {
+    const Camera camera =
+        cameras_.empty() ? Camera()
+                         : cameras_[std::min<size_t>(i, cameras_.size() - 1)];
+    RenderView& view = views_[i];
+    view.view = camera.view;
+    view.projection = Projection(camera, aspect, kNearPlane, kFarPlane);
+    view.view_projection = view.projection * view.view;
+    camera_data.views[i] = view;
+  }
+  const util::Span<const RenderView> views(views_.data(), view_count_);
 
   void* data;
   vmaMapMemory(allocator_, GetFrame().camera_buffer.allocation, &data);
   memcpy(data, &camera_data, sizeof(GpuCameraData));
   vmaUnmapMemory(allocator_, GetFrame().camera_buffer.allocation);
 
+  int frame_index = framenumber_ % kFrameOverlap;
+
+  lighting_->Update(frame_index, lights_, views, render_extent_, kNearPlane,
+                    kFarPlane);
+
+  util::SpanBuilder<ShadowCaster> casters(GetFrame().arena, count);
+  for (int i = 0; i < count; i++) {
+    const RenderObject& object = first[i];
+    casters.push_back({object.mesh, object.transform,
+                       static_cast<uint32_t>(i), object.is_static});
+  }
+  util::Span<ShadowCaster> caster_span = casters.Build();
+  shadows_->Update(frame_index, views, kNearPlane,
+                   glm::vec3(scene_parameters_.sunlight_direction),
+                   {caster_span.data(), caster_span.size()},
+                   GetFrame().arena);
+
   // Scene data.
   float framed = framenumber_ / 120.f;
   scene_parameters_.ambient_color = {sin(framed), 1.f, cos(framed), 1.f};
+  scene_parameters_.cluster_scale_bias = lighting_->params().scale_bias;
   char* scene_data;
   vmaMapMemory(allocator_, scene_parameters_buffer_.allocation,
                reinterpret_cast<void**>(&scene_data));
 
-  int frame_index = framenumber_ % kFrameOverlap;
   size_t buffer_offset =
       GetAlignedBufferSize(sizeof(GpuSceneData)) * frame_index;
   scene_data += buffer_offset;
@@ -1214,49 +2033,194 @@ void Renderer::DrawObjects(VkCommandBuffer cmd, RenderObject* first,
 
   vmaUnmapMemory(allocator_, scene_parameters_buffer_.allocation);
 
+  // Cull the bounding spheres against the union of the view frustums, since
+  // every object is drawn once for all views, and against the draw distance.
+  // Shadow casters are not culled here: objects out of view still cast
+  // shadows into it.
+  std::array<std::optional<Frustum>, kMaxViews> frustums;
+  for (uint32_t v = 0; v < view_count_; v++) {
+    frustums[v].emplace(views_[v].view_projection);
+  }
+  util::SpanBuilder<uint32_t> visible(GetFrame().arena, count);
+  for (int i = 0; i < count; i++) {
+    const RenderObject& object = first[i];
+    // The visibility buffer can only shade meshes in the geometry arena.
+    if (visibility_buffer_ && object.mesh->geometry.empty()) {
+      continue;
+    }
+    const glm::vec3 center = glm::vec3(
+        object.transform * glm::vec4(object.mesh->bounds_center, 1.f));
+    const float scale = std::max(
+        {glm::length(glm::vec3(object.transform[0])),
+         glm::length(glm::vec3(object.transform[1])),
+         glm::length(glm::vec3(object.transform[2]))});
+    const float radius = object.mesh->bounds_radius * scale;
+
+    for (uint32_t v = 0; v < view_count_; v++) {
+      const float distance = glm::length(
+          glm::vec3(views_[v].view * glm::vec4(center, 1.f)));
+      if (distance - radius <= quality_.draw_distance &&
+          frustums[v]->Intersects(center, radius)) {
+        visible.push_back(static_cast<uint32_t>(i));
+        break;
+      }
+    }
+  }
+  GetFrame().visible_objects = visible.Build();
+  // Grouped by pipeline variant, then mesh, so that every material with the
+  // same features draws in one run with the fewest rebinds. Objects keep
+  // their index, which is what the shaders see.
+  std::sort(GetFrame().visible_objects.begin(),
+            GetFrame().visible_objects.end(), [first](uint32_t a, uint32_t b) {
+              const RenderObject& x = first[a];
+              const RenderObject& y = first[b];
+              return std::tie(x.material->variant, x.mesh, a) <
+                     std::tie(y.material->variant, y.mesh, b);
+            });
+
   // Object data.
   void* object_data;
   vmaMapMemory(allocator_, GetFrame().object_buffer.allocation, &object_data);
 
+  // ApplySceneChanges() keeps the scene within the buffers.
+  assert(static_cast<uint32_t>(count) <= kMaxObjects);
   GpuObjectData* object_ssbo = reinterpret_cast<GpuObjectData*>(object_data);
   for (int i = 0; i < count; i++) {
     RenderObject& object = first[i];
     object_ssbo[i].model = object.transform;
+    object_ssbo[i].material = object.material->index;
   }
 
   vmaUnmapMemory(allocator_, GetFrame().object_buffer.allocation);
 
+  material_table_->Upload(framenumber_ % kFrameOverlap);
+
+  if (visibility_buffer_) {
+    void* geometry_data;
+    vmaMapMemory(allocator_, GetFrame().geometry_buffer.allocation,
+                 &geometry_data);
+    GpuObjectGeometry* geometry =
+        static_cast<GpuObjectGeometry*>(geometry_data);
+    for (int i = 0; i < count; i++) {
+      const GeometryRange& range = first[i].mesh->geometry;
+      geometry[i] = {range.first_vertex, range.first_index};
+    }
+    vmaUnmapMemory(allocator_, GetFrame().geometry_buffer.allocation);
+  }
+}
+
+void Renderer::SetRenderViewport(VkCommandBuffer cmd) {
+  VkViewport viewport = {};
+  viewport.x = 0.f;
+  viewport.y = 0.f;
+  viewport.width = static_cast<float>(render_extent_.width);
+  viewport.height = static_cast<float>(render_extent_.height);
+  viewport.minDepth = 0.f;
+  viewport.maxDepth = 1.f;
+  vkCmdSetViewport(cmd, 0, 1, &viewport);
+
+  VkRect2D scissor = {{0, 0}, render_extent_};
+  vkCmdSetScissor(cmd, 0, 1, &scissor);
+}
+
+void Renderer::ApplyQuality(const QualitySettings& quality) {
+  quality_ = quality;
+  lighting_->set_max_lights_per_cluster(quality.max_lights_per_cluster);
+  shadows_->set_resolution_scale(quality.shadow_resolution_scale);
+}
+
+void Renderer::DrawPositions(VkCommandBuffer cmd, VkPipeline pipeline,
+                             RenderObject* first,
+                             util::Span<const uint32_t> visible) {
+  SetRenderViewport(cmd);
+
+  // Every material shares the mesh pipeline layout, so a single pipeline and
+  // one set of descriptors cover the whole pass.
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+  uint32_t uniform_offset = GetAlignedBufferSize(sizeof(GpuSceneData)) *
+                            (framenumber_ % kFrameOverlap);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          mesh_pipeline_layout_, 0, 1,
+                          &GetFrame().global_descriptor, 1, &uniform_offset);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          mesh_pipeline_layout_, 1, 1,
+                          &GetFrame().object_descriptor, 0, nullptr);
+
   Mesh* last_mesh = nullptr;
-  Material* last_material = nullptr;
 
-  for (int i = 0; i < count; i++) {
+  for (uint32_t i : visible) {
     RenderObject& object = first[i];
     assert(object.mesh);
-    assert(object.material);
-    // Only bind the pipeline if it doesn't match the one already bound.
-    if (object.material != last_material) {
-      vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                        object.material->pipeline);
-      last_material = object.material;
 
-      uint32_t uniform_offset = buffer_offset;
-      // Bind the descriptor set when changing pipelines. Because we only have
-      // one dynamic offset, we only need to send 1 uniform offset.
-      vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                              object.material->pipeline_layout, 0, 1,
-                              &GetFrame().global_descriptor, 1,
-                              &uniform_offset);
+    const bool is_indexed_draw = !object.mesh->indices.empty();
+
+    if (object.mesh != last_mesh) {
+      VkDeviceSize offset = 0;
+      vkCmdBindVertexBuffers(cmd, 0, 1, &object.mesh->position_buffer.buffer,
+                             &offset);
+      if (is_indexed_draw) {
+        vkCmdBindIndexBuffer(cmd, object.mesh->index_buffer.buffer, 0,
+                             VK_INDEX_TYPE_UINT32);
+      }
+      last_mesh = object.mesh;
+    }
+
+    // The instance index selects the object matrix, exactly as in the forward
+    // pass, and is the object index of visibility buffer IDs.
+    if (is_indexed_draw) {
+      vkCmdDrawIndexed(cmd, static_cast<uint32_t>(object.mesh->indices.size()),
+                       1, 0, 0, i);
+    } else {
+      vkCmdDraw(cmd, static_cast<uint32_t>(object.mesh->vertices.size()), 1, 0,
+                i);
+    }
+  }
+}
+
+void Renderer::DrawObjects(VkCommandBuffer cmd, RenderObject* first,
+                           util::Span<const uint32_t> visible,
+                           bool after_prepass) {
+  SetRenderViewport(cmd);
 
-      vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                              object.material->pipeline_layout, 1, 1,
-                              &GetFrame().object_descriptor, 0, nullptr);
+  int frame_index = framenumber_ % kFrameOverlap;
+  size_t buffer_offset =
+      GetAlignedBufferSize(sizeof(GpuSceneData)) * frame_index;
+
+  // Every variant shares the mesh pipeline layout and materials are
+  // indexed per object, so descriptors are bound once for the whole pass.
+  uint32_t uniform_offset = buffer_offset;
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          mesh_pipeline_layout_, 0, 1,
+                          &GetFrame().global_descriptor, 1, &uniform_offset);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          mesh_pipeline_layout_, 1, 1,
+                          &GetFrame().object_descriptor, 0, nullptr);
+  VkDescriptorSet sets[] = {lighting_->descriptor(frame_index),
+                            shadows_->descriptor(frame_index)};
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          mesh_pipeline_layout_, 2, 2, sets, 0, nullptr);
+
+  Mesh* last_mesh = nullptr;
+  VkPipeline last_pipeline = VK_NULL_HANDLE;
+
+  for (uint32_t i : visible) {
+    RenderObject& object = first[i];
+    assert(object.mesh);
+    assert(object.material);
+    // Only bind the pipeline if it doesn't match the one already bound.
+    const VkPipeline pipeline = after_prepass
+                                    ? object.material->variant->prepass_pipeline
+                                    : object.material->variant->pipeline;
+    if (pipeline != last_pipeline) {
+      vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+      last_pipeline = pipeline;
     }
 
     MeshPushConstants constants;
     constants.matrix = object.transform;
-    vkCmdPushConstants(cmd, object.material->pipeline_layout,
-                       VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants),
-                       &constants);
+    vkCmdPushConstants(cmd, mesh_pipeline_layout_, VK_SHADER_STAGE_VERTEX_BIT,
+                       0, sizeof(MeshPushConstants), &constants);
 
     const bool is_indexed_draw = !object.mesh->indices.empty();
 
@@ -1268,6 +2232,7 @@ void Renderer::DrawObjects(VkCommandBuffer cmd, RenderObject* first,
         vkCmdBindIndexBuffer(cmd, object.mesh->index_buffer.buffer, 0,
                              VK_INDEX_TYPE_UINT32);
       }
+      last_mesh = object.mesh;
     }
 
     if (is_indexed_draw) {
@@ -1280,30 +2245,273 @@ void Renderer::DrawObjects(VkCommandBuffer cmd, RenderObject* first,
   }
 }
 
+void Renderer::ResolveVisibility(VkCommandBuffer cmd,
+                                 GraphImage visibility) {
+  FrameData& frame = GetFrame();
+  // A 2D array view, as the resolve shader's usampler2DArray requires even
+  // with a single view.
+  VkImageView view = render_graph_->GetView(visibility);
+  if (view != frame.bound_visibility_view) {
+    VkDescriptorImageInfo image_info = {};
+    image_info.sampler = visibility_sampler_;
+    image_info.imageView = view;
+    image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.pNext = nullptr;
+    write.dstSet = frame.visibility_descriptor;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &image_info;
+    vkUpdateDescriptorSets(device_, 1, &write, 0, nullptr);
+    frame.bound_visibility_view = view;
+  }
+
+  SetRenderViewport(cmd);
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                    visibility_resolve_pipeline_);
+
+  const int frame_index = framenumber_ % kFrameOverlap;
+  uint32_t uniform_offset =
+      GetAlignedBufferSize(sizeof(GpuSceneData)) * frame_index;
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          visibility_pipeline_layout_, 0, 1,
+                          &frame.global_descriptor, 1, &uniform_offset);
+  VkDescriptorSet sets[] = {frame.object_descriptor,
+                            lighting_->descriptor(frame_index),
+                            shadows_->descriptor(frame_index),
+                            frame.visibility_descriptor};
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          visibility_pipeline_layout_, 1, 4, sets, 0, nullptr);
+
+  const glm::vec2 extent(static_cast<float>(render_extent_.width),
+                         static_cast<float>(render_extent_.height));
+  vkCmdPushConstants(cmd, visibility_pipeline_layout_,
+                     VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(glm::vec2),
+                     &extent);
+  vkCmdDraw(cmd, 3, 1, 0, 0);
+}
+
+void Renderer::ComposeViews(VkCommandBuffer cmd, VkImage views,
+                            VkImage target) {
+  VkImageBlit blits[kMaxViews] = {};
+  for (uint32_t i = 0; i < view_count_; i++) {
+    VkImageBlit& blit = blits[i];
+    blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, i, 1};
+    blit.srcOffsets[1] = {static_cast<int32_t>(render_extent_.width),
+                          static_cast<int32_t>(render_extent_.height), 1};
+    blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    blit.dstOffsets[0] = {static_cast<int32_t>(i * view_extent_.width), 0, 0};
+    blit.dstOffsets[1] = {static_cast<int32_t>((i + 1) * view_extent_.width),
+                          static_cast<int32_t>(view_extent_.height), 1};
+  }
+  vkCmdBlitImage(cmd, views, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, target,
+                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, view_count_, blits,
+                 VK_FILTER_LINEAR);
+}
+
+void Renderer::ApplySceneChanges() {
+  std::vector<SceneChange>& changes = drained_changes_;
+  changes.clear();
+  // Deferred changes go first so that they are not deferred again.
+  const size_t retries = deferred_changes_.size();
+  std::move(deferred_changes_.begin(), deferred_changes_.end(),
+            std::back_inserter(changes));
+  deferred_changes_.clear();
+  scene_changes_.Drain(changes);
+  if (changes.empty()) {
+    return;
+  }
+
+  // Object indices must also fit in the visibility buffer IDs.
+  static_assert(kMaxObjects <= 1u << (32 - kVisibilityTriangleBits),
+                "Too many objects for the visibility buffer IDs.");
+  bool shadows_changed = false;
+  for (SceneChange& change : changes) {
+    if (change.kind != SceneChange::Kind::kCreate) {
+      continue;
+    }
+    if (renderables_.size() >= kMaxObjects) {
+      std::cerr << "Object " << change.object << " dropped, the scene is "
+                << "limited to " << kMaxObjects << " objects.\n";
+      continue;
+    }
+    RenderObject object;
+    object.id = change.object;
+    object.mesh = GetMesh(change.mesh);
+    object.material = GetMaterial(change.material);
+    object.transform = change.transform;
+    object.is_static = change.is_static;
+    if (object.mesh == nullptr || object.material == nullptr) {
+      std::cerr << "Object " << change.object << " has an unknown mesh "
+                << change.mesh << " or material " << change.material
+                << ".\n";
+      continue;
+    }
+    object_indices_[object.id] = renderables_.size();
+    renderables_.push_back(object);
+    shadows_changed = shadows_changed || object.is_static;
+  }
+
+  bool destroyed = false;
+  for (size_t i = 0; i < changes.size(); i++) {
+    SceneChange& change = changes[i];
+    if (change.kind == SceneChange::Kind::kCreate) {
+      continue;
+    }
+    auto it = object_indices_.find(change.object);
+    if (it == object_indices_.end()) {
+      // The object may have been created on another thread whose changes
+      // were drained before it was visible here; it will be next frame.
+      if (i >= retries) {
+        deferred_changes_.push_back(std::move(change));
+      }
+      continue;
+    }
+
+    RenderObject& object = renderables_[it->second];
+    switch (change.kind) {
+      case SceneChange::Kind::kSetTransform:
+        object.transform = change.transform;
+        shadows_changed = shadows_changed || object.is_static;
+        break;
+      case SceneChange::Kind::kSetMaterial:
+        if (Material* material = GetMaterial(change.material)) {
+          object.material = material;
+        } else {
+          std::cerr << "Unknown material " << change.material << ".\n";
+        }
+        break;
+      case SceneChange::Kind::kDestroy:
+        // Removed below, once no change refers to it by index anymore.
+        object.mesh = nullptr;
+        destroyed = true;
+        shadows_changed = shadows_changed || object.is_static;
+        break;
+      case SceneChange::Kind::kCreate:
+        break;
+    }
+  }
+
+  if (destroyed) {
+    renderables_.erase(
+        std::remove_if(renderables_.begin(), renderables_.end(),
+                       [](const RenderObject& r) { return r.mesh == nullptr; }),
+        renderables_.end());
+    IndexObjects();
+  }
+  if (shadows_changed) {
+    shadows_->InvalidateCache();
+  }
+}
+
+void Renderer::IndexObjects() {
+  object_indices_.clear();
+  for (size_t i = 0; i < renderables_.size(); i++) {
+    object_indices_[renderables_[i].id] = i;
+  }
+}
+
+SceneSnapshot Renderer::CaptureScene() const {
+  SceneSnapshot snapshot;
+  snapshot.objects.reserve(renderables_.size());
+  snapshot.transforms.reserve(renderables_.size());
+  snapshot.is_static.reserve(renderables_.size());
+  for (const RenderObject& object : renderables_) {
+    snapshot.objects.push_back(object.id);
+    snapshot.transforms.push_back(object.transform);
+    snapshot.is_static.push_back(object.is_static ? 1 : 0);
+  }
+  snapshot.cameras = cameras_;
+  snapshot.lights = lights_;
+  return snapshot;
+}
+
+void Renderer::ApplyScene(const SceneSnapshot& snapshot) {
+  const size_t count =
+      std::min(snapshot.objects.size(),
+               std::min(snapshot.transforms.size(), snapshot.is_static.size()));
+  bool static_moved = false;
+  for (size_t i = 0; i < count; i++) {
+    auto it = object_indices_.find(snapshot.objects[i]);
+    if (it == object_indices_.end()) {
+      continue;
+    }
+    RenderObject& object = renderables_[it->second];
+    const bool is_static = snapshot.is_static[i] != 0;
+    // Cached shadows are only stale if a static object moved or an object
+    // changed between static and dynamic.
+    static_moved = static_moved || object.is_static != is_static ||
+                   (is_static && object.transform != snapshot.transforms[i]);
+    object.transform = snapshot.transforms[i];
+    object.is_static = is_static;
+  }
+  if (static_moved) {
+    shadows_->InvalidateCache();
+  }
+
+  // Assignment reuses the vectors' capacity.
+  cameras_ = snapshot.cameras;
+  lights_ = snapshot.lights;
+}
+
 void Renderer::InitScene() {
-  for (int i = 1; i <= 3; i++) {
-    RenderObject shiba;
-    shiba.mesh = GetMesh("shiba_" + std::to_string(i));
-    shiba.material = GetMaterial("default");
-    shiba.transform = glm::mat4{1.f};
+  // The default cameras sit side by side like a wall of monitors, each
+  // turned by one view's horizontal field of view.
+  Camera camera;
+  const float aspect = static_cast<float>(view_extent_.width) /
+                       static_cast<float>(view_extent_.height);
+  const float fov_x = 2.f * std::atan(std::tan(camera.fov_y * 0.5f) * aspect);
+  const glm::mat4 eye = glm::translate(glm::mat4(1.f), {0.f, -6.f, -10.f});
+  for (uint32_t i = 0; i < view_count_; i++) {
+    const float yaw = (i - 0.5f * (view_count_ - 1)) * fov_x;
+    camera.view = glm::rotate(yaw, glm::vec3(0.f, 1.f, 0.f)) * eye;
+    cameras_.push_back(camera);
+  }
 
-    renderables_.push_back(shiba);
+  for (int i = 1; i <= 3; i++) {
+    CreateObject("shiba_" + std::to_string(i), "default", glm::mat4{1.f});
   }
 
   for (int x = -20; x <= 20; x++) {
     for (int z = -20; z <= 20; z++) {
-      RenderObject triangle;
-      triangle.mesh = GetMesh("triangle");
-      triangle.material = GetMaterial("default");
-
       glm::mat4 translation =
           glm::translate(glm::mat4{1.f}, glm::vec3(x, 0, z));
       glm::mat4 scale = glm::scale(glm::mat4{1.f}, glm::vec3(.2f, .2f, .2f));
-      triangle.transform = translation * scale;
-
-      renderables_.push_back(triangle);
+      CreateObject("triangle", "default", translation * scale);
+    }
+  }
+  // Applied now so the scene can be captured before the first frame.
+  ApplySceneChanges();
+
+  scene_parameters_.sunlight_direction =
+      glm::vec4(glm::normalize(glm::vec3(-0.4f, -1.f, -0.3f)), 1.f);
+  scene_parameters_.sunlight_color = {1.f, 0.95f, 0.8f, 1.f};
+
+  // A field of small point lights over the triangles, plus a spot light on
+  // the model.
+  for (int x = -20; x <= 20; x += 2) {
+    for (int z = -20; z <= 20; z += 2) {
+      Light light;
+      light.position = glm::vec3(x, 1.f, z);
+      light.range = 3.f;
+      light.color = glm::vec3((x + 20) / 40.f, 0.5f, (z + 20) / 40.f);
+      light.intensity = 2.f;
+      lights_.push_back(light);
     }
   }
+
+  Light spot;
+  spot.position = glm::vec3(0.f, 8.f, 4.f);
+  spot.range = 20.f;
+  spot.color = glm::vec3(1.f, 0.9f, 0.7f);
+  spot.intensity = 4.f;
+  spot.direction = glm::normalize(glm::vec3(0.f, -1.f, -0.5f));
+  spot.inner_cone_cos = std::cos(glm::radians(15.f));
+  spot.outer_cone_cos = std::cos(glm::radians(25.f));
+  lights_.push_back(spot);
 }
 
 void Renderer::InitDescriptors() {
@@ -1312,7 +2520,9 @@ void Renderer::InitDescriptors() {
   std::vector<VkDescriptorPoolSize> sizes = {
       {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10},
       {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 10},
-      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10},
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 20},
+      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 10},
+      {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 10},
   };
 
   VkDescriptorPoolCreateInfo pool_info = {};
@@ -1320,7 +2530,7 @@ void Renderer::InitDescriptors() {
   pool_info.pNext = nullptr;
 
   pool_info.flags = 0;
-  pool_info.maxSets = 10;
+  pool_info.maxSets = 16;
   pool_info.poolSizeCount = static_cast<uint32_t>(sizes.size());
   pool_info.pPoolSizes = sizes.data();
 
@@ -1330,8 +2540,9 @@ void Renderer::InitDescriptors() {
 
   // Binding for camera data at 0.
   VkDescriptorSetLayoutBinding camera_binding =
-      init::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                                       VK_SHADER_STAGE_VERTEX_BIT, 0);
+      init::DescriptorSetLayoutBinding(
+          VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+          VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0);
   // Binding for scene data at 1.
   VkDescriptorSetLayoutBinding scene_binding = init::DescriptorSetLayoutBinding(
       VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
@@ -1354,8 +2565,17 @@ void Renderer::InitDescriptors() {
   // Descriptor Set 2:
 
   VkDescriptorSetLayoutBinding object_binding =
-      init::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-                                       VK_SHADER_STAGE_VERTEX_BIT, 0);
+      init::DescriptorSetLayoutBinding(
+          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0);
+  // Binding for material parameters at 1.
+  VkDescriptorSetLayoutBinding material_binding =
+      init::DescriptorSetLayoutBinding(
+          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 1);
+
+  VkDescriptorSetLayoutBinding object_bindings[] = {object_binding,
+                                                    material_binding};
 
   VkDescriptorSetLayoutCreateInfo descriptor_set_2_info = {};
   descriptor_set_2_info.sType =
@@ -1363,8 +2583,8 @@ void Renderer::InitDescriptors() {
   descriptor_set_2_info.pNext = nullptr;
 
   descriptor_set_2_info.flags = 0;
-  descriptor_set_2_info.bindingCount = 1;
-  descriptor_set_2_info.pBindings = &object_binding;
+  descriptor_set_2_info.bindingCount = 2;
+  descriptor_set_2_info.pBindings = object_bindings;
 
   vkCreateDescriptorSetLayout(device_, &descriptor_set_2_info, nullptr,
                               &object_set_layout_);
@@ -1375,31 +2595,27 @@ void Renderer::InitDescriptors() {
   scene_parameters_buffer_ = CreateBuffer(
       allocator_, scene_parameters_buffer_size,
       VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-  deletion_stack_.Push([&]() {
-    vmaDestroyBuffer(allocator_, scene_parameters_buffer_.buffer,
-                     scene_parameters_buffer_.allocation);
-  });
+  deletion_queue_.Push(scene_parameters_buffer_.buffer,
+                       scene_parameters_buffer_.allocation);
+
+  material_table_ = std::make_unique<MaterialTable>(allocator_);
+  material_table_->Init(kFrameOverlap);
 
   for (int i = 0; i < kFrameOverlap; i++) {
     // Initialize object buffer.
-    const int kMaxObjects = 10'000;
     frames_[i].object_buffer = CreateBuffer(
         allocator_, sizeof(GpuObjectData) * kMaxObjects,
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-    deletion_stack_.Push([&, i]() {
-      vmaDestroyBuffer(allocator_, frames_[i].object_buffer.buffer,
-                       frames_[i].object_buffer.allocation);
-    });
+    deletion_queue_.Push(frames_[i].object_buffer.buffer,
+                         frames_[i].object_buffer.allocation);
 
     // Initialize camera buffer.
     frames_[i].camera_buffer = CreateBuffer(allocator_, sizeof(GpuCameraData),
                                             VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
                                             VMA_MEMORY_USAGE_CPU_TO_GPU);
-    // Add buffers to the deletion stack.
-    deletion_stack_.Push([&, i]() {
-      vmaDestroyBuffer(allocator_, frames_[i].camera_buffer.buffer,
-                       frames_[i].camera_buffer.allocation);
-    });
+    // Add buffers to the deletion queue.
+    deletion_queue_.Push(frames_[i].camera_buffer.buffer,
+                         frames_[i].camera_buffer.allocation);
 
     // Allocate one descriptor set for each frame.
     VkDescriptorSetAllocateInfo allocate_info = {};
@@ -1452,17 +2668,24 @@ void Renderer::InitDescriptors() {
         init::WriteDescriptorSet(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
                                  frames_[i].object_descriptor, &object_info, 0);
 
+    VkDescriptorBufferInfo material_info = {};
+    material_info.buffer = material_table_->buffer(i);
+    material_info.offset = 0;
+    material_info.range = MaterialTable::size();
+
+    VkWriteDescriptorSet material_write = init::WriteDescriptorSet(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frames_[i].object_descriptor,
+        &material_info, 1);
+
     VkWriteDescriptorSet set_writes[] = {camera_write, scene_write,
-                                         object_write};
+                                         object_write, material_write};
 
-    vkUpdateDescriptorSets(device_, 3, set_writes, 0, nullptr);
+    vkUpdateDescriptorSets(device_, 4, set_writes, 0, nullptr);
   }
 
-  deletion_stack_.Push([&]() {
-    vkDestroyDescriptorSetLayout(device_, global_set_layout_, nullptr);
-    vkDestroyDescriptorSetLayout(device_, object_set_layout_, nullptr);
-    vkDestroyDescriptorPool(device_, descriptor_pool_, nullptr);
-  });
+  deletion_queue_.Push(global_set_layout_);
+  deletion_queue_.Push(object_set_layout_);
+  deletion_queue_.Push(descriptor_pool_);
 }
 
 Renderer::FrameData& Renderer::GetFrame() {
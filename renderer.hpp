@@ -1,5 +1,9 @@
 #pragma once
 
+#include <array>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <unordered_map>
@@ -9,10 +13,32 @@
 #include <vk_mem_alloc.h>
 #include <vulkan/vulkan.h>
 
+#include "async_compute.hpp"
 #include "buffer.hpp"
+#include "camera.hpp"
+#include "cascaded_shadows.hpp"
+#include "clustered_lighting.hpp"
+#include "defragmenter.hpp"
+#include "deletion_queue.hpp"
+#include "device_context.hpp"
+#include "dynamic_resolution.hpp"
+#include "geometry_arena.hpp"
+#include "gpu_timer.hpp"
+#include "linear_arena.hpp"
+#include "material_table.hpp"
+#include "pipeline_manifest.hpp"
+#include "post_process.hpp"
+#include "quality_governor.hpp"
 #include "queue_submitter.hpp"
-#include "task_stack.hpp"
+#include "readback_ring.hpp"
+#include "render_graph.hpp"
+#include "render_target_pool.hpp"
+#include "retirement_queue.hpp"
+#include "scene_changes.hpp"
+#include "scene_snapshot.hpp"
 #include "vk_mesh.hpp"
+#include "vk_types.hpp"
+#include "worker_pool.hpp"
 
 namespace vk {
 
@@ -26,42 +52,244 @@ class Renderer {
     HWND window_handle;
 
     std::vector<const char*> extensions;
+
+    // Render on an existing device instead of creating one, e.g. to serve
+    // several scenes from one process. application_name, extensions and
+    // window_handle are then taken from the context, and async_compute
+    // needs a context created with it. Memory defragmentation is off on
+    // shared contexts since it would move other renderers' allocations.
+    std::shared_ptr<DeviceContext> context;
+
+    // Render `width` x `height` frames offscreen instead of to the window,
+    // e.g. on render farm nodes. window_handle is ignored and nothing is
+    // presented; frames are pulled back with ReadNextFrame().
+    bool headless = false;
+
+    // Lay down depth in a position-only pass before shading. See
+    // set_depth_prepass().
+    bool depth_prepass = false;
+
+    // Views rendered each frame, side by side across the window, e.g. one
+    // per monitor or eye. Up to kMaxViews. With more than one, geometry is
+    // submitted once and broadcast to all views with multiview.
+    uint32_t view_count = 1;
+
+    // When set, the scene is rendered at a resolution picked every few frames
+    // to keep the GPU frame time within budget, then upscaled to the
+    // swapchain.
+    std::optional<DynamicResolution::Settings> dynamic_resolution;
+
+    // When set, draw distance, shadow resolution and light limits are
+    // lowered as needed to hold a frame time target. See QualityGovernor.
+    std::optional<QualityGovernor::Settings> quality_governor;
+
+    // Bin lights on a dedicated compute queue, if the GPU has one, so the
+    // binning of a frame overlaps the shading of the previous one.
+    bool async_compute = false;
+
+    // When set, the scene is rendered in HDR and tonemapped, color graded
+    // and antialiased before presentation. See PostProcess.
+    std::optional<PostProcess::Settings> post_process;
+
+    // When set, meshes are also copied into a geometry arena of this
+    // capacity, which enables set_visibility_buffer().
+    std::optional<GeometryArena::Capacity> geometry_arena;
+
+    // Path of a PipelineManifest. The pipelines it lists are built in
+    // parallel during Init(), and the ones this session used are written
+    // back on Shutdown(). Empty to build pipelines on first use only.
+    std::string pipeline_manifest;
+  };
+
+  struct FrameStats {
+    // CPU time spent recording and submitting the last frame.
+    float cpu_ms = 0.f;
+    // GPU time of the most recent frame to complete. Lags the CPU by the
+    // frames in flight.
+    float gpu_ms = 0.f;
+    // Async compute time of the same frame, and how much of it ran while
+    // the graphics queue was still busy with the frame before. Zero without
+    // async compute.
+    float compute_ms = 0.f;
+    float compute_overlap_ms = 0.f;
+    VkExtent2D render_extent = {0, 0};
+    uint32_t quality_level = 0;
+    QualitySettings quality;
+    uint32_t drawn_objects = 0;
   };
 
   // Lifetime events.
   bool Init(InitParams params);
-  void Draw();
+  // Whether the frame was rendered and presented. A frame that could not be
+  // submitted breaks the futures ReadNextFrame() handed out for it.
+  bool Draw();
   void Shutdown();
 
+  // Runtime resource streaming. Released resources are destroyed once the
+  // frames that may still reference them have completed on the GPU. Any
+  // renderables using them are removed from the scene immediately.
+  void ReleaseMesh(const std::string& name);
+  void ReleaseMaterial(const std::string& name);
+
+  // Material instances. Parameters live in a table indexed per object, and
+  // the feature bits pick one of the pipeline variants built at startup, so
+  // instances with the same features draw without state changes between
+  // them and creating or editing one never compiles a pipeline. Changes
+  // show from the next Draw(); call from the thread calling Draw().
+  bool CreateMaterial(const std::string& name, const MaterialParams& params);
+  bool SetMaterialParams(const std::string& name,
+                         const MaterialParams& params);
+
+  // Scene objects, drawing a mesh with a material. Callable from any thread
+  // without blocking: changes are recorded per thread and applied together
+  // at the start of the next Draw(), creations first and then the other
+  // changes, so an object destroyed in the same frame it is changed in is
+  // gone. Static objects have their shadows cached; moving, adding or
+  // removing one redraws the cache.
+  ObjectId CreateObject(std::string mesh, std::string material,
+                        const glm::mat4& transform, bool is_static = true) {
+    return scene_changes_.Create(std::move(mesh), std::move(material),
+                                 transform, is_static);
+  }
+  void DestroyObject(ObjectId object) { scene_changes_.Destroy(object); }
+  void SetObjectTransform(ObjectId object, const glm::mat4& transform) {
+    scene_changes_.SetTransform(object, transform);
+  }
+  void SetObjectMaterial(ObjectId object, std::string material) {
+    scene_changes_.SetMaterial(object, std::move(material));
+  }
+
+  // Adds the meshes of the glTF model at `path` as `name`_1, `name`_2, ...
+  // Models come from the context's asset cache, so one already loaded by
+  // this or another renderer on the context is not loaded again.
+  bool LoadModel(const std::string& path, const std::string& name);
+
   // Accessors.
   bool initialized() { return initialized_; }
   int framenumber() { return framenumber_; }
 
+  // With the prepass enabled the forward pass only shades the closest
+  // fragment of each pixel, at the cost of transforming geometry twice. Worth
+  // it in high overdraw scenes with expensive fragment shaders. Takes effect
+  // on the next Draw().
+  bool depth_prepass() { return depth_prepass_; }
+  void set_depth_prepass(bool enabled) { depth_prepass_ = enabled; }
+
+  // With the visibility buffer only (object, triangle) IDs are rasterized;
+  // a full screen pass then fetches each pixel's triangle from the geometry
+  // arena and shades it once, so shading cost no longer grows with overdraw
+  // or triangle density. Worth it for dense scenes of small triangles.
+  // Needs InitParams::geometry_arena. Takes effect on the next Draw().
+  bool visibility_buffer() { return visibility_buffer_; }
+  void set_visibility_buffer(bool enabled) {
+    visibility_buffer_ = enabled && geometry_arena_ != nullptr;
+  }
+
+  // Headless only. Copies the frame of the next Draw() to host memory. The
+  // future is ready once the GPU has rendered it, as noticed by the Draw()
+  // that reuses its frame slot or by FlushReadbacks(), so the pixels of
+  // frame N can be read while frames N + 1 and N + 2 render. The image must
+  // be dropped before Shutdown().
+  std::future<ReadbackRing::Image> ReadNextFrame();
+  // Waits for the frames in flight and readies their futures, e.g. at the
+  // end of a batch.
+  void FlushReadbacks();
+
+  // Resolution each view was last rendered at. Equal to the view's tile of
+  // the swapchain unless dynamic resolution is enabled.
+  VkExtent2D render_extent() { return render_extent_; }
+
+  const FrameStats& frame_stats() { return frame_stats_; }
+
+  // Point and spot lights in world space. Up to ClusteredLighting::kMaxLights
+  // are used.
+  void SetLights(std::vector<Light> lights) { lights_ = std::move(lights); }
+
+  // One camera per view. Views without a camera of their own use the last
+  // one.
+  void SetCameras(std::vector<Camera> cameras) {
+    cameras_ = std::move(cameras);
+  }
+
+  // The current objects, cameras and lights. Used to seed a simulation.
+  SceneSnapshot CaptureScene() const;
+  // Takes the scene of the next Draw() from `snapshot`. Copies into storage
+  // that is kept across frames, so steady state frames do not allocate.
+  void ApplyScene(const SceneSnapshot& snapshot);
+
  private:
   struct PipelineBuilder {
     std::vector<VkPipelineShaderStageCreateInfo> shader_stages;
     VkPipelineVertexInputStateCreateInfo vertex_input_info;
     VkPipelineInputAssemblyStateCreateInfo input_assembly;
     VkPipelineDepthStencilStateCreateInfo depth_stencil;
-    VkViewport viewport;
-    VkRect2D scissor;
     VkPipelineRasterizationStateCreateInfo rasterizer;
     VkPipelineColorBlendAttachmentState color_blend_attachment;
     VkPipelineMultisampleStateCreateInfo multisampling;
     VkPipelineLayout layout;
 
-    std::optional<VkPipeline> Build(VkDevice device, VkRenderPass renderpass);
+    std::optional<VkPipeline> Build(VkDevice device, VkRenderPass renderpass,
+                                    VkPipelineCache cache);
+    // One or more parts of the pipeline, as a VK_EXT_graphics_pipeline_library
+    // library to Link() with the others.
+    std::optional<VkPipeline> BuildLibrary(
+        VkDevice device, VkRenderPass renderpass, VkPipelineCache cache,
+        VkGraphicsPipelineLibraryFlagsEXT parts);
+    // A pipeline from libraries covering every part. Without `optimize` the
+    // link is fast but the code is as compiled in each library.
+    static std::optional<VkPipeline> Link(
+        VkDevice device, const std::vector<VkPipeline>& libraries,
+        VkPipelineLayout layout, VkPipelineCache cache, bool optimize);
+
+   private:
+    // Monolithic when `parts` is 0.
+    std::optional<VkPipeline> Create(VkDevice device, VkRenderPass renderpass,
+                                     VkPipelineCache cache,
+                                     VkGraphicsPipelineLibraryFlagsEXT parts);
   };
 
-  struct Material {
+  // The mesh pipelines for one combination of MaterialFeature bits.
+  struct MaterialVariant {
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    // Same as `pipeline` but with an EQUAL depth test and depth writes off,
+    // for use after the depth prepass.
+    VkPipeline prepass_pipeline = VK_NULL_HANDLE;
+    // With pipeline libraries, the fragment shader parts the pipelines were
+    // linked from, kept for the optimized link.
+    VkPipeline fragment_library = VK_NULL_HANDLE;
+    VkPipeline prepass_fragment_library = VK_NULL_HANDLE;
+  };
+
+  // The parts of the mesh pipelines all material variants share, compiled
+  // once when the device supports pipeline libraries.
+  struct MeshPipelineLibraries {
+    VkPipeline vertex_input = VK_NULL_HANDLE;
+    VkPipeline pre_rasterization = VK_NULL_HANDLE;
+    VkPipeline fragment_output = VK_NULL_HANDLE;
+  };
+
+  // An optimized link waiting to replace a variant's fast linked pipelines.
+  struct OptimizedVariant {
+    uint32_t features;
     VkPipeline pipeline;
-    VkPipelineLayout pipeline_layout;
+    VkPipeline prepass_pipeline;
+  };
+
+  struct Material {
+    // Slot in the material table.
+    uint32_t index;
+    MaterialParams params;
+    const MaterialVariant* variant;
   };
 
   struct RenderObject {
+    ObjectId id = 0;
     Mesh* mesh;
     Material* material;
     glm::mat4 transform;
+    // Static objects have their shadows cached. Changing the transform of a
+    // static object requires invalidating the shadow cache.
+    bool is_static = true;
   };
 
   struct GpuSceneData {
@@ -70,8 +298,14 @@ class Renderer {
     glm::vec4 ambient_color;
     glm::vec4 sunlight_direction;
     glm::vec4 sunlight_color;
+    // See ClusteredLighting::ClusterParams.
+    glm::vec4 cluster_scale_bias;
   };
 
+  // Low bits of a visibility buffer ID holding the triangle index; the rest
+  // hold the object index. Must match TRIANGLE_BITS in the shaders.
+  constexpr static uint32_t kVisibilityTriangleBits = 18;
+
   struct FrameData {
     // GPU <--> GPU sync.
     VkSemaphore present_semaphore;
@@ -89,78 +323,216 @@ class Renderer {
     // Storage buffer for objects.
     AllocatedBuffer object_buffer;
     VkDescriptorSet object_descriptor;
+
+    // Arena location of each object's mesh, and the set that shades the
+    // visibility buffer with it. Only with a geometry arena.
+    AllocatedBuffer geometry_buffer;
+    VkDescriptorSet visibility_descriptor;
+    VkImageView bound_visibility_view;
+
+    // CPU scratch memory for this frame (draw lists, sort keys, etc.). Reset
+    // once the frame's fence has signaled.
+    util::LinearArena arena;
+
+    // Indices of the renderables within the draw distance, in the arena.
+    util::Span<uint32_t> visible_objects;
   };
 
-  constexpr static unsigned unsigned int kFrameOverlap = 2;
+  constexpr static unsigned int kFrameOverlap = 2;
+
+  // Format of the headless output, matching the usual sRGB swapchain.
+  constexpr static VkFormat kOffscreenFormat = VK_FORMAT_R8G8B8A8_SRGB;
+  constexpr static uint32_t kOffscreenTexelSize = 4;
+
+  // Creates the image headless frames are rendered to.
+  bool InitOffscreenImage();
 
   bool InitPipeline();
 
   void InitScene();
+  // Applies the changes recorded in scene_changes_ to renderables_.
+  void ApplySceneChanges();
+  // Rebuilds object_indices_ after objects were removed.
+  void IndexObjects();
 
   void InitDescriptors();
 
+  // Set layout, descriptor sets and pipelines of the visibility buffer.
+  bool InitVisibilityBuffer();
+
   bool LoadMeshes();
   bool UploadMesh(Mesh& mesh);
+  // Copies the mesh into the geometry arena, if there is one.
+  void AddToGeometryArena(Mesh& mesh);
+  bool UploadBuffer(const void* source, size_t size, VkBufferUsageFlags usage,
+                    AllocatedBuffer& buffer);
 
   size_t GetAlignedBufferSize(size_t original_size);
 
-  Material* CreateMaterial(VkPipeline pipeline, VkPipelineLayout layout,
-                           const std::string& name);
-
   Material* GetMaterial(const std::string& name);
+  // Builds the mesh pipelines for `features`. Safe to call from several
+  // threads at once.
+  std::optional<MaterialVariant> BuildMaterialVariant(uint32_t features) const;
+  // The variant for `features`, built now unless it was prewarmed, and
+  // recorded as used. Null if it cannot be built.
+  const MaterialVariant* GetMaterialVariant(uint32_t features);
+  // Builds the variants listed in `manifest`, one per core at a time.
+  void PrewarmPipelines(const PipelineManifest& manifest);
+  // With pipeline libraries, builds the shared parts of the mesh pipelines.
+  // Leaves mesh_libraries_ empty if any part fails.
+  void InitMeshLibraries();
+  // With pipeline libraries, links an optimized copy of the variant in the
+  // background.
+  void OptimizeMaterialVariant(uint32_t features);
+  // Swaps in the optimized links finished so far. The fast links are
+  // retired with the current frame.
+  void ApplyOptimizedVariants();
   Mesh* GetMesh(const std::string& name);
 
   FrameData& GetFrame();
 
-  void DrawObjects(VkCommandBuffer cmd, RenderObject* first, int count);
+  // Queues handles for destruction after the current frame has completed.
+  template <typename... Args>
+  void Retire(Args... args) {
+    retirement_queue_.Retire(framenumber_, args...);
+  }
+
+  // Writes the camera, scene and object buffers for the current frame and
+  // culls the objects to the draw distance.
+  void UploadFrameData(RenderObject* first, int count);
+  // Applies the governor's current quality settings.
+  void ApplyQuality(const QualitySettings& quality);
+  // Mesh pipelines take the viewport and scissor as dynamic state so that
+  // the render resolution can change without rebuilding them.
+  void SetRenderViewport(VkCommandBuffer cmd);
+  // Blits the render extent of every layer of `views` into its tile of
+  // `target`.
+  void ComposeViews(VkCommandBuffer cmd, VkImage views, VkImage target);
+  // Draw the objects at `visible` indices from `first`. DrawPositions()
+  // binds position streams only, for the depth prepass and visibility
+  // pipelines.
+  void DrawPositions(VkCommandBuffer cmd, VkPipeline pipeline,
+                     RenderObject* first, util::Span<const uint32_t> visible);
+  void DrawObjects(VkCommandBuffer cmd, RenderObject* first,
+                   util::Span<const uint32_t> visible, bool after_prepass);
+  // Shades every pixel covered in `visibility`.
+  void ResolveVisibility(VkCommandBuffer cmd, GraphImage visibility);
 
   std::vector<RenderObject> renderables_;
+  // Index of each object in renderables_.
+  std::unordered_map<ObjectId, size_t> object_indices_;
+  SceneChangeQueue scene_changes_;
+  // Drained changes, kept to reuse their capacity, and changes to objects
+  // whose creation was not drained yet, retried once on the next frame.
+  std::vector<SceneChange> drained_changes_;
+  std::vector<SceneChange> deferred_changes_;
+  std::vector<Light> lights_;
+  std::vector<Camera> cameras_;
+  std::array<RenderView, kMaxViews> views_;
   std::unordered_map<std::string, Material> materials_;
   std::unordered_map<std::string, Mesh> meshes_;
 
   bool initialized_ = false;
   int framenumber_ = 0;
+  bool depth_prepass_ = false;
+  bool visibility_buffer_ = false;
+  bool headless_ = false;
 
   VkExtent2D swapchain_extent_;
-
-  VkInstance instance_ = VK_NULL_HANDLE;
+  uint32_t view_count_ = 1;
+  // Size of each view's tile of the swapchain.
+  VkExtent2D view_extent_;
+  // Size of the region of the intermediate targets each view is drawn to.
+  VkExtent2D render_extent_;
+
+  // Shared with any other renderer on the same device. The handles below
+  // are copies of the context's.
+  std::shared_ptr<DeviceContext> context_;
   VkPhysicalDevice gpu_ = VK_NULL_HANDLE;
   VkPhysicalDeviceProperties gpu_properties_;
   VkDevice device_ = VK_NULL_HANDLE;
-  VkSurfaceKHR surface_ = VK_NULL_HANDLE;
-
-  VkDebugUtilsMessengerEXT debug_messenger_ = VK_NULL_HANDLE;
+  VkPipelineCache pipeline_cache_ = VK_NULL_HANDLE;
 
   VkQueue graphics_queue_ = VK_NULL_HANDLE;
   uint32_t graphics_queue_family_ = 0;
 
-  VkSwapchainKHR swapchain_;
+  // Headless, the swapchain is a single offscreen image.
+  VkSwapchainKHR swapchain_ = VK_NULL_HANDLE;
   VkFormat swapchain_image_format_;
   std::vector<VkImage> swapchain_images_;
   std::vector<VkImageView> swapchain_image_views_;
+  AllocatedImage offscreen_image_;
 
   FrameData frames_[kFrameOverlap];
 
-  VkRenderPass renderpass_;
-  std::vector<VkFramebuffer> framebuffers_;
-
   VkPipelineLayout mesh_pipeline_layout_;
-  VkPipeline mesh_pipeline_;
+  // Indexed by MaterialFeature bits. Empty until first used or prewarmed.
+  std::array<MaterialVariant, kMaterialVariantCount> material_variants_;
+  // The mesh pipeline state variants are specialized from, with the vertex
+  // input it points to.
+  PipelineBuilder mesh_pipeline_builder_;
+  VertexInputDescription mesh_vertex_description_;
+  VkRenderPass forward_pass_ = VK_NULL_HANDLE;
+  MeshPipelineLibraries mesh_libraries_;
+  // Runs the optimized links, on one thread so they never compete with the
+  // frame for more than a core.
+  std::unique_ptr<util::WorkerPool> pipeline_optimizer_;
+  std::mutex optimized_mutex_;
+  std::vector<OptimizedVariant> optimized_variants_;
+  std::string pipeline_manifest_path_;
+  // Pipelines used this session, saved to pipeline_manifest_path_.
+  PipelineManifest pipeline_usage_;
+  std::unique_ptr<MaterialTable> material_table_;
+  // Depth-only pipeline shared by every material in the prepass.
+  VkPipeline depth_prepass_pipeline_;
+
+  VkDescriptorSetLayout visibility_set_layout_ = VK_NULL_HANDLE;
+  VkPipelineLayout visibility_pipeline_layout_ = VK_NULL_HANDLE;
+  // Writes the IDs, and shades them in a full screen pass.
+  VkPipeline visibility_pipeline_ = VK_NULL_HANDLE;
+  VkPipeline visibility_resolve_pipeline_ = VK_NULL_HANDLE;
+  VkSampler visibility_sampler_ = VK_NULL_HANDLE;
 
-  VkImageView depth_image_view_;
-  AllocatedImage depth_image_;
   VkFormat depth_format_;
+  // Color format the scene is rendered in: the swapchain's, or HDR with
+  // post-processing.
+  VkFormat scene_format_;
 
-  VmaAllocator allocator_;
+  VmaAllocator allocator_ = VK_NULL_HANDLE;
 
   VkDescriptorSetLayout global_set_layout_;
   VkDescriptorSetLayout object_set_layout_;
   VkDescriptorPool descriptor_pool_;
 
-  util::TaskStack deletion_stack_;
+  DeletionQueue deletion_queue_;
+  RetirementQueue retirement_queue_{kFrameOverlap};
+
+  std::unique_ptr<RenderTargetPool> render_target_pool_;
+  std::unique_ptr<RenderGraph> render_graph_;
+  std::unique_ptr<Defragmenter> defragmenter_;
+  std::unique_ptr<ClusteredLighting> lighting_;
+  std::unique_ptr<CascadedShadows> shadows_;
+  std::unique_ptr<PostProcess> post_process_;
+  std::unique_ptr<GeometryArena> geometry_arena_;
+  // Only created headless.
+  std::unique_ptr<ReadbackRing> readback_ring_;
+  std::unique_ptr<GpuTimer> gpu_timer_;
+  // Only created when async compute is enabled and supported.
+  std::unique_ptr<AsyncCompute> async_compute_;
+  std::unique_ptr<GpuTimer> compute_timer_;
+  // Graphics interval of the frame before the last one read, to measure
+  // the overlap of the following frame's compute work with it.
+  std::optional<GpuTimer::Interval> last_gpu_interval_;
+  std::optional<DynamicResolution> dynamic_resolution_;
+  std::optional<QualityGovernor> quality_governor_;
+  QualitySettings quality_;
+  FrameStats frame_stats_;
 
   Mesh triangle_mesh_;
-  Model shiba_model_;
+  // Meshes whose buffers belong to the asset cache, with the model holding
+  // them. Released models are kept until the frames drawing them complete.
+  std::unordered_map<std::string, AssetCache::Handle> cached_meshes_;
+  std::vector<std::pair<uint64_t, AssetCache::Handle>> retired_models_;
 
   GpuSceneData scene_parameters_;
   AllocatedBuffer scene_parameters_buffer_;
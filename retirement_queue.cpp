@@ -0,0 +1,20 @@
+#include "retirement_queue.hpp"
+
+namespace vk {
+
+void RetirementQueue::Collect(uint64_t completed_frame, VkDevice device,
+                              VmaAllocator allocator) {
+  for (Bucket& bucket : buckets_) {
+    if (!bucket.queue.empty() && bucket.frame <= completed_frame) {
+      bucket.queue.Flush(device, allocator);
+    }
+  }
+}
+
+void RetirementQueue::Flush(VkDevice device, VmaAllocator allocator) {
+  for (Bucket& bucket : buckets_) {
+    bucket.queue.Flush(device, allocator);
+  }
+}
+
+}  // namespace vk
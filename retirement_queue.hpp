@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "deletion_queue.hpp"
+
+namespace vk {
+
+// Defers destruction of resources released while the GPU may still be using
+// them. A handle retired during frame N is destroyed by the first Collect()
+// call that reports frame N as completed, i.e. once that frame's fence has been
+// waited on. Nothing here blocks on the GPU.
+//
+// Internally this is a small ring of DeletionQueues, one per frame that can be
+// in flight plus the one currently being recorded.
+class RetirementQueue {
+ public:
+  explicit RetirementQueue(size_t frames_in_flight)
+      : buckets_(frames_in_flight + 1) {}
+
+  RetirementQueue(RetirementQueue&& other) noexcept = default;
+  RetirementQueue& operator=(RetirementQueue&& other) noexcept = default;
+
+  // `frame` is the last frame whose command buffers may reference the handle.
+  template <typename... Args>
+  void Retire(uint64_t frame, Args... args) {
+    Bucket& bucket = buckets_[frame % buckets_.size()];
+    // A bucket that was not collected yet holds older entries, so keeping the
+    // newest frame number only ever delays their destruction.
+    if (bucket.queue.empty() || frame > bucket.frame) {
+      bucket.frame = frame;
+    }
+    bucket.queue.Push(args...);
+  }
+
+  // Destroys everything retired in frames up to and including
+  // `completed_frame`.
+  void Collect(uint64_t completed_frame, VkDevice device,
+               VmaAllocator allocator);
+
+  // Destroys everything. The caller must ensure the device is idle.
+  void Flush(VkDevice device, VmaAllocator allocator);
+
+ private:
+  struct Bucket {
+    uint64_t frame = 0;
+    DeletionQueue queue{kBucketCapacity};
+  };
+
+  constexpr static size_t kBucketCapacity = 64;
+
+  std::vector<Bucket> buckets_;
+};
+
+}  // namespace vk
@@ -0,0 +1,173 @@
+#include "scene_changes.hpp"
+
+#include <utility>
+
+namespace vk {
+
+namespace {
+
+std::atomic<uint64_t> next_queue_id{1};
+
+// The buffers a thread records into, one per queue, retired when the thread
+// exits.
+struct ThreadProducers {
+  struct Entry {
+    uint64_t queue;
+    void* producer;
+    std::shared_ptr<std::atomic<bool>> retired;
+  };
+
+  ~ThreadProducers() {
+    for (Entry& entry : entries) {
+      entry.retired->store(true, std::memory_order_release);
+    }
+  }
+
+  std::vector<Entry> entries;
+  // The last entry used, as most threads only record into one queue.
+  uint64_t last_queue = 0;
+  void* last_producer = nullptr;
+};
+
+}  // namespace
+
+SceneChangeQueue::SceneChangeQueue() : id_(next_queue_id++) {}
+
+SceneChangeQueue::~SceneChangeQueue() {
+  Producer* producer = producers_.load(std::memory_order_acquire);
+  while (producer != nullptr) {
+    Producer* next = producer->next;
+    Delete(producer);
+    producer = next;
+  }
+}
+
+void SceneChangeQueue::Delete(Producer* producer) {
+  Chunk* chunk = producer->head;
+  while (chunk != nullptr) {
+    Chunk* next = chunk->next.load(std::memory_order_acquire);
+    delete chunk;
+    chunk = next;
+  }
+  delete producer;
+}
+
+ObjectId SceneChangeQueue::Create(std::string mesh, std::string material,
+                                  const glm::mat4& transform, bool is_static) {
+  SceneChange change;
+  change.kind = SceneChange::Kind::kCreate;
+  change.object = next_object_.fetch_add(1, std::memory_order_relaxed);
+  change.transform = transform;
+  change.is_static = is_static;
+  change.mesh = std::move(mesh);
+  change.material = std::move(material);
+  const ObjectId object = change.object;
+  Push(std::move(change));
+  return object;
+}
+
+void SceneChangeQueue::Destroy(ObjectId object) {
+  SceneChange change;
+  change.kind = SceneChange::Kind::kDestroy;
+  change.object = object;
+  Push(std::move(change));
+}
+
+void SceneChangeQueue::SetTransform(ObjectId object,
+                                    const glm::mat4& transform) {
+  SceneChange change;
+  change.kind = SceneChange::Kind::kSetTransform;
+  change.object = object;
+  change.transform = transform;
+  Push(std::move(change));
+}
+
+void SceneChangeQueue::SetMaterial(ObjectId object, std::string material) {
+  SceneChange change;
+  change.kind = SceneChange::Kind::kSetMaterial;
+  change.object = object;
+  change.material = std::move(material);
+  Push(std::move(change));
+}
+
+void SceneChangeQueue::Drain(std::vector<SceneChange>& changes) {
+  Producer* previous = nullptr;
+  Producer* producer = producers_.load(std::memory_order_acquire);
+  while (producer != nullptr) {
+    // Checked first: once set, every change of the thread is visible.
+    const bool retired = producer->retired->load(std::memory_order_acquire);
+    while (true) {
+      Chunk* chunk = producer->head;
+      const size_t published =
+          chunk->published.load(std::memory_order_acquire);
+      for (; producer->drained < published; producer->drained++) {
+        changes.push_back(std::move(chunk->changes[producer->drained]));
+      }
+      if (producer->drained < Chunk::kCapacity) {
+        break;
+      }
+      // The producer links the next chunk only once done with this one.
+      Chunk* next = chunk->next.load(std::memory_order_acquire);
+      if (next == nullptr) {
+        break;
+      }
+      delete chunk;
+      producer->head = next;
+      producer->drained = 0;
+    }
+
+    Producer* next = producer->next;
+    if (retired && previous != nullptr) {
+      previous->next = next;
+      Delete(producer);
+    } else {
+      previous = producer;
+    }
+    producer = next;
+  }
+}
+
+void SceneChangeQueue::Push(SceneChange&& change) {
+  Producer& producer = LocalProducer();
+  Chunk* chunk = producer.tail;
+  size_t count = chunk->published.load(std::memory_order_relaxed);
+  if (count == Chunk::kCapacity) {
+    Chunk* next = new Chunk();
+    chunk->next.store(next, std::memory_order_release);
+    producer.tail = chunk = next;
+    count = 0;
+  }
+  chunk->changes[count] = std::move(change);
+  chunk->published.store(count + 1, std::memory_order_release);
+}
+
+SceneChangeQueue::Producer& SceneChangeQueue::LocalProducer() {
+  thread_local ThreadProducers local;
+  if (local.last_queue == id_) {
+    return *static_cast<Producer*>(local.last_producer);
+  }
+
+  // Threads only look up their own buffers, never the shared list, which
+  // the consumer may be unlinking from.
+  for (const ThreadProducers::Entry& entry : local.entries) {
+    if (entry.queue == id_) {
+      local.last_queue = id_;
+      local.last_producer = entry.producer;
+      return *static_cast<Producer*>(entry.producer);
+    }
+  }
+
+  Producer* producer = new Producer();
+  producer->head = producer->tail = new Chunk();
+  producer->next = producers_.load(std::memory_order_relaxed);
+  while (!producers_.compare_exchange_weak(producer->next, producer,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+  }
+  local.entries.push_back({id_, producer, producer->retired});
+  local.last_queue = id_;
+  local.last_producer = producer;
+  return *producer;
+}
+
+}  // namespace vk
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <glm/mat4x4.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace vk {
+
+// Identifies a scene object for its whole lifetime. Never reused; 0 is not a
+// valid object.
+using ObjectId = uint32_t;
+
+struct SceneChange {
+  enum class Kind : uint8_t { kCreate, kDestroy, kSetTransform, kSetMaterial };
+
+  Kind kind = Kind::kCreate;
+  ObjectId object = 0;
+  // kCreate and kSetTransform.
+  glm::mat4 transform = glm::mat4(1.f);
+  // kCreate.
+  bool is_static = true;
+  std::string mesh;
+  // kCreate and kSetMaterial.
+  std::string material;
+};
+
+// Scene changes recorded by any number of threads, drained in bulk by the
+// renderer at a frame boundary.
+//
+// Every producer thread appends to a buffer of its own, a list of fixed size
+// chunks that only it writes to and only the consumer reads from, so
+// recording a change takes no lock and never waits for the renderer or for
+// other producers. A thread's changes are drained in the order it recorded
+// them; changes from different threads are not ordered.
+//
+// Object IDs are handed out by Create() immediately, so a producer can keep
+// changing an object before the renderer has seen it.
+//
+// A thread's buffer is retired when the thread exits, and freed by the next
+// Drain() once its changes were drained, so short lived threads, e.g. of a
+// worker pool that replaces its threads, do not keep their buffers.
+class SceneChangeQueue {
+ public:
+  SceneChangeQueue();
+  // No producer may be recording anymore.
+  ~SceneChangeQueue();
+
+  SceneChangeQueue(const SceneChangeQueue&) = delete;
+  SceneChangeQueue& operator=(const SceneChangeQueue&) = delete;
+
+  // Producer side, from any thread.
+  ObjectId Create(std::string mesh, std::string material,
+                  const glm::mat4& transform, bool is_static);
+  void Destroy(ObjectId object);
+  void SetTransform(ObjectId object, const glm::mat4& transform);
+  void SetMaterial(ObjectId object, std::string material);
+
+  // Consumer side, from one thread at a time. Moves every change recorded so
+  // far to the end of `changes`.
+  void Drain(std::vector<SceneChange>& changes);
+
+ private:
+  struct Chunk {
+    constexpr static size_t kCapacity = 256;
+
+    std::array<SceneChange, kCapacity> changes;
+    // Changes written so far. Stored by the producer after writing them.
+    std::atomic<size_t> published{0};
+    // Set by the producer when it moves on to a new chunk.
+    std::atomic<Chunk*> next{nullptr};
+  };
+
+  struct Producer {
+    // Only written before the producer is published and by the consumer.
+    Producer* next = nullptr;
+    // Set by the producing thread as it exits, after its last change. Shared
+    // with the thread, which may outlive the queue.
+    std::shared_ptr<std::atomic<bool>> retired =
+        std::make_shared<std::atomic<bool>>(false);
+
+    // Consumer state: the oldest chunk still referenced and how many of its
+    // changes were drained.
+    Chunk* head = nullptr;
+    size_t drained = 0;
+
+    // Producer state, on its own cache line: the chunk being written.
+    alignas(64) Chunk* tail = nullptr;
+  };
+
+  void Push(SceneChange&& change);
+  // The calling thread's buffer, created on its first change.
+  Producer& LocalProducer();
+  static void Delete(Producer* producer);
+
+  // Distinguishes queues in the per-thread tables of LocalProducer(), even
+  // if one is allocated where another used to be.
+  const uint64_t id_;
+  std::atomic<ObjectId> next_object_{1};
+  // Singly linked, newest first. Producers add themselves at the head; only
+  // the consumer unlinks retired ones, and never the head, so that adding
+  // stays a single compare and swap.
+  std::atomic<Producer*> producers_{nullptr};
+};
+
+}  // namespace vk
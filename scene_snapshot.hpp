@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/mat4x4.hpp>
+#include <vector>
+
+#include "camera.hpp"
+#include "clustered_lighting.hpp"
+#include "scene_changes.hpp"
+
+namespace vk {
+
+// The parts of the scene a simulation changes from frame to frame, frozen for
+// one frame. Produced by the simulation thread and consumed by the render
+// thread, see RenderThread.
+//
+// Per object data is stored as parallel arrays keyed by `objects`, so a
+// simulation step that only moves objects streams through the transforms
+// alone. Objects are named by ID rather than position since the renderer
+// compacts its objects when some are destroyed.
+struct SceneSnapshot {
+  // Simulation step the snapshot was taken at.
+  uint64_t step = 0;
+
+  // The objects the simulation drives. Objects not listed keep their
+  // previous state, including changes made through Renderer::
+  // SetObjectTransform(), and IDs of destroyed objects are ignored.
+  std::vector<ObjectId> objects;
+  std::vector<glm::mat4> transforms;
+  // Non-zero for static objects, whose shadows are cached. Not a
+  // vector<bool> so it can be written element-wise like the transforms.
+  std::vector<uint8_t> is_static;
+
+  std::vector<Camera> cameras;
+  std::vector<Light> lights;
+};
+
+}  // namespace vk
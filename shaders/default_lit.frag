@@ -1,20 +1,44 @@
 // GLSL version 4.5
 #version 450
+#extension GL_EXT_multiview : require
+#extension GL_GOOGLE_include_directive : require
+
+#include "lighting.glsl"
 
 // Input
 layout (location = 0) in vec3 inColor;
+layout (location = 1) in vec3 inViewPosition;
+layout (location = 2) in vec3 inWorldNormal;
+layout (location = 3) in vec3 inWorldPosition;
+layout (location = 4) flat in uint inMaterial;
+
+// Must match MaterialFeature in material_table.hpp. Each pipeline variant
+// specializes them, so disabled features are compiled out.
+layout (constant_id = 0) const bool kUnlit = false;
+layout (constant_id = 1) const bool kVertexColor = true;
+
+struct MaterialData {
+	vec4 base_color;
+	vec4 emissive;
+	uvec4 features;
+};
+
+layout (set = 1, binding = 1) readonly buffer MaterialBuffer {
+	MaterialData materials[];
+} material_buffer;
 
 // Output write.
 layout (location = 0) out vec4 outFragColor;
 
-layout(set = 0, binding = 1) uniform SceneData {
-	vec4 frag_color; // w is for exponent.
-	vec4 fog_distance; // x for min, y for max, zw unused.
-	vec4 ambient_color;
-	vec4 sunlight_direction; // w for sun power
-	vec4 sunlight_color;
-} scene_data;
-
 void main() {
-	outFragColor = vec4(inColor * scene_data.ambient_color.xyz, 1.f);
+	MaterialData material = material_buffer.materials[inMaterial];
+	vec3 color = material.base_color.rgb;
+	if (kVertexColor) {
+		color *= inColor;
+	}
+	if (!kUnlit) {
+		color *=
+			ShadeSurface(inWorldPosition, -inViewPosition.z, inWorldNormal);
+	}
+	outFragColor = vec4(color + material.emissive.rgb, 1.f);
 }
@@ -0,0 +1,131 @@
+// Surface lighting shared by the forward and visibility buffer shading:
+// ambient, the shadowed sun and the clustered point and spot lights.
+// Requires GL_EXT_multiview. Uses sets 0 (binding 1), 2 and 3 of the mesh
+// pipeline layout.
+
+// Must match ClusteredLighting in clustered_lighting.hpp.
+#define CLUSTER_TILES_X 16
+#define CLUSTER_TILES_Y 9
+#define CLUSTER_SLICES 24
+#define CLUSTER_COUNT (CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES)
+#define MAX_LIGHTS_PER_CLUSTER 128
+
+// Must match kMaxViews in camera.hpp.
+#define MAX_VIEWS 4
+
+// Must match CascadedShadows.
+#define CASCADE_COUNT 4
+#define SHADOW_MAP_SIZE 2048
+
+layout(set = 0, binding = 1) uniform SceneData {
+	vec4 frag_color; // w is for exponent.
+	vec4 fog_distance; // x for min, y for max, zw unused.
+	vec4 ambient_color;
+	vec4 sunlight_direction; // w for sun power
+	vec4 sunlight_color;
+	vec4 cluster_scale_bias; // xy: tiles per pixel, zw: depth slice scale/bias.
+} scene_data;
+
+struct Light {
+	vec4 position_range;
+	vec4 color_inner;
+	vec4 direction_outer;
+};
+
+layout (set = 2, binding = 0) readonly buffer LightBuffer {
+	Light lights[];
+} light_buffer;
+
+layout (set = 2, binding = 1) readonly buffer ClusterBuffer {
+	uint counts[CLUSTER_COUNT * MAX_VIEWS];
+	uint indices[];
+} cluster_buffer;
+
+layout (set = 3, binding = 0) uniform CascadeData {
+	mat4 view_projection[CASCADE_COUNT];
+	vec4 split_depths;
+	vec4 light_direction; // World space.
+} cascade_data;
+
+layout (set = 3, binding = 1) uniform sampler2DArrayShadow shadow_map;
+
+// Fraction of sunlight reaching the surface, 3x3 PCF on top of the
+// sampler's bilinear compare.
+float SunVisibility(vec3 world_position, float depth) {
+	int cascade = 0;
+	while (cascade < CASCADE_COUNT &&
+		   depth > cascade_data.split_depths[cascade]) {
+		cascade++;
+	}
+	if (cascade == CASCADE_COUNT) {
+		return 1.0;
+	}
+
+	vec4 position =
+		cascade_data.view_projection[cascade] * vec4(world_position, 1.0);
+	vec2 uv = position.xy * 0.5 + 0.5;
+
+	float visibility = 0.0;
+	float texel = 1.0 / SHADOW_MAP_SIZE;
+	for (int y = -1; y <= 1; y++) {
+		for (int x = -1; x <= 1; x++) {
+			visibility += texture(shadow_map,
+				vec4(uv + vec2(x, y) * texel, cascade, position.z));
+		}
+	}
+	return visibility / 9.0;
+}
+
+// Index of the fragment's cluster among those of all views.
+uint FindCluster(float depth) {
+	uvec2 tile = uvec2(gl_FragCoord.xy * scene_data.cluster_scale_bias.xy);
+	tile = min(tile, uvec2(CLUSTER_TILES_X - 1, CLUSTER_TILES_Y - 1));
+
+	float slice = floor(log(depth) * scene_data.cluster_scale_bias.z +
+						scene_data.cluster_scale_bias.w);
+	uint z = uint(clamp(slice, 0.0, float(CLUSTER_SLICES - 1)));
+
+	uint cluster = tile.x + tile.y * CLUSTER_TILES_X +
+				   z * CLUSTER_TILES_X * CLUSTER_TILES_Y;
+	return uint(gl_ViewIndex) * CLUSTER_COUNT + cluster;
+}
+
+// Light reaching the surface at `world_position`, `depth` in front of the
+// camera of the current view. `world_normal` need not be normalized; zero
+// for surfaces that only receive ambient light.
+vec3 ShadeSurface(vec3 world_position, float depth, vec3 world_normal) {
+	float normal_length_sq = dot(world_normal, world_normal);
+	vec3 normal = normal_length_sq > 0.0
+		? world_normal * inversesqrt(normal_length_sq)
+		: vec3(0.0);
+
+	vec3 lighting = scene_data.ambient_color.xyz;
+
+	// Sun. sunlight_direction.w is its power.
+	vec3 to_sun = -normalize(cascade_data.light_direction.xyz);
+	float sun = max(dot(normal, to_sun), 0.0) * scene_data.sunlight_direction.w;
+	lighting += scene_data.sunlight_color.rgb * sun *
+				SunVisibility(world_position, depth);
+
+	uint cluster = FindCluster(depth);
+	uint count = cluster_buffer.counts[cluster];
+	for (uint i = 0; i < count; i++) {
+		uint index = cluster_buffer.indices[cluster * MAX_LIGHTS_PER_CLUSTER + i];
+		Light light = light_buffer.lights[index];
+
+		vec3 to_light = light.position_range.xyz - world_position;
+		float distance_sq = max(dot(to_light, to_light), 1e-4);
+		vec3 l = to_light * inversesqrt(distance_sq);
+
+		float range = light.position_range.w;
+		float falloff = clamp(1.0 - distance_sq / (range * range), 0.0, 1.0);
+		falloff *= falloff;
+
+		float cone = smoothstep(light.direction_outer.w, light.color_inner.w,
+								dot(-l, light.direction_outer.xyz));
+
+		lighting += light.color_inner.rgb * max(dot(normal, l), 0.0) *
+					falloff * cone;
+	}
+	return lighting;
+}
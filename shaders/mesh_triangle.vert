@@ -1,19 +1,38 @@
 #version 460
+#extension GL_EXT_multiview : require
+
+// Must match kMaxViews in camera.hpp.
+#define MAX_VIEWS 4
 
 layout (location = 0) in vec3 vPosition;
 layout (location = 1) in vec3 vNormal;
 layout (location = 2) in vec3 vColor;
 
 layout (location = 0) out vec3 outColor;
+layout (location = 1) out vec3 outViewPosition;
+layout (location = 2) out vec3 outWorldNormal;
+layout (location = 3) out vec3 outWorldPosition;
+layout (location = 4) flat out uint outMaterial;
 
-layout (set = 0, binding = 0) uniform CameraBuffer {
+// Must match depth_prepass.vert bit for bit since the depth test is EQUAL
+// when the prepass is enabled.
+invariant gl_Position;
+
+struct CameraData {
 	mat4 view;
 	mat4 projection;
 	mat4 view_projection;
-} camera_data;
+};
+
+// One camera per view of the multiview pass.
+layout (set = 0, binding = 0) uniform CameraBuffer {
+	CameraData views[MAX_VIEWS];
+} camera_buffer;
 
 struct ObjectData {
 	mat4 model;
+	// x: index into the material table.
+	uvec4 material;
 };
 
 // All object matrices:
@@ -27,8 +46,16 @@ layout(push_constant) uniform constants {
 } push_constants;
 
 void main() {
+	CameraData camera = camera_buffer.views[gl_ViewIndex];
 	mat4 model_matrix = object_buffer.objects[gl_BaseInstance].model;
-	mat4 transform = camera_data.view_projection * model_matrix;
+	mat4 transform = camera.view_projection * model_matrix;
 	gl_Position = transform * vec4(vPosition, 1.f);
 	outColor = vColor;
+	outMaterial = object_buffer.objects[gl_BaseInstance].material.x;
+
+	// Lighting happens in world space, which all views share. The view
+	// space position selects the light cluster and shadow cascade.
+	outViewPosition = (camera.view * model_matrix * vec4(vPosition, 1.f)).xyz;
+	outWorldNormal = mat3(model_matrix) * vNormal;
+	outWorldPosition = (model_matrix * vec4(vPosition, 1.f)).xyz;
 }
\ No newline at end of file
@@ -0,0 +1,21 @@
+#version 460
+
+// Reads Mesh::position_buffer only. Outputs world space positions; the
+// geometry shader applies the cascade transforms.
+layout (location = 0) in vec3 vPosition;
+
+struct ObjectData {
+	mat4 model;
+	// x: index into the material table.
+	uvec4 material;
+};
+
+// All object matrices:
+layout (set = 0, binding = 0) readonly buffer ObjectBuffer {
+	ObjectData objects[];
+} object_buffer;
+
+void main() {
+	mat4 model_matrix = object_buffer.objects[gl_BaseInstance].model;
+	gl_Position = model_matrix * vec4(vPosition, 1.f);
+}
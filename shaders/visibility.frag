@@ -0,0 +1,12 @@
+#version 450
+
+// Must match Renderer::kVisibilityTriangleBits.
+#define TRIANGLE_BITS 18
+
+layout (location = 0) flat in uint inObject;
+
+layout (location = 0) out uint outId;
+
+void main() {
+	outId = (inObject << TRIANGLE_BITS) | uint(gl_PrimitiveID);
+}
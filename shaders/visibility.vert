@@ -0,0 +1,39 @@
+#version 460
+#extension GL_EXT_multiview : require
+
+// Must match kMaxViews in camera.hpp.
+#define MAX_VIEWS 4
+
+// Reads Mesh::position_buffer only.
+layout (location = 0) in vec3 vPosition;
+
+layout (location = 0) flat out uint outObject;
+
+struct CameraData {
+	mat4 view;
+	mat4 projection;
+	mat4 view_projection;
+};
+
+layout (set = 0, binding = 0) uniform CameraBuffer {
+	CameraData views[MAX_VIEWS];
+} camera_buffer;
+
+struct ObjectData {
+	mat4 model;
+	// x: index into the material table.
+	uvec4 material;
+};
+
+// All object matrices:
+layout (set = 1, binding = 0) readonly buffer ObjectBuffer {
+	ObjectData objects[];
+} object_buffer;
+
+void main() {
+	mat4 model_matrix = object_buffer.objects[gl_BaseInstance].model;
+	mat4 transform =
+		camera_buffer.views[gl_ViewIndex].view_projection * model_matrix;
+	gl_Position = transform * vec4(vPosition, 1.f);
+	outObject = uint(gl_BaseInstance);
+}
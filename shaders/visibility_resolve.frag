@@ -0,0 +1,151 @@
+#version 450
+#extension GL_EXT_multiview : require
+#extension GL_GOOGLE_include_directive : require
+
+// Shades the visibility buffer: every covered pixel fetches its triangle
+// from the geometry arena, interpolates the vertex attributes at the pixel
+// and is lit once, whatever the overdraw and triangle density.
+
+#include "lighting.glsl"
+
+// Must match Renderer::kVisibilityTriangleBits.
+#define TRIANGLE_BITS 18
+#define EMPTY_ID 0xffffffffu
+// Floats per vertex in the arena; must match Vertex in vk_mesh.hpp.
+#define VERTEX_STRIDE 9
+
+layout (location = 0) out vec4 outFragColor;
+
+struct CameraData {
+	mat4 view;
+	mat4 projection;
+	mat4 view_projection;
+};
+
+layout (set = 0, binding = 0) uniform CameraBuffer {
+	CameraData views[MAX_VIEWS];
+} camera_buffer;
+
+struct ObjectData {
+	mat4 model;
+	// x: index into the material table.
+	uvec4 material;
+};
+
+layout (set = 1, binding = 0) readonly buffer ObjectBuffer {
+	ObjectData objects[];
+} object_buffer;
+
+// Must match MaterialFeature in material_table.hpp.
+#define MATERIAL_UNLIT 1u
+#define MATERIAL_VERTEX_COLOR 2u
+
+struct MaterialData {
+	vec4 base_color;
+	vec4 emissive;
+	uvec4 features;
+};
+
+layout (set = 1, binding = 1) readonly buffer MaterialBuffer {
+	MaterialData materials[];
+} material_buffer;
+
+layout (set = 4, binding = 0) uniform usampler2DArray visibility;
+
+layout (set = 4, binding = 1) readonly buffer VertexBuffer {
+	float vertices[];
+} vertex_buffer;
+
+layout (set = 4, binding = 2) readonly buffer IndexBuffer {
+	uint indices[];
+} index_buffer;
+
+struct ObjectGeometry {
+	uint first_vertex;
+	uint first_index;
+};
+
+layout (set = 4, binding = 3) readonly buffer GeometryBuffer {
+	ObjectGeometry objects[];
+} geometry_buffer;
+
+layout (push_constant) uniform constants {
+	// Size of the rendered region, in pixels.
+	vec2 extent;
+} resolve;
+
+struct VertexData {
+	vec3 position;
+	vec3 normal;
+	vec3 color;
+};
+
+VertexData FetchVertex(uint index) {
+	uint base = index * VERTEX_STRIDE;
+	VertexData vertex;
+	vertex.position = vec3(vertex_buffer.vertices[base],
+						   vertex_buffer.vertices[base + 1],
+						   vertex_buffer.vertices[base + 2]);
+	vertex.normal = vec3(vertex_buffer.vertices[base + 3],
+						 vertex_buffer.vertices[base + 4],
+						 vertex_buffer.vertices[base + 5]);
+	vertex.color = vec3(vertex_buffer.vertices[base + 6],
+						vertex_buffer.vertices[base + 7],
+						vertex_buffer.vertices[base + 8]);
+	return vertex;
+}
+
+void main() {
+	uint id = texelFetch(visibility,
+						 ivec3(ivec2(gl_FragCoord.xy), gl_ViewIndex), 0).r;
+	if (id == EMPTY_ID) {
+		discard;
+	}
+	uint object = id >> TRIANGLE_BITS;
+	uint triangle = id & ((1u << TRIANGLE_BITS) - 1u);
+
+	ObjectGeometry geometry = geometry_buffer.objects[object];
+	uint first = geometry.first_index + triangle * 3;
+	VertexData v0 = FetchVertex(geometry.first_vertex +
+								index_buffer.indices[first]);
+	VertexData v1 = FetchVertex(geometry.first_vertex +
+								index_buffer.indices[first + 1]);
+	VertexData v2 = FetchVertex(geometry.first_vertex +
+								index_buffer.indices[first + 2]);
+
+	CameraData camera = camera_buffer.views[gl_ViewIndex];
+	mat4 model_matrix = object_buffer.objects[object].model;
+	vec3 world0 = (model_matrix * vec4(v0.position, 1.0)).xyz;
+	vec3 world1 = (model_matrix * vec4(v1.position, 1.0)).xyz;
+	vec3 world2 = (model_matrix * vec4(v2.position, 1.0)).xyz;
+	vec4 clip0 = camera.view_projection * vec4(world0, 1.0);
+	vec4 clip1 = camera.view_projection * vec4(world1, 1.0);
+	vec4 clip2 = camera.view_projection * vec4(world2, 1.0);
+
+	// Perspective correct barycentrics are linear in clip space, so the
+	// clip xyw of the pixel's point is M * b, with M's columns the vertices'
+	// clip xyw, and is proportional to (ndc, 1). Solving in homogeneous
+	// coordinates also holds for triangles crossing the camera plane.
+	vec2 ndc = gl_FragCoord.xy / resolve.extent * 2.0 - 1.0;
+	mat3 m = mat3(clip0.xyw, clip1.xyw, clip2.xyw);
+	vec3 b = inverse(m) * vec3(ndc, 1.0);
+	b /= b.x + b.y + b.z;
+
+	vec3 world_position = world0 * b.x + world1 * b.y + world2 * b.z;
+	vec3 normal = mat3(model_matrix) *
+				  (v0.normal * b.x + v1.normal * b.y + v2.normal * b.z);
+	float depth = -(camera.view * vec4(world_position, 1.0)).z;
+
+	// Every material shades in this one pass, so features are branched on
+	// rather than specialized.
+	MaterialData material =
+		material_buffer.materials[object_buffer.objects[object].material.x];
+	vec3 color = material.base_color.rgb;
+	if ((material.features.x & MATERIAL_VERTEX_COLOR) != 0u) {
+		color *= v0.color * b.x + v1.color * b.y + v2.color * b.z;
+	}
+	if ((material.features.x & MATERIAL_UNLIT) == 0u) {
+		color *= ShadeSurface(world_position, depth, normal);
+	}
+	outFragColor = vec4(color + material.emissive.rgb, 1.0);
+}
@@ -2,6 +2,7 @@
 
 #include <string.h>
 
+#include "barrier_batch.hpp"
 #include "buffer.hpp"
 #include "vk_init.hpp"
 
@@ -44,8 +45,10 @@ Texture::Texture(VmaAllocator allocator, VkDevice device,
   VmaAllocationCreateInfo allocation_info = {};
   allocation_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 
+  VmaAllocationInfo allocation = {};
   vmaCreateImage(allocator, &image_info, &allocation_info, &image_.image,
-                 &image_.allocation, nullptr);
+                 &image_.allocation, &allocation);
+  size_ = allocation.size;
 
   queue_submitter.SubmitImmediate([&](VkCommandBuffer cmd) {
     VkImageSubresourceRange range;
@@ -55,24 +58,16 @@ Texture::Texture(VmaAllocator allocator, VkDevice device,
     range.baseArrayLayer = 0;
     range.layerCount = 1;
 
-    // Image barrier to act as a pipeline barrier (i.e. control how GPU overlaps
-    // commands) as well as allowing us to do conversion to correct
-    // formats/layouts.
-    VkImageMemoryBarrier transfer_barrier = {};
-    transfer_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    transfer_barrier.pNext = nullptr;
-
-    transfer_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    transfer_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    transfer_barrier.image = image_.image;
-    transfer_barrier.subresourceRange = range;
-
-    transfer_barrier.srcAccessMask = 0;
-    transfer_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
-                         nullptr, 1, &transfer_barrier);
+    // Move the image into a layout the copy can write to. Its previous
+    // contents are discarded.
+    BarrierBatch barriers;
+    barriers.Image(image_.image, range,
+                   {VK_IMAGE_LAYOUT_UNDEFINED,
+                    VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0},
+                   {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_ACCESS_TRANSFER_WRITE_BIT});
+    barriers.Flush(cmd);
 
     VkBufferImageCopy copy_region = {};
     copy_region.bufferOffset = 0;
@@ -90,17 +85,15 @@ Texture::Texture(VmaAllocator allocator, VkDevice device,
                            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
                            &copy_region);
 
-    VkImageMemoryBarrier readable_barrier = transfer_barrier;
-    readable_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    readable_barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-    readable_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    readable_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
     // Barrier the image into the shader readable layout.
-    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr,
-                         0, nullptr, 1, &readable_barrier);
+    barriers.Image(image_.image, range,
+                   {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_ACCESS_TRANSFER_WRITE_BIT},
+                   {VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT});
+    barriers.Flush(cmd);
   });
 
   vmaDestroyBuffer(allocator, staging_buffer.buffer, staging_buffer.allocation);
@@ -111,6 +104,20 @@ Texture::Texture(VmaAllocator allocator, VkDevice device,
   vkCreateImageView(device, &image_view_create_info, nullptr, &image_view_);
 }
 
+void Texture::Retire(RetirementQueue& queue, uint64_t frame) {
+  if (!allocator_) {
+    return;
+  }
+
+  queue.Retire(frame, image_view_);
+  queue.Retire(frame, image_.image, image_.allocation);
+
+  allocator_ = nullptr;
+  image_.image = VK_NULL_HANDLE;
+  image_.allocation = nullptr;
+  image_view_ = VK_NULL_HANDLE;
+}
+
 Texture::~Texture() {
   if (allocator_) {
     vkDestroyImageView(device_, image_view_, nullptr);
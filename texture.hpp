@@ -4,7 +4,7 @@
 #include <vulkan/vulkan.h>
 
 #include "queue_submitter.hpp"
-#include "task_stack.hpp"
+#include "retirement_queue.hpp"
 #include "vk_types.hpp"
 
 namespace vk {
@@ -27,7 +27,8 @@ class Texture {
       : device_{other.device_},
         allocator_{other.allocator_},
         image_{other.image_},
-        image_view_{other.image_view_} {
+        image_view_{other.image_view_},
+        size_{other.size_} {
     other.device_ = VK_NULL_HANDLE;
     other.allocator_ = nullptr;
     other.image_.image = VK_NULL_HANDLE;
@@ -37,11 +38,19 @@ class Texture {
 
   ~Texture();
 
+  // Hands the GPU resources to `queue` so they are destroyed once `frame` has
+  // completed. The texture is empty afterwards.
+  void Retire(RetirementQueue& queue, uint64_t frame);
+
+  // Device memory taken by the image.
+  VkDeviceSize size() const { return size_; }
+
   Texture& operator=(Texture& other) noexcept {
     device_ = other.device_;
     allocator_ = other.allocator_;
     image_ = std::move(other.image_);
     image_view_ = std::move(other.image_view_);
+    size_ = other.size_;
 
     other.device_ = VK_NULL_HANDLE;
     other.allocator_ = nullptr;
@@ -55,6 +64,7 @@ class Texture {
   VmaAllocator allocator_;
   AllocatedImage image_;
   VkImageView image_view_;
+  VkDeviceSize size_ = 0;
 
   Texture(VmaAllocator allocator, VkDevice device,
           QueueSubmitter& queue_submitter, unsigned char* buffer,
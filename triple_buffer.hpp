@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace util {
+
+// Hands the latest of a stream of values from one producer thread to one
+// consumer thread without locks and without either side ever waiting on the
+// other.
+//
+// The producer fills write_buffer() and publishes it; the consumer acquires
+// the most recently published buffer and reads it until its next Acquire().
+// The third buffer sits between them, so publishing never touches the one
+// being read. Values the consumer was too slow to acquire are overwritten.
+//
+// Buffers are reused rather than reset: write_buffer() holds whatever was
+// published into it before, which lets containers keep their capacity.
+template <typename T>
+class TripleBuffer {
+ public:
+  TripleBuffer() = default;
+
+  TripleBuffer(const TripleBuffer&) = delete;
+  TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+  // Producer side.
+  T& write_buffer() { return buffers_[write_]; }
+  void Publish() {
+    const uint8_t previous =
+        middle_.exchange(write_ | kFresh, std::memory_order_acq_rel);
+    write_ = previous & kIndexMask;
+  }
+
+  // Consumer side. Whether a buffer was published since the last Acquire().
+  bool fresh() const {
+    return (middle_.load(std::memory_order_acquire) & kFresh) != 0;
+  }
+  // Makes the latest published buffer the read buffer. False, keeping the
+  // current one, if nothing was published since the last call.
+  bool Acquire() {
+    if (!fresh()) {
+      return false;
+    }
+    // Only the consumer clears kFresh, so a buffer is still waiting.
+    const uint8_t previous =
+        middle_.exchange(read_, std::memory_order_acq_rel);
+    read_ = previous & kIndexMask;
+    return true;
+  }
+  const T& read_buffer() const { return buffers_[read_]; }
+
+ private:
+  constexpr static uint8_t kIndexMask = 0x3;
+  constexpr static uint8_t kFresh = 0x4;
+
+  std::array<T, 3> buffers_;
+  // Owned by the producer.
+  uint8_t write_ = 0;
+  // Index of the buffer between the two sides, and kFresh if it was
+  // published but not acquired yet.
+  std::atomic<uint8_t> middle_{1};
+  // Owned by the consumer.
+  uint8_t read_ = 2;
+};
+
+}  // namespace util
@@ -1,5 +1,7 @@
 #include "vk_mesh.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
@@ -206,6 +208,46 @@ VertexInputDescription Vertex::GetDescription() {
   return description;
 }
 
+PositionInputDescription Vertex::GetPositionDescription() {
+  PositionInputDescription description;
+
+  description.bindings[0] = {};
+  description.bindings[0].binding = 0;
+  description.bindings[0].stride = sizeof(glm::vec3);
+  description.bindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+  // Same location as in the full layout so shaders can be shared.
+  description.attributes[0] = {};
+  description.attributes[0].binding = 0;
+  description.attributes[0].location = 0;
+  description.attributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+  description.attributes[0].offset = 0;
+
+  return description;
+}
+
+void ComputeBounds(Mesh& mesh) {
+  if (mesh.vertices.empty()) {
+    return;
+  }
+
+  // Center of the axis aligned box; not the tightest sphere but close.
+  glm::vec3 min = mesh.vertices[0].position;
+  glm::vec3 max = mesh.vertices[0].position;
+  for (const Vertex& vertex : mesh.vertices) {
+    min = glm::min(min, vertex.position);
+    max = glm::max(max, vertex.position);
+  }
+  mesh.bounds_center = (min + max) * 0.5f;
+
+  float radius_sq = 0.f;
+  for (const Vertex& vertex : mesh.vertices) {
+    glm::vec3 offset = vertex.position - mesh.bounds_center;
+    radius_sq = std::max(radius_sq, glm::dot(offset, offset));
+  }
+  mesh.bounds_radius = std::sqrt(radius_sq);
+}
+
 Model LoadFromFile(const char* filename, VmaAllocator allocator,
                    VkDevice device, QueueSubmitter& queue_submitter) {
   Model out_model;
@@ -4,6 +4,7 @@
 #include <vulkan/vulkan.h>
 
 #include <array>
+#include <cstdint>
 #include <glm/mat4x4.hpp>
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
@@ -23,21 +24,52 @@ struct VertexInputDescription {
   VkPipelineVertexInputStateCreateFlags flags = 0;
 };
 
+// Input layout for passes that only need positions, e.g. the depth prepass.
+struct PositionInputDescription {
+  std::array<VkVertexInputBindingDescription, 1> bindings;
+  std::array<VkVertexInputAttributeDescription, 1> attributes;
+};
+
 struct Vertex {
   glm::vec3 position;
   glm::vec3 normal;
   glm::vec3 color;
 
   static VertexInputDescription GetDescription();
+  // Layout of Mesh::position_buffer.
+  static PositionInputDescription GetPositionDescription();
+};
+
+// Where a mesh lives in the GeometryArena. Meshes without indices get a
+// trivial index list there, so the ranges always describe indexed triangles.
+struct GeometryRange {
+  uint32_t first_vertex = 0;
+  uint32_t vertex_count = 0;
+  uint32_t first_index = 0;
+  uint32_t index_count = 0;
+
+  bool empty() const { return index_count == 0; }
 };
 
 struct Mesh {
   std::vector<Vertex> vertices;
   std::vector<uint32_t> indices;
   AllocatedBuffer vertex_buffer;
+  // Tightly packed copy of the vertex positions. Depth-only passes read this
+  // instead of vertex_buffer so they fetch 12 bytes per vertex, not 36.
+  AllocatedBuffer position_buffer;
   AllocatedBuffer index_buffer;
+  // Empty unless the renderer has a geometry arena.
+  GeometryRange geometry;
+
+  // Object space bounding sphere, see ComputeBounds().
+  glm::vec3 bounds_center = {0.f, 0.f, 0.f};
+  float bounds_radius = 0.f;
 };
 
+// Fills in the bounding sphere of `mesh` from its vertices.
+void ComputeBounds(Mesh& mesh);
+
 struct MeshPushConstants {
   glm::vec4 data;
   glm::mat4 matrix;
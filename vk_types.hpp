@@ -5,8 +5,8 @@
 namespace vk {
 
 struct AllocatedImage {
-  VkImage image;
-  VmaAllocation allocation;
+  VkImage image = VK_NULL_HANDLE;
+  VmaAllocation allocation = VK_NULL_HANDLE;
 };
 
 }  // namespace vk
@@ -0,0 +1,67 @@
+#include "worker_pool.hpp"
+
+#include <algorithm>
+
+namespace util {
+
+WorkerPool::WorkerPool(size_t threads) {
+  threads = std::max<size_t>(threads, 1);
+  threads_.reserve(threads);
+  for (size_t i = 0; i < threads; i++) {
+    threads_.emplace_back([this]() { Run(); });
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  task_ready_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void WorkerPool::Submit(Task task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(task));
+    unfinished_++;
+  }
+  task_ready_.notify_one();
+}
+
+void WorkerPool::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this]() { return unfinished_ == 0; });
+}
+
+void WorkerPool::Run() {
+  while (true) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      task_ready_.wait(lock,
+                       [this]() { return stopping_ || !tasks_.empty(); });
+      // Queued tasks still run when stopping.
+      if (tasks_.empty()) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+
+    task();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      unfinished_--;
+      if (unfinished_ == 0) {
+        idle_.notify_all();
+      }
+    }
+  }
+}
+
+}  // namespace util
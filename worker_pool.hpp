@@ -0,0 +1,49 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace util {
+
+// Fixed set of threads running tasks in submission order, for CPU work that
+// should overlap rendering such as encoding read back images.
+//
+// Submit() never blocks; the queue grows if producers outpace the workers.
+// The destructor runs the remaining tasks before joining.
+class WorkerPool {
+ public:
+  using Task = std::function<void()>;
+
+  // At least one thread.
+  explicit WorkerPool(size_t threads);
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  void Submit(Task task);
+  // Blocks until every submitted task has finished.
+  void Wait();
+
+  size_t size() const { return threads_.size(); }
+
+ private:
+  void Run();
+
+  std::mutex mutex_;
+  std::condition_variable task_ready_;
+  std::condition_variable idle_;
+  std::deque<Task> tasks_;
+  // Tasks submitted but not finished, queued or running.
+  size_t unfinished_ = 0;
+  bool stopping_ = false;
+
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace util